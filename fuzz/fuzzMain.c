@@ -0,0 +1,342 @@
+// Author: Ben Martens (1349551)
+
+/*	Stand-alone driver for the fuzz harnesses, for builds without libFuzzer (e.g. gcc, or afl-gcc with @@).
+
+	usage: fuzz_<harness> [options] file|directory ...
+
+	-timeout=MS     base time budget per input (default 1000)
+	-per_kb=MS      extra time allowed per KiB of input (default 50).  An input that takes longer than
+	                timeout + per_kb * size is reported as a hang and the driver aborts, so inputs that
+	                trigger super-linear parse time are treated exactly like crashes.
+	-rss_limit_mb=N abort if the resident set size exceeds N MiB (default 2048)
+	-mutate=N       after replaying the inputs, run N random mutations of them (default 0)
+	-seed=N         seed for -mutate
+
+	Every mutation is written to ./fuzz-last-input before it runs, so a crash leaves its reproducer behind.
+	Both budgets are also watched while the target runs, by a thread that checks the clock and the
+	resident set size every few milliseconds: an input that never returns, or allocates until the
+	machine runs out, is written to ./fuzz-last-input and reported like any other.  (RLIMIT_AS can't
+	be used instead, since ASan reserves terabytes of address space for its shadow memory.)
+
+	With no file arguments a single input is read from stdin.
+*/
+
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define WATCHDOG_INTERVAL_MS 10
+
+int LLVMFuzzerTestOneInput(const unsigned char* data, size_t size);
+
+typedef struct fuzzInput {
+    char* name;
+    unsigned char* data;
+    size_t size;
+} FuzzInput;
+
+static long timeoutMs = 1000;
+static long perKbMs = 50;
+static long rssLimitMb = 2048;
+
+// the input the target is running on, for the watchdog.  name is NULL between inputs.
+static pthread_mutex_t currentLock = PTHREAD_MUTEX_INITIALIZER;
+static const char* currentName = NULL;
+static const unsigned char* currentData = NULL;
+static size_t currentSize = 0;
+static struct timespec currentStart;
+
+static void runInput(const char* name, const unsigned char* data, size_t size);
+static double budgetFor(size_t size);
+static double millisecondsSince(const struct timespec* start);
+static void* watchdog(void* unused);
+static long residentMb(void);
+static void saveInput(const unsigned char* data, size_t size);
+static double budgetFor(size_t size) {
+    return timeoutMs + perKbMs * (size / 1024.0);
+}
+
+double millisecondsSince(const struct timespec* start) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000.0 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+// Aborts, with the input saved, if the target runs past its time budget or the process past its memory budget
+void* watchdog(void* unused) {
+    struct timespec interval = {0, WATCHDOG_INTERVAL_MS * 1000000L};
+
+    (void)unused;
+    while (true) {
+        nanosleep(&interval, NULL);
+
+        pthread_mutex_lock(&currentLock);
+        if (currentName != NULL) {
+            double elapsedMs = millisecondsSince(&currentStart);
+            double budgetMs = budgetFor(currentSize);
+            long rssMb = residentMb();
+            if (elapsedMs > budgetMs || rssMb > rssLimitMb) {
+                saveInput(currentData, currentSize);
+                if (elapsedMs > budgetMs) {
+                    fprintf(stderr, "==fuzz== hang: %s (%zu bytes) still running after %.1f ms, budget %.1f ms\n", currentName, currentSize, elapsedMs, budgetMs);
+                } else {
+                    fprintf(stderr, "==fuzz== out of memory: %s (%zu bytes), rss %ld MiB while running\n", currentName, currentSize, rssMb);
+                }
+                fprintf(stderr, "==fuzz== input written to fuzz-last-input\n");
+                abort();
+            }
+        }
+        pthread_mutex_unlock(&currentLock);
+    }
+
+    return NULL;
+}
+
+// The current resident set size, from /proc/self/statm.  0 if it can't be read.
+long residentMb(void) {
+    long pages = 0;
+    long resident = 0;
+
+    FILE* fp = fopen("/proc/self/statm", "r");
+    if (fp == NULL) {
+        return 0;
+    }
+    if (fscanf(fp, "%ld %ld", &pages, &resident) != 2) {
+        resident = 0;
+    }
+    fclose(fp);
+
+    return resident * (sysconf(_SC_PAGESIZE) / 1024) / 1024;
+}
+
+void saveInput(const unsigned char* data, size_t size) {
+    FILE* last = fopen("fuzz-last-input", "wb");
+    if (last != NULL) {
+        fwrite(data, 1, size, last);
+        fclose(last);
+    }
+}
+
+void addInput(FuzzInput** inputs, int* count, const char* path);
+static unsigned char* readInput(FILE* fp, size_t* size);
+static void mutate(const FuzzInput* inputs, int count, long runs, unsigned int seed);
+
+int main(int argc, char** argv) {
+    FuzzInput* inputs = NULL;
+    int count = 0;
+    long runs = 0;
+    unsigned int seed = (unsigned int)time(NULL);
+
+    for (int i = 1; i < argc; i++) {
+        if (sscanf(argv[i], "-timeout=%ld", &timeoutMs) == 1 ||
+                sscanf(argv[i], "-per_kb=%ld", &perKbMs) == 1 ||
+                sscanf(argv[i], "-rss_limit_mb=%ld", &rssLimitMb) == 1 ||
+                sscanf(argv[i], "-mutate=%ld", &runs) == 1 ||
+                sscanf(argv[i], "-seed=%u", &seed) == 1) {
+            continue;
+        }
+        addInput(&inputs, &count, argv[i]);
+    }
+
+    pthread_t watcher;
+    if (pthread_create(&watcher, NULL, watchdog, NULL) != 0) {
+        fprintf(stderr, "cannot start the watchdog, hangs and memory blow-ups will not be caught\n");
+    }
+
+    if (count == 0) {
+        size_t size = 0;
+        unsigned char* data = readInput(stdin, &size);
+        runInput("<stdin>", data, size);
+        free(data);
+        return 0;
+    }
+
+    for (int i = 0; i < count; i++) {
+        runInput(inputs[i].name, inputs[i].data, inputs[i].size);
+    }
+    printf("replayed %d inputs\n", count);
+
+    if (runs > 0) {
+        mutate(inputs, count, runs, seed);
+        printf("ran %ld mutations (seed %u)\n", runs, seed);
+    }
+
+    for (int i = 0; i < count; i++) {
+        free(inputs[i].name);
+        free(inputs[i].data);
+    }
+    free(inputs);
+
+    return 0;
+}
+
+void runInput(const char* name, const unsigned char* data, size_t size) {
+    struct timespec start;
+    struct rusage usage;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pthread_mutex_lock(&currentLock);
+    currentName = name;
+    currentData = data;
+    currentSize = size;
+    currentStart = start;
+    pthread_mutex_unlock(&currentLock);
+
+    LLVMFuzzerTestOneInput(data, size);
+
+    pthread_mutex_lock(&currentLock);
+    currentName = NULL;
+    pthread_mutex_unlock(&currentLock);
+
+    // the watchdog only looks every few milliseconds, so check the exact figures as well
+    double elapsedMs = millisecondsSince(&start);
+    double budgetMs = budgetFor(size);
+    if (elapsedMs > budgetMs) {
+        fprintf(stderr, "==fuzz== hang: %s (%zu bytes) took %.1f ms, budget %.1f ms\n", name, size, elapsedMs, budgetMs);
+        abort();
+    }
+
+    getrusage(RUSAGE_SELF, &usage);
+    if (usage.ru_maxrss / 1024 > rssLimitMb) {
+        fprintf(stderr, "==fuzz== out of memory: %s (%zu bytes), peak rss %ld MiB\n", name, size, usage.ru_maxrss / 1024);
+        abort();
+    }
+}
+
+void addInput(FuzzInput** inputs, int* count, const char* path) {
+    struct stat info;
+
+    if (stat(path, &info) != 0) {
+        fprintf(stderr, "cannot open %s\n", path);
+        return;
+    }
+
+    if (S_ISDIR(info.st_mode)) {
+        DIR* dir = opendir(path);
+        struct dirent* entry;
+        while (dir != NULL && (entry = readdir(dir)) != NULL) {
+            if (entry->d_name[0] == '.') {
+                continue;
+            }
+            char* child = NULL;
+            if (asprintf(&child, "%s/%s", path, entry->d_name) > 0) {
+                addInput(inputs, count, child);
+                free(child);
+            }
+        }
+        if (dir != NULL) {
+            closedir(dir);
+        }
+        return;
+    }
+
+    FILE* fp = fopen(path, "rb");
+    if (fp == NULL) {
+        fprintf(stderr, "cannot open %s\n", path);
+        return;
+    }
+    *inputs = (FuzzInput*)realloc(*inputs, (*count + 1) * sizeof(FuzzInput));
+    (*inputs)[*count].name = strdup(path);
+    (*inputs)[*count].data = readInput(fp, &(*inputs)[*count].size);
+    (*count)++;
+    fclose(fp);
+}
+
+unsigned char* readInput(FILE* fp, size_t* size) {
+    unsigned char* data = NULL;
+    size_t capacity = 0;
+    size_t count = 0;
+
+    *size = 0;
+    do {
+        if (*size == capacity) {
+            capacity = capacity > 0 ? capacity * 2 : 4096;
+            data = (unsigned char*)realloc(data, capacity);
+        }
+        count = fread(data + *size, 1, capacity - *size, fp);
+        *size += count;
+    } while (count > 0);
+
+    return data;
+}
+
+/*	A small mutator for builds without libFuzzer: byte flips, vCard-specific tokens, and repeated
+	slices (which is how folded lines, long parameter lists and similar blow-ups are reached).
+*/
+void mutate(const FuzzInput* inputs, int count, long runs, unsigned int seed) {
+    static const char* tokens[] = {"\r\n", "\r\n ", ":", ";", "=", ".", ",", "\n", "\r", "T", "Z",
+                                   "BEGIN:VCARD", "END:VCARD", "VERSION:4.0", "FN:", "BDAY:", "ANNIVERSARY:",
+                                   ";VALUE=text", "N:", "item1.", ";TYPE=work"};
+    size_t tokenCount = sizeof(tokens) / sizeof(tokens[0]);
+    unsigned char* buffer = NULL;
+    size_t capacity = 0;
+
+    srand(seed);
+    for (long run = 0; run < runs; run++) {
+        const FuzzInput* input = &inputs[rand() % count];
+        size_t size = input->size;
+        if (capacity < size + 4096) {
+            capacity = size + 4096;
+            buffer = (unsigned char*)realloc(buffer, capacity);
+        }
+        memcpy(buffer, input->data, size);
+
+        int edits = 1 + rand() % 4;
+        for (int e = 0; e < edits; e++) {
+            size_t position = size > 0 ? (size_t)rand() % (size + 1) : 0;
+            switch (rand() % 4) {
+            case 0: // flip a byte
+                if (size > 0) {
+                    buffer[position % size] ^= (unsigned char)(1 + rand() % 255);
+                }
+                break;
+            case 1: // delete a slice
+                if (size > 0) {
+                    size_t length = 1 + rand() % 16;
+                    position %= size;
+                    if (length > size - position) {
+                        length = size - position;
+                    }
+                    memmove(buffer + position, buffer + position + length, size - position - length);
+                    size -= length;
+                }
+                break;
+            case 2: { // insert a token
+                const char* token = tokens[rand() % tokenCount];
+                size_t length = strlen(token);
+                if (size + length <= capacity) {
+                    memmove(buffer + position + length, buffer + position, size - position);
+                    memcpy(buffer + position, token, length);
+                    size += length;
+                }
+                break;
+            }
+            default: { // repeat a slice
+                size_t length = size > 0 ? 1 + rand() % (size < 64 ? size : 64) : 0;
+                size_t from = size > length ? (size_t)rand() % (size - length + 1) : 0;
+                int repeats = 1 + rand() % 32;
+                for (int r = 0; r < repeats && size + length <= capacity && length > 0; r++) {
+                    memmove(buffer + position + length, buffer + position, size - position);
+                    memmove(buffer + position, buffer + (from < position ? from : from + length), length);
+                    size += length;
+                }
+                break;
+            }
+            }
+        }
+
+        saveInput(buffer, size);
+        runInput("<mutation>", buffer, size);
+    }
+
+    free(buffer);
+}
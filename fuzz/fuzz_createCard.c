@@ -0,0 +1,42 @@
+// Author: Ben Martens (1349551)
+
+// libFuzzer/AFL harness: parse arbitrary bytes as a vCard, in strict and in tolerant mode, with a projection and with tight limits
+
+#include "VCParser.h"
+
+static const char* const projection[] = {"N", "UID", "EMAIL", NULL};
+
+int LLVMFuzzerTestOneInput(const unsigned char* data, size_t size) {
+    Card* card = NULL;
+    VCardParseOptions options;
+
+    createCardFromBuffer((const char*)data, size, &card, NULL);
+    deleteCard(card);
+
+    initParseOptions(&options);
+    options.tolerant = true;
+    options.diagnostics = initializeList(diagnosticToString, deleteDiagnostic, compareDiagnostics);
+    createCardFromBuffer((const char*)data, size, &card, &options);
+    char* diagnostics = toString(options.diagnostics);
+    free(diagnostics);
+    freeList(options.diagnostics);
+    deleteCard(card);
+
+    initParseOptions(&options);
+    options.projection = projection;
+    createCardFromBuffer((const char*)data, size, &card, &options);
+    deleteCard(card);
+
+    initParseOptions(&options);
+    options.tolerant = true;
+    options.limits.lineLength = 80;
+    options.limits.folds = 2;
+    options.limits.properties = 8;
+    options.limits.parameters = 3;
+    options.limits.values = 5;
+    options.limits.bytes = 2048;
+    createCardFromBuffer((const char*)data, size, &card, &options);
+    deleteCard(card);
+
+    return 0;
+}
@@ -0,0 +1,37 @@
+// Author: Ben Martens (1349551)
+
+// libFuzzer/AFL harness: run the event parser over the input, skipping every error, and walk every span
+
+#include "VCParser.h"
+
+static bool onProperty(void* context, const VCardPropertyEvent* property) {
+    size_t* total = (size_t*)context;
+    VCardSpan rest = property->parameters;
+    VCardSpan name;
+    VCardSpan value;
+
+    *total += property->group.length + property->name.length;
+    while (nextVCardParameter(&rest, &name, &value)) {
+        *total += name.length + value.length;
+    }
+    rest = property->value;
+    while (nextVCardValue(&rest, &value)) {
+        *total += value.length;
+    }
+
+    return true;
+}
+
+static bool onError(void* context, const VCardDiagnostic* diagnostic) {
+    *(size_t*)context += strlen(diagnostic->text);
+    return true;
+}
+
+int LLVMFuzzerTestOneInput(const unsigned char* data, size_t size) {
+    size_t total = 0;
+    VCardEventHandler handler = {&total, NULL, onProperty, NULL, onError};
+
+    parseVCardEventsFromBuffer((const char*)data, size, &handler);
+
+    return 0;
+}
@@ -0,0 +1,72 @@
+// Author: Ben Martens (1349551)
+
+/*	libFuzzer/AFL harness for writeCard round trips.  Any card that parses and validates must be
+	written, parsed back and still be valid, and writing it a second time must give the same bytes.
+*/
+
+#define _GNU_SOURCE
+#include <unistd.h>
+
+#include "VCParser.h"
+
+static char* readWholeFile(const char* fileName) {
+    FILE* fp = fopen(fileName, "rb");
+    char* contents = NULL;
+    size_t size = 0;
+
+    if (fp == NULL) {
+        return NULL;
+    }
+    FILE* out = open_memstream(&contents, &size);
+    char buffer[4096];
+    size_t count;
+    while ((count = fread(buffer, 1, sizeof(buffer), fp)) > 0) {
+        fwrite(buffer, 1, count, out);
+    }
+    fclose(out);
+    fclose(fp);
+
+    return contents;
+}
+
+int LLVMFuzzerTestOneInput(const unsigned char* data, size_t size) {
+    static char first[64];
+    static char second[64];
+    Card* card = NULL;
+    Card* reparsed = NULL;
+
+    if (first[0] == '\0') {
+        snprintf(first, sizeof(first), "/tmp/vcfuzz-%d-a.vcf", (int)getpid());
+        snprintf(second, sizeof(second), "/tmp/vcfuzz-%d-b.vcf", (int)getpid());
+    }
+
+    if (createCardFromBuffer((const char*)data, size, &card, NULL) != OK || validateCard(card) != OK) {
+        deleteCard(card);
+        return 0;
+    }
+
+    if (writeCard(first, card) != OK) {
+        abort();
+    }
+    if (createCard(first, &reparsed) != OK || validateCard(reparsed) != OK) {
+        abort();
+    }
+    if (writeCard(second, reparsed) != OK) {
+        abort();
+    }
+
+    char* firstText = readWholeFile(first);
+    char* secondText = readWholeFile(second);
+    if (firstText == NULL || secondText == NULL || strcmp(firstText, secondText) != 0) {
+        abort();
+    }
+
+    free(firstText);
+    free(secondText);
+    deleteCard(card);
+    deleteCard(reparsed);
+    unlink(first);
+    unlink(second);
+
+    return 0;
+}
@@ -0,0 +1,23 @@
+// Author: Ben Martens (1349551)
+
+// libFuzzer/AFL harness: validate and print whatever the tolerant parser manages to build
+
+#include "VCParser.h"
+
+int LLVMFuzzerTestOneInput(const unsigned char* data, size_t size) {
+    Card* card = NULL;
+    VCardParseOptions options;
+
+    initParseOptions(&options);
+    options.tolerant = true;
+    if (createCardFromBuffer((const char*)data, size, &card, &options) != OK) {
+        return 0;
+    }
+
+    validateCard(card);
+    char* cardString = cardToString(card);
+    free(cardString);
+    deleteCard(card);
+
+    return 0;
+}
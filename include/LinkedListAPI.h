@@ -24,6 +24,15 @@ typedef struct listNode{
     struct listNode* next;
 } Node;
 
+/**
+ * Optional lookup structure derived from the contents of a list, e.g. an index of its elements by key.
+ * Embed it as the first member of the real index.  The list owns an attached index and drops it
+ * (with deleteIndex) whenever the list is modified, so an index never describes a stale list.
+ **/
+typedef struct listIndex{
+    void (*deleteIndex)(struct listIndex* index);
+} ListIndex;
+
 /**
  * Metadata head of the list. 
  * Contains no actual data but contains
@@ -37,6 +46,14 @@ typedef struct listHead{
     void (*deleteData)(void* toBeDeleted);
     int (*compare)(const void* first,const void* second);
     char* (*printData)(void* toBePrinted);
+
+    //Optional inline storage, see initializeListInPlace.  All NULL/false for lists made by initializeList.
+    char* storageStart;     //nodes and data inside [storageStart, storageEnd) are never freed one by one
+    char* storageEnd;
+    Node* spareNodes;       //unused inline nodes, linked through next
+    bool inPlace;           //the List struct itself lives inside the storage and is not freed by freeList
+
+    ListIndex* index;       //see setListIndex.  NULL until one is attached.
 } List;
 
 
@@ -63,6 +80,49 @@ typedef struct iter{
 List* initializeList(char* (*printFunction)(void* toBePrinted),void (*deleteFunction)(void* toBeDeleted),int (*compareFunction)(const void* first,const void* second));
 
 
+/** Function to initialize a List struct that lives inside a larger allocation, usually together with
+* its first few nodes and the data they point to (small-vector storage).
+* Nodes handed to the list with addInlineNodes are used before any node is malloc'd, and go back to
+* the list when their element is removed.  Data inside [storage, storage + storageSize) is never passed
+* to deleteFunction; everything else in the list is freed as usual.  freeList only clears such a list.
+*@pre function pointer arguments must not be NULL.  list lies inside the storage.
+*@post list is empty and ready to use.  The storage must outlive the list.
+*@param list - the List struct to initialize
+*@param storage - start of the inline storage
+*@param storageSize - size of the inline storage in bytes
+**/
+void initializeListInPlace(List* list, char* (*printFunction)(void* toBePrinted),void (*deleteFunction)(void* toBeDeleted),int (*compareFunction)(const void* first,const void* second), void* storage, size_t storageSize);
+
+/** Function to give an in-place list a block of unused nodes.
+*@pre list was set up with initializeListInPlace and nodes lie inside its storage
+*@param nodes - array of count nodes
+**/
+void addInlineNodes(List* list, Node* nodes, int count);
+
+/** Function to test whether a pointer lies inside a list's inline storage, i.e. is not separately allocated.
+*@return false for lists made by initializeList
+**/
+bool listStorageContains(const List* list, const void* pointer);
+
+
+/** Function to get the index attached to a list.
+*@return the index, or NULL if none is attached or the list has been modified since
+**/
+ListIndex* getListIndex(const List* list);
+
+/** Function to attach an index to a list.  Readers that share an unmodified list may call it at the
+* same time: the first index attached wins.
+*@post the list owns the returned index.  If an index was already attached, the new one is deleted.
+*@return the index now attached to the list
+**/
+ListIndex* setListIndex(List* list, ListIndex* index);
+
+/** Function to drop the index attached to a list, if any.  The list functions do this themselves;
+* call it after changing the list's nodes or their data directly.
+**/
+void invalidateListIndex(List* list);
+
+
 
 /**Function for creating a node for the linked list. 
 * This node contains abstracted (void *) data as well as previous and next
@@ -99,6 +159,7 @@ void insertBack(List* list, void* toBeAdded);
 
 /** Deletes the entire linked list, freeing all memory asssociated with the list, including the list struct itself.
 * Uses the supplied function pointer to release allocated memory for the data.
+* A list set up with initializeListInPlace is only cleared; its storage belongs to the caller.
 * @pre 'List' type must exist and be used in order to keep track of the linked list.
 * @param list pointer to the List struct
 **/
@@ -132,7 +193,10 @@ void insertSorted(List* list, void* toBeAdded);
  * returns the data 
  * You can assume that the list contains no duplicates
  *@pre List must exist and have memory allocated to it
- *@post toBeDeleted will have its memory freed if it exists in the list.
+ *@post the node holding toBeDeleted is removed, but the data itself is not freed: it is handed back to the
+ *      caller.  If listStorageContains(list, data) is true, e.g. for a value of a parsed Property, whose
+ *      values live in the Property's own block, the data is still owned by that storage: the caller must
+ *      not free it, and it is only valid for as long as the storage is.
  *@param list - a pointer to the List struct
  *@param toBeDeleted - a pointer to data that is to be removed from the list
  *@return on success: void * pointer to data  on failure: NULL
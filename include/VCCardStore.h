@@ -0,0 +1,121 @@
+#ifndef _CARD_STORE_H
+#define _CARD_STORE_H
+
+#include <stdint.h>
+
+#include "VCParser.h"
+
+/*	Embedded, single-file store of cards keyed by UID, for rosters too large to keep in memory.
+
+	The file is an array of 4 KiB pages holding three B+trees: the cards by UID, and secondary indexes
+	by EMAIL and by FN.  A card is stored as a FlatCard (see VCFlatCard.h) in its leaf, or in a chain
+	of overflow pages if it is large.  The index trees map a value (ASCII case folded) and a UID to
+	nothing, and are kept in step with the cards by every change.  Leaves are linked in key order, so
+	range scans read them one after another.
+
+	Pages are read through a cache of a fixed number of pages.  Changed pages stay in the cache until
+	they are committed; only a single change that touches more pages than the cache holds makes it
+	grow, and it shrinks again after the commit.
+
+	A commit first writes every changed page to <file>-journal and syncs it, then writes the pages in
+	place and syncs the file.  If the process dies part way, opening the store again either finds a
+	complete journal and writes it again, or an incomplete one and ignores it, so the store always
+	holds the state of the last commit.  Every page also carries a CRC-32, so damage is reported
+	rather than read.
+
+	Pages emptied by removals are not merged with their neighbours; overflow pages are reused.  The
+	file uses the byte order of the machine that wrote it.  All functions may be called from several
+	threads; they take turns.
+*/
+
+typedef struct cardStore CardStore;
+typedef struct cardStoreCursor CardStoreCursor;
+
+typedef enum cardStoreIndex {
+	CARD_STORE_BY_UID,
+	CARD_STORE_BY_EMAIL,	//every EMAIL property's first value
+	CARD_STORE_BY_FN
+} CardStoreIndex;
+
+typedef enum cardStoreSync {
+	CARD_STORE_SYNC_EACH,		//every change is committed before it returns
+	CARD_STORE_SYNC_DEFERRED	//changes are committed by commitCardStore, closeCardStore, or when half the cache is waiting to be written
+} CardStoreSync;
+
+typedef struct cardStoreOpts {
+	//Pages (4 KiB each) kept in memory.  Default 256; at least 16 and at most 262144 (1 GiB) are used.
+	int		cachePages;
+
+	CardStoreSync	sync;
+} CardStoreOptions;
+
+typedef struct cardStoreStats {
+	uint64_t	cards;
+	uint32_t	pages;		//size of the file, in pages
+	uint64_t	cacheHits;
+	uint64_t	cacheMisses;
+	uint64_t	commits;
+} CardStoreStats;
+
+//Longest UID a card can be stored under.  Index values longer than CARD_STORE_MAX_INDEX_VALUE are not indexed.
+#define CARD_STORE_MAX_UID 255
+#define CARD_STORE_MAX_INDEX_VALUE 200
+
+void initCardStoreOptions(CardStoreOptions* options);
+
+/** Function to open a store, creating it if the file does not exist, and recover its last commit.
+ *@return OK, INV_FILE if the file is damaged, is not a card store or is open in another process,
+		  WRITE_ERROR if recovery can't write the file, OTHER_ERROR if an argument is invalid or memory
+		  runs out
+ *@param options - NULL for the defaults
+ **/
+VCardErrorCode openCardStore(const char* fileName, const CardStoreOptions* options, CardStore** store);
+
+/** Function to commit, close and free a store.  Cursors must be closed first.
+ *@return OK, or as commitCardStore
+ **/
+VCardErrorCode closeCardStore(CardStore* store);
+
+// ************* Changes ****************************************************
+// All of them return OK, OTHER_ERROR for bad arguments or if memory runs out, INV_FILE if a page is
+// damaged, or WRITE_ERROR if the file can't be written.  If a change or a commit fails, every change
+// since the last commit is undone.  If a commit fails after it started writing the file, the store
+// refuses further changes (WRITE_ERROR) until it is opened again, which finishes the commit.
+
+//Stores a copy of a card under its UID (see cardUIDKey), replacing any card with the same UID
+VCardErrorCode storeCard(CardStore* store, const Card* card);
+
+//Removes the card with a UID.  OTHER_ERROR if there is none.
+VCardErrorCode removeStoredCard(CardStore* store, const char* uid);
+
+//Writes every change so far to the file (see the top of this file)
+VCardErrorCode commitCardStore(CardStore* store);
+// **************************************************************************
+
+/** Function to read the card with a UID.
+ *@post *card is a new Card to be freed with deleteCard, or NULL if there is no such card
+ *@return OK (whether or not the card exists), INV_FILE, OTHER_ERROR as above
+ **/
+VCardErrorCode getStoredCard(CardStore* store, const char* uid, Card** card);
+
+/** Function to start a scan of the cards in the order of an index, from one value to another.  The
+ *  cursor sees the store as it is at each call to nextStoredCard, so changes made between calls are
+ *  picked up if they are further on.
+ *@return OK, OTHER_ERROR if an argument is invalid or memory runs out
+ *@param from, to - the first and last values to include (UIDs, EMAILs or FNs; case is ignored for
+		 the last two).  NULL for no limit.  Give the same value to find the cards with it.
+ **/
+VCardErrorCode openCardStoreCursor(CardStore* store, CardStoreIndex index, const char* from, const char* to, CardStoreCursor** cursor);
+
+/** Function to read the next card of a scan.  Cards with several values in the index (e.g. EMAILs)
+ *  are returned once for each.
+ *@post *card is a new Card to be freed with deleteCard, or NULL once the scan is over
+ *@return OK, INV_FILE, OTHER_ERROR as above
+ **/
+VCardErrorCode nextStoredCard(CardStoreCursor* cursor, Card** card);
+
+void closeCardStoreCursor(CardStoreCursor* cursor);
+
+void cardStoreStatistics(CardStore* store, CardStoreStats* stats);
+
+#endif
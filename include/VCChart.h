@@ -0,0 +1,78 @@
+#ifndef _CHART_H
+#define _CHART_H
+
+#include <stdio.h>
+
+#include "VCRosterSort.h"
+
+/*	SVG charts of a roster's grades: a histogram and a box plot of each assessment, and box plots of
+	its sections side by side.
+
+	An assessment's grades are read from the cards once (through a CardNumberFunction, as for sorting)
+	and sorted, and every chart of it is drawn from that copy.  Output goes through a large buffer
+	straight to the file.  writeGradeDashboard draws the charts of several assessments at once on a
+	pool of threads: first each assessment's grades are collected, then each chart is written to its
+	own file.
+*/
+
+typedef enum chartKind {
+	CHART_HISTOGRAM,
+	CHART_BOX_PLOT,
+
+	//One box per section, after one for the whole class.  Needs ChartOptions.section.
+	CHART_SECTIONS
+} ChartKind;
+
+//Gets the section a card is in, e.g. from an X- property.  Returns NULL if it has none.  The name must stay valid while charts are drawn.
+typedef const char* (*CardSectionFunction)(const Card* card, void* context);
+
+typedef struct chartAssessment {
+	//Shown at the top of the charts
+	const char*	title;
+
+	//Reads a card's grade.  Returns false for students without one, who are left out.
+	CardNumberFunction	grade;
+	void*	context;
+
+	//Range of the grade axis, e.g. 0 to 100.  If minimum is not below maximum the range of the grades
+	//is used.  Histogram bins split this range evenly; grades outside it count in the end bins.
+	int64_t	minimum;
+	int64_t	maximum;
+} ChartAssessment;
+
+typedef struct chartOpts {
+	//Size in pixels.  Default 640 by 400.  Section charts are made wider if they need it.
+	int		width;
+	int		height;
+
+	//Number of histogram bars.  Default 10.
+	int		bins;
+
+	//Splits the class into sections, which are shown in order of name.  NULL (the default) for no
+	//section charts.
+	CardSectionFunction	section;
+	void*	sectionContext;
+
+	//Threads writeGradeDashboard uses.  0 (the default) uses one per online CPU.
+	int		threads;
+} ChartOptions;
+
+void initChartOptions(ChartOptions* options);
+
+/** Function to write one chart to an open stream.
+ *@return OK, OTHER_ERROR if an argument is invalid or memory runs out, WRITE_ERROR if writing fails
+ *@param options - NULL for the defaults
+ **/
+VCardErrorCode writeGradeChart(List* roster, const ChartAssessment* assessment, ChartKind kind, const ChartOptions* options, FILE* fp);
+
+//Like writeGradeChart, into a new file
+VCardErrorCode writeGradeChartToFile(List* roster, const ChartAssessment* assessment, ChartKind kind, const ChartOptions* options, const char* fileName);
+
+/** Function to write every chart of several assessments, each to its own file, on a pool of threads.
+ *  Assessment i gets <prefix>-<i>-histogram.svg, <prefix>-<i>-boxplot.svg and, if options->section is
+ *  set, <prefix>-<i>-sections.svg (i has three digits).
+ *@return as writeGradeChart.  WRITE_ERROR if any of the files can't be written.
+ **/
+VCardErrorCode writeGradeDashboard(List* roster, const ChartAssessment* assessments, int assessmentCount, const ChartOptions* options, const char* prefix);
+
+#endif
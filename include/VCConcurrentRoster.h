@@ -0,0 +1,76 @@
+#ifndef _CONCURRENT_ROSTER_H
+#define _CONCURRENT_ROSTER_H
+
+#include "VCParser.h"
+
+/*	Thread-safe, read-mostly roster of Cards keyed by a string (normally the UID value).
+
+	Lookups are lock-free: a reader thread attaches once, then brackets every group of lookups with
+	enterRosterRead/leaveRosterRead.  Cards returned inside the bracket stay valid until the matching
+	leaveRosterRead, even if a writer replaces or removes them in the meantime.
+
+	Writers are serialized by a mutex and never wait for readers.  Replaced and removed cards are
+	retired and freed with deleteCard only once every reader that could still see them has left
+	(epoch-based reclamation).
+*/
+
+#define CONCURRENT_ROSTER_MAX_READERS 128
+
+typedef struct concurrentRoster ConcurrentRoster;
+typedef struct rosterReader RosterReader;
+
+/** Function to create an empty roster.
+ *@return the new roster, or NULL if allocation fails
+ *@param initialBuckets - expected number of cards, used to size the hash table (0 for a default)
+ **/
+ConcurrentRoster* createConcurrentRoster(int initialBuckets);
+
+/** Function to delete a roster, freeing every card still in it or waiting to be reclaimed.
+ *@pre no reader is attached and no writer is running
+ **/
+void deleteConcurrentRoster(ConcurrentRoster* roster);
+
+// ************* Readers ****************************************************
+
+/** Function to register the calling thread as a reader.
+ *@return the reader handle, or NULL if CONCURRENT_ROSTER_MAX_READERS readers are already attached
+ **/
+RosterReader* attachRosterReader(ConcurrentRoster* roster);
+void detachRosterReader(RosterReader* reader);
+
+//Start and end a read-side critical section.  Sections must not be nested.
+void enterRosterRead(RosterReader* reader);
+void leaveRosterRead(RosterReader* reader);
+
+/** Function to look up a card.
+ *@pre called between enterRosterRead and leaveRosterRead
+ *@return the card stored under key (must not be modified), or NULL if there is none
+ **/
+const Card* concurrentRosterFind(RosterReader* reader, const char* key);
+
+/** Function to call visit for every card in the roster, in no particular order.  Stops early if visit
+ *  returns false.
+ *@pre called between enterRosterRead and leaveRosterRead
+ **/
+void concurrentRosterForEach(RosterReader* reader, bool (*visit)(const char* key, const Card* card, void* context), void* context);
+
+// ************* Writers ****************************************************
+
+/** Function to insert a card, or replace the card already stored under key.  Takes ownership of card.
+ *@return OK, or OTHER_ERROR if an argument is NULL or allocation fails (the caller then still owns card)
+ **/
+VCardErrorCode concurrentRosterPut(ConcurrentRoster* roster, const char* key, Card* card);
+
+/** Function to remove the card stored under key.
+ *@return OK, or OTHER_ERROR if no card is stored under key or allocation fails (the card then stays)
+ **/
+VCardErrorCode concurrentRosterRemove(ConcurrentRoster* roster, const char* key);
+
+int concurrentRosterLength(ConcurrentRoster* roster);
+
+/** Function to wait until every retired card has been freed.  Must not be called by a thread that is
+ *  inside a read-side critical section.
+ **/
+void concurrentRosterSynchronize(ConcurrentRoster* roster);
+
+#endif
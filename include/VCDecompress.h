@@ -0,0 +1,59 @@
+#ifndef _DECOMPRESS_H
+#define _DECOMPRESS_H
+
+#include <stdio.h>
+
+#include "VCParser.h"
+
+/*	Streaming decompression of gzip (.gz) and zstd (.zst) vCard files.
+
+	A DecompressStream reads compressed data from an open stream and inflates it on its own thread,
+	a few blocks ahead of the reader, so decompression overlaps with parsing and nothing is written to
+	disk.  readDecompressStream is a VCardReadFunction, so a stream can be handed straight to
+	createCardFromReader; createCardWithOptions does this for files named *.vcf.gz, *.vcf.zst, etc.
+
+	An empty file is read as empty data in either format.  gzip support uses zlib and is always built.  zstd support needs libzstd and is only built with
+	VCARD_WITH_ZSTD defined (make ZSTD=1).
+*/
+
+typedef enum vCardCompression {
+	VCARD_COMPRESSION_NONE,
+	VCARD_COMPRESSION_GZIP,
+	VCARD_COMPRESSION_ZSTD
+} VCardCompression;
+
+typedef struct decompressStream DecompressStream;
+
+/** Function to find the compression of a file from its name.
+ *@return the compression given by the file's last extension (.gz or .zst), VCARD_COMPRESSION_NONE otherwise
+ *@param fileName - the file name
+		 baseLength - if not NULL, set to the length of the name without the compression extension
+ **/
+VCardCompression compressionForFileName(const char* fileName, size_t* baseLength);
+
+//Whether this build can decompress the given format (NONE is always supported)
+bool compressionSupported(VCardCompression compression);
+
+/** Function to start decompressing a stream.
+ *@pre fp is open for reading and stays open until closeDecompressStream
+ *@return OK, INV_FILE if fp is NULL or the format isn't supported by this build, OTHER_ERROR if obj
+		  is NULL or the stream can't be set up
+ *@param fp - the compressed input, read from its current position
+		 compression - GZIP or ZSTD
+		 obj - the new stream
+ **/
+VCardErrorCode openDecompressStream(FILE* fp, VCardCompression compression, DecompressStream** obj);
+
+/** Function to read up to size bytes of decompressed data.  Has the signature of a VCardReadFunction.
+ *@return the number of bytes read, 0 at the end of the data or after an error
+ *@param stream - a DecompressStream
+ **/
+size_t readDecompressStream(void* stream, char* buffer, size_t size);
+
+/** Function to stop the decompression thread and free the stream.  fp is not closed.
+ *@return OK, or INV_FILE if the compressed data was damaged or cut short (or couldn't be read) before
+		  the point the reader got to
+ **/
+VCardErrorCode closeDecompressStream(DecompressStream* stream);
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef _EXPORT_H
+#define _EXPORT_H
+
+#include <stdio.h>
+
+#include "VCParser.h"
+
+/*	Streaming export of roster columns as CSV (RFC 4180) or JSON Lines, e.g. for plotting tools.
+
+	Each card becomes one row (one JSON object per line), with one field per ExportColumn.  Output goes
+	through a large buffer straight to the stream, and every field is escaped as it is copied, so the
+	cost is one pass over the exported text.  JSON output is always valid UTF-8: bytes that aren't part
+	of a well-formed sequence are written as U+FFFD.  A roster can also be split into shards, one file
+	per thread, which are written in parallel.
+*/
+
+typedef enum exportFormat { EXPORT_CSV, EXPORT_JSON_LINES } ExportFormat;
+
+/*	One exported field.  name selects the first property with that name (case-insensitive) and group;
+	FN, BDAY and ANNIVERSARY select the card's own fields.  A card without the property gets an empty
+	CSV field, or null in JSON.
+*/
+typedef struct exportColumn {
+	//CSV header / JSON key.  NULL uses name.
+	const char*	title;
+
+	const char*	name;
+
+	//NULL or "" for properties without a group
+	const char*	group;
+
+	//Which value of the property to export (e.g. 0 for the family name of N).  -1 exports all of them,
+	//joined with ';' as in vCard text.  Ignored for BDAY and ANNIVERSARY.
+	int			value;
+} ExportColumn;
+
+/** Function to write a roster to an open stream.
+ *@pre roster is a List of Card*.  columns holds columnCount columns, each with a name.
+ *@return OK, OTHER_ERROR if an argument is invalid, WRITE_ERROR if writing fails
+ *@param header - whether to start CSV output with a row of titles (ignored for JSON Lines)
+ **/
+VCardErrorCode exportRoster(List* roster, const ExportColumn* columns, int columnCount, ExportFormat format, bool header, FILE* fp);
+
+//Like exportRoster, into a new file
+VCardErrorCode exportRosterToFile(List* roster, const ExportColumn* columns, int columnCount, ExportFormat format, bool header, const char* fileName);
+
+/** Function to split a roster into shards of consecutive cards and write each one to its own file on
+ *  its own thread.  Shard i goes to <prefix>-<i>.csv or <prefix>-<i>.jsonl (i has three digits), and
+ *  every CSV shard gets the header row if header is set.
+ *@return OK, OTHER_ERROR if an argument is invalid or a thread can't be started, WRITE_ERROR if any
+		  shard can't be written
+ *@param shards - the number of files and threads, at least 1
+ **/
+VCardErrorCode exportRosterShards(List* roster, const ExportColumn* columns, int columnCount, ExportFormat format, bool header, const char* prefix, int shards);
+
+#endif
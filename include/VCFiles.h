@@ -0,0 +1,19 @@
+#ifndef _FILES_H
+#define _FILES_H
+
+#include <stdbool.h>
+
+/*	File helpers shared by the modules that keep a roster on disk (VCJournal and VCCardStore).  They
+	are internal to the library and not meant for its callers.
+*/
+
+/** Function to make the creation, renaming or removal of a file durable, by syncing its directory.
+ *@return true on success
+ *@param path - path of the file, whose directory is synced
+ **/
+bool syncDirectory(const char* path);
+
+//Returns base followed by suffix in a new string, to be freed, or NULL if allocation fails
+char* joinPath(const char* base, const char* suffix);
+
+#endif
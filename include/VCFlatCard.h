@@ -0,0 +1,133 @@
+#ifndef _FLATCARD_H
+#define _FLATCARD_H
+
+#include <stdint.h>
+
+#include "VCParser.h"
+
+/*	Compact, single-allocation representation of a Card.
+
+	A FlatCard is one contiguous block laid out as:
+
+		FlatCard header | FlatProperty table | FlatParameter table | value table | string pool
+
+	Every reference inside the block is a 32-bit byte offset from the start of the block, so the
+	block can be copied with memcpy, written to disk or mapped into another process unchanged.
+	Property 0 is always the FN property, the remaining properties are the optional properties
+	in list order.  Offset 0 of the string pool always holds the empty string.
+*/
+
+#define FLAT_CARD_MAGIC 0x44524346u // "FCRD"
+
+//Flags stored in FlatDateTime.flags
+#define FLAT_DT_PRESENT 0x1u
+#define FLAT_DT_UTC     0x2u
+#define FLAT_DT_TEXT    0x4u
+
+//Flat counterpart of Parameter.  Both fields are string offsets.
+typedef struct flatParam {
+	uint32_t	name;
+	uint32_t	value;
+} FlatParameter;
+
+//Flat counterpart of Property.  name and group are string offsets, the tables are indices.
+typedef struct flatProp {
+	uint32_t	name;
+	uint32_t	group;
+
+	//index of the first parameter in the parameter table, and the number of parameters
+	uint32_t	firstParameter;
+	uint32_t	parameterCount;
+
+	//index of the first value in the value table, and the number of values
+	uint32_t	firstValue;
+	uint32_t	valueCount;
+} FlatProperty;
+
+//Flat counterpart of DateTime.  date, time and text are string offsets.
+typedef struct flatDt {
+	uint32_t	flags;
+	uint32_t	date;
+	uint32_t	time;
+	uint32_t	text;
+} FlatDateTime;
+
+//Header at the start of every flat card block
+typedef struct flatCard {
+	uint32_t	magic;
+
+	//total size of the block in bytes, including this header
+	uint32_t	size;
+
+	uint32_t	propertyCount;
+	uint32_t	parameterCount;
+	uint32_t	valueCount;
+
+	//byte offsets of the tables and the string pool
+	uint32_t	properties;
+	uint32_t	parameters;
+	uint32_t	values;
+	uint32_t	strings;
+
+	FlatDateTime	birthday;
+	FlatDateTime	anniversary;
+} FlatCard;
+
+/** Function to pack a Card into a single contiguous FlatCard block.
+ *@pre card is a valid Card (e.g. as returned by createCard)
+ *@post card has not been modified.  *obj points to a newly allocated block that must be freed with deleteFlatCard
+ *@return OK on success, INV_CARD if card is malformed, OTHER_ERROR if obj is NULL, the card does not
+		  fit in 32-bit offsets or allocation fails
+ *@param card - the Card to pack
+		 obj - the resulting FlatCard
+ **/
+VCardErrorCode createFlatCard(const Card* card, FlatCard** obj);
+
+/** Function to unpack a FlatCard back into a regular Card.
+ *@pre flat is a block created by createFlatCard (or a verbatim copy of one)
+ *@post *obj points to a newly allocated Card that must be freed with deleteCard
+ *@return OK on success, INV_CARD if the block is not a valid flat card, OTHER_ERROR otherwise
+ *@param flat - the FlatCard to unpack
+		 size - number of readable bytes at flat, which the block is checked against (not its own size field)
+		 obj - the resulting Card
+ **/
+VCardErrorCode flatCardToCard(const FlatCard* flat, size_t size, Card** obj);
+
+/** Function to check that a block of memory holds a well-formed FlatCard, i.e. that every
+ *  offset and index stays within the block and every string is terminated inside the pool.
+ *@return true if the block can be safely read through the accessors below
+ *@param block - start of the block
+		 size - number of readable bytes at block
+ **/
+bool flatCardIsValid(const void* block, size_t size);
+
+void deleteFlatCard(FlatCard* obj);
+
+// ************* Accessors **************************************************
+//Mirror the fields of Card, Property, Parameter and DateTime.  Indices are not range checked.
+const FlatProperty* flatCardFN(const FlatCard* obj);
+int flatCardOptionalCount(const FlatCard* obj);
+const FlatProperty* flatCardOptionalProperty(const FlatCard* obj, int index);
+
+//Returns NULL if the date is not specified in the card
+const FlatDateTime* flatCardBirthday(const FlatCard* obj);
+const FlatDateTime* flatCardAnniversary(const FlatCard* obj);
+
+const char* flatPropertyName(const FlatCard* obj, const FlatProperty* prop);
+const char* flatPropertyGroup(const FlatCard* obj, const FlatProperty* prop);
+int flatPropertyParameterCount(const FlatProperty* prop);
+const FlatParameter* flatPropertyParameter(const FlatCard* obj, const FlatProperty* prop, int index);
+int flatPropertyValueCount(const FlatProperty* prop);
+const char* flatPropertyValue(const FlatCard* obj, const FlatProperty* prop, int index);
+
+const char* flatParameterName(const FlatCard* obj, const FlatParameter* param);
+const char* flatParameterValue(const FlatCard* obj, const FlatParameter* param);
+
+const char* flatDateTimeDate(const FlatCard* obj, const FlatDateTime* dateTime);
+const char* flatDateTimeTime(const FlatCard* obj, const FlatDateTime* dateTime);
+const char* flatDateTimeText(const FlatCard* obj, const FlatDateTime* dateTime);
+bool flatDateTimeUTC(const FlatDateTime* dateTime);
+bool flatDateTimeIsText(const FlatDateTime* dateTime);
+// **************************************************************************
+
+#endif
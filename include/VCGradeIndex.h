@@ -0,0 +1,88 @@
+#ifndef _GRADE_INDEX_H
+#define _GRADE_INDEX_H
+
+#include "VCRosterSort.h"
+
+/*	Order statistics over one grade column of a roster: class rank, percentile rank, the grade at a
+	percentile (for curving) and the top or bottom K students (for honours lists), while grades keep
+	changing during marking.
+
+	Students are referred to by their position in the roster when the index was created.  Their grades
+	are kept in a balanced search tree (a treap) whose nodes also count their subtrees, so changing one
+	grade and every query take O(log n) time, plus O(K) for the top or bottom K.  Students without a
+	grade are left out of every count.
+
+	Where grades are equal, the student earlier in the roster counts as the better one, so top and
+	bottom K are always well defined.  Ranks and percentile ranks treat equal grades as equal.
+
+	The index does not follow changes to the roster itself: after adding, removing or reordering cards
+	create it again.  It is not thread safe; concurrent queries are fine while no grade is changing.
+*/
+
+typedef struct gradeIndex GradeIndex;
+
+/** Function to create an index of a roster's grades.
+ *@post *index holds a new index, to be freed with deleteGradeIndex, or NULL on error
+ *@return OK, OTHER_ERROR if an argument is invalid or memory runs out
+ *@param grade - reads a card's grade, e.g. from an X- property.  Returns false for students without one.
+ **/
+VCardErrorCode createGradeIndex(List* roster, CardNumberFunction grade, void* context, GradeIndex** index);
+
+void deleteGradeIndex(GradeIndex* index);
+
+//Number of cards in the roster the index was created from
+int gradeIndexLength(const GradeIndex* index);
+
+//Number of those cards that have a grade
+int gradedCount(const GradeIndex* index);
+
+//Card at a roster position, or NULL if the position is out of range
+Card* gradedCard(const GradeIndex* index, int position);
+
+//Gets a student's grade.  Returns false if they have none or the position is out of range.
+bool getStudentGrade(const GradeIndex* index, int position, int64_t* grade);
+
+/** Function to change a student's grade, e.g. after it was entered by hand.
+ *@return OK, OTHER_ERROR if the position is out of range
+ **/
+VCardErrorCode setStudentGrade(GradeIndex* index, int position, int64_t grade);
+
+//Removes a student's grade, as setStudentGrade
+VCardErrorCode clearStudentGrade(GradeIndex* index, int position);
+
+/** Function to read a student's grade from their card again, after the card was edited.
+ *@return as setStudentGrade
+ **/
+VCardErrorCode refreshStudentGrade(GradeIndex* index, int position);
+
+//Number of grades strictly below, and strictly above, a grade
+int countGradesBelow(const GradeIndex* index, int64_t grade);
+int countGradesAbove(const GradeIndex* index, int64_t grade);
+
+//Class rank of a student: 1 plus the number of higher grades, so equal grades share a rank.  0 if they have no grade.
+int studentRank(const GradeIndex* index, int position);
+
+/** Function to get a student's percentile rank: the percentage of grades below theirs, counting
+ *  equal grades (their own included) as half below.
+ *@return 0 to 100, or -1 if they have no grade
+ **/
+double studentPercentileRank(const GradeIndex* index, int position);
+
+/** Function to get the grade at a percentile, by the nearest rank method: the lowest grade with at least
+ *  percentile percent of the grades at or below it.
+ *@return OK, OTHER_ERROR if nobody has a grade or the percentile is not between 0 and 100
+ **/
+VCardErrorCode gradeAtPercentile(const GradeIndex* index, double percentile, int64_t* grade);
+
+//Roster position of the student with the nth lowest grade (0 for the lowest), or -1 if n is out of range
+int nthGradedStudent(const GradeIndex* index, int n);
+
+/** Functions to list the students with the K highest grades, best first, or the K lowest, worst first.
+ *@post positions holds the roster positions of min(k, gradedCount) students
+ *@return the number of positions written
+ *@param positions - room for k positions
+ **/
+int topGradedStudents(const GradeIndex* index, int k, int* positions);
+int bottomGradedStudents(const GradeIndex* index, int k, int* positions);
+
+#endif
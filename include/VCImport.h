@@ -0,0 +1,60 @@
+#ifndef _IMPORT_H
+#define _IMPORT_H
+
+#include "VCParser.h"
+
+/*	Bulk import of CSV class lists (RFC 4180: comma separated, fields optionally in double quotes, ""
+	for a quote, CRLF or LF line ends) straight into Cards.
+
+	An ImportColumn maps one CSV column to one value of a property, so several columns can fill one
+	property (e.g. family and given name into N).  Every row with a non-empty FN becomes a Card; other
+	rows are rejected and reported.  The input is cut into batches at row boundaries and the batches
+	are converted on several threads, each decoding its fields in a scratch arena that is reset for
+	every batch.  Each imported property is a single allocation, like a parsed one, and the cards are
+	freed with deleteCard as usual.
+*/
+
+//Maps a CSV column to a property value
+typedef struct importColumn {
+	//The CSV column with this title in the header row.  NULL to use column instead.
+	const char*	title;
+
+	//0-based index of the CSV column, if title is NULL
+	int			column;
+
+	//Property name (FN for the card's FN) and group (NULL or "" for none)
+	const char*	name;
+	const char*	group;
+
+	//Which value of the property the column fills, e.g. 1 for the given name in N
+	int			value;
+} ImportColumn;
+
+typedef struct importOpts {
+	//Whether the first row is a header (needed for columns with a title).  Default true.
+	bool	header;
+
+	//Threads to use.  0 (the default) uses one per online CPU.
+	int		threads;
+
+	//If not NULL, a VCardDiagnostic (INV_CARD, with the row's line and text) is appended for every
+	//rejected row, in input order.  If memory runs out, no more are appended.  See VCardParseOptions.
+	List*	diagnostics;
+} ImportOptions;
+
+void initImportOptions(ImportOptions* options);
+
+/** Function to import every row of CSV text.
+ *@pre data holds length bytes (it does not need to be NUL terminated)
+ *@post *roster is a new List of Card*, in row order, whose deleteData is deleteCard.  NULL on error.
+ *@return OK (even if rows were rejected), INV_FILE if a column title is not in the header,
+		  OTHER_ERROR if an argument is invalid or memory runs out
+ *@param columns - columnCount columns.  One of them must fill FN.
+		 options - NULL for the defaults
+ **/
+VCardErrorCode importRosterFromBuffer(const char* data, size_t length, const ImportColumn* columns, int columnCount, const ImportOptions* options, List** roster);
+
+//Like importRosterFromBuffer, for a file.  INV_FILE if the file can't be read.
+VCardErrorCode importRosterFromFile(const char* fileName, const ImportColumn* columns, int columnCount, const ImportOptions* options, List** roster);
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef _INTERN_H
+#define _INTERN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*	Thread-safe string interning.  Interning a string returns a canonical copy that is shared by every
+	caller that interns an equal string, so interned strings can be compared by pointer.
+
+	A case-folding table treats strings that differ only in ASCII case as equal; the canonical copy
+	keeps the spelling that was interned first.
+
+	Interned strings are never freed individually.  They stay valid until the table is deleted, so a
+	table that outlives its input should only be fed a bounded set of strings.  The global table (see
+	findVCardString) holds a fixed vocabulary and stays valid until the process exits.
+*/
+
+typedef struct internTable InternTable;
+
+/** Function to create an empty table.
+ *@return the new table, or NULL if allocation fails
+ *@param foldCase - whether strings that differ only in case are interned to the same copy
+ **/
+InternTable* createInternTable(bool foldCase);
+
+/** Function to delete a table and every string interned in it.
+ *@pre no other thread is using the table, and none of its strings are used afterwards
+ **/
+void deleteInternTable(InternTable* table);
+
+/** Function to intern the first length bytes of string (which need not be NUL terminated).
+ *@return the canonical NUL terminated copy, or NULL if an argument is NULL or allocation fails
+ **/
+const char* internString(InternTable* table, const char* string, size_t length);
+
+/** Function to look up a string without adding it.
+ *@return the canonical copy, or NULL if the string was never interned or an argument is NULL
+ **/
+const char* findInternedString(InternTable* table, const char* string, size_t length);
+
+//Number of distinct strings, and the bytes of string data (including terminators) held by the table
+int internTableLength(InternTable* table);
+size_t internTableBytes(InternTable* table);
+
+/** Function to look up a string in the process-wide, case-preserving table of vCard words: property
+ *  names, parameter names and common parameter values, each in all lower or all upper case only.  The
+ *  parser shares these instead of copying them into each property.  Groups (e.g. "item1"), other
+ *  parameter values and words in mixed case ("Home") are not in the table and are still copied into
+ *  the property.  Nothing is ever added to the table, so input can't make it grow.
+ *@return the canonical copy, or NULL if the string is not one of the words in one of those spellings
+ **/
+const char* findVCardString(const char* string, size_t length);
+
+//The process-wide table, e.g. for internTableLength
+InternTable* vCardInternTable(void);
+
+//FNV-1a hash of the first length bytes of string, over the lower-cased bytes if foldCase is set.  Used by every hash table in the library.
+uint64_t hashString(const char* string, size_t length, bool foldCase);
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef _JOURNAL_H
+#define _JOURNAL_H
+
+#include <stdint.h>
+
+#include "VCConcurrentRoster.h"
+
+/*	Roster persisted as an append-only journal of mutations, with group commit.
+
+	A JournaledRoster keeps the current cards in memory in a ConcurrentRoster keyed by UID, so lookups
+	are lock-free and never wait for writers.  Every mutation is applied in memory and appended to
+	<base>.journal as one checksummed record.  A background thread writes appended records out and
+	fsyncs them; every record that arrived while the previous fsync was running goes out with the next
+	one, so concurrent writers share fsyncs instead of paying for one each.
+
+	Compaction writes every card to <base>.snapshot (atomically, by rename) and drops the records the
+	snapshot covers from the journal.  On open, the snapshot is loaded and the journal replayed on top
+	of it.  A record that was only partly written when the process died is detected by its checksum
+	and cut off, so recovery always ends in the state after the last complete record.
+*/
+
+typedef struct journaledRoster JournaledRoster;
+
+typedef enum journalSync {
+	JOURNAL_SYNC_EACH,		//every mutation returns once its record is on disk
+	JOURNAL_SYNC_DEFERRED	//mutations return at once; use journalSync to wait for them
+} JournalSync;
+
+//Options for openJournaledRoster.  Use initJournalOptions to get the defaults.
+typedef struct journalOpts {
+	JournalSync	sync;
+
+	//How long the writer thread waits for more records before each fsync, in milliseconds.  0 (the
+	//default) writes as soon as there is something to write.
+	int		commitDelayMs;
+
+	//Compact in the background once the journal is larger than this many bytes.  0 turns automatic
+	//compaction off.  The default is 16 MiB.
+	size_t	compactBytes;
+} JournalOptions;
+
+typedef struct journalStats {
+	uint64_t	records;		//records appended since open
+	uint64_t	syncs;			//fsyncs of the journal since open
+	uint64_t	compactions;
+	uint64_t	replayed;		//records replayed from the journal on open
+	size_t		journalBytes;	//current size of the journal file
+} JournalStats;
+
+void initJournalOptions(JournalOptions* options);
+
+/** Function to open (or create) a journaled roster and recover its cards.
+ *@pre no other JournaledRoster has the same base open
+ *@return OK, INV_FILE if the snapshot is damaged or the files can't be opened, OTHER_ERROR if an
+		  argument is NULL or allocation fails
+ *@param base - path prefix of the .journal and .snapshot files
+		 options - NULL for the defaults
+		 obj - the opened roster
+ **/
+VCardErrorCode openJournaledRoster(const char* base, const JournalOptions* options, JournaledRoster** obj);
+
+/** Function to write out every pending record, stop the background threads and free the roster.
+ *@return OK, or WRITE_ERROR if a record could not be written at some point since the roster was opened
+ **/
+VCardErrorCode closeJournaledRoster(JournaledRoster* roster);
+
+/** Function to get the cards, for lookups (see VCConcurrentRoster.h).  Cards must only be changed
+ *  through the journal functions.
+ **/
+ConcurrentRoster* journaledRosterCards(JournaledRoster* roster);
+
+// ************* Mutations **************************************************
+// All of them return OK, OTHER_ERROR for bad arguments (or a card that doesn't exist), or WRITE_ERROR
+// if the journal can't be written.  A write failure is not rolled back: the changes whose records were
+// lost stay in memory, so the cards are ahead of the journal, and opening the roster again gives the
+// state after the last record that reached the disk.  From then on every mutation fails with
+// WRITE_ERROR without being applied.  In JOURNAL_SYNC_EACH mode the change that got WRITE_ERROR is
+// one of those still in memory; in JOURNAL_SYNC_DEFERRED mode journalSync reports the failure.
+
+//Inserts a copy of card, or replaces the card with the same UID
+VCardErrorCode journalPutCard(JournaledRoster* roster, const Card* card);
+
+VCardErrorCode journalRemoveCard(JournaledRoster* roster, const char* key);
+
+/** Function to set one property slot of a card (see VCRosterDiff.h): the index-th property with the
+ *  given group and name.  A slot that doesn't exist yet is added to the end of the card.
+ *@param property - the new value, copied.  NULL removes the slot.  FN index 0 can't be removed.
+ **/
+VCardErrorCode journalSetProperty(JournaledRoster* roster, const char* key, const char* name, const char* group, int index, const Property* property);
+
+//Waits until every mutation made so far is on disk
+VCardErrorCode journalSync(JournaledRoster* roster);
+// **************************************************************************
+
+/** Function to write a snapshot of every card and drop the journal records it covers.  Writers are
+ *  only held up while the cards are listed; they are encoded and written while writers carry on.
+ *@return OK, or WRITE_ERROR (the old snapshot and journal are then still valid)
+ **/
+VCardErrorCode compactJournal(JournaledRoster* roster);
+
+void journalStatistics(JournaledRoster* roster, JournalStats* stats);
+
+#endif
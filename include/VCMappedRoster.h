@@ -0,0 +1,120 @@
+#ifndef _MAPPED_ROSTER_H
+#define _MAPPED_ROSTER_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "VCFlatCard.h"
+#include "VCRosterDiff.h"
+
+/*	Read-only roster published in a POSIX shared memory segment, so that several processes can read
+	one copy of it without parsing or copying anything.
+
+	The segment is laid out as:
+
+		MappedRosterHeader | card table | key index | key strings | FlatCard blocks
+
+	Every reference in it is a byte offset from the start of the segment, so it works at whatever
+	address a process maps it.  The cards are FlatCards (see VCFlatCard.h) and are read through the
+	FlatCard accessors.  The key index lists the cards sorted by key so they can be found by binary
+	search.
+
+	Publishing under a name that is already in use replaces the roster: the new segment is written
+	under a temporary name and renamed over the old one (in /dev/shm, so this is Linux only), then the
+	old segment is marked as superseded.  An attach at any moment finds one whole roster or the other.
+	Processes that are still attached to the old one keep a valid mapping, and can check
+	mappedRosterIsCurrent to find out when they should attach again.
+*/
+
+#define MAPPED_ROSTER_MAGIC 0x5453524Du // "MRST"
+
+//Layout version.  Readers refuse segments with a different one.
+#define MAPPED_ROSTER_VERSION 1u
+
+//Values of MappedRosterHeader.state
+#define MAPPED_ROSTER_WRITING    0u
+#define MAPPED_ROSTER_READY      1u
+#define MAPPED_ROSTER_SUPERSEDED 2u
+
+//Header at the start of the segment
+typedef struct mappedRosterHeader {
+	uint32_t	magic;
+	uint32_t	version;
+
+	//Set to MAPPED_ROSTER_READY once the rest of the segment is written
+	atomic_uint	state;
+
+	uint32_t	cardCount;
+
+	//Incremented each time a roster is published under the same name
+	uint64_t	generation;
+
+	//total size of the segment in bytes, including this header
+	uint64_t	size;
+
+	//byte offsets of the card table (cardCount MappedCardEntry), the key index (keyCount uint32_t
+	//card indices, sorted by key) and the key strings
+	uint64_t	cards;
+	uint64_t	keys;
+	uint32_t	keyCount;
+	uint32_t	reserved;
+	uint64_t	keyStrings;
+} MappedRosterHeader;
+
+//One card in the card table
+typedef struct mappedCardEntry {
+	//byte offset and size of the card's FlatCard block
+	uint64_t	offset;
+	uint32_t	size;
+
+	//byte offset of the card's key, or 0 if it has none
+	uint32_t	key;
+} MappedCardEntry;
+
+typedef struct mappedRoster MappedRoster;
+
+/** Function to publish a roster in a shared memory segment, replacing any roster published under the same name.
+ *@pre only one process publishes under a name at a time
+ *@post the roster has not been modified.  The segment stays until it is replaced or removed, even
+		after the publishing process exits.
+ *@return OK, INV_CARD if a card can't be flattened, INV_FILE if the segment can't be created,
+		  OTHER_ERROR if an argument is invalid or memory runs out
+ *@param name - the shm_open name, e.g. "/roster"
+		 roster - a List of Card*
+		 key - key of each card for mappedRosterFind, NULL for cardUIDKey.  Cards without a key are
+			   published but can't be found by key.
+		 context - passed to key
+ **/
+VCardErrorCode publishMappedRoster(const char* name, List* roster, CardKeyFunction key, void* context);
+
+//Marks the roster published under name as superseded and unlinks it.  INV_FILE if there is none.
+VCardErrorCode removeMappedRoster(const char* name);
+
+/** Function to map a published roster read-only.  The whole segment is checked before it is used.
+	A segment that is still marked as being written (e.g. by an older publisher) is waited for, for
+	about a second (ATTACH_RETRIES tries ATTACH_RETRY_NS apart, in VCMappedRoster.c).
+ *@post *obj must be released with detachMappedRoster.  NULL on error.
+ *@return OK, INV_FILE if there is no roster under name, it is still being written after the wait or it is malformed,
+		  OTHER_ERROR if an argument is invalid or memory runs out
+ **/
+VCardErrorCode attachMappedRoster(const char* name, MappedRoster** obj);
+
+void detachMappedRoster(MappedRoster* obj);
+
+int mappedRosterLength(const MappedRoster* obj);
+
+//Returns the card at index (in roster order), or NULL if index is out of range
+const FlatCard* mappedRosterGetCard(const MappedRoster* obj, int index);
+
+//Returns the key of the card at index, or NULL if it has none or index is out of range
+const char* mappedRosterGetKey(const MappedRoster* obj, int index);
+
+//Returns the first card (in roster order) with the key, or NULL if there is none
+const FlatCard* mappedRosterFind(const MappedRoster* obj, const char* key);
+
+uint64_t mappedRosterGeneration(const MappedRoster* obj);
+
+//False once the roster has been replaced or removed
+bool mappedRosterIsCurrent(const MappedRoster* obj);
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef _PARALLEL_PARSE_H
+#define _PARALLEL_PARSE_H
+
+#include "VCParser.h"
+
+/*	Parallel parsing of input that holds many vCards one after the other, such as a registrar export.
+
+	The input is cut into chunks of about chunkBytes, each starting on a line that begins with
+	BEGIN:VCARD.  A folded line always continues with a space or a tab, so no chunk can start inside
+	one.  A pool of threads takes chunks in turn and parses each card in them (the text from one
+	BEGIN:VCARD line to the next) with createCardFromBuffer and the given options.  Blank lines after
+	a card are ignored.
+
+	The cards are either collected in input order (parseRosterFromFile/Buffer) or handed out through a
+	bounded queue as soon as they are parsed, in no particular order (startRosterParse), so a consumer
+	can get to work before the whole input is parsed.
+*/
+
+typedef struct parallelParseOpts {
+	/*	Options for each card.  Its diagnostics list, if not NULL, receives the problems found in every
+		card in input order, with offsets and line numbers in the whole input.
+	*/
+	VCardParseOptions	parse;
+
+	//Threads to use.  0 (the default) uses one per online CPU.
+	int		threads;
+
+	//Size of the chunks the input is cut into.  0 (the default) for 4 MiB.
+	size_t	chunkBytes;
+
+	//Cards startRosterParse may have parsed and not yet handed out; workers wait while it is full.  0 (the default) for 256.
+	int		queueLength;
+} ParallelParseOptions;
+
+typedef struct rosterParse RosterParse;
+
+void initParallelParseOptions(ParallelParseOptions* options);
+
+/** Function to parse every card in a buffer, in parallel.
+ *@pre data holds length bytes (it does not need to be NUL terminated)
+ *@post *roster is a new List of Card*, in input order, whose deleteData is deleteCard.  NULL on error.
+		Cards that could not be parsed are left out (and reported in options->parse.diagnostics).
+ *@return OK (even if cards were left out), OTHER_ERROR if an argument is invalid or memory runs out
+ *@param options - NULL for the defaults
+ **/
+VCardErrorCode parseRosterFromBuffer(const char* data, size_t length, const ParallelParseOptions* options, List** roster);
+
+/** Function to parse every card in a file, in parallel.  The file is mapped rather than read, unless
+ *  it is compressed (.gz or .zst, see VCDecompress.h), in which case it is decompressed first.
+ *@return as parseRosterFromBuffer, or INV_FILE if the file can't be read
+ **/
+VCardErrorCode parseRosterFromFile(const char* fileName, const ParallelParseOptions* options, List** roster);
+
+/** Function to start parsing a file in the background.  Get the cards with nextParsedCard, then call finishRosterParse.
+ *@return OK, INV_FILE if the file can't be read, OTHER_ERROR if no thread could be started or memory runs out
+ **/
+VCardErrorCode startRosterParse(const char* fileName, const ParallelParseOptions* options, RosterParse** obj);
+
+/** Function to take a parsed card, waiting for one if none is ready.  Any number of threads may call it.
+ *@post the caller owns the card
+ *@return the card, or NULL once every card has been handed out
+ **/
+Card* nextParsedCard(RosterParse* parse);
+
+/** Function to stop a parse, wait for its threads and free it.  Cards that were not taken yet are deleted.
+ *@post the diagnostics of the cards that were parsed have been appended to options->parse.diagnostics, in input order
+ *@return OK, or OTHER_ERROR if memory ran out during the parse
+ **/
+VCardErrorCode finishRosterParse(RosterParse* parse);
+
+#endif
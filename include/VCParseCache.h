@@ -0,0 +1,63 @@
+#ifndef _PARSE_CACHE_H
+#define _PARSE_CACHE_H
+
+#include <stdint.h>
+
+#include "VCParser.h"
+
+/*	Opt-in cache of parsed vCard files, shared by every thread of a process.
+
+	A file is identified by its path together with its device, inode, size and modification time, so a
+	file that is replaced or rewritten is parsed again on its next load, while loading an unchanged
+	file only costs a stat and a hash lookup.  Concurrent loads of the same file wait for a single parse.
+
+	Loads return a reference-counted CachedCard.  Its Card is shared and must not be modified; it stays
+	valid until the reference is released, even if the cache evicts it or the file changes.  Once the
+	cards held by the cache exceed its memory bound, the least recently used ones are evicted.
+*/
+
+typedef struct parseCache ParseCache;
+typedef struct cachedCard CachedCard;
+
+typedef struct parseCacheStats {
+	uint64_t	hits;
+	uint64_t	misses;		//loads that parsed the file (including ones that failed)
+	uint64_t	evictions;
+	int			entries;
+	size_t		bytes;		//estimated memory held by the cached cards
+} ParseCacheStats;
+
+/** Function to create an empty cache.
+ *@return the new cache, or NULL if allocation fails
+ *@param maxBytes - memory bound for the cached cards (estimated), 0 for no bound
+ **/
+ParseCache* createParseCache(size_t maxBytes);
+
+/** Function to delete a cache.  Cards still referenced stay valid until they are released.
+ *@pre no other thread is using the cache
+ **/
+void deleteParseCache(ParseCache* cache);
+
+//The process-wide cache, bounded to 64 MiB, created on first use
+ParseCache* vCardParseCache(void);
+
+/** Function to get the card in a file, parsing it with createCard unless an identical file is cached.
+ *@post *obj is a new reference, to be released with releaseCachedCard.  NULL on error.
+ *@return OK, or the error createCard returns.  Errors are not cached.
+ *@param cache - the cache, or NULL for vCardParseCache()
+ **/
+VCardErrorCode loadCachedCard(ParseCache* cache, const char* fileName, CachedCard** obj);
+
+//The shared card.  Must not be modified or deleted.
+const Card* cachedCardGet(const CachedCard* cached);
+
+//Takes another reference
+CachedCard* retainCachedCard(CachedCard* cached);
+void releaseCachedCard(CachedCard* cached);
+
+//Drops every card from the cache (referenced ones stay valid)
+void clearParseCache(ParseCache* cache);
+
+void parseCacheStatistics(ParseCache* cache, ParseCacheStats* stats);
+
+#endif
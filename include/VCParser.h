@@ -8,7 +8,7 @@
 
 #include "LinkedListAPI.h"
 
-typedef enum ers {OK, INV_FILE, INV_CARD, INV_PROP, INV_DT, WRITE_ERROR, OTHER_ERROR } VCardErrorCode;
+typedef enum ers {OK, INV_FILE, INV_CARD, INV_PROP, INV_DT, WRITE_ERROR, OTHER_ERROR, LIMIT_EXCEEDED } VCardErrorCode;
 
 /*	Represents vCard Date-time, needed for date-related properties, i.e. birthday and anniversary
 	We assume that the type of date-related parameters is either unspecified or is "date-and-or-time"
@@ -47,7 +47,12 @@ typedef struct param {
 } Parameter;
 
 
-//Represents a generic vCard property
+/*	Represents a generic vCard property
+	Properties made by the parser keep their parameters and values in the same allocation as the Property
+	itself, and share interned copies of their name, group and parameter strings with other properties.
+	Change them through the list functions, don't replace or free their strings, and free them only with
+	deleteProperty.
+*/
 typedef struct prop {
 	//Property name.  Must not be empty string.  Must not be NULL.
 	char* 		name; 
@@ -124,6 +129,202 @@ int compareDates(const void* first,const void* second);
 char* dateToString(void* date);
 // **************************************************************************
 
+// ************* Copy helper functions **************************************
+//Deep copies.  The copies share no memory with the originals and are freed with the matching delete function.
+//All of them return NULL if the argument is NULL or memory runs out.
+Card* copyCard(const Card* obj);
+Property* copyProperty(const Property* prop);
+Parameter* copyParameter(const Parameter* param);
+DateTime* copyDate(const DateTime* date);
+
+/** Function to build a property without parameters from its values, stored the way the parser stores
+ *  properties (one allocation, interned name and group; see Property).  Freed with deleteProperty.
+ *@return the new property, or NULL if name is NULL, valueCount is less than 1 or memory runs out
+ *@param group - NULL or "" for no group
+		 values - valueCount strings, copied.  NULL entries are stored as empty values.
+ **/
+Property* createPropertyFromValues(const char* name, const char* group, const char* const* values, int valueCount);
+// **************************************************************************
+
+// ************* Parse options and diagnostics ******************************
+
+//Describes one problem found while parsing a vCard file
+typedef struct diag {
+	VCardErrorCode	error;
+
+	//Byte offset and 1-based line number of the start of the offending (unfolded) line
+	size_t	offset;
+	int		line;
+
+	//Short, static description of the problem.  Must not be freed.
+	const char*	reason;
+
+	//Copy of the offending unfolded line.  Empty string if the problem is not tied to a line.  Must not be NULL.
+	char*	text;
+} VCardDiagnostic;
+
+/*	Hard limits on the resources one card may take, for parsing untrusted input.  0 means no limit.
+	Each one is checked before the memory it guards is used, and exceeding any of them stops the parse
+	with LIMIT_EXCEEDED, even in tolerant mode.
+*/
+typedef struct parseLimits {
+	//Longest logical (unfolded) line, in bytes, not counting line endings
+	size_t	lineLength;
+
+	//Most continuation lines in one logical line
+	int		folds;
+
+	//Most properties in a card, including FN, BDAY and ANNIVERSARY
+	int		properties;
+
+	//Most parameters, and most values, in one property
+	int		parameters;
+	int		values;
+
+	/*	Most bytes the parser may allocate for one card: its properties and dates, and the buffers it reads
+		lines into.  A line can never be longer than this.
+	*/
+	size_t	bytes;
+} VCardParseLimits;
+
+//Options for createCardWithOptions.  Use initParseOptions to get the defaults (strict, no diagnostics, every property, no limits).
+typedef struct parseOpts {
+	/*	If true, invalid lines are skipped (and reported) instead of failing the whole card.  The card is
+		only rejected if no FN property could be found.
+	*/
+	bool	tolerant;
+
+	/*	If not NULL, a VCardDiagnostic is appended for every problem found.  In strict mode that is at most
+		one entry, for the error that stopped the parse.  Create the list with
+		initializeList(diagnosticToString, deleteDiagnostic, compareDiagnostics).
+	*/
+	List*	diagnostics;
+
+	/*	If not NULL, a NULL-terminated list of property names (e.g. {"N", "UID", "EMAIL", NULL}) to parse;
+		FN is always parsed.  Any other known property, including BDAY and ANNIVERSARY, is skipped as
+		soon as its name has been read, so its parameters and values are neither checked nor stored.
+		Unknown or malformed property names are still reported.
+	*/
+	const char* const*	projection;
+
+	//See VCardParseLimits
+	VCardParseLimits	limits;
+} VCardParseOptions;
+
+void initParseOptions(VCardParseOptions* options);
+
+/** Function to create a Card object from a vCard file, with the given options.
+ *@pre options is NULL or was set up with initParseOptions
+ *@post *obj is the new Card on success and NULL otherwise.  In tolerant mode the result may be OK
+		even though diagnostics were reported.
+ *@return the error code indicating success or the error encountered when parsing the file
+ *@param fileName - the name of a .vcf/.vcard file, optionally compressed as .vcf.gz or .vcf.zst (see
+		 VCDecompress.h).  createCard accepts the same names.
+		 obj - the resulting Card
+		 options - parse options, NULL for the behaviour of createCard
+ **/
+VCardErrorCode createCardWithOptions(char* fileName, Card** obj, const VCardParseOptions* options);
+
+/*	Reads up to size bytes of vCard text into buffer, like fread.  Returns the number of bytes read,
+	0 once the end of the input has been reached.
+*/
+typedef size_t (*VCardReadFunction)(void* context, char* buffer, size_t size);
+
+/** Functions to create a Card object from vCard text that is already in memory, from an open
+ *  stream, or from a read callback.  They behave exactly like createCardWithOptions once the text
+ *  is available; there is no file extension to check.
+ *@pre buffer holds length bytes (it does not need to be NUL terminated).  fp is open for reading.
+ *@post The caller's buffer and stream are not modified or closed.  *obj is the new Card on success
+		and NULL otherwise.
+ *@return the error code indicating success or the error encountered when parsing.  INV_FILE if the
+		  buffer, stream or read function is NULL.
+ **/
+VCardErrorCode createCardFromBuffer(const char* buffer, size_t length, Card** obj, const VCardParseOptions* options);
+VCardErrorCode createCardFromFile(FILE* fp, Card** obj, const VCardParseOptions* options);
+VCardErrorCode createCardFromReader(VCardReadFunction read, void* context, Card** obj, const VCardParseOptions* options);
+
+void deleteDiagnostic(void* toBeDeleted);
+int compareDiagnostics(const void* first,const void* second);
+char* diagnosticToString(void* diag);
+// **************************************************************************
+
+// ************* Event parsing **********************************************
+
+/*	The event parser reads vCard text line by line and reports what it finds to callbacks instead of
+	building Cards, for jobs that only look at a few properties.  Nothing is allocated per event: every
+	span points into the parser's line buffer and is only valid during the callback.
+
+	The input may hold any number of cards one after the other.  The parser checks the structure
+	(BEGIN:VCARD, VERSION:4.0, END:VCARD, CRLF line endings, an FN in every card) and the syntax of each
+	property line, reporting problems with the same errors and reasons as createCardWithOptions.  It
+	does not check property names or values, so every well-formed property line is reported, including
+	BDAY, ANNIVERSARY and extension properties.
+*/
+
+//A piece of the current line.  Not NUL terminated.
+typedef struct vCardSpan {
+	const char*	start;
+	size_t		length;
+} VCardSpan;
+
+//One property line, unfolded
+typedef struct vCardPropertyEvent {
+	//Length 0 if the property has no group
+	VCardSpan	group;
+	VCardSpan	name;
+
+	//Everything between the name and the ':', e.g. ";TYPE=work;PREF=1".  See nextVCardParameter.
+	VCardSpan	parameters;
+
+	//Everything after the ':'.  See nextVCardValue.
+	VCardSpan	value;
+
+	//Byte offset and 1-based line number of the start of the line
+	size_t	offset;
+	int		line;
+} VCardPropertyEvent;
+
+/*	Callbacks for the event parser.  Any of them may be NULL.  Returning false stops the parse.
+
+	error receives problems as VCardDiagnostics whose text points into the line buffer.  Returning true
+	skips the offending line and carries on, like tolerant parsing; without an error callback the first
+	problem stops the parse.
+*/
+typedef struct vCardEventHandler {
+	void*	context;
+
+	bool	(*beginCard)(void* context, int line);
+	bool	(*property)(void* context, const VCardPropertyEvent* property);
+	bool	(*endCard)(void* context, int line);
+	bool	(*error)(void* context, const VCardDiagnostic* diagnostic);
+} VCardEventHandler;
+
+/** Functions to parse vCard text into events, from a file (same names as createCardWithOptions),
+ *  from memory or from a read callback.
+ *@return OK if the input was parsed to the end or a callback stopped the parse, otherwise the error
+		  that stopped it.  INV_FILE if the file, buffer or read function can't be used.
+ **/
+VCardErrorCode parseVCardEvents(const char* fileName, const VCardEventHandler* handler);
+VCardErrorCode parseVCardEventsFromBuffer(const char* buffer, size_t length, const VCardEventHandler* handler);
+VCardErrorCode parseVCardEventsFromReader(VCardReadFunction read, void* context, const VCardEventHandler* handler);
+
+/** Function to take the next parameter from a property's parameters span, skipping empty ones.
+ *@post *parameters is advanced past it
+ *@return false once there are no parameters left
+ **/
+bool nextVCardParameter(VCardSpan* parameters, VCardSpan* name, VCardSpan* value);
+
+/** Function to take the next ';'-separated value from a property's value span.  An empty span holds
+ *  one empty value, and "a;" holds "a" and "".
+ *@post *values is advanced past it; its start is NULL once the last value has been taken
+ *@return false once there are no values left
+ **/
+bool nextVCardValue(VCardSpan* values, VCardSpan* value);
+
+//Case-insensitive comparison of a span with a string, e.g. vCardSpanIs(event->name, "EMAIL")
+bool vCardSpanIs(VCardSpan span, const char* expected);
+// **************************************************************************
+
 // ************* Assignment 2 functions - MUST be implemented ***************
 
 /** Function to writing a Card object into a file in vCard format.
@@ -0,0 +1,56 @@
+#ifndef _PROPERTY_INDEX_H
+#define _PROPERTY_INDEX_H
+
+#include "VCParser.h"
+
+/*	Per-card index of the optional properties by kind, so that a card's EMAIL, TEL or N can be found
+	without walking its whole property list and comparing names.
+
+	The index is one allocation holding, for every kind, the card's properties of that kind in list
+	order.  It is built on the first lookup (or by indexCardProperties) and attached to the card's
+	optionalProperties list, which drops it as soon as the list is modified through the list
+	functions; the next lookup builds it again.  Building it only reads the card, so several threads
+	may look up properties of the same card as long as none of them modifies it.
+*/
+
+//Known optional properties, in the order of RFC 6350.  FN is only used for FNs after the first one, since card->fn is not in the list.
+typedef enum vCardPropertyKind {
+	VCARD_PROPERTY_SOURCE, VCARD_PROPERTY_KIND, VCARD_PROPERTY_XML, VCARD_PROPERTY_N,
+	VCARD_PROPERTY_NICKNAME, VCARD_PROPERTY_PHOTO, VCARD_PROPERTY_GENDER, VCARD_PROPERTY_ADR,
+	VCARD_PROPERTY_TEL, VCARD_PROPERTY_EMAIL, VCARD_PROPERTY_IMPP, VCARD_PROPERTY_LANG,
+	VCARD_PROPERTY_TZ, VCARD_PROPERTY_GEO, VCARD_PROPERTY_TITLE, VCARD_PROPERTY_ROLE,
+	VCARD_PROPERTY_LOGO, VCARD_PROPERTY_ORG, VCARD_PROPERTY_MEMBER, VCARD_PROPERTY_RELATED,
+	VCARD_PROPERTY_CATEGORIES, VCARD_PROPERTY_NOTE, VCARD_PROPERTY_PRODID, VCARD_PROPERTY_REV,
+	VCARD_PROPERTY_SOUND, VCARD_PROPERTY_UID, VCARD_PROPERTY_CLIENTPIDMAP, VCARD_PROPERTY_URL,
+	VCARD_PROPERTY_KEY, VCARD_PROPERTY_FBURL, VCARD_PROPERTY_CALADRURI, VCARD_PROPERTY_CALURI,
+	VCARD_PROPERTY_FN,
+
+	//Any other name, e.g. properties added by hand
+	VCARD_PROPERTY_OTHER,
+
+	VCARD_PROPERTY_KIND_COUNT
+} VCardPropertyKind;
+
+//Kind of a property name, ignoring case.  VCARD_PROPERTY_OTHER for NULL or unknown names.
+VCardPropertyKind propertyKindForName(const char* name);
+
+//Upper case name of a kind, e.g. "EMAIL".  NULL for VCARD_PROPERTY_OTHER and out of range values.
+const char* propertyKindName(VCardPropertyKind kind);
+
+/** Function to build a card's index now rather than on the first lookup, e.g. before sharing the card between threads.
+ *@return OK, OTHER_ERROR if the card is NULL or memory runs out
+ **/
+VCardErrorCode indexCardProperties(const Card* card);
+
+/** Function to get a card's optional properties of one kind.
+ *@pre the card is not being modified
+ *@post the array belongs to the card and is valid until its optionalProperties list is modified
+ *@return the properties, in list order, or NULL if there are none (*count is 0) or memory runs out (*count is -1)
+ *@param count - receives the number of properties
+ **/
+Property* const* cardPropertiesOfKind(const Card* card, VCardPropertyKind kind, int* count);
+
+//Returns the first of a card's optional properties of one kind, or NULL if there is none or memory runs out
+Property* cardPropertyOfKind(const Card* card, VCardPropertyKind kind);
+
+#endif
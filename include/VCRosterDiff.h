@@ -0,0 +1,120 @@
+#ifndef _ROSTER_DIFF_H
+#define _ROSTER_DIFF_H
+
+#include "VCParser.h"
+
+/*	Diff, three-way merge and patching of rosters.  A roster is a List of Card*.
+
+	Cards are matched by key (by default the first UID value) with a hash join, so diffing two rosters
+	is linear in their size.  Within a matched card, properties are matched by their slot: group, name
+	and the index among the card's properties with that group and name (card->fn is FN index 0).
+	Birthday and anniversary are reported as BDAY and ANNIVERSARY.
+
+	Patches hold their own copies of everything, so they stay valid after the rosters they were made
+	from are freed, and can be applied to any number of rosters.
+*/
+
+typedef enum changeKind { CHANGE_ADDED, CHANGE_REMOVED, CHANGE_MODIFIED } ChangeKind;
+
+//Returns the key of a card, or NULL if it has none.  The key must stay valid as long as the card.
+typedef const char* (*CardKeyFunction)(const Card* card, void* context);
+
+//One added, removed or modified property of a card
+typedef struct propertyChange {
+	ChangeKind	kind;
+
+	//The property's slot.  Group is an empty string for properties without a group.
+	char*	name;
+	char*	group;
+	int		index;
+
+	//The property before and after the change (copies).  before is NULL for added properties, after
+	//is NULL for removed ones.  Both are NULL for BDAY and ANNIVERSARY, which use the dates instead.
+	Property*	before;
+	Property*	after;
+	DateTime*	dateBefore;
+	DateTime*	dateAfter;
+} PropertyChange;
+
+//One added, removed or modified card
+typedef struct cardChange {
+	ChangeKind	kind;
+	char*		key;
+
+	//Copy of the card after the change.  NULL for removed cards.
+	Card*		card;
+
+	//For modified cards, the PropertyChanges that turn the old card into the new one.  Empty otherwise.
+	List*		properties;
+} CardChange;
+
+typedef struct rosterPatch {
+	//CardChanges, in the order of the new roster followed by the removed cards
+	List*	changes;
+
+	//For merges, the changes from the other side that conflicted with ours (see MergePolicy).  Empty otherwise.
+	List*	conflicts;
+
+	//Cards that were left out because they have no key, or the same key as an earlier card
+	int		skipped;
+} RosterPatch;
+
+//How mergeRosters resolves a conflict.  Either way, the conflict is listed in the patch.
+typedef enum mergePolicy { MERGE_KEEP_OURS, MERGE_TAKE_THEIRS } MergePolicy;
+
+//The default key: the first value of the card's first UID property
+const char* cardUIDKey(const Card* card, void* context);
+
+/** Function to compute the changes that turn one card into another.
+ *@return a List of PropertyChange, empty if the cards are equal.  NULL if an argument is NULL or
+		  allocation fails.
+ **/
+List* diffCards(const Card* before, const Card* after);
+
+/** Function to compute the changes that turn one roster into another.
+ *@return the patch, or NULL if a roster is NULL or allocation fails
+ *@param before, after - Lists of Card*
+		 key - the card key, NULL for cardUIDKey
+		 context - passed to key
+ **/
+RosterPatch* diffRosters(List* before, List* after, CardKeyFunction key, void* context);
+
+/** Function to merge the changes made in theirs since base into ours.
+ *  Changes only one side made are taken as they are.  Both sides adding or changing the same card or
+ *  property to the same result is not a conflict; anything else that overlaps is.
+ *@return a patch that brings ours up to date when applied to it, or NULL if a roster is NULL or
+		  allocation fails
+ **/
+RosterPatch* mergeRosters(List* base, List* ours, List* theirs, MergePolicy policy, CardKeyFunction key, void* context);
+
+/** Function to apply a patch to a roster in place.
+ *  Added cards replace a card with the same key if there is one.  Property changes set their slot to
+ *  the new value (or remove it), whatever the slot held before.
+ *@pre the roster's deleteData frees cards
+ *@return OK, or OTHER_ERROR if a modified card is not in the roster or a change would remove a card's
+		  FN.  The roster is left unchanged in that case.  Also OTHER_ERROR if memory runs out part way,
+		  when the changes that could not be copied are left out.
+ **/
+VCardErrorCode applyRosterPatch(List* roster, const RosterPatch* patch, CardKeyFunction key, void* context);
+
+/** Function to apply PropertyChanges to a single card in place, with the same rules as applyRosterPatch.
+ *  A change whose before and after are both NULL removes its slot, except for BDAY and ANNIVERSARY,
+ *  which are set to dateAfter.
+ *@return OK, or OTHER_ERROR if an argument is NULL or a change would remove the card's FN (the card is
+		  then unchanged), or if memory runs out
+ **/
+VCardErrorCode applyCardChanges(Card* card, List* changes);
+
+void deleteRosterPatch(RosterPatch* patch);
+
+// ************* List helper functions **************************************
+void deleteCardChange(void* toBeDeleted);
+int compareCardChanges(const void* first,const void* second);
+char* cardChangeToString(void* change);
+
+void deletePropertyChange(void* toBeDeleted);
+int comparePropertyChanges(const void* first,const void* second);
+char* propertyChangeToString(void* change);
+// **************************************************************************
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef _ROSTER_LIST_H
+#define _ROSTER_LIST_H
+
+#include "VCParser.h"
+
+/*	The List of Card* that the bulk readers (VCImport and VCParallelParse) hand back.  Internal to the
+	library and not meant for its callers.
+*/
+
+/** Function to create an empty roster: a List that prints its cards with cardToString, frees them with
+ *  deleteCard and compares them by FN, like compareProperties.
+ *@return the new list, or NULL if allocation fails
+ **/
+List* createRosterList(void);
+
+#endif
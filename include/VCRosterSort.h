@@ -0,0 +1,59 @@
+#ifndef _ROSTER_SORT_H
+#define _ROSTER_SORT_H
+
+#include <stdint.h>
+
+#include "VCParser.h"
+
+/*	Sorting a roster (a List of Card*) by name, for class lists.
+
+	Each card's sort key is worked out once: the family name, given names and additional names from its
+	N property, or its FN if it has no N (or an N with neither a family nor a given name).  The names
+	are compared byte by byte, ignoring ASCII case and leading and trailing spaces, so "de Vries" and
+	"De Vries" sort together.  An optional number, e.g. a grade or a student number, can be sorted on
+	before the name.
+
+	The keys are packed into one array and sorted with a parallel merge sort.  The sort is stable:
+	cards with equal keys keep their roster order.
+*/
+
+//Gets the number to sort a card on.  Returns false if the card has none; such cards come after all others.
+typedef bool (*CardNumberFunction)(const Card* card, void* context, int64_t* number);
+
+typedef struct rosterSortOpts {
+	//Sorted on (in ascending order) before the name.  NULL to sort on the name only.
+	CardNumberFunction	number;
+	void*	context;
+
+	//Sorts in descending order instead.  Cards without a number still come last.
+	bool	descending;
+
+	//Threads to use.  0 (the default) uses one per online CPU.  Small rosters are always sorted on one thread.
+	int		threads;
+} RosterSortOptions;
+
+void initRosterSortOptions(RosterSortOptions* options);
+
+/** Function to work out the sorted order of a roster without changing it.
+ *@post *order holds getLength(roster) indices into the roster, in sorted order, and must be freed.
+		NULL if the roster is empty or on error.
+ *@return OK, OTHER_ERROR if an argument is invalid or memory runs out
+ *@param options - NULL for the defaults
+ **/
+VCardErrorCode rosterSortOrder(List* roster, const RosterSortOptions* options, int** order);
+
+/** Function to get a roster's cards in sorted order, leaving the roster as it is.
+ *@post *view holds the *count cards of the roster, in sorted order, and must be freed (but not the
+		cards, which still belong to the roster).  NULL if the roster is empty or on error.
+ *@return as rosterSortOrder
+ **/
+VCardErrorCode sortedRosterView(List* roster, const RosterSortOptions* options, Card*** view, int* count);
+
+/** Function to sort a roster in place.  Only the order of the cards changes; nothing is allocated or
+ *  freed in the list.
+ *@post the roster is sorted, or unchanged on error
+ *@return as rosterSortOrder
+ **/
+VCardErrorCode sortRoster(List* roster, const RosterSortOptions* options);
+
+#endif
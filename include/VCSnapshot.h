@@ -0,0 +1,88 @@
+#ifndef _SNAPSHOT_H
+#define _SNAPSHOT_H
+
+#include <stdint.h>
+
+#include "VCParser.h"
+
+/*	Roster with persistent, structurally shared versions, copied on write one card at a time.
+
+	A SharedRoster always has one current RosterSnapshot.  Readers pin the current snapshot in O(1)
+	and may read it for as long as they like: a pinned snapshot is immutable and is never modified
+	or freed underneath them.
+
+	Writers open a RosterWriter, make their changes and commit.  A new version shares every card
+	it did not touch with the previous one; cards are stored in fixed size chunks and only the
+	chunks and cards that were modified get copied.  Sharing stops at the card: an edited card is
+	deep copied with all of its properties, including the ones the edit leaves alone.  Only one
+	writer may be open at a time, but writers never wait for readers.
+*/
+
+typedef struct sharedRoster SharedRoster;
+typedef struct rosterSnapshot RosterSnapshot;
+typedef struct rosterWriter RosterWriter;
+
+/** Function to create an empty roster.
+ *@return the new roster, or NULL if allocation fails
+ **/
+SharedRoster* createSharedRoster(void);
+
+/** Function to delete a roster and every card in its current version.
+ *@pre no writer is open.  Snapshots pinned before this call stay valid until they are released.
+ *@param roster - the roster to delete
+ **/
+void deleteSharedRoster(SharedRoster* roster);
+
+// ************* Readers ****************************************************
+
+/** Function to pin the current version of the roster.  Never blocks on writers.
+ *@post the returned snapshot stays valid and unchanged until releaseSnapshot is called
+ *@return the current snapshot
+ *@param roster - the roster
+ **/
+RosterSnapshot* pinSnapshot(SharedRoster* roster);
+
+void releaseSnapshot(RosterSnapshot* snapshot);
+
+//Version number of the snapshot.  Every commit increments it by one, the empty roster is version 0.
+uint64_t snapshotVersion(const RosterSnapshot* snapshot);
+
+int snapshotLength(const RosterSnapshot* snapshot);
+
+//Returns the card at index, or NULL if index is out of range.  The card must not be modified.
+const Card* snapshotGetCard(const RosterSnapshot* snapshot, int index);
+
+// ************* Writers ****************************************************
+
+/** Function to start a new version of the roster.  Waits for any other open writer to commit or abort.
+ *@return a writer whose draft starts as a copy of the current version
+ *@param roster - the roster
+ **/
+RosterWriter* beginRosterWrite(SharedRoster* roster);
+
+int writerLength(const RosterWriter* writer);
+
+/** Function to get a card of the draft for modification.  The first call for a given index deep copies
+ *  the card, every property included (and its chunk); later calls in the same writer return the same
+ *  private copy.
+ *@return the modifiable card, or NULL if index is out of range or the copy fails
+ **/
+Card* writerEditCard(RosterWriter* writer, int index);
+
+//The following functions take ownership of card on success.  They return OTHER_ERROR if index is out of
+//range or memory runs out, in which case the caller still owns card.
+VCardErrorCode writerReplaceCard(RosterWriter* writer, int index, Card* card);
+VCardErrorCode writerAppendCard(RosterWriter* writer, Card* card);
+VCardErrorCode writerRemoveCard(RosterWriter* writer, int index);
+
+/** Function to publish the draft as the new current version and close the writer.
+ *@post readers that pin after this call see the new version, the previous version is freed once its
+		last reader releases it
+ *@return the version number of the new snapshot
+ **/
+uint64_t commitRosterWrite(RosterWriter* writer);
+
+//Discards the draft and closes the writer
+void abortRosterWrite(RosterWriter* writer);
+
+#endif
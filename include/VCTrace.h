@@ -0,0 +1,85 @@
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "VCParser.h"
+
+/*	Tracing of the parser, for finding out why a particular file was slow to load.
+
+	Two independent mechanisms share the same trace points:
+
+	- Static probes for perf, bpftrace and SystemTap (provider "vcparser"), compiled in with make SDT=1
+	  (needs sys/sdt.h, e.g. from systemtap-sdt-dev).  An unused probe is a single nop.  For example:
+
+		bpftrace -e 'usdt:bin/libvcparser.so:vcparser:card__parse__start { @s[tid] = nsecs; }
+		             usdt:bin/libvcparser.so:vcparser:card__parse__done { @us = hist((nsecs - @s[tid]) / 1000); }'
+
+	- An in-process ring buffer, started with startVCardTrace and written as Chrome trace-event JSON
+	  with writeVCardTrace, which chrome://tracing and ui.perfetto.dev can open.  While it is not
+	  running each trace point costs one relaxed load.  Once it is full the oldest events are
+	  overwritten.
+
+	Trace points (probe names, with the argument they pass):
+
+		card__parse__start / card__parse__done		one card parsed by any createCard function (input offset / VCardErrorCode)
+		property__start / property__done			one property line (line number / 1 if it was stored)
+		line__fold									a logical line made of several physical lines (number of continuation lines)
+		validate__start / validate__done			validateCard (number of optional properties / VCardErrorCode)
+		write__start / write__done					writeCard (number of optional properties / VCardErrorCode)
+*/
+
+/** Function to start recording trace events in the ring buffer, discarding any that were recorded before.
+ *@return OK, OTHER_ERROR if capacity is 0 or memory runs out
+ *@param capacity - number of events kept, e.g. 1 << 20.  Each takes 48 bytes.
+ **/
+VCardErrorCode startVCardTrace(size_t capacity);
+
+//Stops recording, waiting for events that are being recorded.  The events are kept for writeVCardTrace.
+void stopVCardTrace(void);
+
+/** Function to write the recorded events, oldest first, as Chrome trace-event JSON.  Stops the trace
+ *  first if it is running.
+ *@return OK, INV_FILE if no trace was started since the last freeVCardTrace, WRITE_ERROR if the file
+		  can't be written
+ **/
+VCardErrorCode writeVCardTrace(const char* fileName);
+
+//Number of events currently in the ring buffer
+size_t vCardTraceLength(void);
+
+//Frees the ring buffer, stopping the trace first if it is running
+void freeVCardTrace(void);
+
+// ************* Trace points (used by the library) *************************
+
+#ifdef VCARD_WITH_SDT
+#include <sys/sdt.h>
+#define VCARD_PROBE(probe, arg) DTRACE_PROBE1(vcparser, probe, arg)
+#else
+#define VCARD_PROBE(probe, arg) ((void)0)
+#endif
+
+//Ring buffer phases, as in the trace-event format
+#define VCARD_TRACE_BEGIN 'B'
+#define VCARD_TRACE_END 'E'
+#define VCARD_TRACE_INSTANT 'i'
+
+extern atomic_bool vCardTracing;
+
+void recordVCardTraceEvent(const char* name, char phase, const char* argName, int64_t arg);
+
+//Fires probe and, if the ring buffer is running, records an event.  name and argName must be string literals.
+#define VCARD_TRACE(probe, name, phase, argName, arg) \
+	do { \
+		int64_t vCardTraceArg = (int64_t)(arg); \
+		VCARD_PROBE(probe, vCardTraceArg); \
+		if (atomic_load_explicit(&vCardTracing, memory_order_relaxed)) { \
+			recordVCardTraceEvent(name, phase, argName, vCardTraceArg); \
+		} \
+	} while (0)
+// **************************************************************************
+
+#endif
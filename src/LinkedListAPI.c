@@ -3,6 +3,9 @@
 #include "LinkedListAPI.h"
 #include "assert.h"
 
+static Node* takeNode(List* list, void* data);
+static void releaseNode(List* list, Node* node);
+
 /** Function to initialize the list metadata head to the appropriate function pointers. Allocates memory to the struct.
 *@return pointer to the list head
 *@param printFunction function pointer to print a single node of the list
@@ -25,10 +28,116 @@ List * initializeList(char* (*printFunction)(void* toBePrinted),void (*deleteFun
 	tmpList->deleteData = deleteFunction;
 	tmpList->compare = compareFunction;
 	tmpList->printData = printFunction;
+
+	tmpList->storageStart = NULL;
+	tmpList->storageEnd = NULL;
+	tmpList->spareNodes = NULL;
+	tmpList->inPlace = false;
+	tmpList->index = NULL;
 	
 	return tmpList;
 }
 
+/** Function to initialize a List struct inside caller-owned storage.  Nodes and data inside the storage
+* are never freed individually; the storage is freed by its owner once the list has been cleared.
+**/
+void initializeListInPlace(List* list, char* (*printFunction)(void* toBePrinted),void (*deleteFunction)(void* toBeDeleted),int (*compareFunction)(const void* first,const void* second), void* storage, size_t storageSize){
+    assert(list != NULL);
+    assert(printFunction != NULL);
+    assert(deleteFunction != NULL);
+    assert(compareFunction != NULL);
+
+	list->head = NULL;
+	list->tail = NULL;
+
+	list->length = 0;
+
+	list->deleteData = deleteFunction;
+	list->compare = compareFunction;
+	list->printData = printFunction;
+
+	list->storageStart = (char*)storage;
+	list->storageEnd = (char*)storage + storageSize;
+	list->spareNodes = NULL;
+	list->inPlace = true;
+	list->index = NULL;
+}
+
+void addInlineNodes(List* list, Node* nodes, int count){
+	for (int i = count - 1; i >= 0; i--){
+		nodes[i].next = list->spareNodes;
+		list->spareNodes = &nodes[i];
+	}
+}
+
+bool listStorageContains(const List* list, const void* pointer){
+	if (list == NULL || list->storageStart == NULL){
+		return false;
+	}
+
+	return (const char*)pointer >= list->storageStart && (const char*)pointer < list->storageEnd;
+}
+
+ListIndex* getListIndex(const List* list){
+	if (list == NULL){
+		return NULL;
+	}
+
+	return __atomic_load_n(&list->index, __ATOMIC_ACQUIRE);
+}
+
+ListIndex* setListIndex(List* list, ListIndex* index){
+	if (list == NULL || index == NULL){
+		return NULL;
+	}
+
+	ListIndex* attached = NULL;
+	if (__atomic_compare_exchange_n(&list->index, &attached, index, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)){
+		return index;
+	}
+
+	index->deleteIndex(index);
+	return attached;
+}
+
+//Called on every modification, so the common case (no index) is a plain load
+void invalidateListIndex(List* list){
+	if (list == NULL || __atomic_load_n(&list->index, __ATOMIC_RELAXED) == NULL){
+		return;
+	}
+
+	ListIndex* index = __atomic_exchange_n(&list->index, NULL, __ATOMIC_ACQ_REL);
+	if (index != NULL){
+		index->deleteIndex(index);
+	}
+}
+
+//Uses a spare inline node if there is one
+Node* takeNode(List* list, void* data){
+	Node* node = list->spareNodes;
+
+	if (node == NULL){
+		return initializeNode(data);
+	}
+
+	list->spareNodes = node->next;
+	node->data = data;
+	node->previous = NULL;
+	node->next = NULL;
+
+	return node;
+}
+
+//Inline nodes go back to the spare list, heap nodes are freed
+void releaseNode(List* list, Node* node){
+	if (listStorageContains(list, node)){
+		node->next = list->spareNodes;
+		list->spareNodes = node;
+	}else{
+		free(node);
+	}
+}
+
 
 /** Deletes the entire linked list, freeing all memory.
 * uses the supplied function pointer to release allocated memory for the data
@@ -39,7 +148,9 @@ List * initializeList(char* (*printFunction)(void* toBePrinted),void (*deleteFun
 void freeList(List* list){	
 
     clearList(list);
-	free(list);
+	if (list != NULL && !list->inPlace){
+		free(list);
+	}
 }
 
 /** Clears the list: frees the contents of the list - Node structs and data stored in them - 
@@ -55,6 +166,8 @@ void clearList(List* list){
 		return;
 	}
 	
+	invalidateListIndex(list);
+
 	if (list->head == NULL && list->tail == NULL){
 		return;
 	}
@@ -62,10 +175,12 @@ void clearList(List* list){
 	Node* tmp;
 	
 	while (list->head != NULL){
-		list->deleteData(list->head->data);
+		if (!listStorageContains(list, list->head->data)){
+			list->deleteData(list->head->data);
+		}
 		tmp = list->head;
 		list->head = list->head->next;
-		free(tmp);
+		releaseNode(list, tmp);
 	}
 	
 	list->head = NULL;
@@ -107,9 +222,10 @@ void insertBack(List* list, void* toBeAdded){
 		return;
 	}
 	
+	invalidateListIndex(list);
 	(list->length)++;
 
-	Node* newNode = initializeNode(toBeAdded);
+	Node* newNode = takeNode(list, toBeAdded);
 	
     if (list->head == NULL && list->tail == NULL){
         list->head = newNode;
@@ -132,9 +248,10 @@ void insertFront(List* list, void* toBeAdded){
 		return;
 	}
 	
+	invalidateListIndex(list);
 	(list->length)++;
 
-	Node* newNode = initializeNode(toBeAdded);
+	Node* newNode = takeNode(list, toBeAdded);
 	
     if (list->head == NULL && list->tail == NULL){
         list->head = newNode;
@@ -196,8 +313,9 @@ void* deleteDataFromList(List* list, void* toBeDeleted){
 				list->tail = delNode->previous;
 			}
 			
+			invalidateListIndex(list);
 			void* data = delNode->data;
-			free(delNode);
+			releaseNode(list, delNode);
 			
 			(list->length)--;
 
@@ -254,7 +372,8 @@ void insertSorted(List *list, void *toBeAdded){
 			free(currDescr);
 			free(newDescr);
 		
-			Node* newNode = initializeNode(toBeAdded);
+			invalidateListIndex(list);
+			Node* newNode = takeNode(list, toBeAdded);
 			newNode->next = currNode;
 			newNode->previous = currNode->previous;
 			currNode->previous->next = newNode;
@@ -280,17 +399,25 @@ returned string must be freed by the calling function.
 char* toString(List * list){
 	ListIterator iter = createIterator(list);
 	char* str;
+	size_t len = 0;
+	size_t capacity = 64;
 		
-	str = (char*)malloc(sizeof(char));
+	str = (char*)malloc(capacity);
 	strcpy(str, "");
 	
 	void* elem;
 	while((elem = nextElement(&iter)) != NULL){
 		char* currDescr = list->printData(elem);
-		int newLen = strlen(str)+50+strlen(currDescr);
-		str = (char*)realloc(str, newLen);
-		//strcat(str, "\n");
-		strcat(str, currDescr);
+		size_t descrLen = strlen(currDescr);
+		//grow geometrically and append at the known end, so long lists stay linear
+		if (len + descrLen + 1 > capacity){
+			while (len + descrLen + 1 > capacity){
+				capacity *= 2;
+			}
+			str = (char*)realloc(str, capacity);
+		}
+		memcpy(str + len, currDescr, descrLen + 1);
+		len += descrLen;
 		
 		free(currDescr);
 	}
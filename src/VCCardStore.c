@@ -0,0 +1,1623 @@
+// Author: Ben Martens (1349551)
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <strings.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "VCCardStore.h"
+#include "VCFiles.h"
+#include "VCFlatCard.h"
+#include "VCRosterDiff.h"
+
+#define PAGE_SIZE 4096
+#define PAGE_HEADER_SIZE 16
+#define PAGE_SPACE (PAGE_SIZE - PAGE_HEADER_SIZE)
+#define SLOT_SIZE 2
+#define NO_PAGE 0 // page 0 is the meta page, so no link points at it
+#define EMPTY_FRAME UINT32_MAX // not NO_PAGE, since the meta page is cached like any other
+#define DEFAULT_CACHE_PAGES 256
+#define MIN_CACHE_PAGES 16
+#define MAX_CACHE_PAGES (1 << 18) // 1 GiB, far below where the frame and bucket counts could overflow an int
+#define MAX_DEPTH 32
+#define MAX_KEY (CARD_STORE_MAX_INDEX_VALUE + 1 + CARD_STORE_MAX_UID)
+#define MAX_CELLS 512
+
+/*	Leaf cells: key length (u16), value length (u32), flags (u8), the key, then the value or, with
+	CELL_OVERFLOW, the u32 number of its first overflow page.  A value is kept in the leaf if the cell
+	is at most MAX_INLINE_CELL bytes, which is small enough for every page to hold at least four cells,
+	so that a split always leaves both halves able to take the new cell.
+	Interior cells: key length (u16), child page (u32), the key.  The child holds the keys from this
+	key up to the next cell's; the page's link is the child for keys below the first cell's.
+*/
+#define LEAF_CELL_HEADER 7
+#define INTERIOR_CELL_HEADER 6
+#define CELL_OVERFLOW 0x1
+#define MAX_INLINE_CELL (PAGE_SPACE / 4 - SLOT_SIZE)
+#define OVERFLOW_SPACE PAGE_SPACE
+
+#define STORE_MAGIC 0x54424356u   // "VCBT"
+#define JOURNAL_MAGIC 0x4A424356u // "VCBJ"
+#define STORE_VERSION 1u
+
+/*	Every page starts with this header, then (for leaves and interior pages) a slot array of u16 cell
+	offsets, in key order.  The cells are packed at the end of the page.  checksum is the CRC-32 of the
+	rest of the page, and number the page's own number, so a page written to the wrong place is caught.
+	link is the next leaf, the first child, the next overflow page or the next free page.
+*/
+typedef struct pageHeader {
+    uint32_t checksum;
+    uint32_t number;
+    uint8_t type;
+    uint8_t reserved;
+    uint16_t count;
+    uint32_t link;
+} PageHeader;
+
+typedef enum pageType { PAGE_META = 1, PAGE_LEAF, PAGE_INTERIOR, PAGE_OVERFLOW, PAGE_FREE } PageType;
+
+// Page 0, after its header
+typedef struct storeMeta {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t pageSize;
+    uint32_t pageCount;
+    uint32_t freeHead;
+    uint32_t roots[3]; // by CardStoreIndex, NO_PAGE for an empty tree
+    uint64_t cardCount;
+} StoreMeta;
+
+// The journal is this header, then count entries of a u32 page number and the page
+typedef struct journalHeader {
+    uint32_t magic;
+    uint32_t count;
+    uint32_t checksum; // of the entries
+    uint32_t reserved;
+} JournalHeader;
+
+typedef struct cacheFrame {
+    uint32_t page; // EMPTY_FRAME if the frame holds no page
+    bool dirty;
+    bool referenced;
+    int next; // in the hash chain, -1 at the end
+    uint8_t* data;
+} CacheFrame;
+
+struct cardStore {
+    pthread_mutex_t lock;
+    CardStoreOptions options;
+    int fd;
+    int journalFd;
+    StoreMeta meta;
+    VCardErrorCode failure; // of the operation in progress; OK while nothing has gone wrong
+    bool broken;            // a commit failed part way, so the file must be recovered by opening it again
+
+    CacheFrame* frames;
+    int frameCount;
+    int* buckets;
+    int bucketMask;
+    int hand; // of the CLOCK
+    int dirtyCount;
+    CardStoreStats stats;
+};
+
+struct cardStoreCursor {
+    CardStore* store;
+    CardStoreIndex index;
+    uint8_t from[MAX_KEY];
+    int fromLength; // -1 for no lower limit
+    uint8_t to[MAX_KEY];
+    int toLength; // -1 for no upper limit
+    uint8_t last[MAX_KEY];
+    int lastLength; // -1 before the first card
+    bool done;
+};
+
+// The cells of a page, or of a page to be written
+typedef struct cellList {
+    int count;
+    size_t bytes; // including a slot each
+    const uint8_t* data[MAX_CELLS];
+    uint16_t length[MAX_CELLS];
+} CellList;
+
+static VCardErrorCode openStore(CardStore* store, const char* fileName);
+static VCardErrorCode recoverJournal(CardStore* store);
+static VCardErrorCode initStoreFile(CardStore* store);
+static bool readMeta(CardStore* store);
+static void writeMeta(CardStore* store);
+static VCardErrorCode finishChange(CardStore* store);
+static VCardErrorCode commitStore(CardStore* store);
+static void rollBack(CardStore* store);
+static int compareFrames(const void* first, const void* second, void* frames);
+
+static bool initCache(CardStore* store);
+static void freeCache(CardStore* store);
+static int findFrame(CardStore* store, uint32_t page);
+static int getFrame(CardStore* store, uint32_t page, bool load);
+static int freeFrame(CardStore* store);
+static void unhashFrame(CardStore* store, int frame);
+static void shrinkCache(CardStore* store);
+static bool readPage(CardStore* store, uint32_t page, uint8_t* data);
+static bool writePage(CardStore* store, uint32_t page, const uint8_t* data);
+static bool pageValid(const uint8_t* data, uint32_t page);
+static void sealPage(uint8_t* data);
+static uint32_t allocatePage(CardStore* store);
+static bool releasePage(CardStore* store, uint32_t page);
+
+static PageHeader* header(uint8_t* data);
+static const PageHeader* constHeader(const uint8_t* data);
+static const uint8_t* cellAt(const uint8_t* data, int index);
+static size_t cellSize(const uint8_t* cell, uint8_t type);
+static uint16_t cellKeyLength(const uint8_t* cell);
+static const uint8_t* cellKey(const uint8_t* cell, uint8_t type);
+static uint32_t cellChild(const uint8_t* cell);
+static int compareKeys(const uint8_t* first, size_t firstLength, const uint8_t* second, size_t secondLength);
+static int searchPage(const uint8_t* data, const uint8_t* key, size_t length, bool after);
+static uint32_t childFor(const uint8_t* data, const uint8_t* key, size_t length, int* index);
+static void readCells(const uint8_t* data, CellList* cells);
+static bool insertCell(CellList* cells, int index, const uint8_t* cell, uint16_t length);
+static void removeCell(CellList* cells, int index);
+static bool layoutPage(uint8_t* data, uint8_t type, uint32_t link, const CellList* cells, int first, int end);
+static int splitPoint(const CellList* cells);
+
+static bool treeFind(CardStore* store, CardStoreIndex tree, const uint8_t* key, size_t length, uint8_t* cell);
+static bool treeSeek(CardStore* store, CardStoreIndex tree, const uint8_t* key, int length, bool after, uint8_t* cell);
+static bool treePut(CardStore* store, CardStoreIndex tree, const uint8_t* key, size_t length, const uint8_t* cell, uint16_t cellLength);
+static bool treeDelete(CardStore* store, CardStoreIndex tree, const uint8_t* key, size_t length);
+
+static uint16_t buildLeafCell(CardStore* store, uint8_t* cell, const uint8_t* key, size_t keyLength, const void* value, uint32_t valueLength);
+static FlatCard* readValue(CardStore* store, const uint8_t* cell);
+static bool writeOverflow(CardStore* store, const uint8_t* value, uint32_t length, uint32_t* first);
+static bool freeOverflow(CardStore* store, const uint8_t* cell);
+static bool updateIndexes(CardStore* store, const FlatCard* flat, const char* uid, bool add);
+static bool updateIndex(CardStore* store, CardStoreIndex tree, const char* value, const char* uid, bool add);
+static int indexKey(uint8_t* key, const char* value, const char* uid);
+static VCardErrorCode cardFromCell(CardStore* store, const uint8_t* cell, Card** card);
+static bool pastEnd(const CardStoreCursor* cursor, const uint8_t* key, size_t length);
+
+static bool readAll(int fd, void* data, size_t length, off_t offset);
+static bool writeAll(int fd, const void* data, size_t length, off_t offset);
+static int openFile(const char* path, bool* created);
+
+// ************* Store *****************************************************
+void initCardStoreOptions(CardStoreOptions* options) {
+    if (options == NULL) {
+        return;
+    }
+
+    options->cachePages = DEFAULT_CACHE_PAGES;
+    options->sync = CARD_STORE_SYNC_EACH;
+}
+
+VCardErrorCode openCardStore(const char* fileName, const CardStoreOptions* options, CardStore** store) {
+    if (store == NULL) {
+        return OTHER_ERROR;
+    }
+    *store = NULL;
+    if (fileName == NULL || (options != NULL && options->cachePages < 0)) {
+        return OTHER_ERROR;
+    }
+
+    CardStore* newStore = (CardStore*)calloc(1, sizeof(CardStore));
+    if (newStore == NULL) {
+        return OTHER_ERROR;
+    }
+    initCardStoreOptions(&newStore->options);
+    if (options != NULL) {
+        newStore->options = *options;
+    }
+    if (newStore->options.cachePages < MIN_CACHE_PAGES) {
+        newStore->options.cachePages = MIN_CACHE_PAGES;
+    }
+    if (newStore->options.cachePages > MAX_CACHE_PAGES) {
+        newStore->options.cachePages = MAX_CACHE_PAGES;
+    }
+    newStore->fd = -1;
+    newStore->journalFd = -1;
+    pthread_mutex_init(&newStore->lock, NULL);
+
+    VCardErrorCode error = initCache(newStore) ? openStore(newStore, fileName) : OTHER_ERROR;
+    if (error != OK) {
+        if (newStore->fd >= 0) {
+            close(newStore->fd);
+        }
+        if (newStore->journalFd >= 0) {
+            close(newStore->journalFd);
+        }
+        freeCache(newStore);
+        pthread_mutex_destroy(&newStore->lock);
+        free(newStore);
+        return error;
+    }
+
+    *store = newStore;
+    return OK;
+}
+
+VCardErrorCode openStore(CardStore* store, const char* fileName) {
+    char* journalName = joinPath(fileName, "-journal");
+    if (journalName == NULL) {
+        return OTHER_ERROR;
+    }
+    bool created;
+    bool journalCreated;
+    store->fd = openFile(fileName, &created);
+    store->journalFd = openFile(journalName, &journalCreated);
+    free(journalName);
+    if (store->fd < 0 || store->journalFd < 0) {
+        return INV_FILE;
+    }
+    // new directory entries have to be on disk before anything committed to the files can count
+    if ((created || journalCreated) && !syncDirectory(fileName)) {
+        return INV_FILE;
+    }
+    // the lock goes away with the descriptor, so a crashed process doesn't leave it behind
+    if (flock(store->fd, LOCK_EX | LOCK_NB) != 0) {
+        return INV_FILE;
+    }
+
+    VCardErrorCode error = recoverJournal(store);
+    if (error != OK) {
+        return error;
+    }
+
+    struct stat status;
+    if (fstat(store->fd, &status) != 0) {
+        return INV_FILE;
+    }
+    if (status.st_size == 0) {
+        return initStoreFile(store);
+    }
+
+    return readMeta(store) ? OK : INV_FILE;
+}
+
+// Writes a complete journal out again, since the commit it belongs to may not have reached the file
+VCardErrorCode recoverJournal(CardStore* store) {
+    struct stat status;
+    if (fstat(store->journalFd, &status) != 0) {
+        return INV_FILE;
+    }
+    if (status.st_size == 0) {
+        return OK;
+    }
+
+    JournalHeader journal;
+    size_t entrySize = sizeof(uint32_t) + PAGE_SIZE;
+    uint8_t* entries = NULL;
+    bool complete = (size_t)status.st_size >= sizeof(JournalHeader) && readAll(store->journalFd, &journal, sizeof(journal), 0) &&
+            journal.magic == JOURNAL_MAGIC && (size_t)status.st_size == sizeof(JournalHeader) + journal.count * entrySize;
+    if (complete) {
+        entries = (uint8_t*)malloc(journal.count * entrySize + 1);
+        if (entries == NULL) {
+            return OTHER_ERROR;
+        }
+        complete = readAll(store->journalFd, entries, journal.count * entrySize, sizeof(JournalHeader)) &&
+                (uint32_t)crc32(0, entries, journal.count * entrySize) == journal.checksum;
+    }
+
+    bool written = true;
+    for (uint32_t i = 0; complete && written && i < journal.count; i++) {
+        uint32_t page;
+        memcpy(&page, entries + i * entrySize, sizeof(page));
+        written = writeAll(store->fd, entries + i * entrySize + sizeof(page), PAGE_SIZE, (off_t)page * PAGE_SIZE);
+    }
+    free(entries);
+
+    // an incomplete journal belongs to a commit that never touched the file, and is dropped
+    if (!written || (complete && fsync(store->fd) != 0) || ftruncate(store->journalFd, 0) != 0 || fsync(store->journalFd) != 0) {
+        return WRITE_ERROR;
+    }
+
+    return OK;
+}
+
+VCardErrorCode initStoreFile(CardStore* store) {
+    store->meta = (StoreMeta){STORE_MAGIC, STORE_VERSION, PAGE_SIZE, 1, NO_PAGE, {NO_PAGE, NO_PAGE, NO_PAGE}, 0};
+    writeMeta(store);
+    if (store->failure != OK) {
+        return store->failure;
+    }
+
+    return commitStore(store);
+}
+
+bool readMeta(CardStore* store) {
+    uint8_t data[PAGE_SIZE];
+
+    if (!readPage(store, 0, data) || constHeader(data)->type != PAGE_META) {
+        return false;
+    }
+    memcpy(&store->meta, data + PAGE_HEADER_SIZE, sizeof(StoreMeta));
+
+    const StoreMeta* meta = &store->meta;
+    bool valid = meta->magic == STORE_MAGIC && meta->version == STORE_VERSION && meta->pageSize == PAGE_SIZE && meta->pageCount >= 1;
+    for (int i = 0; i < 3; i++) {
+        valid = valid && meta->roots[i] < meta->pageCount;
+    }
+
+    return valid && meta->freeHead < meta->pageCount;
+}
+
+void writeMeta(CardStore* store) {
+    uint8_t data[PAGE_SIZE] = {0};
+
+    header(data)->type = PAGE_META;
+    memcpy(data + PAGE_HEADER_SIZE, &store->meta, sizeof(StoreMeta));
+    writePage(store, 0, data);
+}
+
+VCardErrorCode closeCardStore(CardStore* store) {
+    if (store == NULL) {
+        return OTHER_ERROR;
+    }
+
+    pthread_mutex_lock(&store->lock);
+    VCardErrorCode error = store->broken ? WRITE_ERROR : commitStore(store);
+    pthread_mutex_unlock(&store->lock);
+
+    close(store->fd);
+    close(store->journalFd);
+    freeCache(store);
+    pthread_mutex_destroy(&store->lock);
+    free(store);
+
+    return error;
+}
+
+VCardErrorCode commitCardStore(CardStore* store) {
+    if (store == NULL) {
+        return OTHER_ERROR;
+    }
+
+    pthread_mutex_lock(&store->lock);
+    VCardErrorCode error = store->broken ? WRITE_ERROR : commitStore(store);
+    pthread_mutex_unlock(&store->lock);
+
+    return error;
+}
+
+void cardStoreStatistics(CardStore* store, CardStoreStats* stats) {
+    if (store == NULL || stats == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&store->lock);
+    *stats = store->stats;
+    stats->cards = store->meta.cardCount;
+    stats->pages = store->meta.pageCount;
+    pthread_mutex_unlock(&store->lock);
+}
+// *************************************************************************
+
+// ************* Commits ***************************************************
+// Ends a change: undoes it if it failed, otherwise commits if it is time to
+VCardErrorCode finishChange(CardStore* store) {
+    if (store->failure != OK) {
+        VCardErrorCode error = store->failure;
+        rollBack(store);
+        return error;
+    }
+
+    writeMeta(store);
+    if (store->failure == OK && (store->options.sync == CARD_STORE_SYNC_EACH || store->dirtyCount > store->options.cachePages / 2)) {
+        return commitStore(store);
+    }
+    if (store->failure != OK) {
+        VCardErrorCode error = store->failure;
+        rollBack(store);
+        return error;
+    }
+
+    return OK;
+}
+
+VCardErrorCode commitStore(CardStore* store) {
+    if (store->dirtyCount == 0) {
+        return OK;
+    }
+
+    // the pages in order, so they are written to the file front to back
+    int* dirty = (int*)malloc(store->dirtyCount * sizeof(int));
+    size_t entrySize = sizeof(uint32_t) + PAGE_SIZE;
+    uint8_t* journal = (uint8_t*)malloc(sizeof(JournalHeader) + store->dirtyCount * entrySize);
+    if (dirty == NULL || journal == NULL) {
+        free(dirty);
+        free(journal);
+        return OTHER_ERROR;
+    }
+    int count = 0;
+    for (int i = 0; i < store->frameCount; i++) {
+        if (store->frames[i].dirty) {
+            dirty[count++] = i;
+        }
+    }
+    qsort_r(dirty, count, sizeof(int), compareFrames, store->frames);
+
+    uint8_t* entry = journal + sizeof(JournalHeader);
+    for (int i = 0; i < count; i++) {
+        CacheFrame* frame = &store->frames[dirty[i]];
+        header(frame->data)->number = frame->page;
+        sealPage(frame->data);
+        memcpy(entry, &frame->page, sizeof(uint32_t));
+        memcpy(entry + sizeof(uint32_t), frame->data, PAGE_SIZE);
+        entry += entrySize;
+    }
+    JournalHeader journalHeader = {JOURNAL_MAGIC, (uint32_t)count, (uint32_t)crc32(0, journal + sizeof(JournalHeader), count * entrySize), 0};
+    memcpy(journal, &journalHeader, sizeof(JournalHeader));
+
+    // once the journal is on disk the commit will happen, even if the writes below are cut short
+    bool journaled = writeAll(store->journalFd, journal, sizeof(JournalHeader) + count * entrySize, 0) &&
+            ftruncate(store->journalFd, sizeof(JournalHeader) + count * entrySize) == 0 && fdatasync(store->journalFd) == 0;
+    bool written = journaled;
+    for (int i = 0; written && i < count; i++) {
+        CacheFrame* frame = &store->frames[dirty[i]];
+        written = writeAll(store->fd, frame->data, PAGE_SIZE, (off_t)frame->page * PAGE_SIZE);
+    }
+    written = written && fdatasync(store->fd) == 0;
+    free(dirty);
+    free(journal);
+
+    if (!journaled) {
+        // nothing reached the file, so the changes can be dropped as if they had failed
+        rollBack(store);
+        return WRITE_ERROR;
+    }
+    if (!written) {
+        // the file may be half written; opening it again finishes the commit from the journal
+        store->broken = true;
+        return WRITE_ERROR;
+    }
+
+    // left behind if this fails, the journal is only written again on open, which does no harm
+    if (ftruncate(store->journalFd, 0) != 0) {
+        store->broken = true;
+    }
+    for (int i = 0; i < store->frameCount; i++) {
+        store->frames[i].dirty = false;
+    }
+    store->dirtyCount = 0;
+    store->stats.commits++;
+    shrinkCache(store);
+
+    return OK;
+}
+
+int compareFrames(const void* first, const void* second, void* frames) {
+    uint32_t a = ((CacheFrame*)frames)[*(const int*)first].page;
+    uint32_t b = ((CacheFrame*)frames)[*(const int*)second].page;
+
+    return (a > b) - (a < b);
+}
+
+// Drops every change since the last commit, by forgetting the changed pages and reading the meta page again
+void rollBack(CardStore* store) {
+    for (int i = 0; i < store->frameCount; i++) {
+        if (store->frames[i].dirty) {
+            unhashFrame(store, i);
+            store->frames[i].dirty = false;
+            store->frames[i].page = EMPTY_FRAME;
+        }
+    }
+    store->dirtyCount = 0;
+    shrinkCache(store);
+
+    if (!readMeta(store)) {
+        store->broken = true;
+    }
+    store->failure = OK;
+}
+// *************************************************************************
+
+// ************* Cache *****************************************************
+bool initCache(CardStore* store) {
+    size_t pages = (size_t)store->options.cachePages;
+    size_t buckets = 1;
+    while (buckets < pages * 2) {
+        buckets *= 2;
+    }
+
+    store->frames = (CacheFrame*)calloc(pages, sizeof(CacheFrame));
+    store->buckets = (int*)malloc(buckets * sizeof(int));
+    if (store->frames == NULL || store->buckets == NULL) {
+        return false;
+    }
+    store->bucketMask = (int)(buckets - 1);
+    for (size_t i = 0; i < buckets; i++) {
+        store->buckets[i] = -1;
+    }
+    for (int i = 0; i < store->options.cachePages; i++) {
+        store->frames[i].data = (uint8_t*)malloc(PAGE_SIZE);
+        if (store->frames[i].data == NULL) {
+            return false;
+        }
+        store->frames[i].page = EMPTY_FRAME;
+        store->frames[i].next = -1;
+        store->frameCount++;
+    }
+
+    return true;
+}
+
+void freeCache(CardStore* store) {
+    for (int i = 0; store->frames != NULL && i < store->frameCount; i++) {
+        free(store->frames[i].data);
+    }
+    free(store->frames);
+    free(store->buckets);
+}
+
+int findFrame(CardStore* store, uint32_t page) {
+    for (int frame = store->buckets[page & store->bucketMask]; frame >= 0; frame = store->frames[frame].next) {
+        if (store->frames[frame].page == page) {
+            return frame;
+        }
+    }
+
+    return -1;
+}
+
+// The frame holding a page, read from the file if load is set (otherwise the caller fills it in).  -1 on error.
+int getFrame(CardStore* store, uint32_t page, bool load) {
+    int frame = findFrame(store, page);
+    if (frame >= 0) {
+        store->frames[frame].referenced = true;
+        store->stats.cacheHits++;
+        return frame;
+    }
+
+    frame = freeFrame(store);
+    if (frame < 0) {
+        store->failure = OTHER_ERROR;
+        return -1;
+    }
+    CacheFrame* cached = &store->frames[frame];
+    if (load) {
+        store->stats.cacheMisses++;
+        if (page >= store->meta.pageCount && page != 0) {
+            store->failure = INV_FILE;
+            return -1;
+        }
+        if (!readAll(store->fd, cached->data, PAGE_SIZE, (off_t)page * PAGE_SIZE) || !pageValid(cached->data, page)) {
+            store->failure = INV_FILE;
+            return -1;
+        }
+    }
+
+    cached->page = page;
+    cached->referenced = true;
+    cached->next = store->buckets[page & store->bucketMask];
+    store->buckets[page & store->bucketMask] = frame;
+    return frame;
+}
+
+// An empty frame, found by the CLOCK among the committed pages.  Adds a frame if every page is waiting to be written.
+int freeFrame(CardStore* store) {
+    for (int step = 0; step < store->frameCount * 2; step++) {
+        int frame = store->hand;
+        store->hand = (store->hand + 1) % store->frameCount;
+
+        CacheFrame* cached = &store->frames[frame];
+        if (cached->dirty) {
+            continue;
+        }
+        if (cached->page != EMPTY_FRAME && cached->referenced) {
+            cached->referenced = false;
+            continue;
+        }
+        if (cached->page != EMPTY_FRAME) {
+            unhashFrame(store, frame);
+            cached->page = EMPTY_FRAME;
+        }
+        return frame;
+    }
+
+    CacheFrame* frames = (CacheFrame*)realloc(store->frames, (store->frameCount + 1) * sizeof(CacheFrame));
+    if (frames == NULL) {
+        return -1;
+    }
+    store->frames = frames;
+    CacheFrame* added = &store->frames[store->frameCount];
+    added->data = (uint8_t*)malloc(PAGE_SIZE);
+    if (added->data == NULL) {
+        return -1;
+    }
+    added->page = EMPTY_FRAME;
+    added->dirty = false;
+    added->referenced = false;
+    added->next = -1;
+
+    return store->frameCount++;
+}
+
+void unhashFrame(CardStore* store, int frame) {
+    int* link = &store->buckets[store->frames[frame].page & store->bucketMask];
+    while (*link >= 0 && *link != frame) {
+        link = &store->frames[*link].next;
+    }
+    if (*link == frame) {
+        *link = store->frames[frame].next;
+    }
+    store->frames[frame].next = -1;
+}
+
+// Gives back the frames a large change added, once they hold nothing waiting to be written
+void shrinkCache(CardStore* store) {
+    while (store->frameCount > store->options.cachePages && !store->frames[store->frameCount - 1].dirty) {
+        CacheFrame* last = &store->frames[store->frameCount - 1];
+        if (last->page != EMPTY_FRAME) {
+            unhashFrame(store, store->frameCount - 1);
+        }
+        free(last->data);
+        store->frameCount--;
+    }
+    store->hand = 0;
+}
+
+// Copies a page out of the cache.  Pages are only ever used through copies, so nothing has to stay pinned.
+bool readPage(CardStore* store, uint32_t page, uint8_t* data) {
+    int frame = getFrame(store, page, true);
+    if (frame < 0) {
+        return false;
+    }
+
+    memcpy(data, store->frames[frame].data, PAGE_SIZE);
+    return true;
+}
+
+bool writePage(CardStore* store, uint32_t page, const uint8_t* data) {
+    int frame = getFrame(store, page, false);
+    if (frame < 0) {
+        return false;
+    }
+
+    CacheFrame* cached = &store->frames[frame];
+    memcpy(cached->data, data, PAGE_SIZE);
+    if (!cached->dirty) {
+        cached->dirty = true;
+        store->dirtyCount++;
+    }
+    return true;
+}
+
+// Checks the checksum and, for tree pages, that every cell lies inside the page
+bool pageValid(const uint8_t* data, uint32_t page) {
+    const PageHeader* pageHeader = constHeader(data);
+    if ((uint32_t)crc32(0, data + sizeof(uint32_t), PAGE_SIZE - sizeof(uint32_t)) != pageHeader->checksum || pageHeader->number != page) {
+        return false;
+    }
+    if (pageHeader->type != PAGE_LEAF && pageHeader->type != PAGE_INTERIOR) {
+        return pageHeader->type >= PAGE_META && pageHeader->type <= PAGE_FREE;
+    }
+
+    size_t slotsEnd = PAGE_HEADER_SIZE + (size_t)pageHeader->count * SLOT_SIZE;
+    if (slotsEnd > PAGE_SIZE) {
+        return false;
+    }
+    size_t minimum = pageHeader->type == PAGE_LEAF ? LEAF_CELL_HEADER : INTERIOR_CELL_HEADER;
+    for (int i = 0; i < pageHeader->count; i++) {
+        uint16_t offset;
+        memcpy(&offset, data + PAGE_HEADER_SIZE + i * SLOT_SIZE, SLOT_SIZE);
+        if (offset < slotsEnd || offset + minimum > PAGE_SIZE || offset + cellSize(data + offset, pageHeader->type) > PAGE_SIZE ||
+                cellKeyLength(data + offset) > MAX_KEY) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void sealPage(uint8_t* data) {
+    header(data)->checksum = (uint32_t)crc32(0, data + sizeof(uint32_t), PAGE_SIZE - sizeof(uint32_t));
+}
+
+// A page off the free list, or a new one at the end of the file.  NO_PAGE on error.
+uint32_t allocatePage(CardStore* store) {
+    uint32_t page = store->meta.freeHead;
+    if (page != NO_PAGE) {
+        uint8_t data[PAGE_SIZE];
+        if (!readPage(store, page, data)) {
+            return NO_PAGE;
+        }
+        if (constHeader(data)->type != PAGE_FREE || constHeader(data)->link >= store->meta.pageCount) {
+            store->failure = INV_FILE;
+            return NO_PAGE;
+        }
+        store->meta.freeHead = constHeader(data)->link;
+        return page;
+    }
+
+    if (store->meta.pageCount == UINT32_MAX) {
+        store->failure = OTHER_ERROR;
+        return NO_PAGE;
+    }
+    return store->meta.pageCount++;
+}
+
+bool releasePage(CardStore* store, uint32_t page) {
+    uint8_t data[PAGE_SIZE] = {0};
+
+    header(data)->type = PAGE_FREE;
+    header(data)->link = store->meta.freeHead;
+    store->meta.freeHead = page;
+    return writePage(store, page, data);
+}
+// *************************************************************************
+
+// ************* Pages and cells *******************************************
+PageHeader* header(uint8_t* data) {
+    return (PageHeader*)data;
+}
+
+const PageHeader* constHeader(const uint8_t* data) {
+    return (const PageHeader*)data;
+}
+
+const uint8_t* cellAt(const uint8_t* data, int index) {
+    uint16_t offset;
+    memcpy(&offset, data + PAGE_HEADER_SIZE + index * SLOT_SIZE, SLOT_SIZE);
+
+    return data + offset;
+}
+
+size_t cellSize(const uint8_t* cell, uint8_t type) {
+    if (type == PAGE_INTERIOR) {
+        return INTERIOR_CELL_HEADER + cellKeyLength(cell);
+    }
+
+    uint32_t valueLength;
+    memcpy(&valueLength, cell + 2, sizeof(uint32_t));
+    return LEAF_CELL_HEADER + cellKeyLength(cell) + ((cell[6] & CELL_OVERFLOW) ? sizeof(uint32_t) : valueLength);
+}
+
+uint16_t cellKeyLength(const uint8_t* cell) {
+    uint16_t length;
+    memcpy(&length, cell, sizeof(length));
+
+    return length;
+}
+
+const uint8_t* cellKey(const uint8_t* cell, uint8_t type) {
+    return cell + (type == PAGE_INTERIOR ? INTERIOR_CELL_HEADER : LEAF_CELL_HEADER);
+}
+
+uint32_t cellChild(const uint8_t* cell) {
+    uint32_t child;
+    memcpy(&child, cell + 2, sizeof(child));
+
+    return child;
+}
+
+// Byte order, a shorter key first if it is a prefix of the other
+int compareKeys(const uint8_t* first, size_t firstLength, const uint8_t* second, size_t secondLength) {
+    int order = memcmp(first, second, firstLength < secondLength ? firstLength : secondLength);
+    if (order != 0) {
+        return order;
+    }
+
+    return (firstLength > secondLength) - (firstLength < secondLength);
+}
+
+// Index of the first cell whose key is not below key (or, with after, is above it)
+int searchPage(const uint8_t* data, const uint8_t* key, size_t length, bool after) {
+    uint8_t type = constHeader(data)->type;
+    int low = 0;
+    int high = constHeader(data)->count;
+
+    while (low < high) {
+        int middle = (low + high) / 2;
+        const uint8_t* cell = cellAt(data, middle);
+        int order = compareKeys(cellKey(cell, type), cellKeyLength(cell), key, length);
+        if (order < 0 || (after && order == 0)) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    return low;
+}
+
+// The child of an interior page that holds key.  index receives its position: 0 for the link, i + 1 for cell i.
+uint32_t childFor(const uint8_t* data, const uint8_t* key, size_t length, int* index) {
+    *index = searchPage(data, key, length, true);
+
+    return *index == 0 ? constHeader(data)->link : cellChild(cellAt(data, *index - 1));
+}
+
+void readCells(const uint8_t* data, CellList* cells) {
+    uint8_t type = constHeader(data)->type;
+
+    cells->count = constHeader(data)->count;
+    cells->bytes = 0;
+    for (int i = 0; i < cells->count; i++) {
+        cells->data[i] = cellAt(data, i);
+        cells->length[i] = (uint16_t)cellSize(cells->data[i], type);
+        cells->bytes += cells->length[i] + SLOT_SIZE;
+    }
+}
+
+bool insertCell(CellList* cells, int index, const uint8_t* cell, uint16_t length) {
+    if (cells->count >= MAX_CELLS) {
+        return false;
+    }
+
+    memmove(&cells->data[index + 1], &cells->data[index], (cells->count - index) * sizeof(cells->data[0]));
+    memmove(&cells->length[index + 1], &cells->length[index], (cells->count - index) * sizeof(cells->length[0]));
+    cells->data[index] = cell;
+    cells->length[index] = length;
+    cells->count++;
+    cells->bytes += length + SLOT_SIZE;
+    return true;
+}
+
+void removeCell(CellList* cells, int index) {
+    cells->bytes -= cells->length[index] + SLOT_SIZE;
+    cells->count--;
+    memmove(&cells->data[index], &cells->data[index + 1], (cells->count - index) * sizeof(cells->data[0]));
+    memmove(&cells->length[index], &cells->length[index + 1], (cells->count - index) * sizeof(cells->length[0]));
+}
+
+// Lays out cells [first, end) in a fresh page.  data must not be where the cells are.  False if they don't fit.
+bool layoutPage(uint8_t* data, uint8_t type, uint32_t link, const CellList* cells, int first, int end) {
+    size_t bytes = 0;
+    for (int i = first; i < end; i++) {
+        bytes += cells->length[i] + SLOT_SIZE;
+    }
+    if (bytes > PAGE_SPACE) {
+        return false;
+    }
+
+    memset(data, 0, PAGE_SIZE);
+    header(data)->type = type;
+    header(data)->count = (uint16_t)(end - first);
+    header(data)->link = link;
+    uint16_t offset = PAGE_SIZE;
+    for (int i = first; i < end; i++) {
+        offset -= cells->length[i];
+        memcpy(data + offset, cells->data[i], cells->length[i]);
+        memcpy(data + PAGE_HEADER_SIZE + (i - first) * SLOT_SIZE, &offset, SLOT_SIZE);
+    }
+
+    return true;
+}
+
+// Where to split cells that don't fit in one page: the first cell of the second half, by bytes
+int splitPoint(const CellList* cells) {
+    size_t half = 0;
+    int point = 0;
+    while (point < cells->count - 1 && half + cells->length[point] + SLOT_SIZE <= cells->bytes / 2) {
+        half += cells->length[point] + SLOT_SIZE;
+        point++;
+    }
+
+    return point < 1 ? 1 : point;
+}
+// *************************************************************************
+
+// ************* Trees *****************************************************
+// Copies the leaf cell with key into cell (PAGE_SIZE bytes).  False if there is none or on error.
+bool treeFind(CardStore* store, CardStoreIndex tree, const uint8_t* key, size_t length, uint8_t* cell) {
+    uint8_t data[PAGE_SIZE];
+    uint32_t page = store->meta.roots[tree];
+
+    for (int depth = 0; page != NO_PAGE; depth++) {
+        if (depth > MAX_DEPTH || !readPage(store, page, data)) {
+            if (store->failure == OK) {
+                store->failure = INV_FILE;
+            }
+            return false;
+        }
+        if (constHeader(data)->type == PAGE_LEAF) {
+            int index = searchPage(data, key, length, false);
+            if (index >= constHeader(data)->count) {
+                return false;
+            }
+            const uint8_t* found = cellAt(data, index);
+            if (compareKeys(cellKey(found, PAGE_LEAF), cellKeyLength(found), key, length) != 0) {
+                return false;
+            }
+            memcpy(cell, found, cellSize(found, PAGE_LEAF));
+            return true;
+        }
+        if (constHeader(data)->type != PAGE_INTERIOR) {
+            store->failure = INV_FILE;
+            return false;
+        }
+
+        int index;
+        page = childFor(data, key, length, &index);
+    }
+
+    return false;
+}
+
+/*	Copies the first leaf cell whose key is not below key (or, with after, is above it) into cell.
+	length -1 starts from the first cell.  False at the end of the tree or on error.
+*/
+bool treeSeek(CardStore* store, CardStoreIndex tree, const uint8_t* key, int length, bool after, uint8_t* cell) {
+    uint8_t data[PAGE_SIZE];
+    uint32_t page = store->meta.roots[tree];
+
+    int depth = 0;
+    for (; page != NO_PAGE; depth++) {
+        if (depth > MAX_DEPTH || !readPage(store, page, data) || (constHeader(data)->type != PAGE_LEAF && constHeader(data)->type != PAGE_INTERIOR)) {
+            if (store->failure == OK) {
+                store->failure = INV_FILE;
+            }
+            return false;
+        }
+        if (constHeader(data)->type == PAGE_LEAF) {
+            break;
+        }
+
+        int index = 0;
+        page = length < 0 ? constHeader(data)->link : childFor(data, key, length, &index);
+    }
+    if (page == NO_PAGE) {
+        return false;
+    }
+
+    // on along the leaves, past empty ones; the step limit stops a damaged chain that loops
+    int index = length < 0 ? 0 : searchPage(data, key, length, after);
+    for (uint32_t steps = 0; index >= constHeader(data)->count; steps++) {
+        page = constHeader(data)->link;
+        if (page == NO_PAGE) {
+            return false;
+        }
+        if (steps > store->meta.pageCount || !readPage(store, page, data) || constHeader(data)->type != PAGE_LEAF) {
+            if (store->failure == OK) {
+                store->failure = INV_FILE;
+            }
+            return false;
+        }
+        index = 0;
+    }
+
+    const uint8_t* found = cellAt(data, index);
+    memcpy(cell, found, cellSize(found, PAGE_LEAF));
+    return true;
+}
+
+// Inserts a leaf cell, or replaces the one with the same key, splitting pages up the tree as needed
+bool treePut(CardStore* store, CardStoreIndex tree, const uint8_t* key, size_t length, const uint8_t* cell, uint16_t cellLength) {
+    uint8_t data[PAGE_SIZE];
+    uint8_t left[PAGE_SIZE];
+    uint8_t right[PAGE_SIZE];
+    uint8_t separator[INTERIOR_CELL_HEADER + MAX_KEY];
+    static CellList emptyCells;
+    CellList* cells = (CellList*)malloc(sizeof(CellList));
+    uint32_t path[MAX_DEPTH];
+    int childIndex[MAX_DEPTH];
+    int depth = 0;
+
+    if (cells == NULL) {
+        store->failure = OTHER_ERROR;
+        return false;
+    }
+
+    uint32_t page = store->meta.roots[tree];
+    if (page == NO_PAGE) {
+        page = allocatePage(store);
+        if (page == NO_PAGE || !layoutPage(data, PAGE_LEAF, NO_PAGE, &emptyCells, 0, 0) || !writePage(store, page, data)) {
+            free(cells);
+            return false;
+        }
+        store->meta.roots[tree] = page;
+    }
+
+    for (;;) {
+        if (!readPage(store, page, data)) {
+            free(cells);
+            return false;
+        }
+        if (constHeader(data)->type == PAGE_LEAF) {
+            break;
+        }
+        if (constHeader(data)->type != PAGE_INTERIOR || depth >= MAX_DEPTH) {
+            store->failure = INV_FILE;
+            free(cells);
+            return false;
+        }
+        path[depth] = page;
+        page = childFor(data, key, length, &childIndex[depth]);
+        depth++;
+    }
+
+    readCells(data, cells);
+    int index = searchPage(data, key, length, false);
+    if (index < cells->count && compareKeys(cellKey(cells->data[index], PAGE_LEAF), cellKeyLength(cells->data[index]), key, length) == 0) {
+        removeCell(cells, index);
+    }
+    bool put = insertCell(cells, index, cell, cellLength);
+
+    // each round writes page, split in two if it has to be, and moves up to its parent
+    uint8_t type = PAGE_LEAF;
+    uint32_t link = constHeader(data)->link;
+    while (put) {
+        if (layoutPage(left, type, link, cells, 0, cells->count)) {
+            put = writePage(store, page, left);
+            break;
+        }
+
+        uint32_t sibling = allocatePage(store);
+        if (sibling == NO_PAGE) {
+            put = false;
+            break;
+        }
+        int point = splitPoint(cells);
+        uint16_t separatorLength;
+        if (type == PAGE_LEAF) {
+            // the new page follows this one in the chain of leaves, and its first key separates them
+            put = layoutPage(left, PAGE_LEAF, sibling, cells, 0, point) && layoutPage(right, PAGE_LEAF, link, cells, point, cells->count);
+            separatorLength = cellKeyLength(cells->data[point]);
+            memcpy(separator + INTERIOR_CELL_HEADER, cellKey(cells->data[point], PAGE_LEAF), separatorLength);
+        } else {
+            // the middle cell moves up, and its child becomes the new page's first
+            put = layoutPage(left, PAGE_INTERIOR, link, cells, 0, point) &&
+                    layoutPage(right, PAGE_INTERIOR, cellChild(cells->data[point]), cells, point + 1, cells->count);
+            separatorLength = cellKeyLength(cells->data[point]);
+            memcpy(separator + INTERIOR_CELL_HEADER, cellKey(cells->data[point], PAGE_INTERIOR), separatorLength);
+        }
+        memcpy(separator, &separatorLength, sizeof(uint16_t));
+        memcpy(separator + 2, &sibling, sizeof(uint32_t));
+        put = put && writePage(store, page, left) && writePage(store, sibling, right);
+        if (!put) {
+            break;
+        }
+
+        if (depth == 0) {
+            uint32_t root = allocatePage(store);
+            CellList* rootCells = cells;
+            rootCells->count = 0;
+            rootCells->bytes = 0;
+            put = root != NO_PAGE && insertCell(rootCells, 0, separator, INTERIOR_CELL_HEADER + separatorLength) &&
+                    layoutPage(data, PAGE_INTERIOR, page, rootCells, 0, 1) && writePage(store, root, data);
+            if (put) {
+                store->meta.roots[tree] = root;
+            }
+            break;
+        }
+
+        depth--;
+        page = path[depth];
+        put = readPage(store, page, data);
+        if (put) {
+            readCells(data, cells);
+            put = insertCell(cells, childIndex[depth], separator, INTERIOR_CELL_HEADER + separatorLength);
+        }
+        type = PAGE_INTERIOR;
+        link = constHeader(data)->link;
+    }
+    free(cells);
+
+    // the change is undone by the caller's rollBack, which needs a reason even where no page access gave one
+    if (!put && store->failure == OK) {
+        store->failure = OTHER_ERROR;
+    }
+    return put;
+}
+
+// Removes the leaf cell with key, if there is one.  Pages are left as they are, even if they become empty.
+bool treeDelete(CardStore* store, CardStoreIndex tree, const uint8_t* key, size_t length) {
+    uint8_t data[PAGE_SIZE];
+    uint8_t updated[PAGE_SIZE];
+    uint32_t page = store->meta.roots[tree];
+
+    for (int depth = 0; page != NO_PAGE; depth++) {
+        if (depth > MAX_DEPTH || !readPage(store, page, data)) {
+            if (store->failure == OK) {
+                store->failure = INV_FILE;
+            }
+            return false;
+        }
+        if (constHeader(data)->type == PAGE_INTERIOR) {
+            int index;
+            page = childFor(data, key, length, &index);
+            continue;
+        }
+        if (constHeader(data)->type != PAGE_LEAF) {
+            store->failure = INV_FILE;
+            return false;
+        }
+
+        int index = searchPage(data, key, length, false);
+        if (index >= constHeader(data)->count) {
+            return true;
+        }
+        const uint8_t* cell = cellAt(data, index);
+        if (compareKeys(cellKey(cell, PAGE_LEAF), cellKeyLength(cell), key, length) != 0) {
+            return true;
+        }
+
+        CellList* cells = (CellList*)malloc(sizeof(CellList));
+        if (cells == NULL) {
+            store->failure = OTHER_ERROR;
+            return false;
+        }
+        readCells(data, cells);
+        removeCell(cells, index);
+        layoutPage(updated, PAGE_LEAF, constHeader(data)->link, cells, 0, cells->count);
+        free(cells);
+        return writePage(store, page, updated);
+    }
+
+    return true;
+}
+// *************************************************************************
+
+// ************* Cards *****************************************************
+VCardErrorCode storeCard(CardStore* store, const Card* card) {
+    const char* uid = cardUIDKey(card, NULL);
+    if (store == NULL || uid == NULL || uid[0] == '\0' || strlen(uid) > CARD_STORE_MAX_UID) {
+        return OTHER_ERROR;
+    }
+
+    FlatCard* flat = NULL;
+    VCardErrorCode error = createFlatCard(card, &flat);
+    if (error != OK) {
+        return error;
+    }
+    uint8_t* cell = (uint8_t*)malloc(PAGE_SIZE);
+    uint8_t* oldCell = (uint8_t*)malloc(PAGE_SIZE);
+    if (cell == NULL || oldCell == NULL) {
+        free(cell);
+        free(oldCell);
+        deleteFlatCard(flat);
+        return OTHER_ERROR;
+    }
+
+    pthread_mutex_lock(&store->lock);
+    if (store->broken) {
+        pthread_mutex_unlock(&store->lock);
+        free(cell);
+        free(oldCell);
+        deleteFlatCard(flat);
+        return WRITE_ERROR;
+    }
+
+    size_t length = strlen(uid);
+    bool replacing = treeFind(store, CARD_STORE_BY_UID, (const uint8_t*)uid, length, oldCell);
+    if (replacing) {
+        FlatCard* old = readValue(store, oldCell);
+        if (old != NULL) {
+            updateIndexes(store, old, uid, false);
+            free(old);
+        }
+        freeOverflow(store, oldCell);
+    }
+    if (store->failure == OK) {
+        uint16_t cellLength = buildLeafCell(store, cell, (const uint8_t*)uid, length, flat, flat->size);
+        if (cellLength > 0 && treePut(store, CARD_STORE_BY_UID, (const uint8_t*)uid, length, cell, cellLength)) {
+            updateIndexes(store, flat, uid, true);
+            if (!replacing) {
+                store->meta.cardCount++;
+            }
+        }
+    }
+    error = finishChange(store);
+    pthread_mutex_unlock(&store->lock);
+
+    free(cell);
+    free(oldCell);
+    deleteFlatCard(flat);
+    return error;
+}
+
+VCardErrorCode removeStoredCard(CardStore* store, const char* uid) {
+    if (store == NULL || uid == NULL || strlen(uid) > CARD_STORE_MAX_UID) {
+        return OTHER_ERROR;
+    }
+    uint8_t* cell = (uint8_t*)malloc(PAGE_SIZE);
+    if (cell == NULL) {
+        return OTHER_ERROR;
+    }
+
+    pthread_mutex_lock(&store->lock);
+    if (store->broken) {
+        pthread_mutex_unlock(&store->lock);
+        free(cell);
+        return WRITE_ERROR;
+    }
+
+    size_t length = strlen(uid);
+    bool found = treeFind(store, CARD_STORE_BY_UID, (const uint8_t*)uid, length, cell);
+    if (found) {
+        FlatCard* old = readValue(store, cell);
+        if (old != NULL) {
+            updateIndexes(store, old, uid, false);
+            free(old);
+        }
+        freeOverflow(store, cell);
+        if (treeDelete(store, CARD_STORE_BY_UID, (const uint8_t*)uid, length)) {
+            store->meta.cardCount--;
+        }
+    }
+    VCardErrorCode error = found || store->failure != OK ? finishChange(store) : OTHER_ERROR;
+    pthread_mutex_unlock(&store->lock);
+
+    free(cell);
+    return error;
+}
+
+VCardErrorCode getStoredCard(CardStore* store, const char* uid, Card** card) {
+    if (card == NULL) {
+        return OTHER_ERROR;
+    }
+    *card = NULL;
+    if (store == NULL || uid == NULL) {
+        return OTHER_ERROR;
+    }
+    if (strlen(uid) > CARD_STORE_MAX_UID) {
+        return OK;
+    }
+    uint8_t* cell = (uint8_t*)malloc(PAGE_SIZE);
+    if (cell == NULL) {
+        return OTHER_ERROR;
+    }
+
+    pthread_mutex_lock(&store->lock);
+    VCardErrorCode error = OK;
+    if (treeFind(store, CARD_STORE_BY_UID, (const uint8_t*)uid, strlen(uid), cell)) {
+        error = cardFromCell(store, cell, card);
+    } else if (store->failure != OK) {
+        error = store->failure;
+    }
+    store->failure = OK;
+    pthread_mutex_unlock(&store->lock);
+
+    free(cell);
+    return error;
+}
+
+// Builds a leaf cell, moving the value out to overflow pages if it is too large.  0 on error.
+uint16_t buildLeafCell(CardStore* store, uint8_t* cell, const uint8_t* key, size_t keyLength, const void* value, uint32_t valueLength) {
+    uint16_t length16 = (uint16_t)keyLength;
+    memcpy(cell, &length16, sizeof(uint16_t));
+    memcpy(cell + 2, &valueLength, sizeof(uint32_t));
+    memcpy(cell + LEAF_CELL_HEADER, key, keyLength);
+
+    if (LEAF_CELL_HEADER + keyLength + valueLength <= MAX_INLINE_CELL) {
+        cell[6] = 0;
+        if (valueLength > 0) {
+            memcpy(cell + LEAF_CELL_HEADER + keyLength, value, valueLength);
+        }
+        return (uint16_t)(LEAF_CELL_HEADER + keyLength + valueLength);
+    }
+
+    uint32_t first;
+    if (!writeOverflow(store, (const uint8_t*)value, valueLength, &first)) {
+        return 0;
+    }
+    cell[6] = CELL_OVERFLOW;
+    memcpy(cell + LEAF_CELL_HEADER + keyLength, &first, sizeof(uint32_t));
+    return (uint16_t)(LEAF_CELL_HEADER + keyLength + sizeof(uint32_t));
+}
+
+// The card in a leaf cell of the UID tree, checked to be a valid FlatCard.  NULL on error.
+FlatCard* readValue(CardStore* store, const uint8_t* cell) {
+    uint32_t length;
+    memcpy(&length, cell + 2, sizeof(uint32_t));
+    uint8_t* value = (uint8_t*)malloc(length > 0 ? length : 1);
+    if (value == NULL) {
+        store->failure = OTHER_ERROR;
+        return NULL;
+    }
+
+    const uint8_t* key = cellKey(cell, PAGE_LEAF);
+    if (!(cell[6] & CELL_OVERFLOW)) {
+        memcpy(value, key + cellKeyLength(cell), length);
+    } else {
+        uint8_t data[PAGE_SIZE];
+        uint32_t page;
+        memcpy(&page, key + cellKeyLength(cell), sizeof(uint32_t));
+        for (uint32_t copied = 0; copied < length;) {
+            if (page == NO_PAGE || !readPage(store, page, data) || constHeader(data)->type != PAGE_OVERFLOW) {
+                store->failure = INV_FILE;
+                free(value);
+                return NULL;
+            }
+            uint32_t chunk = length - copied < OVERFLOW_SPACE ? length - copied : OVERFLOW_SPACE;
+            memcpy(value + copied, data + PAGE_HEADER_SIZE, chunk);
+            copied += chunk;
+            page = constHeader(data)->link;
+        }
+    }
+
+    if (!flatCardIsValid(value, length)) {
+        store->failure = INV_FILE;
+        free(value);
+        return NULL;
+    }
+    return (FlatCard*)value;
+}
+
+bool writeOverflow(CardStore* store, const uint8_t* value, uint32_t length, uint32_t* first) {
+    uint8_t data[PAGE_SIZE];
+    uint32_t page = allocatePage(store);
+    *first = page;
+
+    for (uint32_t written = 0; page != NO_PAGE;) {
+        uint32_t chunk = length - written < OVERFLOW_SPACE ? length - written : OVERFLOW_SPACE;
+        uint32_t next = written + chunk < length ? allocatePage(store) : NO_PAGE;
+        if (written + chunk < length && next == NO_PAGE) {
+            return false;
+        }
+
+        memset(data, 0, PAGE_SIZE);
+        header(data)->type = PAGE_OVERFLOW;
+        header(data)->link = next;
+        memcpy(data + PAGE_HEADER_SIZE, value + written, chunk);
+        if (!writePage(store, page, data)) {
+            return false;
+        }
+        written += chunk;
+        page = next;
+    }
+
+    return store->failure == OK;
+}
+
+bool freeOverflow(CardStore* store, const uint8_t* cell) {
+    if (!(cell[6] & CELL_OVERFLOW)) {
+        return true;
+    }
+
+    uint8_t data[PAGE_SIZE];
+    uint32_t page;
+    memcpy(&page, cellKey(cell, PAGE_LEAF) + cellKeyLength(cell), sizeof(uint32_t));
+    for (uint32_t steps = 0; page != NO_PAGE; steps++) {
+        if (steps > store->meta.pageCount || !readPage(store, page, data) || constHeader(data)->type != PAGE_OVERFLOW) {
+            store->failure = INV_FILE;
+            return false;
+        }
+        uint32_t next = constHeader(data)->link;
+        if (!releasePage(store, page)) {
+            return false;
+        }
+        page = next;
+    }
+
+    return true;
+}
+
+// Adds or removes the index entries of a card: its FN, and the first value of each EMAIL
+bool updateIndexes(CardStore* store, const FlatCard* flat, const char* uid, bool add) {
+    const FlatProperty* fn = flatCardFN(flat);
+    if (flatPropertyValueCount(fn) > 0) {
+        updateIndex(store, CARD_STORE_BY_FN, flatPropertyValue(flat, fn, 0), uid, add);
+    }
+
+    int count = flatCardOptionalCount(flat);
+    for (int i = 0; i < count && store->failure == OK; i++) {
+        const FlatProperty* property = flatCardOptionalProperty(flat, i);
+        if (strcasecmp(flatPropertyName(flat, property), "EMAIL") == 0 && flatPropertyValueCount(property) > 0) {
+            updateIndex(store, CARD_STORE_BY_EMAIL, flatPropertyValue(flat, property, 0), uid, add);
+        }
+    }
+
+    return store->failure == OK;
+}
+
+bool updateIndex(CardStore* store, CardStoreIndex tree, const char* value, const char* uid, bool add) {
+    uint8_t key[MAX_KEY];
+    int length = indexKey(key, value, uid);
+    if (length < 0) {
+        return true;
+    }
+
+    if (!add) {
+        return treeDelete(store, tree, key, length);
+    }
+    uint8_t cell[LEAF_CELL_HEADER + MAX_KEY];
+    uint16_t cellLength = buildLeafCell(store, cell, key, length, NULL, 0);
+
+    return cellLength > 0 && treePut(store, tree, key, length, cell, cellLength);
+}
+
+// An index key: the value, ASCII case folded, a NUL and the UID.  -1 if the value is too long to index.
+int indexKey(uint8_t* key, const char* value, const char* uid) {
+    size_t valueLength = strlen(value);
+    size_t uidLength = strlen(uid);
+    if (valueLength > CARD_STORE_MAX_INDEX_VALUE || uidLength > CARD_STORE_MAX_UID) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < valueLength; i++) {
+        key[i] = (value[i] >= 'A' && value[i] <= 'Z') ? (uint8_t)(value[i] - 'A' + 'a') : (uint8_t)value[i];
+    }
+    key[valueLength] = '\0';
+    memcpy(key + valueLength + 1, uid, uidLength);
+
+    return (int)(valueLength + 1 + uidLength);
+}
+
+VCardErrorCode cardFromCell(CardStore* store, const uint8_t* cell, Card** card) {
+    FlatCard* flat = readValue(store, cell);
+    if (flat == NULL) {
+        return store->failure;
+    }
+
+    uint32_t length;
+    memcpy(&length, cell + 2, sizeof(uint32_t));
+    VCardErrorCode error = flatCardToCard(flat, length, card);
+    free(flat);
+    return error;
+}
+// *************************************************************************
+
+// ************* Cursors ***************************************************
+VCardErrorCode openCardStoreCursor(CardStore* store, CardStoreIndex index, const char* from, const char* to, CardStoreCursor** cursor) {
+    if (cursor == NULL) {
+        return OTHER_ERROR;
+    }
+    *cursor = NULL;
+    if (store == NULL || (int)index < CARD_STORE_BY_UID || index > CARD_STORE_BY_FN) {
+        return OTHER_ERROR;
+    }
+
+    CardStoreCursor* newCursor = (CardStoreCursor*)malloc(sizeof(CardStoreCursor));
+    if (newCursor == NULL) {
+        return OTHER_ERROR;
+    }
+    newCursor->store = store;
+    newCursor->index = index;
+    newCursor->fromLength = -1;
+    newCursor->toLength = -1;
+    newCursor->lastLength = -1;
+    newCursor->done = false;
+
+    // the limits are compared with the part of an index key before its NUL
+    const char* limits[2] = {from, to};
+    uint8_t* keys[2] = {newCursor->from, newCursor->to};
+    int* lengths[2] = {&newCursor->fromLength, &newCursor->toLength};
+    for (int i = 0; i < 2; i++) {
+        if (limits[i] == NULL) {
+            continue;
+        }
+        int length = index == CARD_STORE_BY_UID ? (int)strlen(limits[i]) : indexKey(keys[i], limits[i], "") - 1;
+        if (length < 0 || length > CARD_STORE_MAX_UID) {
+            free(newCursor);
+            return OTHER_ERROR;
+        }
+        if (index == CARD_STORE_BY_UID) {
+            memcpy(keys[i], limits[i], length);
+        }
+        *lengths[i] = length;
+    }
+
+    *cursor = newCursor;
+    return OK;
+}
+
+VCardErrorCode nextStoredCard(CardStoreCursor* cursor, Card** card) {
+    if (card == NULL) {
+        return OTHER_ERROR;
+    }
+    *card = NULL;
+    if (cursor == NULL) {
+        return OTHER_ERROR;
+    }
+    if (cursor->done) {
+        return OK;
+    }
+    uint8_t* cell = (uint8_t*)malloc(PAGE_SIZE);
+    uint8_t* cardCell = (uint8_t*)malloc(PAGE_SIZE);
+    if (cell == NULL || cardCell == NULL) {
+        free(cell);
+        free(cardCell);
+        return OTHER_ERROR;
+    }
+
+    CardStore* store = cursor->store;
+    pthread_mutex_lock(&store->lock);
+    VCardErrorCode error = OK;
+    while (*card == NULL && error == OK) {
+        bool started = cursor->lastLength >= 0;
+        bool found = started ? treeSeek(store, cursor->index, cursor->last, cursor->lastLength, true, cell)
+                : treeSeek(store, cursor->index, cursor->from, cursor->fromLength, false, cell);
+        if (!found) {
+            error = store->failure;
+            cursor->done = error == OK;
+            break;
+        }
+
+        const uint8_t* key = cellKey(cell, PAGE_LEAF);
+        size_t length = cellKeyLength(cell);
+        if (pastEnd(cursor, key, length)) {
+            cursor->done = true;
+            break;
+        }
+        memcpy(cursor->last, key, length);
+        cursor->lastLength = (int)length;
+
+        if (cursor->index == CARD_STORE_BY_UID) {
+            error = cardFromCell(store, cell, card);
+            continue;
+        }
+        // an index entry leads to the card by its UID, after the NUL
+        const uint8_t* uid = memchr(key, '\0', length);
+        if (uid != NULL && treeFind(store, CARD_STORE_BY_UID, uid + 1, key + length - uid - 1, cardCell)) {
+            error = cardFromCell(store, cardCell, card);
+        } else {
+            error = store->failure;
+        }
+    }
+    store->failure = OK;
+    pthread_mutex_unlock(&store->lock);
+
+    free(cell);
+    free(cardCell);
+    return error;
+}
+
+void closeCardStoreCursor(CardStoreCursor* cursor) {
+    free(cursor);
+}
+
+bool pastEnd(const CardStoreCursor* cursor, const uint8_t* key, size_t length) {
+    if (cursor->toLength < 0) {
+        return false;
+    }
+    if (cursor->index != CARD_STORE_BY_UID) {
+        const uint8_t* end = memchr(key, '\0', length);
+        length = end != NULL ? (size_t)(end - key) : length;
+    }
+
+    return compareKeys(key, length, cursor->to, cursor->toLength) > 0;
+}
+// *************************************************************************
+
+// ************* Files *****************************************************
+bool readAll(int fd, void* data, size_t length, off_t offset) {
+    while (length > 0) {
+        ssize_t count = pread(fd, data, length, offset);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            return false;
+        }
+        data = (char*)data + count;
+        length -= (size_t)count;
+        offset += count;
+    }
+
+    return true;
+}
+
+bool writeAll(int fd, const void* data, size_t length, off_t offset) {
+    while (length > 0) {
+        ssize_t count = pwrite(fd, data, length, offset);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count < 0) {
+            return false;
+        }
+        data = (const char*)data + count;
+        length -= (size_t)count;
+        offset += count;
+    }
+
+    return true;
+}
+
+// Opens a file for reading and writing, creating it if there is none
+int openFile(const char* path, bool* created) {
+    int fd = open(path, O_RDWR | O_CLOEXEC);
+
+    *created = fd < 0 && errno == ENOENT;
+    if (*created) {
+        fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    }
+
+    return fd;
+}
+// *************************************************************************
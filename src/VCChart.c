@@ -0,0 +1,772 @@
+// Author: Ben Martens (1349551)
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+#include "VCChart.h"
+
+#define WRITER_CAPACITY (64 * 1024)
+#define MARGIN_LEFT 60
+#define MARGIN_RIGHT 20
+#define MARGIN_TOP 50
+#define MARGIN_BOTTOM 50
+#define MIN_BOX_SPACING 60
+#define AXIS_TICKS 5
+
+static const char* chartFileSuffixes[] = {"histogram", "boxplot", "sections"};
+
+typedef struct chartWriter {
+    FILE* fp;
+    char* data;
+    size_t length;
+    size_t capacity;
+    bool failed;
+} ChartWriter;
+
+// The roster as the charts see it, shared read only by every thread
+typedef struct chartRoster {
+    const Card** cards;
+    int cardCount;
+    int* sectionOf;           // per card, -1 for none.  NULL without sections.
+    const char** sectionNames; // sorted
+    int sectionCount;
+} ChartRoster;
+
+// One assessment's grades
+typedef struct gradeData {
+    const ChartAssessment* assessment;
+    int64_t* sorted; // every grade, ascending
+    int count;
+    int64_t* bySection; // grades grouped by section, each group ascending
+    int* sectionStart;  // section s is bySection[sectionStart[s]] to bySection[sectionStart[s + 1] - 1]
+    double minimum;     // the grade axis
+    double maximum;
+    bool failed;
+} GradeData;
+
+typedef struct sectionEntry {
+    const char* name;
+    int card;
+} SectionEntry;
+
+typedef struct gradeEntry {
+    int section;
+    int64_t grade;
+} GradeEntry;
+
+typedef struct boxGroup {
+    const char* label;
+    const int64_t* grades; // ascending
+    int count;
+} BoxGroup;
+
+typedef struct chartJob {
+    GradeData* data;
+    ChartKind kind;
+    char* fileName;
+    VCardErrorCode error;
+} ChartJob;
+
+// Work for the thread pool: collecting each assessment's grades, then drawing each chart
+typedef struct dashboard {
+    const ChartRoster* roster;
+    const ChartOptions* options;
+    GradeData* data;
+    int dataCount;
+    ChartJob* jobs;
+    int jobCount;
+    atomic_int next;
+} Dashboard;
+
+static bool optionsValid(const ChartOptions* options);
+static bool initChartRoster(ChartRoster* chartRoster, List* roster, const ChartOptions* options);
+static void freeChartRoster(ChartRoster* chartRoster);
+static int compareSections(const void* first, const void* second);
+static bool collectGrades(const ChartRoster* roster, GradeData* data);
+static void freeGradeData(GradeData* data);
+static int compareGrades(const void* first, const void* second);
+static VCardErrorCode writeChart(const ChartRoster* roster, const GradeData* data, ChartKind kind, const ChartOptions* options, FILE* fp);
+static void runWorkers(Dashboard* dashboard, int tasks, void* (*function)(void* argument));
+static void* collectDashboardGrades(void* argument);
+static void* writeDashboardCharts(void* argument);
+
+static void drawHistogram(ChartWriter* writer, const GradeData* data, const ChartOptions* options);
+static void drawBoxPlots(ChartWriter* writer, const GradeData* data, const BoxGroup* groups, int groupCount, const ChartOptions* options);
+static void drawBox(ChartWriter* writer, const BoxGroup* group, double center, double halfWidth, const GradeData* data, double top, double bottom);
+static void drawHeader(ChartWriter* writer, int width, int height, const GradeData* data);
+static void drawGradeAxis(ChartWriter* writer, const GradeData* data, double left, double right, double top, double bottom);
+static double gradeToY(const GradeData* data, double grade, double top, double bottom);
+static double niceStep(double range);
+static double quantile(const int64_t* sorted, int count, double fraction);
+static double mean(const int64_t* grades, int count);
+
+static bool initWriter(ChartWriter* writer, FILE* fp);
+static void writeFormat(ChartWriter* writer, const char* format, ...);
+static void writeEscaped(ChartWriter* writer, const char* text);
+static bool reserve(ChartWriter* writer, size_t length);
+static void flushWriter(ChartWriter* writer);
+
+// ************* Charts ****************************************************
+void initChartOptions(ChartOptions* options) {
+    if (options == NULL) {
+        return;
+    }
+
+    options->width = 640;
+    options->height = 400;
+    options->bins = 10;
+    options->section = NULL;
+    options->sectionContext = NULL;
+    options->threads = 0;
+}
+
+VCardErrorCode writeGradeChart(List* roster, const ChartAssessment* assessment, ChartKind kind, const ChartOptions* options, FILE* fp) {
+    ChartOptions defaults;
+    if (options == NULL) {
+        initChartOptions(&defaults);
+        options = &defaults;
+    }
+    if (roster == NULL || assessment == NULL || assessment->grade == NULL || fp == NULL || !optionsValid(options) ||
+            (int)kind < CHART_HISTOGRAM || kind > CHART_SECTIONS || (kind == CHART_SECTIONS && options->section == NULL)) {
+        return OTHER_ERROR;
+    }
+
+    ChartRoster chartRoster;
+    GradeData data = {.assessment = assessment};
+    if (!initChartRoster(&chartRoster, roster, options) || !collectGrades(&chartRoster, &data)) {
+        freeGradeData(&data);
+        freeChartRoster(&chartRoster);
+        return OTHER_ERROR;
+    }
+
+    VCardErrorCode error = writeChart(&chartRoster, &data, kind, options, fp);
+
+    freeGradeData(&data);
+    freeChartRoster(&chartRoster);
+    return error;
+}
+
+VCardErrorCode writeGradeChartToFile(List* roster, const ChartAssessment* assessment, ChartKind kind, const ChartOptions* options, const char* fileName) {
+    if (fileName == NULL) {
+        return OTHER_ERROR;
+    }
+
+    FILE* fp = fopen(fileName, "wb");
+    if (fp == NULL) {
+        return WRITE_ERROR;
+    }
+    VCardErrorCode error = writeGradeChart(roster, assessment, kind, options, fp);
+    if (fclose(fp) != 0 && error == OK) {
+        error = WRITE_ERROR;
+    }
+
+    return error;
+}
+
+VCardErrorCode writeGradeDashboard(List* roster, const ChartAssessment* assessments, int assessmentCount, const ChartOptions* options, const char* prefix) {
+    ChartOptions defaults;
+    if (options == NULL) {
+        initChartOptions(&defaults);
+        options = &defaults;
+    }
+    if (roster == NULL || assessments == NULL || assessmentCount < 1 || prefix == NULL || !optionsValid(options)) {
+        return OTHER_ERROR;
+    }
+    for (int i = 0; i < assessmentCount; i++) {
+        if (assessments[i].grade == NULL) {
+            return OTHER_ERROR;
+        }
+    }
+
+    int kinds = options->section != NULL ? 3 : 2;
+    ChartRoster chartRoster;
+    bool ready = initChartRoster(&chartRoster, roster, options);
+    Dashboard dashboard = {.roster = &chartRoster, .options = options, .dataCount = assessmentCount, .jobCount = assessmentCount * kinds};
+    atomic_init(&dashboard.next, 0);
+    dashboard.data = (GradeData*)calloc(assessmentCount, sizeof(GradeData));
+    dashboard.jobs = (ChartJob*)calloc(dashboard.jobCount, sizeof(ChartJob));
+    VCardErrorCode error = ready && dashboard.data != NULL && dashboard.jobs != NULL ? OK : OTHER_ERROR;
+
+    for (int i = 0; error == OK && i < assessmentCount; i++) {
+        dashboard.data[i].assessment = &assessments[i];
+        for (int kind = 0; kind < kinds; kind++) {
+            ChartJob* job = &dashboard.jobs[i * kinds + kind];
+            size_t length = strlen(prefix) + 32;
+            job->data = &dashboard.data[i];
+            job->kind = (ChartKind)kind;
+            job->fileName = (char*)malloc(length);
+            if (job->fileName == NULL) {
+                error = OTHER_ERROR;
+                break;
+            }
+            snprintf(job->fileName, length, "%s-%03d-%s.svg", prefix, i, chartFileSuffixes[kind]);
+        }
+    }
+
+    if (error == OK) {
+        runWorkers(&dashboard, assessmentCount, collectDashboardGrades);
+        for (int i = 0; i < assessmentCount; i++) {
+            if (dashboard.data[i].failed) {
+                error = OTHER_ERROR;
+            }
+        }
+    }
+    if (error == OK) {
+        runWorkers(&dashboard, dashboard.jobCount, writeDashboardCharts);
+        for (int i = 0; i < dashboard.jobCount; i++) {
+            if (error == OK) {
+                error = dashboard.jobs[i].error;
+            }
+        }
+    }
+
+    for (int i = 0; dashboard.jobs != NULL && i < dashboard.jobCount; i++) {
+        free(dashboard.jobs[i].fileName);
+    }
+    for (int i = 0; dashboard.data != NULL && i < assessmentCount; i++) {
+        freeGradeData(&dashboard.data[i]);
+    }
+    free(dashboard.jobs);
+    free(dashboard.data);
+    freeChartRoster(&chartRoster);
+
+    return error;
+}
+
+VCardErrorCode writeChart(const ChartRoster* roster, const GradeData* data, ChartKind kind, const ChartOptions* options, FILE* fp) {
+    ChartWriter writer;
+    if (!initWriter(&writer, fp)) {
+        return OTHER_ERROR;
+    }
+
+    if (kind == CHART_HISTOGRAM) {
+        drawHistogram(&writer, data, options);
+    } else {
+        int groupCount = kind == CHART_SECTIONS ? roster->sectionCount + 1 : 1;
+        BoxGroup* groups = (BoxGroup*)malloc(groupCount * sizeof(BoxGroup));
+        if (groups == NULL) {
+            free(writer.data);
+            return OTHER_ERROR;
+        }
+        groups[0] = (BoxGroup){"All", data->sorted, data->count};
+        for (int s = 0; s < groupCount - 1; s++) {
+            groups[s + 1] = (BoxGroup){roster->sectionNames[s], data->bySection + data->sectionStart[s],
+                    data->sectionStart[s + 1] - data->sectionStart[s]};
+        }
+        drawBoxPlots(&writer, data, groups, groupCount, options);
+        free(groups);
+    }
+
+    flushWriter(&writer);
+    if (fflush(fp) != 0) {
+        writer.failed = true;
+    }
+
+    free(writer.data);
+    return writer.failed ? WRITE_ERROR : OK;
+}
+
+bool optionsValid(const ChartOptions* options) {
+    return options->width >= MARGIN_LEFT + MARGIN_RIGHT + 10 && options->width <= 100000 &&
+            options->height >= MARGIN_TOP + MARGIN_BOTTOM + 10 && options->height <= 100000 &&
+            options->bins >= 1 && options->bins <= 10000;
+}
+// *************************************************************************
+
+// ************* Thread pool ***********************************************
+// The calling thread works too, and does all of the tasks on its own if no thread can be started
+void runWorkers(Dashboard* dashboard, int tasks, void* (*function)(void* argument)) {
+    int threads = dashboard->options->threads > 0 ? dashboard->options->threads : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads > tasks) {
+        threads = tasks;
+    }
+
+    atomic_store(&dashboard->next, 0);
+    pthread_t* workers = (pthread_t*)calloc(threads > 0 ? threads : 1, sizeof(pthread_t));
+    int started = 0;
+    while (workers != NULL && started < threads - 1 && pthread_create(&workers[started], NULL, function, dashboard) == 0) {
+        started++;
+    }
+    function(dashboard);
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    free(workers);
+}
+
+void* collectDashboardGrades(void* argument) {
+    Dashboard* dashboard = (Dashboard*)argument;
+
+    int index;
+    while ((index = atomic_fetch_add(&dashboard->next, 1)) < dashboard->dataCount) {
+        GradeData* data = &dashboard->data[index];
+        data->failed = !collectGrades(dashboard->roster, data);
+    }
+
+    return NULL;
+}
+
+void* writeDashboardCharts(void* argument) {
+    Dashboard* dashboard = (Dashboard*)argument;
+
+    int index;
+    while ((index = atomic_fetch_add(&dashboard->next, 1)) < dashboard->jobCount) {
+        ChartJob* job = &dashboard->jobs[index];
+        FILE* fp = fopen(job->fileName, "wb");
+        if (fp == NULL) {
+            job->error = WRITE_ERROR;
+            continue;
+        }
+        job->error = writeChart(dashboard->roster, job->data, job->kind, dashboard->options, fp);
+        if (fclose(fp) != 0 && job->error == OK) {
+            job->error = WRITE_ERROR;
+        }
+    }
+
+    return NULL;
+}
+// *************************************************************************
+
+// ************* Grades ****************************************************
+// Numbers the sections in order of name, so every chart lists them the same way
+bool initChartRoster(ChartRoster* chartRoster, List* roster, const ChartOptions* options) {
+    int length = getLength(roster);
+    *chartRoster = (ChartRoster){.cards = (const Card**)malloc((length > 0 ? length : 1) * sizeof(Card*))};
+    if (chartRoster->cards == NULL) {
+        return false;
+    }
+
+    void* element;
+    ListIterator iter = createIterator(roster);
+    while ((element = nextElement(&iter)) != NULL && chartRoster->cardCount < length) {
+        chartRoster->cards[chartRoster->cardCount++] = (const Card*)element;
+    }
+    if (options->section == NULL) {
+        return true;
+    }
+
+    int count = chartRoster->cardCount;
+    SectionEntry* entries = (SectionEntry*)malloc((count > 0 ? count : 1) * sizeof(SectionEntry));
+    chartRoster->sectionOf = (int*)malloc((count > 0 ? count : 1) * sizeof(int));
+    chartRoster->sectionNames = (const char**)malloc((count > 0 ? count : 1) * sizeof(char*));
+    if (entries == NULL || chartRoster->sectionOf == NULL || chartRoster->sectionNames == NULL) {
+        free(entries);
+        return false;
+    }
+
+    int named = 0;
+    for (int i = 0; i < count; i++) {
+        const char* name = options->section(chartRoster->cards[i], options->sectionContext);
+        chartRoster->sectionOf[i] = -1;
+        if (name != NULL) {
+            entries[named++] = (SectionEntry){name, i};
+        }
+    }
+    qsort(entries, named, sizeof(SectionEntry), compareSections);
+
+    for (int i = 0; i < named; i++) {
+        if (i == 0 || strcmp(entries[i].name, entries[i - 1].name) != 0) {
+            chartRoster->sectionNames[chartRoster->sectionCount++] = entries[i].name;
+        }
+        chartRoster->sectionOf[entries[i].card] = chartRoster->sectionCount - 1;
+    }
+
+    free(entries);
+    return true;
+}
+
+void freeChartRoster(ChartRoster* chartRoster) {
+    free(chartRoster->cards);
+    free(chartRoster->sectionOf);
+    free(chartRoster->sectionNames);
+}
+
+int compareSections(const void* first, const void* second) {
+    return strcmp(((const SectionEntry*)first)->name, ((const SectionEntry*)second)->name);
+}
+
+bool collectGrades(const ChartRoster* roster, GradeData* data) {
+    const ChartAssessment* assessment = data->assessment;
+    int count = roster->cardCount;
+    int sections = roster->sectionOf != NULL ? roster->sectionCount : 0;
+
+    GradeEntry* entries = (GradeEntry*)malloc((count > 0 ? count : 1) * sizeof(GradeEntry));
+    data->sorted = (int64_t*)malloc((count > 0 ? count : 1) * sizeof(int64_t));
+    data->bySection = (int64_t*)malloc((count > 0 ? count : 1) * sizeof(int64_t));
+    data->sectionStart = (int*)calloc(sections + 2, sizeof(int));
+    if (entries == NULL || data->sorted == NULL || data->bySection == NULL || data->sectionStart == NULL) {
+        free(entries);
+        return false;
+    }
+
+    // counting sort by section, counts[s + 1] first holding the size of section s
+    int* counts = data->sectionStart;
+    for (int i = 0; i < count; i++) {
+        int64_t grade;
+        if (assessment->grade(roster->cards[i], assessment->context, &grade)) {
+            int section = sections > 0 ? roster->sectionOf[i] : -1;
+            entries[data->count] = (GradeEntry){section, grade};
+            data->sorted[data->count++] = grade;
+            if (section >= 0) {
+                counts[section + 1]++;
+            }
+        }
+    }
+    for (int s = 0; s < sections; s++) {
+        counts[s + 1] += counts[s];
+    }
+    for (int i = 0; i < data->count; i++) {
+        if (entries[i].section >= 0) {
+            data->bySection[counts[entries[i].section]++] = entries[i].grade;
+        }
+    }
+    // the starts were moved on to the ends
+    for (int s = sections; s > 0; s--) {
+        counts[s] = counts[s - 1];
+    }
+    counts[0] = 0;
+    free(entries);
+
+    qsort(data->sorted, data->count, sizeof(int64_t), compareGrades);
+    for (int s = 0; s < sections; s++) {
+        qsort(data->bySection + data->sectionStart[s], data->sectionStart[s + 1] - data->sectionStart[s], sizeof(int64_t), compareGrades);
+    }
+
+    if (assessment->minimum < assessment->maximum) {
+        data->minimum = (double)assessment->minimum;
+        data->maximum = (double)assessment->maximum;
+    } else if (data->count > 0 && data->sorted[0] < data->sorted[data->count - 1]) {
+        data->minimum = (double)data->sorted[0];
+        data->maximum = (double)data->sorted[data->count - 1];
+    } else {
+        data->minimum = (data->count > 0 ? (double)data->sorted[0] : 0) - 1;
+        data->maximum = data->minimum + 2;
+    }
+
+    return true;
+}
+
+void freeGradeData(GradeData* data) {
+    free(data->sorted);
+    free(data->bySection);
+    free(data->sectionStart);
+}
+
+int compareGrades(const void* first, const void* second) {
+    int64_t a = *(const int64_t*)first;
+    int64_t b = *(const int64_t*)second;
+
+    return (a > b) - (a < b);
+}
+// *************************************************************************
+
+// ************* Drawing ***************************************************
+void drawHistogram(ChartWriter* writer, const GradeData* data, const ChartOptions* options) {
+    int bins = options->bins;
+    int* counts = (int*)calloc(bins, sizeof(int));
+    if (counts == NULL) {
+        writer->failed = true;
+        return;
+    }
+
+    double binWidth = (data->maximum - data->minimum) / bins;
+    int highest = 0;
+    for (int i = 0; i < data->count; i++) {
+        double position = (data->sorted[i] - data->minimum) / binWidth;
+        int bin = position < 0 ? 0 : (position >= bins ? bins - 1 : (int)position);
+        if (++counts[bin] > highest) {
+            highest = counts[bin];
+        }
+    }
+
+    double left = MARGIN_LEFT;
+    double right = options->width - MARGIN_RIGHT;
+    double top = MARGIN_TOP;
+    double bottom = options->height - MARGIN_BOTTOM;
+    drawHeader(writer, options->width, options->height, data);
+
+    // count axis, with gridlines
+    double step = highest > AXIS_TICKS ? niceStep(highest) : 1;
+    double axisTop = highest > 0 ? step * (int)((highest + step - 1) / step) : 1;
+    for (double tick = 0; tick <= axisTop + step / 2; tick += step) {
+        double y = bottom - (bottom - top) * tick / axisTop;
+        writeFormat(writer, "<line class=\"grid\" x1=\"%.1f\" y1=\"%.1f\" x2=\"%.1f\" y2=\"%.1f\"/>\n"
+                "<text x=\"%.1f\" y=\"%.1f\" text-anchor=\"end\">%g</text>\n", left, y, right, y, left - 6, y + 4, tick);
+    }
+
+    double barWidth = (right - left) / bins;
+    int labelEvery = (bins - 1) / 10 + 1;
+    for (int bin = 0; bin < bins; bin++) {
+        double x = left + bin * barWidth;
+        double height = (bottom - top) * counts[bin] / axisTop;
+        if (counts[bin] > 0) {
+            writeFormat(writer, "<rect class=\"bar\" x=\"%.1f\" y=\"%.1f\" width=\"%.1f\" height=\"%.1f\"><title>%d</title></rect>\n",
+                    x + 1, bottom - height, barWidth - 2, height, counts[bin]);
+        }
+    }
+    for (int edge = 0; edge <= bins; edge += labelEvery) {
+        writeFormat(writer, "<text x=\"%.1f\" y=\"%.1f\" text-anchor=\"middle\">%g</text>\n", left + edge * barWidth,
+                bottom + 18, data->minimum + edge * binWidth);
+    }
+    writeFormat(writer, "<line class=\"axis\" x1=\"%.1f\" y1=\"%.1f\" x2=\"%.1f\" y2=\"%.1f\"/>\n</svg>\n", left, bottom, right, bottom);
+
+    free(counts);
+}
+
+void drawBoxPlots(ChartWriter* writer, const GradeData* data, const BoxGroup* groups, int groupCount, const ChartOptions* options) {
+    int width = options->width;
+    if (width < MARGIN_LEFT + MARGIN_RIGHT + groupCount * MIN_BOX_SPACING) {
+        width = MARGIN_LEFT + MARGIN_RIGHT + groupCount * MIN_BOX_SPACING;
+    }
+
+    double left = MARGIN_LEFT;
+    double right = width - MARGIN_RIGHT;
+    double top = MARGIN_TOP;
+    double bottom = options->height - MARGIN_BOTTOM;
+    drawHeader(writer, width, options->height, data);
+    drawGradeAxis(writer, data, left, right, top, bottom);
+
+    double spacing = (right - left) / groupCount;
+    double halfWidth = spacing / 4 < 40 ? spacing / 4 : 40;
+    for (int g = 0; g < groupCount; g++) {
+        double center = left + spacing * (g + 0.5);
+        drawBox(writer, &groups[g], center, halfWidth, data, top, bottom);
+
+        writeFormat(writer, "<text x=\"%.1f\" y=\"%.1f\" text-anchor=\"middle\">", center, bottom + 18);
+        writeEscaped(writer, groups[g].label);
+        writeFormat(writer, "</text>\n<text class=\"note\" x=\"%.1f\" y=\"%.1f\" text-anchor=\"middle\">n=%d</text>\n",
+                center, bottom + 34, groups[g].count);
+    }
+    writeFormat(writer, "</svg>\n");
+}
+
+/*	A Tukey box plot: the box spans the quartiles, the whiskers reach the furthest grades within 1.5
+	times the interquartile range of it, and grades further out are drawn as points.  The mean is a
+	diamond.
+*/
+void drawBox(ChartWriter* writer, const BoxGroup* group, double center, double halfWidth, const GradeData* data, double top, double bottom) {
+    if (group->count == 0) {
+        return;
+    }
+
+    const int64_t* grades = group->grades;
+    int count = group->count;
+    double lower = quantile(grades, count, 0.25);
+    double median = quantile(grades, count, 0.5);
+    double upper = quantile(grades, count, 0.75);
+    double reach = (upper - lower) * 1.5;
+
+    int low = 0;
+    while (grades[low] < lower - reach) {
+        low++;
+    }
+    int high = count - 1;
+    while (grades[high] > upper + reach) {
+        high--;
+    }
+
+    double y1 = gradeToY(data, grades[low], top, bottom);
+    double y2 = gradeToY(data, grades[high], top, bottom);
+    double boxTop = gradeToY(data, upper, top, bottom);
+    double boxBottom = gradeToY(data, lower, top, bottom);
+    double meanY = gradeToY(data, mean(grades, count), top, bottom);
+    writeFormat(writer, "<g><title>min %lld, Q1 %g, median %g, Q3 %g, max %lld</title>\n", (long long)grades[0], lower, median, upper,
+            (long long)grades[count - 1]);
+    writeFormat(writer, "<line class=\"whisker\" x1=\"%.1f\" y1=\"%.1f\" x2=\"%.1f\" y2=\"%.1f\"/>\n"
+            "<line class=\"whisker\" x1=\"%.1f\" y1=\"%.1f\" x2=\"%.1f\" y2=\"%.1f\"/>\n", center, y2, center, boxTop, center, boxBottom, center, y1);
+    writeFormat(writer, "<line class=\"whisker\" x1=\"%.1f\" y1=\"%.1f\" x2=\"%.1f\" y2=\"%.1f\"/>\n"
+            "<line class=\"whisker\" x1=\"%.1f\" y1=\"%.1f\" x2=\"%.1f\" y2=\"%.1f\"/>\n", center - halfWidth / 2, y1, center + halfWidth / 2, y1,
+            center - halfWidth / 2, y2, center + halfWidth / 2, y2);
+    writeFormat(writer, "<rect class=\"box\" x=\"%.1f\" y=\"%.1f\" width=\"%.1f\" height=\"%.1f\"/>\n"
+            "<line class=\"median\" x1=\"%.1f\" y1=\"%.1f\" x2=\"%.1f\" y2=\"%.1f\"/>\n", center - halfWidth, boxTop, halfWidth * 2,
+            boxBottom - boxTop, center - halfWidth, gradeToY(data, median, top, bottom), center + halfWidth, gradeToY(data, median, top, bottom));
+    writeFormat(writer, "<path class=\"mean\" d=\"M%.1f %.1fl4 4l-4 4l-4 -4z\"/>\n", center, meanY - 4);
+
+    // equal grades share a point
+    for (int i = 0; i < count; i++) {
+        if ((i < low || i > high) && (i == 0 || grades[i] != grades[i - 1])) {
+            writeFormat(writer, "<circle class=\"outlier\" cx=\"%.1f\" cy=\"%.1f\" r=\"3\"/>\n", center, gradeToY(data, grades[i], top, bottom));
+        }
+    }
+    writeFormat(writer, "</g>\n");
+}
+
+void drawHeader(ChartWriter* writer, int width, int height, const GradeData* data) {
+    const char* title = data->assessment->title != NULL ? data->assessment->title : "";
+
+    writeFormat(writer, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+            "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"%d\" height=\"%d\" viewBox=\"0 0 %d %d\">\n"
+            "<style>text{font-family:sans-serif;font-size:12px;fill:#333}.title{font-size:16px;font-weight:bold}.note{fill:#777}"
+            ".axis{stroke:#333}.grid{stroke:#ddd}.bar{fill:#4e79a7}.box{fill:#a0cbe8;stroke:#4e79a7}.whisker{stroke:#4e79a7}"
+            ".median{stroke:#e15759;stroke-width:2}.mean{fill:#fff;stroke:#333}.outlier{fill:none;stroke:#4e79a7}</style>\n"
+            "<rect width=\"100%%\" height=\"100%%\" fill=\"#fff\"/>\n<title>", width, height, width, height);
+    writeEscaped(writer, title);
+    writeFormat(writer, "</title>\n<text class=\"title\" x=\"%d\" y=\"22\" text-anchor=\"middle\">", width / 2);
+    writeEscaped(writer, title);
+    writeFormat(writer, "</text>\n<text class=\"note\" x=\"%d\" y=\"38\" text-anchor=\"middle\">n=%d", width / 2, data->count);
+    if (data->count > 0) {
+        writeFormat(writer, ", mean %.2f, median %g", mean(data->sorted, data->count), quantile(data->sorted, data->count, 0.5));
+    }
+    writeFormat(writer, "</text>\n");
+}
+
+void drawGradeAxis(ChartWriter* writer, const GradeData* data, double left, double right, double top, double bottom) {
+    double step = niceStep(data->maximum - data->minimum);
+    double first = step * (double)(long long)(data->minimum / step);
+    if (first < data->minimum) {
+        first += step;
+    }
+
+    // counted in whole steps: past 2^53 adding a small step to a large tick can leave it unchanged
+    double span = (data->maximum - first) / step + 1.0 / 1000;
+    int ticks = span >= 0 ? (int)span : -1;
+    for (int i = 0; i <= ticks; i++) {
+        double tick = first + i * step;
+        double y = gradeToY(data, tick, top, bottom);
+        writeFormat(writer, "<line class=\"grid\" x1=\"%.1f\" y1=\"%.1f\" x2=\"%.1f\" y2=\"%.1f\"/>\n"
+                "<text x=\"%.1f\" y=\"%.1f\" text-anchor=\"end\">%g</text>\n", left, y, right, y, left - 6, y + 4, tick);
+    }
+    writeFormat(writer, "<line class=\"axis\" x1=\"%.1f\" y1=\"%.1f\" x2=\"%.1f\" y2=\"%.1f\"/>\n", left, top, left, bottom);
+}
+
+// Grades outside the axis are drawn at its ends
+double gradeToY(const GradeData* data, double grade, double top, double bottom) {
+    if (grade < data->minimum) {
+        grade = data->minimum;
+    } else if (grade > data->maximum) {
+        grade = data->maximum;
+    }
+
+    return bottom - (bottom - top) * (grade - data->minimum) / (data->maximum - data->minimum);
+}
+
+// 1, 2 or 5 times a power of ten, giving about AXIS_TICKS ticks over range
+double niceStep(double range) {
+    double raw = range / AXIS_TICKS;
+    double magnitude = 1;
+    while (magnitude * 10 <= raw) {
+        magnitude *= 10;
+    }
+    while (magnitude > raw) {
+        magnitude /= 10;
+    }
+
+    double fraction = raw / magnitude;
+    return magnitude * (fraction <= 1 ? 1 : (fraction <= 2 ? 2 : (fraction <= 5 ? 5 : 10)));
+}
+
+// Linear interpolation between the closest ranks (as in most spreadsheets)
+double quantile(const int64_t* sorted, int count, double fraction) {
+    double position = fraction * (count - 1);
+    int below = (int)position;
+    if (below >= count - 1) {
+        return (double)sorted[count - 1];
+    }
+
+    return sorted[below] + (position - below) * (double)(sorted[below + 1] - sorted[below]);
+}
+
+double mean(const int64_t* grades, int count) {
+    double sum = 0;
+    for (int i = 0; i < count; i++) {
+        sum += (double)grades[i];
+    }
+
+    return sum / count;
+}
+// *************************************************************************
+
+// ************* Writer ****************************************************
+bool initWriter(ChartWriter* writer, FILE* fp) {
+    writer->fp = fp;
+    writer->data = (char*)malloc(WRITER_CAPACITY);
+    writer->length = 0;
+    writer->capacity = WRITER_CAPACITY;
+    writer->failed = false;
+
+    return writer->data != NULL;
+}
+
+// Formats straight into the buffer, flushing it and trying again if the text doesn't fit
+void writeFormat(ChartWriter* writer, const char* format, ...) {
+    for (int attempt = 0; attempt < 2 && !writer->failed; attempt++) {
+        size_t space = writer->capacity - writer->length;
+        va_list args;
+        va_start(args, format);
+        int length = vsnprintf(writer->data + writer->length, space, format, args);
+        va_end(args);
+
+        if (length < 0) {
+            writer->failed = true;
+        } else if ((size_t)length < space) {
+            writer->length += length;
+            return;
+        } else if (!reserve(writer, (size_t)length + 1)) {
+            return;
+        }
+    }
+}
+
+// Text content or attribute value.  Control characters, which XML does not allow, become spaces.
+void writeEscaped(ChartWriter* writer, const char* text) {
+    for (const char* c = text; *c != '\0'; c++) {
+        const char* entity = NULL;
+        switch (*c) {
+            case '&': entity = "&amp;"; break;
+            case '<': entity = "&lt;"; break;
+            case '>': entity = "&gt;"; break;
+            case '"': entity = "&quot;"; break;
+            case '\'': entity = "&apos;"; break;
+        }
+
+        size_t length = entity != NULL ? strlen(entity) : 1;
+        if (!reserve(writer, length)) {
+            return;
+        }
+        if (entity != NULL) {
+            memcpy(writer->data + writer->length, entity, length);
+        } else {
+            writer->data[writer->length] = (unsigned char)*c < 0x20 ? ' ' : *c;
+        }
+        writer->length += length;
+    }
+}
+
+// Makes room for length more bytes, writing out the buffer first and growing it only if that is not enough
+bool reserve(ChartWriter* writer, size_t length) {
+    if (writer->failed) {
+        return false;
+    }
+    if (writer->length + length <= writer->capacity) {
+        return true;
+    }
+
+    flushWriter(writer);
+    if (!writer->failed && length > writer->capacity) {
+        char* data = (char*)realloc(writer->data, length);
+        if (data == NULL) {
+            writer->failed = true;
+        } else {
+            writer->data = data;
+            writer->capacity = length;
+        }
+    }
+
+    return !writer->failed;
+}
+
+void flushWriter(ChartWriter* writer) {
+    if (writer->failed || writer->length == 0) {
+        return;
+    }
+
+    if (fwrite(writer->data, 1, writer->length, writer->fp) != writer->length) {
+        writer->failed = true;
+        return;
+    }
+    writer->length = 0;
+}
+// *************************************************************************
@@ -0,0 +1,453 @@
+// Author: Ben Martens (1349551)
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "VCConcurrentRoster.h"
+#include "VCIntern.h"
+
+#define DEFAULT_BUCKETS 64
+#define CACHE_LINE 64
+
+typedef struct rosterEntry {
+    char* key;
+    uint64_t hash;
+    _Atomic(Card*) card;
+    _Atomic(struct rosterEntry*) next;
+} RosterEntry;
+
+typedef struct rosterTable {
+    uint64_t bucketCount; // always a power of two
+    _Atomic(RosterEntry*) buckets[];
+} RosterTable;
+
+// an object that has been unlinked but may still be seen by readers that entered before the unlink
+typedef struct retiredObject {
+    void* object;
+    void (*destroy)(void* object);
+    uint64_t epoch;
+    struct retiredObject* next;
+} RetiredObject;
+
+/*	A reader's epoch is 0 while it is outside a critical section, otherwise it is the global epoch it
+	observed on entry, shifted left by one with the low bit set.  Each reader has a cache line to
+	itself, so entering and leaving doesn't slow down the readers next to it.
+*/
+struct rosterReader {
+    _Alignas(CACHE_LINE) ConcurrentRoster* roster;
+    atomic_uint_fast64_t epoch;
+    atomic_bool inUse;
+};
+
+struct concurrentRoster {
+    _Atomic(RosterTable*) table;
+    atomic_uint_fast64_t globalEpoch;
+    pthread_mutex_t writeLock;
+    int length;
+    RetiredObject* retired;
+    RosterReader readers[CONCURRENT_ROSTER_MAX_READERS];
+};
+
+static RosterTable* createTable(uint64_t bucketCount);
+static RosterEntry* findEntry(RosterTable* table, const char* key, uint64_t hash);
+static void growTable(ConcurrentRoster* roster);
+static void retire(ConcurrentRoster* roster, RetiredObject* retired, void* object, void (*destroy)(void* object));
+static void collectRetired(ConcurrentRoster* roster);
+static void destroyEntry(void* object);
+static void destroyCard(void* object);
+static void destroyTable(void* object);
+
+// ************* Roster ****************************************************
+ConcurrentRoster* createConcurrentRoster(int initialBuckets) {
+    ConcurrentRoster* roster = (ConcurrentRoster*)aligned_alloc(_Alignof(ConcurrentRoster), sizeof(ConcurrentRoster));
+    if (roster == NULL) {
+        return NULL;
+    }
+
+    uint64_t bucketCount = DEFAULT_BUCKETS;
+    while (bucketCount < (uint64_t)initialBuckets) {
+        bucketCount *= 2;
+    }
+    RosterTable* table = createTable(bucketCount);
+    if (table == NULL) {
+        free(roster);
+        return NULL;
+    }
+
+    atomic_init(&roster->table, table);
+    atomic_init(&roster->globalEpoch, 1);
+    pthread_mutex_init(&roster->writeLock, NULL);
+    roster->length = 0;
+    roster->retired = NULL;
+    for (int i = 0; i < CONCURRENT_ROSTER_MAX_READERS; i++) {
+        roster->readers[i].roster = roster;
+        atomic_init(&roster->readers[i].epoch, 0);
+        atomic_init(&roster->readers[i].inUse, false);
+    }
+
+    return roster;
+}
+
+void deleteConcurrentRoster(ConcurrentRoster* roster) {
+    if (roster == NULL) {
+        return;
+    }
+
+    RosterTable* table = atomic_load(&roster->table);
+    for (uint64_t i = 0; i < table->bucketCount; i++) {
+        RosterEntry* entry = atomic_load(&table->buckets[i]);
+        while (entry != NULL) {
+            RosterEntry* next = atomic_load(&entry->next);
+            deleteCard(atomic_load(&entry->card));
+            destroyEntry(entry);
+            entry = next;
+        }
+    }
+    free(table);
+
+    while (roster->retired != NULL) {
+        RetiredObject* retired = roster->retired;
+        roster->retired = retired->next;
+        retired->destroy(retired->object);
+        free(retired);
+    }
+
+    pthread_mutex_destroy(&roster->writeLock);
+    free(roster);
+}
+// *************************************************************************
+
+// ************* Readers ***************************************************
+RosterReader* attachRosterReader(ConcurrentRoster* roster) {
+    for (int i = 0; i < CONCURRENT_ROSTER_MAX_READERS; i++) {
+        bool expected = false;
+        if (atomic_compare_exchange_strong(&roster->readers[i].inUse, &expected, true)) {
+            return &roster->readers[i];
+        }
+    }
+
+    return NULL;
+}
+
+void detachRosterReader(RosterReader* reader) {
+    if (reader == NULL) {
+        return;
+    }
+
+    atomic_store(&reader->epoch, 0);
+    atomic_store(&reader->inUse, false);
+}
+
+void enterRosterRead(RosterReader* reader) {
+    uint64_t epoch = atomic_load(&reader->roster->globalEpoch);
+
+    // re-check after announcing, so a writer can't advance twice past an epoch we never published
+    while (true) {
+        atomic_store(&reader->epoch, (epoch << 1) | 1);
+        uint64_t current = atomic_load(&reader->roster->globalEpoch);
+        if (current == epoch) {
+            break;
+        }
+        epoch = current;
+    }
+}
+
+void leaveRosterRead(RosterReader* reader) {
+    atomic_store_explicit(&reader->epoch, 0, memory_order_release);
+}
+
+const Card* concurrentRosterFind(RosterReader* reader, const char* key) {
+    if (key == NULL) {
+        return NULL;
+    }
+
+    RosterTable* table = atomic_load_explicit(&reader->roster->table, memory_order_acquire);
+    RosterEntry* entry = findEntry(table, key, hashString(key, strlen(key), false));
+    if (entry == NULL) {
+        return NULL;
+    }
+
+    return atomic_load_explicit(&entry->card, memory_order_acquire);
+}
+
+void concurrentRosterForEach(RosterReader* reader, bool (*visit)(const char* key, const Card* card, void* context), void* context) {
+    if (visit == NULL) {
+        return;
+    }
+
+    RosterTable* table = atomic_load_explicit(&reader->roster->table, memory_order_acquire);
+    for (uint64_t i = 0; i < table->bucketCount; i++) {
+        RosterEntry* entry = atomic_load_explicit(&table->buckets[i], memory_order_acquire);
+        while (entry != NULL) {
+            if (!visit(entry->key, atomic_load_explicit(&entry->card, memory_order_acquire), context)) {
+                return;
+            }
+            entry = atomic_load_explicit(&entry->next, memory_order_acquire);
+        }
+    }
+}
+// *************************************************************************
+
+// ************* Writers ***************************************************
+VCardErrorCode concurrentRosterPut(ConcurrentRoster* roster, const char* key, Card* card) {
+    if (roster == NULL || key == NULL || card == NULL) {
+        return OTHER_ERROR;
+    }
+
+    uint64_t hash = hashString(key, strlen(key), false);
+
+    pthread_mutex_lock(&roster->writeLock);
+    RosterTable* table = atomic_load(&roster->table);
+    RosterEntry* entry = findEntry(table, key, hash);
+    if (entry != NULL) {
+        // the node is allocated first, so a failure leaves the old card in place
+        RetiredObject* retired = (RetiredObject*)malloc(sizeof(RetiredObject));
+        if (retired == NULL) {
+            pthread_mutex_unlock(&roster->writeLock);
+            return OTHER_ERROR;
+        }
+        Card* previous = atomic_exchange(&entry->card, card);
+        retire(roster, retired, previous, destroyCard);
+    } else {
+        entry = (RosterEntry*)malloc(sizeof(RosterEntry));
+        char* keyCopy = strdup(key);
+        if (entry == NULL || keyCopy == NULL) {
+            free(entry);
+            free(keyCopy);
+            pthread_mutex_unlock(&roster->writeLock);
+            return OTHER_ERROR;
+        }
+        entry->key = keyCopy;
+        entry->hash = hash;
+        atomic_init(&entry->card, card);
+
+        // the entry is fully built before it is published at the head of its bucket
+        _Atomic(RosterEntry*)* bucket = &table->buckets[hash & (table->bucketCount - 1)];
+        atomic_init(&entry->next, atomic_load(bucket));
+        atomic_store_explicit(bucket, entry, memory_order_release);
+
+        roster->length++;
+        if ((uint64_t)roster->length > 2 * table->bucketCount) {
+            growTable(roster);
+        }
+    }
+    collectRetired(roster);
+    pthread_mutex_unlock(&roster->writeLock);
+
+    return OK;
+}
+
+VCardErrorCode concurrentRosterRemove(ConcurrentRoster* roster, const char* key) {
+    VCardErrorCode error = OTHER_ERROR;
+
+    if (roster == NULL || key == NULL) {
+        return OTHER_ERROR;
+    }
+
+    uint64_t hash = hashString(key, strlen(key), false);
+
+    pthread_mutex_lock(&roster->writeLock);
+    RosterTable* table = atomic_load(&roster->table);
+    _Atomic(RosterEntry*)* link = &table->buckets[hash & (table->bucketCount - 1)];
+    RosterEntry* entry = atomic_load(link);
+    while (entry != NULL) {
+        if (entry->hash == hash && strcmp(entry->key, key) == 0) {
+            RetiredObject* retiredCard = (RetiredObject*)malloc(sizeof(RetiredObject));
+            RetiredObject* retiredEntry = (RetiredObject*)malloc(sizeof(RetiredObject));
+            if (retiredCard == NULL || retiredEntry == NULL) {
+                free(retiredCard);
+                free(retiredEntry);
+                break;
+            }
+
+            // readers already on the entry can still follow its next pointer, which is left intact
+            atomic_store_explicit(link, atomic_load(&entry->next), memory_order_release);
+            retire(roster, retiredCard, atomic_load(&entry->card), destroyCard);
+            retire(roster, retiredEntry, entry, destroyEntry);
+            roster->length--;
+            error = OK;
+            break;
+        }
+        link = &entry->next;
+        entry = atomic_load(link);
+    }
+    collectRetired(roster);
+    pthread_mutex_unlock(&roster->writeLock);
+
+    return error;
+}
+
+int concurrentRosterLength(ConcurrentRoster* roster) {
+    pthread_mutex_lock(&roster->writeLock);
+    int length = roster->length;
+    pthread_mutex_unlock(&roster->writeLock);
+
+    return length;
+}
+
+void concurrentRosterSynchronize(ConcurrentRoster* roster) {
+    while (true) {
+        pthread_mutex_lock(&roster->writeLock);
+        collectRetired(roster);
+        bool done = roster->retired == NULL;
+        pthread_mutex_unlock(&roster->writeLock);
+
+        if (done) {
+            return;
+        }
+        sched_yield();
+    }
+}
+// *************************************************************************
+
+// ************* Static helper functions ***********************************
+RosterTable* createTable(uint64_t bucketCount) {
+    RosterTable* table = (RosterTable*)malloc(sizeof(RosterTable) + bucketCount * sizeof(_Atomic(RosterEntry*)));
+    if (table == NULL) {
+        return NULL;
+    }
+
+    table->bucketCount = bucketCount;
+    for (uint64_t i = 0; i < bucketCount; i++) {
+        atomic_init(&table->buckets[i], NULL);
+    }
+
+    return table;
+}
+
+RosterEntry* findEntry(RosterTable* table, const char* key, uint64_t hash) {
+    RosterEntry* entry = atomic_load_explicit(&table->buckets[hash & (table->bucketCount - 1)], memory_order_acquire);
+
+    while (entry != NULL) {
+        if (entry->hash == hash && strcmp(entry->key, key) == 0) {
+            return entry;
+        }
+        entry = atomic_load_explicit(&entry->next, memory_order_acquire);
+    }
+
+    return NULL;
+}
+
+/*	Readers may still be walking the old table, so its chains are left untouched: the new table gets
+	fresh entries pointing at the same cards, and the old table is retired along with its entries.
+	Called with the write lock held.
+*/
+void growTable(ConcurrentRoster* roster) {
+    RosterTable* oldTable = atomic_load(&roster->table);
+    RosterTable* newTable = createTable(oldTable->bucketCount * 2);
+    RetiredObject* retired = (RetiredObject*)malloc(sizeof(RetiredObject));
+    if (newTable == NULL || retired == NULL) {
+        free(newTable);
+        free(retired);
+        return; // keep using the old table, chains just get longer
+    }
+
+    for (uint64_t i = 0; i < oldTable->bucketCount; i++) {
+        RosterEntry* entry = atomic_load(&oldTable->buckets[i]);
+        while (entry != NULL) {
+            RosterEntry* copy = (RosterEntry*)malloc(sizeof(RosterEntry));
+            char* keyCopy = strdup(entry->key);
+            if (copy == NULL || keyCopy == NULL) {
+                // undo the partial copy, the cards are still owned by the old entries
+                free(copy);
+                free(keyCopy);
+                for (uint64_t j = 0; j < newTable->bucketCount; j++) {
+                    RosterEntry* built = atomic_load(&newTable->buckets[j]);
+                    while (built != NULL) {
+                        RosterEntry* next = atomic_load(&built->next);
+                        destroyEntry(built);
+                        built = next;
+                    }
+                }
+                free(newTable);
+                free(retired);
+                return;
+            }
+            copy->key = keyCopy;
+            copy->hash = entry->hash;
+            atomic_init(&copy->card, atomic_load(&entry->card));
+            _Atomic(RosterEntry*)* bucket = &newTable->buckets[copy->hash & (newTable->bucketCount - 1)];
+            atomic_init(&copy->next, atomic_load(bucket));
+            atomic_init(bucket, copy);
+
+            entry = atomic_load(&entry->next);
+        }
+    }
+
+    atomic_store_explicit(&roster->table, newTable, memory_order_release);
+    retire(roster, retired, oldTable, destroyTable);
+}
+
+/*	Called with the write lock held.  The caller allocates the node before it unlinks anything, so a
+	failed allocation can be reported without waiting for readers.
+*/
+void retire(ConcurrentRoster* roster, RetiredObject* retired, void* object, void (*destroy)(void* object)) {
+    retired->object = object;
+    retired->destroy = destroy;
+    retired->epoch = atomic_load(&roster->globalEpoch);
+    retired->next = roster->retired;
+    roster->retired = retired;
+}
+
+/*	Advances the global epoch if every active reader has caught up with it, then frees everything
+	retired at least two epochs ago: no reader still inside a critical section can have seen it.
+	Called with the write lock held.
+*/
+void collectRetired(ConcurrentRoster* roster) {
+    uint64_t epoch = atomic_load(&roster->globalEpoch);
+    bool canAdvance = true;
+
+    for (int i = 0; i < CONCURRENT_ROSTER_MAX_READERS; i++) {
+        uint64_t readerEpoch = atomic_load(&roster->readers[i].epoch);
+        if ((readerEpoch & 1) && (readerEpoch >> 1) != epoch) {
+            canAdvance = false;
+            break;
+        }
+    }
+    if (canAdvance) {
+        epoch++;
+        atomic_store(&roster->globalEpoch, epoch);
+    }
+
+    RetiredObject** link = &roster->retired;
+    while (*link != NULL) {
+        RetiredObject* retired = *link;
+        if (retired->epoch + 2 <= epoch) {
+            *link = retired->next;
+            retired->destroy(retired->object);
+            free(retired);
+        } else {
+            link = &retired->next;
+        }
+    }
+}
+
+void destroyEntry(void* object) {
+    RosterEntry* entry = (RosterEntry*)object;
+
+    free(entry->key);
+    free(entry);
+}
+
+void destroyCard(void* object) {
+    deleteCard((Card*)object);
+}
+
+// A table replaced by growTable, with its entries (the cards moved to the new table)
+void destroyTable(void* object) {
+    RosterTable* table = (RosterTable*)object;
+
+    for (uint64_t i = 0; i < table->bucketCount; i++) {
+        RosterEntry* entry = atomic_load(&table->buckets[i]);
+        while (entry != NULL) {
+            RosterEntry* next = atomic_load(&entry->next);
+            destroyEntry(entry);
+            entry = next;
+        }
+    }
+    free(table);
+}
+// **************************************************************************
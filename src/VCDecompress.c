@@ -0,0 +1,330 @@
+// Author: Ben Martens (1349551)
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <zlib.h>
+#ifdef VCARD_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+#include "VCDecompress.h"
+
+#define INPUT_SIZE (64 * 1024)
+#define BLOCK_SIZE (64 * 1024)
+#define BLOCK_COUNT 4 // how far the decompression thread may run ahead of the reader
+
+/*	Blocks go round a ring: the decompression thread fills blocks[filled % BLOCK_COUNT] while fewer
+	than BLOCK_COUNT blocks are waiting, and the reader drains blocks[drained % BLOCK_COUNT].
+*/
+typedef struct outputBlock {
+    char data[BLOCK_SIZE];
+    size_t length;
+} OutputBlock;
+
+struct decompressStream {
+    FILE* fp;
+    VCardCompression compression;
+    unsigned char input[INPUT_SIZE];
+
+    pthread_mutex_t lock;
+    pthread_cond_t blockFilled;
+    pthread_cond_t blockDrained;
+    OutputBlock blocks[BLOCK_COUNT];
+    unsigned long filled;
+    unsigned long drained;
+    bool finished; // no more blocks will be filled
+    bool failed;   // ... because the data was bad
+    bool cancelled;
+
+    // reader side only
+    size_t position; // in blocks[drained % BLOCK_COUNT]
+    bool sawFailure;
+
+    pthread_t thread;
+};
+
+static void* decompressInBackground(void* argument);
+static bool inflateGzip(DecompressStream* stream);
+#ifdef VCARD_WITH_ZSTD
+static bool decompressZstd(DecompressStream* stream);
+#endif
+static OutputBlock* nextEmptyBlock(DecompressStream* stream);
+static void publishBlock(DecompressStream* stream);
+
+// ************* Public functions ******************************************
+VCardCompression compressionForFileName(const char* fileName, size_t* baseLength) {
+    VCardCompression compression = VCARD_COMPRESSION_NONE;
+    size_t length = fileName != NULL ? strlen(fileName) : 0;
+    size_t suffixLength = 0;
+
+    if (length > 3 && strcmp(fileName + length - 3, ".gz") == 0) {
+        compression = VCARD_COMPRESSION_GZIP;
+        suffixLength = 3;
+    } else if (length > 4 && strcmp(fileName + length - 4, ".zst") == 0) {
+        compression = VCARD_COMPRESSION_ZSTD;
+        suffixLength = 4;
+    }
+
+    if (baseLength != NULL) {
+        *baseLength = length - suffixLength;
+    }
+    return compression;
+}
+
+bool compressionSupported(VCardCompression compression) {
+    switch (compression) {
+        case VCARD_COMPRESSION_NONE:
+        case VCARD_COMPRESSION_GZIP:
+            return true;
+        case VCARD_COMPRESSION_ZSTD:
+#ifdef VCARD_WITH_ZSTD
+            return true;
+#else
+            return false;
+#endif
+    }
+
+    return false;
+}
+
+VCardErrorCode openDecompressStream(FILE* fp, VCardCompression compression, DecompressStream** obj) {
+    if (obj == NULL) {
+        return OTHER_ERROR;
+    }
+    *obj = NULL;
+    if (fp == NULL || compression == VCARD_COMPRESSION_NONE || !compressionSupported(compression)) {
+        return INV_FILE;
+    }
+
+    DecompressStream* stream = (DecompressStream*)malloc(sizeof(DecompressStream));
+    if (stream == NULL) {
+        return OTHER_ERROR;
+    }
+    stream->fp = fp;
+    stream->compression = compression;
+    pthread_mutex_init(&stream->lock, NULL);
+    pthread_cond_init(&stream->blockFilled, NULL);
+    pthread_cond_init(&stream->blockDrained, NULL);
+    stream->filled = 0;
+    stream->drained = 0;
+    stream->finished = false;
+    stream->failed = false;
+    stream->cancelled = false;
+    stream->position = 0;
+    stream->sawFailure = false;
+
+    if (pthread_create(&stream->thread, NULL, decompressInBackground, stream) != 0) {
+        pthread_cond_destroy(&stream->blockFilled);
+        pthread_cond_destroy(&stream->blockDrained);
+        pthread_mutex_destroy(&stream->lock);
+        free(stream);
+        return OTHER_ERROR;
+    }
+
+    *obj = stream;
+    return OK;
+}
+
+size_t readDecompressStream(void* context, char* buffer, size_t size) {
+    DecompressStream* stream = (DecompressStream*)context;
+    size_t copied = 0;
+
+    if (stream == NULL || buffer == NULL) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&stream->lock);
+    while (copied < size) {
+        while (stream->drained == stream->filled && !stream->finished) {
+            pthread_cond_wait(&stream->blockFilled, &stream->lock);
+        }
+        if (stream->drained == stream->filled) {
+            stream->sawFailure = stream->failed;
+            break;
+        }
+
+        // the block is not touched by the other thread until it is handed back, so copy without the lock
+        OutputBlock* block = &stream->blocks[stream->drained % BLOCK_COUNT];
+        pthread_mutex_unlock(&stream->lock);
+        size_t count = block->length - stream->position;
+        if (count > size - copied) {
+            count = size - copied;
+        }
+        memcpy(buffer + copied, block->data + stream->position, count);
+        copied += count;
+        stream->position += count;
+        pthread_mutex_lock(&stream->lock);
+
+        if (stream->position == block->length) {
+            stream->drained++;
+            stream->position = 0;
+            pthread_cond_signal(&stream->blockDrained);
+        }
+    }
+    pthread_mutex_unlock(&stream->lock);
+
+    return copied;
+}
+
+VCardErrorCode closeDecompressStream(DecompressStream* stream) {
+    if (stream == NULL) {
+        return OTHER_ERROR;
+    }
+
+    pthread_mutex_lock(&stream->lock);
+    stream->cancelled = true;
+    pthread_cond_signal(&stream->blockDrained);
+    pthread_mutex_unlock(&stream->lock);
+    pthread_join(stream->thread, NULL);
+
+    VCardErrorCode error = stream->sawFailure ? INV_FILE : OK;
+    pthread_cond_destroy(&stream->blockFilled);
+    pthread_cond_destroy(&stream->blockDrained);
+    pthread_mutex_destroy(&stream->lock);
+    free(stream);
+
+    return error;
+}
+// *************************************************************************
+
+// ************* Decompression thread **************************************
+void* decompressInBackground(void* argument) {
+    DecompressStream* stream = (DecompressStream*)argument;
+    bool succeeded = false;
+
+    if (stream->compression == VCARD_COMPRESSION_GZIP) {
+        succeeded = inflateGzip(stream);
+    }
+#ifdef VCARD_WITH_ZSTD
+    else if (stream->compression == VCARD_COMPRESSION_ZSTD) {
+        succeeded = decompressZstd(stream);
+    }
+#endif
+
+    pthread_mutex_lock(&stream->lock);
+    stream->finished = true;
+    stream->failed = !succeeded && !stream->cancelled;
+    pthread_cond_signal(&stream->blockFilled);
+    pthread_mutex_unlock(&stream->lock);
+
+    return NULL;
+}
+
+// also accepts zlib streams and several concatenated gzip members, like gzip -d
+bool inflateGzip(DecompressStream* stream) {
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (inflateInit2(&zs, 15 + 32) != Z_OK) {
+        return false;
+    }
+
+    bool succeeded = false;
+    bool memberDone = true; // nothing to finish yet, so an empty file is empty data, as for zstd
+    OutputBlock* block = nextEmptyBlock(stream);
+    while (block != NULL) {
+        if (zs.avail_in == 0) {
+            zs.next_in = stream->input;
+            zs.avail_in = (uInt)fread(stream->input, 1, INPUT_SIZE, stream->fp);
+            if (zs.avail_in == 0) {
+                succeeded = memberDone && !ferror(stream->fp);
+                break;
+            }
+        }
+        if (memberDone) {
+            if (inflateReset(&zs) != Z_OK) {
+                break;
+            }
+            memberDone = false;
+        }
+
+        zs.next_out = (Bytef*)block->data + block->length;
+        zs.avail_out = (uInt)(BLOCK_SIZE - block->length);
+        int result = inflate(&zs, Z_NO_FLUSH);
+        block->length = BLOCK_SIZE - zs.avail_out;
+        if (result == Z_STREAM_END) {
+            memberDone = true;
+        } else if (result != Z_OK && result != Z_BUF_ERROR) {
+            break;
+        }
+
+        if (block->length == BLOCK_SIZE) {
+            publishBlock(stream);
+            block = nextEmptyBlock(stream);
+        }
+    }
+    if (block != NULL && block->length > 0) {
+        publishBlock(stream);
+    }
+
+    inflateEnd(&zs);
+    return succeeded;
+}
+
+#ifdef VCARD_WITH_ZSTD
+// accepts several concatenated frames, like zstd -d
+bool decompressZstd(DecompressStream* stream) {
+    ZSTD_DStream* zs = ZSTD_createDStream();
+    if (zs == NULL) {
+        return false;
+    }
+    ZSTD_initDStream(zs);
+
+    bool succeeded = false;
+    size_t frameRemaining = 0; // what ZSTD_decompressStream last returned: 0 at the end of a frame
+    ZSTD_inBuffer in = {stream->input, 0, 0};
+    OutputBlock* block = nextEmptyBlock(stream);
+    while (block != NULL) {
+        if (in.pos == in.size) {
+            in.size = fread(stream->input, 1, INPUT_SIZE, stream->fp);
+            in.pos = 0;
+            if (in.size == 0) {
+                succeeded = frameRemaining == 0 && !ferror(stream->fp);
+                break;
+            }
+        }
+
+        ZSTD_outBuffer out = {block->data, BLOCK_SIZE, block->length};
+        frameRemaining = ZSTD_decompressStream(zs, &out, &in);
+        block->length = out.pos;
+        if (ZSTD_isError(frameRemaining)) {
+            break;
+        }
+
+        if (block->length == BLOCK_SIZE) {
+            publishBlock(stream);
+            block = nextEmptyBlock(stream);
+        }
+    }
+    if (block != NULL && block->length > 0) {
+        publishBlock(stream);
+    }
+
+    ZSTD_freeDStream(zs);
+    return succeeded;
+}
+#endif
+
+// waits for a free block; NULL once the reader has closed the stream
+OutputBlock* nextEmptyBlock(DecompressStream* stream) {
+    OutputBlock* block = NULL;
+
+    pthread_mutex_lock(&stream->lock);
+    while (stream->filled - stream->drained == BLOCK_COUNT && !stream->cancelled) {
+        pthread_cond_wait(&stream->blockDrained, &stream->lock);
+    }
+    if (!stream->cancelled) {
+        block = &stream->blocks[stream->filled % BLOCK_COUNT];
+        block->length = 0;
+    }
+    pthread_mutex_unlock(&stream->lock);
+
+    return block;
+}
+
+void publishBlock(DecompressStream* stream) {
+    pthread_mutex_lock(&stream->lock);
+    stream->filled++;
+    pthread_cond_signal(&stream->blockFilled);
+    pthread_mutex_unlock(&stream->lock);
+}
+// *************************************************************************
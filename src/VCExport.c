@@ -0,0 +1,511 @@
+// Author: Ben Martens (1349551)
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <strings.h>
+
+#include "VCExport.h"
+
+#define WRITER_CAPACITY (256 * 1024)
+
+/*	Output is assembled in data and handed to the stream in large writes.  While a CSV field is open it
+	is kept whole in the buffer, since whether it needs quotes is only known at its end.
+*/
+typedef struct exportWriter {
+    FILE* fp;
+    char* data;
+    size_t length;
+    size_t capacity;
+    bool failed;
+
+    bool fieldOpen;
+    size_t fieldStart; // position of the speculative opening quote
+    bool fieldNeedsQuotes;
+} ExportWriter;
+
+typedef struct exportJob {
+    const Card** cards;
+    int cardCount;
+    const ExportColumn* columns;
+    int columnCount;
+    ExportFormat format;
+    bool header;
+    char* fileName;
+    VCardErrorCode error;
+} ExportJob;
+
+static VCardErrorCode writeCards(FILE* fp, const Card** cards, int cardCount, const ExportColumn* columns, int columnCount, ExportFormat format, bool header);
+static void* writeShard(void* argument);
+static const Card** rosterToArray(List* roster, int* count);
+static bool columnsValid(const ExportColumn* columns, int columnCount);
+
+static void writeRow(ExportWriter* writer, const Card* card, const ExportColumn* columns, int columnCount, ExportFormat format, const Property** found);
+static void writeValue(ExportWriter* writer, const Card* card, const ExportColumn* column, const Property* property, ExportFormat format);
+static void writeDate(ExportWriter* writer, const DateTime* date, ExportFormat format);
+static void beginText(ExportWriter* writer, ExportFormat format);
+static void writeText(ExportWriter* writer, const char* text, ExportFormat format);
+static void endText(ExportWriter* writer, ExportFormat format);
+static size_t utf8SequenceLength(const unsigned char* text, size_t length);
+
+static bool initWriter(ExportWriter* writer, FILE* fp);
+static bool reserve(ExportWriter* writer, size_t length);
+static void writeBytes(ExportWriter* writer, const char* bytes, size_t length);
+static void flushWriter(ExportWriter* writer, size_t length);
+
+// ************* Export functions ******************************************
+VCardErrorCode exportRoster(List* roster, const ExportColumn* columns, int columnCount, ExportFormat format, bool header, FILE* fp) {
+    if (roster == NULL || fp == NULL || !columnsValid(columns, columnCount)) {
+        return OTHER_ERROR;
+    }
+
+    int cardCount = 0;
+    const Card** cards = rosterToArray(roster, &cardCount);
+    if (cards == NULL) {
+        return OTHER_ERROR;
+    }
+    VCardErrorCode error = writeCards(fp, cards, cardCount, columns, columnCount, format, header);
+    free(cards);
+
+    return error;
+}
+
+VCardErrorCode exportRosterToFile(List* roster, const ExportColumn* columns, int columnCount, ExportFormat format, bool header, const char* fileName) {
+    if (roster == NULL || fileName == NULL || !columnsValid(columns, columnCount)) {
+        return OTHER_ERROR;
+    }
+
+    FILE* fp = fopen(fileName, "wb");
+    if (fp == NULL) {
+        return WRITE_ERROR;
+    }
+    VCardErrorCode error = exportRoster(roster, columns, columnCount, format, header, fp);
+    if (fclose(fp) != 0 && error == OK) {
+        error = WRITE_ERROR;
+    }
+
+    return error;
+}
+
+VCardErrorCode exportRosterShards(List* roster, const ExportColumn* columns, int columnCount, ExportFormat format, bool header, const char* prefix, int shards) {
+    if (roster == NULL || prefix == NULL || shards < 1 || !columnsValid(columns, columnCount)) {
+        return OTHER_ERROR;
+    }
+
+    int cardCount = 0;
+    const Card** cards = rosterToArray(roster, &cardCount);
+    ExportJob* jobs = (ExportJob*)calloc(shards, sizeof(ExportJob));
+    pthread_t* threads = (pthread_t*)calloc(shards, sizeof(pthread_t));
+    bool* started = (bool*)calloc(shards, sizeof(bool));
+    VCardErrorCode error = cards != NULL && jobs != NULL && threads != NULL && started != NULL ? OK : OTHER_ERROR;
+
+    const char* extension = format == EXPORT_CSV ? "csv" : "jsonl";
+    for (int i = 0; error == OK && i < shards; i++) {
+        // the first cardCount % shards shards get one extra card
+        int first = i * (cardCount / shards) + (i < cardCount % shards ? i : cardCount % shards);
+        jobs[i] = (ExportJob){cards + first, cardCount / shards + (i < cardCount % shards), columns, columnCount, format, header, NULL, OK};
+        size_t length = strlen(prefix) + strlen(extension) + 16;
+        jobs[i].fileName = (char*)malloc(length);
+        if (jobs[i].fileName == NULL) {
+            error = OTHER_ERROR;
+            break;
+        }
+        snprintf(jobs[i].fileName, length, "%s-%03d.%s", prefix, i, extension);
+
+        started[i] = pthread_create(&threads[i], NULL, writeShard, &jobs[i]) == 0;
+        if (!started[i]) {
+            error = OTHER_ERROR;
+        }
+    }
+
+    for (int i = 0; jobs != NULL && i < shards; i++) {
+        if (started != NULL && started[i]) {
+            pthread_join(threads[i], NULL);
+            if (error == OK) {
+                error = jobs[i].error;
+            }
+        }
+        free(jobs[i].fileName);
+    }
+    free(cards);
+    free(jobs);
+    free(threads);
+    free(started);
+
+    return error;
+}
+
+void* writeShard(void* argument) {
+    ExportJob* job = (ExportJob*)argument;
+
+    FILE* fp = fopen(job->fileName, "wb");
+    if (fp == NULL) {
+        job->error = WRITE_ERROR;
+        return NULL;
+    }
+    job->error = writeCards(fp, job->cards, job->cardCount, job->columns, job->columnCount, job->format, job->header);
+    if (fclose(fp) != 0 && job->error == OK) {
+        job->error = WRITE_ERROR;
+    }
+
+    return NULL;
+}
+
+VCardErrorCode writeCards(FILE* fp, const Card** cards, int cardCount, const ExportColumn* columns, int columnCount, ExportFormat format, bool header) {
+    ExportWriter writer;
+    const Property** found = (const Property**)malloc(columnCount * sizeof(Property*));
+
+    if (found == NULL || !initWriter(&writer, fp)) {
+        free(found);
+        return OTHER_ERROR;
+    }
+
+    if (header && format == EXPORT_CSV) {
+        for (int i = 0; i < columnCount; i++) {
+            if (i > 0) {
+                writeBytes(&writer, ",", 1);
+            }
+            beginText(&writer, format);
+            writeText(&writer, columns[i].title != NULL ? columns[i].title : columns[i].name, format);
+            endText(&writer, format);
+        }
+        writeBytes(&writer, "\r\n", 2);
+    }
+    for (int i = 0; i < cardCount && !writer.failed; i++) {
+        writeRow(&writer, cards[i], columns, columnCount, format, found);
+    }
+    flushWriter(&writer, writer.length);
+    if (fflush(fp) != 0) {
+        writer.failed = true;
+    }
+
+    free(found);
+    free(writer.data);
+    return writer.failed ? WRITE_ERROR : OK;
+}
+// *************************************************************************
+
+// ************* Rows and fields *******************************************
+// found is scratch space for one Property* per column
+void writeRow(ExportWriter* writer, const Card* card, const ExportColumn* columns, int columnCount, ExportFormat format, const Property** found) {
+    // one pass over the card's properties finds the first match for every column
+    for (int i = 0; i < columnCount; i++) {
+        found[i] = NULL;
+    }
+    void* element;
+    ListIterator iter = createIterator(card->optionalProperties);
+    while ((element = nextElement(&iter)) != NULL) {
+        const Property* property = (const Property*)element;
+        for (int i = 0; i < columnCount; i++) {
+            const char* group = columns[i].group != NULL ? columns[i].group : "";
+            if (found[i] == NULL && strcasecmp(property->name, columns[i].name) == 0 &&
+                    strcasecmp(property->group, group) == 0) {
+                found[i] = property;
+            }
+        }
+    }
+
+    if (format == EXPORT_JSON_LINES) {
+        writeBytes(writer, "{", 1);
+    }
+    for (int i = 0; i < columnCount; i++) {
+        if (i > 0) {
+            writeBytes(writer, ",", 1);
+        }
+        if (format == EXPORT_JSON_LINES) {
+            beginText(writer, format);
+            writeText(writer, columns[i].title != NULL ? columns[i].title : columns[i].name, format);
+            endText(writer, format);
+            writeBytes(writer, ":", 1);
+        }
+        writeValue(writer, card, &columns[i], found[i], format);
+    }
+    if (format == EXPORT_JSON_LINES) {
+        writeBytes(writer, "}\n", 2);
+    } else {
+        writeBytes(writer, "\r\n", 2);
+    }
+}
+
+void writeValue(ExportWriter* writer, const Card* card, const ExportColumn* column, const Property* property, ExportFormat format) {
+    bool noGroup = column->group == NULL || strlen(column->group) == 0;
+
+    if (noGroup && strcasecmp(column->name, "BDAY") == 0) {
+        writeDate(writer, card->birthday, format);
+        return;
+    }
+    if (noGroup && strcasecmp(column->name, "ANNIVERSARY") == 0) {
+        writeDate(writer, card->anniversary, format);
+        return;
+    }
+    if (noGroup && strcasecmp(column->name, "FN") == 0) {
+        property = card->fn;
+    }
+
+    if (property == NULL || (column->value >= getLength(property->values))) {
+        if (format == EXPORT_JSON_LINES) {
+            writeBytes(writer, "null", 4);
+        }
+        return;
+    }
+
+    beginText(writer, format);
+    int index = 0;
+    void* element;
+    ListIterator iter = createIterator(property->values);
+    while ((element = nextElement(&iter)) != NULL) {
+        if (column->value < 0 && index > 0) {
+            writeText(writer, ";", format);
+        }
+        if (column->value < 0 || column->value == index) {
+            writeText(writer, (const char*)element, format);
+        }
+        index++;
+    }
+    endText(writer, format);
+}
+
+// in the form dateToString uses, without the line break
+void writeDate(ExportWriter* writer, const DateTime* date, ExportFormat format) {
+    if (date == NULL) {
+        if (format == EXPORT_JSON_LINES) {
+            writeBytes(writer, "null", 4);
+        }
+        return;
+    }
+
+    beginText(writer, format);
+    if (date->isText) {
+        writeText(writer, date->text, format);
+    } else {
+        writeText(writer, date->date, format);
+        if (strlen(date->time) > 0) {
+            writeText(writer, "T", format);
+            writeText(writer, date->time, format);
+        }
+    }
+    if (date->UTC) {
+        writeText(writer, "Z", format);
+    }
+    endText(writer, format);
+}
+
+/*	A text field is written as beginText, any number of writeText and endText, escaping as it goes.
+	CSV fields get a speculative opening quote, which endText drops again if nothing needed quoting.
+*/
+void beginText(ExportWriter* writer, ExportFormat format) {
+    if (!reserve(writer, 1)) {
+        return;
+    }
+    if (format == EXPORT_CSV) {
+        writer->fieldOpen = true;
+        writer->fieldStart = writer->length;
+        writer->fieldNeedsQuotes = false;
+    }
+    writer->data[writer->length++] = '"';
+}
+
+void writeText(ExportWriter* writer, const char* text, ExportFormat format) {
+    static const char hex[] = "0123456789abcdef";
+    size_t length = strlen(text);
+
+    // worst case: every byte becomes \u00XX
+    if (!reserve(writer, format == EXPORT_CSV ? 2 * length : 6 * length)) {
+        return;
+    }
+
+    char* out = writer->data + writer->length;
+    if (format == EXPORT_CSV) {
+        for (size_t i = 0; i < length; i++) {
+            char c = text[i];
+            if (c == '"') {
+                *out++ = '"';
+                writer->fieldNeedsQuotes = true;
+            } else if (c == ',' || c == '\r' || c == '\n') {
+                writer->fieldNeedsQuotes = true;
+            }
+            *out++ = c;
+        }
+    } else {
+        for (size_t i = 0; i < length; i++) {
+            unsigned char c = (unsigned char)text[i];
+            if (c == '"' || c == '\\') {
+                *out++ = '\\';
+                *out++ = (char)c;
+            } else if (c == '\n') {
+                *out++ = '\\';
+                *out++ = 'n';
+            } else if (c == '\r') {
+                *out++ = '\\';
+                *out++ = 'r';
+            } else if (c == '\t') {
+                *out++ = '\\';
+                *out++ = 't';
+            } else if (c < 0x20) {
+                memcpy(out, "\\u00", 4);
+                out[4] = hex[c >> 4];
+                out[5] = hex[c & 0xF];
+                out += 6;
+            } else if (c < 0x80) {
+                *out++ = (char)c;
+            } else {
+                // JSON has to be valid UTF-8, so each byte that doesn't start a valid sequence becomes U+FFFD
+                size_t sequence = utf8SequenceLength((const unsigned char*)text + i, length - i);
+                if (sequence == 0) {
+                    memcpy(out, "\xEF\xBF\xBD", 3);
+                    out += 3;
+                } else {
+                    memcpy(out, text + i, sequence);
+                    out += sequence;
+                    i += sequence - 1;
+                }
+            }
+        }
+    }
+    writer->length = out - writer->data;
+}
+
+// The length of the well-formed UTF-8 sequence text starts with (no overlong forms, surrogates or values past U+10FFFF), or 0
+size_t utf8SequenceLength(const unsigned char* text, size_t length) {
+    size_t sequence;
+    unsigned char low = 0x80;
+    unsigned char high = 0xBF;
+
+    if (text[0] >= 0xC2 && text[0] <= 0xDF) {
+        sequence = 2;
+    } else if (text[0] >= 0xE0 && text[0] <= 0xEF) {
+        sequence = 3;
+        low = text[0] == 0xE0 ? 0xA0 : 0x80;
+        high = text[0] == 0xED ? 0x9F : 0xBF;
+    } else if (text[0] >= 0xF0 && text[0] <= 0xF4) {
+        sequence = 4;
+        low = text[0] == 0xF0 ? 0x90 : 0x80;
+        high = text[0] == 0xF4 ? 0x8F : 0xBF;
+    } else {
+        return 0;
+    }
+    if (sequence > length || text[1] < low || text[1] > high) {
+        return 0;
+    }
+    for (size_t i = 2; i < sequence; i++) {
+        if (text[i] < 0x80 || text[i] > 0xBF) {
+            return 0;
+        }
+    }
+
+    return sequence;
+}
+
+void endText(ExportWriter* writer, ExportFormat format) {
+    if (!reserve(writer, 1)) {
+        return;
+    }
+
+    if (format == EXPORT_CSV) {
+        writer->fieldOpen = false;
+        if (!writer->fieldNeedsQuotes) {
+            char* start = writer->data + writer->fieldStart;
+            memmove(start, start + 1, writer->length - writer->fieldStart - 1);
+            writer->length--;
+            return;
+        }
+    }
+    writer->data[writer->length++] = '"';
+}
+// *************************************************************************
+
+// ************* Helpers ***************************************************
+const Card** rosterToArray(List* roster, int* count) {
+    const Card** cards = (const Card**)malloc((getLength(roster) + 1) * sizeof(Card*));
+
+    *count = 0;
+    if (cards == NULL) {
+        return NULL;
+    }
+    void* element;
+    ListIterator iter = createIterator(roster);
+    while ((element = nextElement(&iter)) != NULL) {
+        cards[(*count)++] = (const Card*)element;
+    }
+
+    return cards;
+}
+
+bool columnsValid(const ExportColumn* columns, int columnCount) {
+    if (columns == NULL || columnCount < 1) {
+        return false;
+    }
+    for (int i = 0; i < columnCount; i++) {
+        if (columns[i].name == NULL) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool initWriter(ExportWriter* writer, FILE* fp) {
+    writer->fp = fp;
+    writer->data = (char*)malloc(WRITER_CAPACITY);
+    writer->length = 0;
+    writer->capacity = WRITER_CAPACITY;
+    writer->failed = false;
+    writer->fieldOpen = false;
+    writer->fieldStart = 0;
+    writer->fieldNeedsQuotes = false;
+
+    return writer->data != NULL;
+}
+
+/*	Makes room for length more bytes, writing out everything before the open field (if any) first.  The
+	buffer only grows when a single field doesn't fit.  Returns false once the writer has failed.
+*/
+bool reserve(ExportWriter* writer, size_t length) {
+    if (writer->failed) {
+        return false;
+    }
+    if (writer->length + length <= writer->capacity) {
+        return true;
+    }
+
+    flushWriter(writer, writer->fieldOpen ? writer->fieldStart : writer->length);
+    if (!writer->failed && writer->length + length > writer->capacity) {
+        size_t capacity = writer->capacity * 2;
+        while (capacity < writer->length + length) {
+            capacity *= 2;
+        }
+        char* data = (char*)realloc(writer->data, capacity);
+        if (data == NULL) {
+            writer->failed = true;
+        } else {
+            writer->data = data;
+            writer->capacity = capacity;
+        }
+    }
+
+    return !writer->failed;
+}
+
+void writeBytes(ExportWriter* writer, const char* bytes, size_t length) {
+    if (reserve(writer, length)) {
+        memcpy(writer->data + writer->length, bytes, length);
+        writer->length += length;
+    }
+}
+
+// writes out the first length bytes of the buffer and moves the rest to the front
+void flushWriter(ExportWriter* writer, size_t length) {
+    if (writer->failed || length == 0) {
+        return;
+    }
+
+    if (fwrite(writer->data, 1, length, writer->fp) != length) {
+        writer->failed = true;
+        return;
+    }
+    memmove(writer->data, writer->data + length, writer->length - length);
+    writer->length -= length;
+    if (writer->fieldOpen) {
+        writer->fieldStart -= length;
+    }
+}
+// *************************************************************************
@@ -0,0 +1,39 @@
+// Author: Ben Martens (1349551)
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <libgen.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "VCFiles.h"
+
+// ************* Files *****************************************************
+bool syncDirectory(const char* path) {
+    char* directory = strdup(path);
+    if (directory == NULL) {
+        return false;
+    }
+
+    int directoryFd = open(dirname(directory), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    bool synced = directoryFd >= 0 && fsync(directoryFd) == 0;
+    if (directoryFd >= 0) {
+        close(directoryFd);
+    }
+
+    free(directory);
+    return synced;
+}
+
+char* joinPath(const char* base, const char* suffix) {
+    char* path = (char*)malloc(strlen(base) + strlen(suffix) + 1);
+
+    if (path != NULL) {
+        strcpy(path, base);
+        strcat(path, suffix);
+    }
+
+    return path;
+}
+// *************************************************************************
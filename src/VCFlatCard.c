@@ -0,0 +1,413 @@
+// Author: Ben Martens (1349551)
+
+#define _GNU_SOURCE
+#include "VCFlatCard.h"
+
+// running totals and write cursors used while packing a card
+typedef struct flatBuilder {
+    FlatCard* card;
+    uint32_t propertyCount;
+    uint32_t parameterCount;
+    uint32_t valueCount;
+    size_t stringBytes;
+    uint32_t nextString;
+} FlatBuilder;
+
+static bool measureProperty(FlatBuilder* builder, const Property* prop);
+static uint32_t storeString(FlatBuilder* builder, const char* string);
+static void storeProperty(FlatBuilder* builder, const Property* prop);
+static void storeDateTime(FlatBuilder* builder, FlatDateTime* flatDate, const DateTime* dateTime);
+static Property* unpackProperty(const FlatCard* flat, const FlatProperty* flatProp);
+static DateTime* unpackDateTime(const FlatCard* flat, const FlatDateTime* flatDate);
+static char* copyFlatString(const FlatCard* flat, uint32_t offset, bool emptyIsLiteral);
+
+// ************* Conversion ************************************************
+VCardErrorCode createFlatCard(const Card* card, FlatCard** obj) {
+    FlatBuilder builder = {0};
+
+    if (obj == NULL) {
+        return OTHER_ERROR;
+    }
+    *obj = NULL;
+
+    if (card == NULL || card->fn == NULL || card->optionalProperties == NULL) {
+        return INV_CARD;
+    }
+
+    // first pass: count table entries and string bytes (offset 0 holds the shared empty string)
+    builder.stringBytes = 1;
+    if (!measureProperty(&builder, card->fn)) {
+        return INV_CARD;
+    }
+    void* elem;
+    ListIterator iter = createIterator(card->optionalProperties);
+    while ((elem = nextElement(&iter)) != NULL) {
+        if (!measureProperty(&builder, (Property*)elem)) {
+            return INV_CARD;
+        }
+    }
+    const DateTime* dates[2] = {card->birthday, card->anniversary};
+    for (int i = 0; i < 2; i++) {
+        if (dates[i] == NULL) {
+            continue;
+        }
+        if (dates[i]->date == NULL || dates[i]->time == NULL || dates[i]->text == NULL) {
+            return INV_CARD;
+        }
+        builder.stringBytes += strlen(dates[i]->date) + strlen(dates[i]->time) + strlen(dates[i]->text) + 3;
+    }
+
+    size_t propertyTable = sizeof(FlatCard);
+    size_t parameterTable = propertyTable + (size_t)builder.propertyCount * sizeof(FlatProperty);
+    size_t valueTable = parameterTable + (size_t)builder.parameterCount * sizeof(FlatParameter);
+    size_t stringPool = valueTable + (size_t)builder.valueCount * sizeof(uint32_t);
+    size_t total = stringPool + builder.stringBytes;
+    if (total > UINT32_MAX) {
+        return OTHER_ERROR;
+    }
+
+    FlatCard* flat = (FlatCard*)calloc(1, total);
+    if (flat == NULL) {
+        return OTHER_ERROR;
+    }
+    flat->magic = FLAT_CARD_MAGIC;
+    flat->size = (uint32_t)total;
+    flat->propertyCount = builder.propertyCount;
+    flat->parameterCount = builder.parameterCount;
+    flat->valueCount = builder.valueCount;
+    flat->properties = (uint32_t)propertyTable;
+    flat->parameters = (uint32_t)parameterTable;
+    flat->values = (uint32_t)valueTable;
+    flat->strings = (uint32_t)stringPool;
+
+    // second pass: fill in the tables, reusing the counters as write cursors
+    builder.card = flat;
+    builder.propertyCount = 0;
+    builder.parameterCount = 0;
+    builder.valueCount = 0;
+    builder.nextString = flat->strings + 1; // the calloc already wrote the empty string
+
+    storeProperty(&builder, card->fn);
+    iter = createIterator(card->optionalProperties);
+    while ((elem = nextElement(&iter)) != NULL) {
+        storeProperty(&builder, (Property*)elem);
+    }
+    storeDateTime(&builder, &flat->birthday, card->birthday);
+    storeDateTime(&builder, &flat->anniversary, card->anniversary);
+
+    *obj = flat;
+    return OK;
+}
+
+VCardErrorCode flatCardToCard(const FlatCard* flat, size_t size, Card** obj) {
+    if (obj == NULL) {
+        return OTHER_ERROR;
+    }
+    *obj = NULL;
+
+    if (!flatCardIsValid(flat, size)) {
+        return INV_CARD;
+    }
+
+    Card* card = (Card*)malloc(sizeof(Card));
+    if (card == NULL) {
+        return OTHER_ERROR;
+    }
+    card->fn = unpackProperty(flat, flatCardFN(flat));
+    card->optionalProperties = initializeList(propertyToString, deleteProperty, compareProperties);
+    card->birthday = unpackDateTime(flat, flatCardBirthday(flat));
+    card->anniversary = unpackDateTime(flat, flatCardAnniversary(flat));
+
+    int count = flatCardOptionalCount(flat);
+    for (int i = 0; i < count; i++) {
+        insertBack(card->optionalProperties, unpackProperty(flat, flatCardOptionalProperty(flat, i)));
+    }
+
+    *obj = card;
+    return OK;
+}
+
+bool flatCardIsValid(const void* block, size_t size) {
+    const FlatCard* flat = (const FlatCard*)block;
+
+    if (block == NULL || size < sizeof(FlatCard)) {
+        return false;
+    }
+    if (flat->magic != FLAT_CARD_MAGIC || flat->size > size || flat->size < sizeof(FlatCard)) {
+        return false;
+    }
+    if (flat->propertyCount == 0 ||
+            flat->properties != sizeof(FlatCard) ||
+            flat->parameters != flat->properties + (uint64_t)flat->propertyCount * sizeof(FlatProperty) ||
+            flat->values != flat->parameters + (uint64_t)flat->parameterCount * sizeof(FlatParameter) ||
+            flat->strings != flat->values + (uint64_t)flat->valueCount * sizeof(uint32_t) ||
+            flat->strings >= flat->size) {
+        return false;
+    }
+
+    // the pool must end with a terminator so no string can run past the block
+    const char* base = (const char*)flat;
+    if (base[flat->strings] != '\0' || base[flat->size - 1] != '\0') {
+        return false;
+    }
+
+    #define STRING_OK(offset) ((offset) >= flat->strings && (offset) < flat->size)
+
+    const FlatProperty* props = (const FlatProperty*)(base + flat->properties);
+    for (uint32_t i = 0; i < flat->propertyCount; i++) {
+        if (!STRING_OK(props[i].name) || !STRING_OK(props[i].group) ||
+                (uint64_t)props[i].firstParameter + props[i].parameterCount > flat->parameterCount ||
+                (uint64_t)props[i].firstValue + props[i].valueCount > flat->valueCount) {
+            return false;
+        }
+    }
+    const FlatParameter* params = (const FlatParameter*)(base + flat->parameters);
+    for (uint32_t i = 0; i < flat->parameterCount; i++) {
+        if (!STRING_OK(params[i].name) || !STRING_OK(params[i].value)) {
+            return false;
+        }
+    }
+    const uint32_t* values = (const uint32_t*)(base + flat->values);
+    for (uint32_t i = 0; i < flat->valueCount; i++) {
+        if (!STRING_OK(values[i])) {
+            return false;
+        }
+    }
+    const FlatDateTime* dates[2] = {&flat->birthday, &flat->anniversary};
+    for (int i = 0; i < 2; i++) {
+        if ((dates[i]->flags & FLAT_DT_PRESENT) &&
+                (!STRING_OK(dates[i]->date) || !STRING_OK(dates[i]->time) || !STRING_OK(dates[i]->text))) {
+            return false;
+        }
+    }
+
+    #undef STRING_OK
+
+    return true;
+}
+
+void deleteFlatCard(FlatCard* obj) {
+    free(obj);
+}
+// *************************************************************************
+
+// ************* Accessors *************************************************
+const FlatProperty* flatCardFN(const FlatCard* obj) {
+    return (const FlatProperty*)((const char*)obj + obj->properties);
+}
+
+int flatCardOptionalCount(const FlatCard* obj) {
+    return (int)obj->propertyCount - 1;
+}
+
+const FlatProperty* flatCardOptionalProperty(const FlatCard* obj, int index) {
+    return flatCardFN(obj) + 1 + index;
+}
+
+const FlatDateTime* flatCardBirthday(const FlatCard* obj) {
+    return (obj->birthday.flags & FLAT_DT_PRESENT) ? &obj->birthday : NULL;
+}
+
+const FlatDateTime* flatCardAnniversary(const FlatCard* obj) {
+    return (obj->anniversary.flags & FLAT_DT_PRESENT) ? &obj->anniversary : NULL;
+}
+
+const char* flatPropertyName(const FlatCard* obj, const FlatProperty* prop) {
+    return (const char*)obj + prop->name;
+}
+
+const char* flatPropertyGroup(const FlatCard* obj, const FlatProperty* prop) {
+    return (const char*)obj + prop->group;
+}
+
+int flatPropertyParameterCount(const FlatProperty* prop) {
+    return (int)prop->parameterCount;
+}
+
+const FlatParameter* flatPropertyParameter(const FlatCard* obj, const FlatProperty* prop, int index) {
+    const FlatParameter* params = (const FlatParameter*)((const char*)obj + obj->parameters);
+    return &params[prop->firstParameter + index];
+}
+
+int flatPropertyValueCount(const FlatProperty* prop) {
+    return (int)prop->valueCount;
+}
+
+const char* flatPropertyValue(const FlatCard* obj, const FlatProperty* prop, int index) {
+    const uint32_t* values = (const uint32_t*)((const char*)obj + obj->values);
+    return (const char*)obj + values[prop->firstValue + index];
+}
+
+const char* flatParameterName(const FlatCard* obj, const FlatParameter* param) {
+    return (const char*)obj + param->name;
+}
+
+const char* flatParameterValue(const FlatCard* obj, const FlatParameter* param) {
+    return (const char*)obj + param->value;
+}
+
+const char* flatDateTimeDate(const FlatCard* obj, const FlatDateTime* dateTime) {
+    return (const char*)obj + dateTime->date;
+}
+
+const char* flatDateTimeTime(const FlatCard* obj, const FlatDateTime* dateTime) {
+    return (const char*)obj + dateTime->time;
+}
+
+const char* flatDateTimeText(const FlatCard* obj, const FlatDateTime* dateTime) {
+    return (const char*)obj + dateTime->text;
+}
+
+bool flatDateTimeUTC(const FlatDateTime* dateTime) {
+    return (dateTime->flags & FLAT_DT_UTC) != 0;
+}
+
+bool flatDateTimeIsText(const FlatDateTime* dateTime) {
+    return (dateTime->flags & FLAT_DT_TEXT) != 0;
+}
+// *************************************************************************
+
+// ************* Static helper functions ***********************************
+bool measureProperty(FlatBuilder* builder, const Property* prop) {
+    if (prop == NULL || prop->name == NULL || prop->group == NULL ||
+            prop->parameters == NULL || prop->values == NULL) {
+        return false;
+    }
+
+    builder->propertyCount++;
+    builder->stringBytes += strlen(prop->name) + strlen(prop->group) + 2;
+
+    void* elem;
+    ListIterator iter = createIterator(prop->parameters);
+    while ((elem = nextElement(&iter)) != NULL) {
+        Parameter* param = (Parameter*)elem;
+        if (param->name == NULL || param->value == NULL) {
+            return false;
+        }
+        builder->parameterCount++;
+        builder->stringBytes += strlen(param->name) + strlen(param->value) + 2;
+    }
+
+    iter = createIterator(prop->values);
+    while ((elem = nextElement(&iter)) != NULL) {
+        builder->valueCount++;
+        builder->stringBytes += strlen((char*)elem) + 1;
+    }
+
+    return true;
+}
+
+uint32_t storeString(FlatBuilder* builder, const char* string) {
+    size_t length = strlen(string);
+
+    if (length == 0) {
+        return builder->card->strings;
+    }
+
+    uint32_t offset = builder->nextString;
+    memcpy((char*)builder->card + offset, string, length + 1);
+    builder->nextString += (uint32_t)length + 1;
+
+    return offset;
+}
+
+void storeProperty(FlatBuilder* builder, const Property* prop) {
+    FlatCard* flat = builder->card;
+    FlatProperty* flatProp = (FlatProperty*)((char*)flat + flat->properties) + builder->propertyCount++;
+    FlatParameter* params = (FlatParameter*)((char*)flat + flat->parameters);
+    uint32_t* values = (uint32_t*)((char*)flat + flat->values);
+
+    flatProp->name = storeString(builder, prop->name);
+    flatProp->group = storeString(builder, prop->group);
+    flatProp->firstParameter = builder->parameterCount;
+    flatProp->firstValue = builder->valueCount;
+
+    void* elem;
+    ListIterator iter = createIterator(prop->parameters);
+    while ((elem = nextElement(&iter)) != NULL) {
+        Parameter* param = (Parameter*)elem;
+        params[builder->parameterCount].name = storeString(builder, param->name);
+        params[builder->parameterCount].value = storeString(builder, param->value);
+        builder->parameterCount++;
+    }
+
+    iter = createIterator(prop->values);
+    while ((elem = nextElement(&iter)) != NULL) {
+        values[builder->valueCount++] = storeString(builder, (char*)elem);
+    }
+
+    flatProp->parameterCount = builder->parameterCount - flatProp->firstParameter;
+    flatProp->valueCount = builder->valueCount - flatProp->firstValue;
+}
+
+void storeDateTime(FlatBuilder* builder, FlatDateTime* flatDate, const DateTime* dateTime) {
+    if (dateTime == NULL) {
+        flatDate->flags = 0;
+        flatDate->date = flatDate->time = flatDate->text = builder->card->strings;
+        return;
+    }
+
+    flatDate->flags = FLAT_DT_PRESENT;
+    if (dateTime->UTC) {
+        flatDate->flags |= FLAT_DT_UTC;
+    }
+    if (dateTime->isText) {
+        flatDate->flags |= FLAT_DT_TEXT;
+    }
+    flatDate->date = storeString(builder, dateTime->date);
+    flatDate->time = storeString(builder, dateTime->time);
+    flatDate->text = storeString(builder, dateTime->text);
+}
+
+// empty groups and date fields are string literals in a parsed Card (see createProperty), so keep it that way
+char* copyFlatString(const FlatCard* flat, uint32_t offset, bool emptyIsLiteral) {
+    const char* source = (const char*)flat + offset;
+
+    if (emptyIsLiteral && source[0] == '\0') {
+        return "";
+    }
+
+    char* copy = (char*)malloc(strlen(source) + 1);
+    strcpy(copy, source);
+    return copy;
+}
+
+Property* unpackProperty(const FlatCard* flat, const FlatProperty* flatProp) {
+    Property* prop = (Property*)malloc(sizeof(Property));
+
+    prop->name = copyFlatString(flat, flatProp->name, false);
+    prop->group = copyFlatString(flat, flatProp->group, true);
+    prop->parameters = initializeList(parameterToString, deleteParameter, compareParameters);
+    prop->values = initializeList(valueToString, deleteValue, compareValues);
+
+    for (int i = 0; i < flatPropertyParameterCount(flatProp); i++) {
+        const FlatParameter* flatParam = flatPropertyParameter(flat, flatProp, i);
+        Parameter* param = (Parameter*)malloc(sizeof(Parameter));
+        param->name = copyFlatString(flat, flatParam->name, false);
+        param->value = copyFlatString(flat, flatParam->value, false);
+        insertBack(prop->parameters, param);
+    }
+
+    for (int i = 0; i < flatPropertyValueCount(flatProp); i++) {
+        const uint32_t* values = (const uint32_t*)((const char*)flat + flat->values);
+        insertBack(prop->values, copyFlatString(flat, values[flatProp->firstValue + i], false));
+    }
+
+    return prop;
+}
+
+DateTime* unpackDateTime(const FlatCard* flat, const FlatDateTime* flatDate) {
+    if (flatDate == NULL) {
+        return NULL;
+    }
+
+    DateTime* dateTime = (DateTime*)malloc(sizeof(DateTime));
+    dateTime->UTC = flatDateTimeUTC(flatDate);
+    dateTime->isText = flatDateTimeIsText(flatDate);
+    dateTime->date = copyFlatString(flat, flatDate->date, true);
+    dateTime->time = copyFlatString(flat, flatDate->time, true);
+    dateTime->text = copyFlatString(flat, flatDate->text, true);
+
+    return dateTime;
+}
+// **************************************************************************
@@ -0,0 +1,428 @@
+// Author: Ben Martens (1349551)
+
+#include <time.h>
+
+#include "VCGradeIndex.h"
+
+#define NO_NODE -1
+
+/*	One student.  The tree is ordered from the worst grade to the best; equal grades are ordered by
+	roster position, later students first (see the header).  Node numbers are roster positions.
+*/
+typedef struct gradeNode {
+    int64_t grade;
+    int left;
+    int right;
+    int size;          // number of nodes in the subtree rooted here
+    uint32_t priority; // treap heap order: a node's priority is at least its children's
+    bool graded;       // in the tree
+} GradeNode;
+
+struct gradeIndex {
+    CardNumberFunction grade;
+    void* context;
+    Card** cards;
+    GradeNode* nodes;
+    int count;
+    int root;
+    int graded;
+};
+
+typedef struct gradeWalk {
+    const GradeNode* nodes;
+    bool bestFirst;
+    int* positions;
+    int wanted;
+    int written;
+} GradeWalk;
+
+static void insertStudent(GradeIndex* index, int position);
+static void removeStudent(GradeIndex* index, int position);
+static bool comesBefore(const GradeNode* nodes, int first, int second);
+static int subtreeSize(const GradeNode* nodes, int node);
+static void updateSize(GradeNode* nodes, int node);
+static int mergeTrees(GradeNode* nodes, int first, int second);
+static void splitTree(GradeNode* nodes, int node, int key, int* before, int* after);
+static int removeFirst(GradeNode* nodes, int node);
+static int countAtMost(const GradeIndex* index, int64_t grade);
+static void walkStudents(GradeWalk* walk, int node);
+static uint32_t nodePriority(uint64_t seed, int position);
+
+// ************* Creation **************************************************
+VCardErrorCode createGradeIndex(List* roster, CardNumberFunction grade, void* context, GradeIndex** index) {
+    if (index == NULL) {
+        return OTHER_ERROR;
+    }
+    *index = NULL;
+    if (roster == NULL || grade == NULL) {
+        return OTHER_ERROR;
+    }
+
+    GradeIndex* newIndex = (GradeIndex*)malloc(sizeof(GradeIndex));
+    if (newIndex == NULL) {
+        return OTHER_ERROR;
+    }
+    int count = getLength(roster);
+    newIndex->grade = grade;
+    newIndex->context = context;
+    newIndex->cards = (Card**)malloc((count > 0 ? count : 1) * sizeof(Card*));
+    newIndex->nodes = (GradeNode*)malloc((count > 0 ? count : 1) * sizeof(GradeNode));
+    newIndex->count = 0;
+    newIndex->root = NO_NODE;
+    newIndex->graded = 0;
+    if (newIndex->cards == NULL || newIndex->nodes == NULL) {
+        deleteGradeIndex(newIndex);
+        return OTHER_ERROR;
+    }
+
+    // the priorities only need to be unpredictable to whoever enters the grades
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t seed = (uint64_t)now.tv_nsec ^ ((uint64_t)now.tv_sec << 32) ^ (uint64_t)(uintptr_t)newIndex;
+
+    ListIterator iter = createIterator(roster);
+    Card* card;
+    while ((card = (Card*)nextElement(&iter)) != NULL && newIndex->count < count) {
+        int position = newIndex->count++;
+        newIndex->cards[position] = card;
+        newIndex->nodes[position].priority = nodePriority(seed, position);
+        newIndex->nodes[position].graded = false;
+
+        int64_t value;
+        if (grade(card, context, &value)) {
+            newIndex->nodes[position].grade = value;
+            insertStudent(newIndex, position);
+        }
+    }
+
+    *index = newIndex;
+    return OK;
+}
+
+void deleteGradeIndex(GradeIndex* index) {
+    if (index == NULL) {
+        return;
+    }
+
+    free(index->cards);
+    free(index->nodes);
+    free(index);
+}
+// *************************************************************************
+
+// ************* Grades ****************************************************
+int gradeIndexLength(const GradeIndex* index) {
+    return index != NULL ? index->count : 0;
+}
+
+int gradedCount(const GradeIndex* index) {
+    return index != NULL ? index->graded : 0;
+}
+
+Card* gradedCard(const GradeIndex* index, int position) {
+    if (index == NULL || position < 0 || position >= index->count) {
+        return NULL;
+    }
+
+    return index->cards[position];
+}
+
+bool getStudentGrade(const GradeIndex* index, int position, int64_t* grade) {
+    if (index == NULL || position < 0 || position >= index->count || !index->nodes[position].graded) {
+        return false;
+    }
+
+    if (grade != NULL) {
+        *grade = index->nodes[position].grade;
+    }
+    return true;
+}
+
+VCardErrorCode setStudentGrade(GradeIndex* index, int position, int64_t grade) {
+    if (index == NULL || position < 0 || position >= index->count) {
+        return OTHER_ERROR;
+    }
+
+    GradeNode* node = &index->nodes[position];
+    if (node->graded && node->grade == grade) {
+        return OK;
+    }
+
+    if (node->graded) {
+        removeStudent(index, position);
+    }
+    node->grade = grade;
+    insertStudent(index, position);
+
+    return OK;
+}
+
+VCardErrorCode clearStudentGrade(GradeIndex* index, int position) {
+    if (index == NULL || position < 0 || position >= index->count) {
+        return OTHER_ERROR;
+    }
+
+    if (index->nodes[position].graded) {
+        removeStudent(index, position);
+    }
+
+    return OK;
+}
+
+VCardErrorCode refreshStudentGrade(GradeIndex* index, int position) {
+    if (index == NULL || position < 0 || position >= index->count) {
+        return OTHER_ERROR;
+    }
+
+    int64_t grade;
+    if (index->grade(index->cards[position], index->context, &grade)) {
+        return setStudentGrade(index, position, grade);
+    }
+
+    return clearStudentGrade(index, position);
+}
+// *************************************************************************
+
+// ************* Queries ***************************************************
+int countGradesBelow(const GradeIndex* index, int64_t grade) {
+    if (index == NULL) {
+        return 0;
+    }
+
+    const GradeNode* nodes = index->nodes;
+    int count = 0;
+    int node = index->root;
+    while (node != NO_NODE) {
+        if (nodes[node].grade < grade) {
+            count += subtreeSize(nodes, nodes[node].left) + 1;
+            node = nodes[node].right;
+        } else {
+            node = nodes[node].left;
+        }
+    }
+
+    return count;
+}
+
+int countGradesAbove(const GradeIndex* index, int64_t grade) {
+    if (index == NULL) {
+        return 0;
+    }
+
+    return index->graded - countAtMost(index, grade);
+}
+
+int studentRank(const GradeIndex* index, int position) {
+    int64_t grade;
+    if (!getStudentGrade(index, position, &grade)) {
+        return 0;
+    }
+
+    return countGradesAbove(index, grade) + 1;
+}
+
+double studentPercentileRank(const GradeIndex* index, int position) {
+    int64_t grade;
+    if (!getStudentGrade(index, position, &grade)) {
+        return -1;
+    }
+
+    int below = countGradesBelow(index, grade);
+    int equal = countAtMost(index, grade) - below;
+
+    return (below + equal / 2.0) * 100.0 / index->graded;
+}
+
+VCardErrorCode gradeAtPercentile(const GradeIndex* index, double percentile, int64_t* grade) {
+    if (index == NULL || grade == NULL || index->graded == 0 || !(percentile >= 0 && percentile <= 100)) {
+        return OTHER_ERROR;
+    }
+
+    // multiplying first keeps whole percentiles of whole class sizes exact
+    double exactRank = percentile * index->graded / 100.0;
+    int rank = (int)exactRank;
+    if (rank < exactRank) {
+        rank++;
+    }
+    if (rank < 1) {
+        rank = 1;
+    } else if (rank > index->graded) {
+        rank = index->graded;
+    }
+
+    *grade = index->nodes[nthGradedStudent(index, rank - 1)].grade;
+    return OK;
+}
+
+int nthGradedStudent(const GradeIndex* index, int n) {
+    if (index == NULL || n < 0 || n >= index->graded) {
+        return -1;
+    }
+
+    const GradeNode* nodes = index->nodes;
+    int node = index->root;
+    while (node != NO_NODE) {
+        int leftSize = subtreeSize(nodes, nodes[node].left);
+        if (n < leftSize) {
+            node = nodes[node].left;
+        } else if (n == leftSize) {
+            return node;
+        } else {
+            n -= leftSize + 1;
+            node = nodes[node].right;
+        }
+    }
+
+    return -1;
+}
+
+int topGradedStudents(const GradeIndex* index, int k, int* positions) {
+    if (index == NULL || positions == NULL || k <= 0) {
+        return 0;
+    }
+
+    GradeWalk walk = {index->nodes, true, positions, k, 0};
+    walkStudents(&walk, index->root);
+
+    return walk.written;
+}
+
+int bottomGradedStudents(const GradeIndex* index, int k, int* positions) {
+    if (index == NULL || positions == NULL || k <= 0) {
+        return 0;
+    }
+
+    GradeWalk walk = {index->nodes, false, positions, k, 0};
+    walkStudents(&walk, index->root);
+
+    return walk.written;
+}
+
+int countAtMost(const GradeIndex* index, int64_t grade) {
+    const GradeNode* nodes = index->nodes;
+    int count = 0;
+    int node = index->root;
+    while (node != NO_NODE) {
+        if (nodes[node].grade <= grade) {
+            count += subtreeSize(nodes, nodes[node].left) + 1;
+            node = nodes[node].right;
+        } else {
+            node = nodes[node].left;
+        }
+    }
+
+    return count;
+}
+
+// In order, from the best grade or from the worst, stopping once enough students are written
+void walkStudents(GradeWalk* walk, int node) {
+    if (node == NO_NODE || walk->written >= walk->wanted) {
+        return;
+    }
+
+    const GradeNode* current = &walk->nodes[node];
+    walkStudents(walk, walk->bestFirst ? current->right : current->left);
+    if (walk->written < walk->wanted) {
+        walk->positions[walk->written++] = node;
+    }
+    walkStudents(walk, walk->bestFirst ? current->left : current->right);
+}
+// *************************************************************************
+
+// ************* Tree ******************************************************
+void insertStudent(GradeIndex* index, int position) {
+    GradeNode* nodes = index->nodes;
+    nodes[position].left = NO_NODE;
+    nodes[position].right = NO_NODE;
+    nodes[position].size = 1;
+    nodes[position].graded = true;
+
+    int before, after;
+    splitTree(nodes, index->root, position, &before, &after);
+    index->root = mergeTrees(nodes, mergeTrees(nodes, before, position), after);
+    index->graded++;
+}
+
+// The student is the first node of the part of the tree that does not come before them
+void removeStudent(GradeIndex* index, int position) {
+    GradeNode* nodes = index->nodes;
+
+    int before, after;
+    splitTree(nodes, index->root, position, &before, &after);
+    index->root = mergeTrees(nodes, before, removeFirst(nodes, after));
+    nodes[position].graded = false;
+    index->graded--;
+}
+
+bool comesBefore(const GradeNode* nodes, int first, int second) {
+    if (nodes[first].grade != nodes[second].grade) {
+        return nodes[first].grade < nodes[second].grade;
+    }
+
+    return first > second;
+}
+
+int subtreeSize(const GradeNode* nodes, int node) {
+    return node != NO_NODE ? nodes[node].size : 0;
+}
+
+void updateSize(GradeNode* nodes, int node) {
+    nodes[node].size = subtreeSize(nodes, nodes[node].left) + subtreeSize(nodes, nodes[node].right) + 1;
+}
+
+// Joins two trees, all of first coming before all of second
+int mergeTrees(GradeNode* nodes, int first, int second) {
+    if (first == NO_NODE) {
+        return second;
+    }
+    if (second == NO_NODE) {
+        return first;
+    }
+
+    if (nodes[first].priority >= nodes[second].priority) {
+        nodes[first].right = mergeTrees(nodes, nodes[first].right, second);
+        updateSize(nodes, first);
+        return first;
+    }
+
+    nodes[second].left = mergeTrees(nodes, first, nodes[second].left);
+    updateSize(nodes, second);
+    return second;
+}
+
+// Splits a tree into the nodes that come before key and the rest
+void splitTree(GradeNode* nodes, int node, int key, int* before, int* after) {
+    if (node == NO_NODE) {
+        *before = NO_NODE;
+        *after = NO_NODE;
+        return;
+    }
+
+    if (comesBefore(nodes, node, key)) {
+        splitTree(nodes, nodes[node].right, key, &nodes[node].right, after);
+        *before = node;
+    } else {
+        splitTree(nodes, nodes[node].left, key, before, &nodes[node].left);
+        *after = node;
+    }
+    updateSize(nodes, node);
+}
+
+int removeFirst(GradeNode* nodes, int node) {
+    if (nodes[node].left == NO_NODE) {
+        return nodes[node].right;
+    }
+
+    nodes[node].left = removeFirst(nodes, nodes[node].left);
+    updateSize(nodes, node);
+    return node;
+}
+
+uint32_t nodePriority(uint64_t seed, int position) {
+    uint64_t hash = seed + (uint64_t)position * 0x9e3779b97f4a7c15u;
+    hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9u;
+    hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebu;
+
+    return (uint32_t)(hash ^ (hash >> 31));
+}
+// *************************************************************************
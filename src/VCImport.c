@@ -0,0 +1,756 @@
+// Author: Ben Martens (1349551)
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include "VCImport.h"
+#include "VCRosterList.h"
+
+#define BATCH_BYTES (256 * 1024) // rows are cut into batches of about this much input
+#define ARENA_BLOCK (64 * 1024)
+
+typedef struct arenaBlock {
+    struct arenaBlock* next;
+    size_t used;
+    size_t size;
+    char data[];
+} ArenaBlock;
+
+// bump allocator for the fields of a batch; everything in it is freed at once by resetArena
+typedef struct arena {
+    ArenaBlock* head;
+} Arena;
+
+// one property (or FN) built from one or more columns
+typedef struct importTarget {
+    const char* name;
+    const char* group;
+    int valueCount;
+    bool isFN;
+} ImportTarget;
+
+// the columns resolved against the header
+typedef struct importPlan {
+    ImportTarget* targets;
+    int targetCount;
+    int* fieldOfColumn;  // CSV column of every ImportColumn
+    int* targetOfColumn; // target of every ImportColumn
+    const ImportColumn* columns;
+    int columnCount;
+    int fieldCount;      // CSV columns that have to be decoded
+} ImportPlan;
+
+typedef struct rejectedRow {
+    size_t offset;
+    int line;
+    const char* reason;
+    char* text;
+} RejectedRow;
+
+typedef struct importBatch {
+    const char* start;
+    const char* end;
+    int lines; // line ends in the batch.  Rejected rows have line numbers from the start of the batch until the batches are collected.
+
+    Card** cards;
+    int cardCount;
+    RejectedRow* rejected;
+    int rejectedCount;
+    bool failed; // out of memory
+} ImportBatch;
+
+/*	A part of the input scanned for row starts from a guessed first row: the row after the first line end
+	in the part.  The guess is wrong if that line end is inside a quoted field; splitRows then rescans
+	from the real row start until it reaches one of the rows found here.
+*/
+typedef struct splitChunk {
+    const char* start;
+    const char* end;
+    const char** rows; // in order.  The last one is the first at or after end, or the end of the input.
+    int rowCount;
+    int rowCapacity;
+    bool failed;
+} SplitChunk;
+
+typedef struct splitJob {
+    const char* first; // the first row of the input
+    const char* end;
+    SplitChunk* chunks;
+    int chunkCount;
+    atomic_int nextChunk;
+} SplitJob;
+
+typedef struct importJob {
+    const char* data;
+    const ImportPlan* plan;
+    ImportBatch* batches;
+    int batchCount;
+    atomic_int nextBatch;
+    bool report;
+} ImportJob;
+
+static const char* scanRow(const char* position, const char* end, Arena* arena, char** fields, int fieldCount, int* fieldsSeen, int* lines, bool* unterminated);
+static bool splitRows(const char* first, const char* end, int threads, ImportBatch** batches, int* batchCount);
+static void* scanChunks(void* argument);
+static bool addRow(SplitChunk* chunk, const char* row);
+static int findRow(const SplitChunk* chunk, const char* row);
+static void startBatch(ImportBatch* batches, int* batchCount, const char* row);
+static void runWorkers(void* (*work)(void* job), void* job, int threads);
+static bool createPlan(ImportPlan* plan, const ImportColumn* columns, int columnCount, char** titles, int titleCount);
+static void freePlan(ImportPlan* plan);
+static void* importBatches(void* argument);
+static bool importBatch(const ImportJob* job, ImportBatch* batch, Arena* arena);
+static Card* buildCard(const ImportPlan* plan, char** fields, int fieldsSeen, Arena* arena, const char** reason);
+static bool addRejected(ImportBatch* batch, size_t offset, int line, const char* reason, const char* text, size_t length);
+
+static void* arenaAlloc(Arena* arena, size_t size);
+static void resetArena(Arena* arena);
+static void freeArena(Arena* arena);
+
+
+// ************* Import functions ******************************************
+void initImportOptions(ImportOptions* options) {
+    if (options == NULL) {
+        return;
+    }
+
+    options->header = true;
+    options->threads = 0;
+    options->diagnostics = NULL;
+}
+
+VCardErrorCode importRosterFromFile(const char* fileName, const ImportColumn* columns, int columnCount, const ImportOptions* options, List** roster) {
+    if (roster == NULL) {
+        return OTHER_ERROR;
+    }
+    *roster = NULL;
+    if (fileName == NULL) {
+        return INV_FILE;
+    }
+
+    FILE* fp = fopen(fileName, "rb");
+    if (fp == NULL) {
+        return INV_FILE;
+    }
+    char* data = NULL;
+    long length = -1;
+    if (fseek(fp, 0, SEEK_END) == 0 && (length = ftell(fp)) >= 0 && fseek(fp, 0, SEEK_SET) == 0) {
+        data = (char*)malloc(length + 1);
+        if (data != NULL && fread(data, 1, length, fp) != (size_t)length) {
+            free(data);
+            data = NULL;
+        }
+    }
+    fclose(fp);
+    if (data == NULL) {
+        return length < 0 ? INV_FILE : OTHER_ERROR;
+    }
+
+    VCardErrorCode error = importRosterFromBuffer(data, length, columns, columnCount, options, roster);
+    free(data);
+
+    return error;
+}
+
+VCardErrorCode importRosterFromBuffer(const char* data, size_t length, const ImportColumn* columns, int columnCount, const ImportOptions* options, List** roster) {
+    ImportOptions defaults;
+    ImportPlan plan;
+    Arena arena = {NULL};
+
+    if (roster == NULL) {
+        return OTHER_ERROR;
+    }
+    *roster = NULL;
+    if (data == NULL || columns == NULL || columnCount < 1) {
+        return OTHER_ERROR;
+    }
+    if (options == NULL) {
+        initImportOptions(&defaults);
+        options = &defaults;
+    }
+
+    // the header is decoded in full, so columns can be found by title.  A UTF-8 byte order mark, as
+    // spreadsheets write, is not part of the first title.
+    const char* end = data + length;
+    const char* position = data;
+    int line = 1;
+    char** titles = NULL;
+    int titleCount = 0;
+    if (length >= 3 && memcmp(data, "\xEF\xBB\xBF", 3) == 0) {
+        position += 3;
+    }
+    if (options->header && position < end) {
+        int lines = 0;
+        bool unterminated = false;
+        scanRow(position, end, NULL, NULL, 0, &titleCount, &lines, &unterminated);
+        titles = (char**)arenaAlloc(&arena, titleCount * sizeof(char*));
+        if (titles == NULL) {
+            freeArena(&arena);
+            return OTHER_ERROR;
+        }
+        position = scanRow(position, end, &arena, titles, titleCount, &titleCount, &lines, &unterminated);
+        line += lines;
+    }
+    if (!createPlan(&plan, columns, columnCount, titles, titleCount)) {
+        freeArena(&arena);
+        return plan.fieldCount < 0 ? INV_FILE : OTHER_ERROR;
+    }
+    freeArena(&arena);
+
+    // cut the rows into batches, then decode the batches.  Both passes run on every thread.
+    int threads = options->threads > 0 ? options->threads : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    ImportBatch* batches = NULL;
+    int batchCount = 0;
+    if (!splitRows(position, end, threads, &batches, &batchCount)) {
+        freePlan(&plan);
+        return OTHER_ERROR;
+    }
+
+    ImportJob job = {data, &plan, batches, batchCount, 0, options->diagnostics != NULL};
+    runWorkers(importBatches, &job, threads < batchCount ? threads : batchCount);
+
+    // collect the results in row order.  An import that ran out of memory reports nothing more.
+    List* cards = createRosterList();
+    bool failed = false;
+    for (int i = 0; i < batchCount; i++) {
+        failed = failed || batches[i].failed;
+    }
+    for (int i = 0; i < batchCount; i++) {
+        ImportBatch* batch = &batches[i];
+        for (int c = 0; c < batch->cardCount; c++) {
+            insertBack(cards, batch->cards[c]);
+        }
+        for (int r = 0; r < batch->rejectedCount; r++) {
+            RejectedRow* row = &batch->rejected[r];
+            row->line += line;
+            VCardDiagnostic* diagnostic = failed ? NULL : (VCardDiagnostic*)malloc(sizeof(VCardDiagnostic));
+            if (diagnostic == NULL) {
+                free(row->text);
+                failed = true;
+                continue;
+            }
+            *diagnostic = (VCardDiagnostic){INV_CARD, row->offset, row->line, row->reason, row->text};
+            insertBack(options->diagnostics, diagnostic);
+        }
+        line += batch->lines;
+        free(batch->cards);
+        free(batch->rejected);
+    }
+    free(batches);
+    freePlan(&plan);
+
+    if (failed) {
+        freeList(cards);
+        return OTHER_ERROR;
+    }
+    *roster = cards;
+    return OK;
+}
+// *************************************************************************
+
+// ************* Splitting *************************************************
+/*	Cuts the rows from first to end into batches of about BATCH_BYTES.  The input is split into one
+	chunk per thread, and every chunk is scanned for row starts on its own thread from a guessed first
+	row (see SplitChunk).  Then, one chunk after another, the real row start reached so far is followed
+	until it meets a row of the chunk, which is almost always at once; from there on the chunk's rows
+	are the real ones.
+*/
+bool splitRows(const char* first, const char* end, int threads, ImportBatch** batches, int* batchCount) {
+    int chunkCount = (int)((end - first) / BATCH_BYTES) + 1;
+    if (chunkCount > threads) {
+        chunkCount = threads > 0 ? threads : 1;
+    }
+
+    *batches = (ImportBatch*)calloc((end - first) / BATCH_BYTES + 2, sizeof(ImportBatch));
+    SplitChunk* chunks = (SplitChunk*)calloc(chunkCount, sizeof(SplitChunk));
+    if (*batches == NULL || chunks == NULL) {
+        free(*batches);
+        free(chunks);
+        return false;
+    }
+    size_t chunkBytes = (end - first) / chunkCount + 1;
+    for (int i = 0; i < chunkCount; i++) {
+        chunks[i].start = i == 0 ? first : chunks[i - 1].end;
+        chunks[i].end = (size_t)(end - chunks[i].start) > chunkBytes ? chunks[i].start + chunkBytes : end;
+    }
+
+    SplitJob job = {first, end, chunks, chunkCount, 0};
+    runWorkers(scanChunks, &job, chunkCount);
+
+    bool failed = false;
+    const char* row = first;
+    *batchCount = 0;
+    for (int i = 0; i < chunkCount; i++) {
+        SplitChunk* chunk = &chunks[i];
+        failed = failed || chunk->failed;
+        while (!failed && row < chunk->end) {
+            int found = findRow(chunk, row);
+            if (found >= 0) {
+                for (int r = found; r < chunk->rowCount - 1; r++) {
+                    startBatch(*batches, batchCount, chunk->rows[r]);
+                }
+                row = chunk->rows[chunk->rowCount - 1];
+                break;
+            }
+
+            int lines = 0;
+            int fieldsSeen = 0;
+            bool unterminated = false;
+            startBatch(*batches, batchCount, row);
+            row = scanRow(row, end, NULL, NULL, 0, &fieldsSeen, &lines, &unterminated);
+        }
+        free(chunk->rows);
+    }
+    free(chunks);
+    if (*batchCount > 0) {
+        (*batches)[*batchCount - 1].end = end;
+    }
+
+    if (failed) {
+        free(*batches);
+        *batches = NULL;
+        *batchCount = 0;
+    }
+    return !failed;
+}
+
+void* scanChunks(void* argument) {
+    SplitJob* job = (SplitJob*)argument;
+
+    int index;
+    while ((index = atomic_fetch_add(&job->nextChunk, 1)) < job->chunkCount) {
+        SplitChunk* chunk = &job->chunks[index];
+        const char* row = chunk->start;
+        if (row > job->first && row[-1] != '\n') {
+            const char* lineEnd = (const char*)memchr(row, '\n', job->end - row);
+            row = lineEnd != NULL ? lineEnd + 1 : job->end;
+        }
+
+        while (row < chunk->end && addRow(chunk, row)) {
+            int lines = 0;
+            int fieldsSeen = 0;
+            bool unterminated = false;
+            row = scanRow(row, job->end, NULL, NULL, 0, &fieldsSeen, &lines, &unterminated);
+        }
+        chunk->failed = chunk->failed || !addRow(chunk, row);
+    }
+
+    return NULL;
+}
+
+bool addRow(SplitChunk* chunk, const char* row) {
+    if (chunk->rowCount == chunk->rowCapacity) {
+        int capacity = chunk->rowCapacity > 0 ? chunk->rowCapacity * 2 : 1024;
+        const char** grown = (const char**)realloc(chunk->rows, capacity * sizeof(const char*));
+        if (grown == NULL) {
+            chunk->failed = true;
+            return false;
+        }
+        chunk->rows = grown;
+        chunk->rowCapacity = capacity;
+    }
+    chunk->rows[chunk->rowCount++] = row;
+
+    return true;
+}
+
+// index of row among the chunk's rows, or -1
+int findRow(const SplitChunk* chunk, const char* row) {
+    int low = 0;
+    int high = chunk->rowCount - 1;
+
+    while (low <= high) {
+        int middle = low + (high - low) / 2;
+        if (chunk->rows[middle] == row) {
+            return middle;
+        }
+        if (chunk->rows[middle] < row) {
+            low = middle + 1;
+        } else {
+            high = middle - 1;
+        }
+    }
+
+    return -1;
+}
+
+// starts a new batch at row if the current one is full; the batches are as many as splitRows made room for
+void startBatch(ImportBatch* batches, int* batchCount, const char* row) {
+    if (*batchCount > 0 && row - batches[*batchCount - 1].start < BATCH_BYTES) {
+        return;
+    }
+
+    if (*batchCount > 0) {
+        batches[*batchCount - 1].end = row;
+    }
+    batches[*batchCount].start = row;
+    (*batchCount)++;
+}
+
+// Runs work on threads threads, the calling thread being one of them.  If no thread starts the caller does all the work.
+void runWorkers(void* (*work)(void* job), void* job, int threads) {
+    pthread_t* workers = (pthread_t*)calloc(threads > 0 ? threads : 1, sizeof(pthread_t));
+    int started = 0;
+
+    while (workers != NULL && started < threads - 1 && pthread_create(&workers[started], NULL, work, job) == 0) {
+        started++;
+    }
+    work(job);
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    free(workers);
+}
+// *************************************************************************
+
+// ************* Batches ***************************************************
+void* importBatches(void* argument) {
+    ImportJob* job = (ImportJob*)argument;
+    Arena arena = {NULL};
+
+    int index;
+    while ((index = atomic_fetch_add(&job->nextBatch, 1)) < job->batchCount) {
+        ImportBatch* batch = &job->batches[index];
+        batch->failed = !importBatch(job, batch, &arena);
+        resetArena(&arena);
+    }
+    freeArena(&arena);
+
+    return NULL;
+}
+
+bool importBatch(const ImportJob* job, ImportBatch* batch, Arena* arena) {
+    const ImportPlan* plan = job->plan;
+    int capacity = 64;
+
+    batch->cards = (Card**)malloc(capacity * sizeof(Card*));
+    char** fields = (char**)arenaAlloc(arena, plan->fieldCount * sizeof(char*));
+    if (batch->cards == NULL || fields == NULL) {
+        return false;
+    }
+
+    const char* position = batch->start;
+    int line = 0;
+    while (position < batch->end) {
+        const char* rowStart = position;
+        int lines = 0;
+        int fieldsSeen = 0;
+        bool unterminated = false;
+        for (int i = 0; i < plan->fieldCount; i++) {
+            fields[i] = NULL;
+        }
+        position = scanRow(position, batch->end, arena, fields, plan->fieldCount, &fieldsSeen, &lines, &unterminated);
+
+        // blank lines are skipped silently
+        size_t rowLength = position - rowStart;
+        while (rowLength > 0 && (rowStart[rowLength - 1] == '\n' || rowStart[rowLength - 1] == '\r')) {
+            rowLength--;
+        }
+        if (rowLength > 0) {
+            const char* reason = unterminated ? "unterminated quoted field" : NULL;
+            Card* card = reason == NULL ? buildCard(plan, fields, fieldsSeen, arena, &reason) : NULL;
+            if (card != NULL) {
+                if (batch->cardCount == capacity) {
+                    capacity *= 2;
+                    Card** grown = (Card**)realloc(batch->cards, capacity * sizeof(Card*));
+                    if (grown == NULL) {
+                        deleteCard(card);
+                        return false;
+                    }
+                    batch->cards = grown;
+                }
+                batch->cards[batch->cardCount++] = card;
+            } else if (reason == NULL) {
+                return false;
+            } else if (job->report && !addRejected(batch, rowStart - job->data, line, reason, rowStart, rowLength)) {
+                return false;
+            }
+        }
+        line += lines;
+    }
+    batch->lines = line;
+
+    return true;
+}
+
+// returns NULL with *reason set for rows that can't become cards, or with *reason NULL if memory ran out
+Card* buildCard(const ImportPlan* plan, char** fields, int fieldsSeen, Arena* arena, const char** reason) {
+    const char*** values = (const char***)arenaAlloc(arena, plan->targetCount * sizeof(char**));
+    bool* present = (bool*)arenaAlloc(arena, plan->targetCount * sizeof(bool));
+
+    *reason = NULL;
+    if (values == NULL || present == NULL) {
+        return NULL;
+    }
+    for (int t = 0; t < plan->targetCount; t++) {
+        values[t] = (const char**)arenaAlloc(arena, plan->targets[t].valueCount * sizeof(char*));
+        if (values[t] == NULL) {
+            return NULL;
+        }
+        for (int v = 0; v < plan->targets[t].valueCount; v++) {
+            values[t][v] = "";
+        }
+        present[t] = false;
+    }
+    for (int i = 0; i < plan->columnCount; i++) {
+        int field = plan->fieldOfColumn[i];
+        int target = plan->targetOfColumn[i];
+        if (field < fieldsSeen && fields[field] != NULL && strlen(fields[field]) > 0) {
+            values[target][plan->columns[i].value] = fields[field];
+            present[target] = true;
+        }
+    }
+
+    Card* card = (Card*)malloc(sizeof(Card));
+    if (card == NULL) {
+        return NULL;
+    }
+    card->fn = NULL;
+    card->optionalProperties = initializeList(propertyToString, deleteProperty, compareProperties);
+    card->birthday = NULL;
+    card->anniversary = NULL;
+
+    for (int t = 0; t < plan->targetCount; t++) {
+        const ImportTarget* target = &plan->targets[t];
+        if (!present[t]) {
+            continue;
+        }
+        Property* property = createPropertyFromValues(target->name, target->group, values[t], target->valueCount);
+        if (property == NULL) {
+            deleteCard(card);
+            return NULL;
+        }
+        if (target->isFN && card->fn == NULL) {
+            card->fn = property;
+        } else {
+            insertBack(card->optionalProperties, property);
+        }
+    }
+    if (card->fn == NULL) {
+        deleteCard(card);
+        *reason = "missing FN";
+        return NULL;
+    }
+
+    return card;
+}
+
+bool addRejected(ImportBatch* batch, size_t offset, int line, const char* reason, const char* text, size_t length) {
+    // grows in powers of two
+    if ((batch->rejectedCount & (batch->rejectedCount - 1)) == 0) {
+        int capacity = batch->rejectedCount > 0 ? batch->rejectedCount * 2 : 1;
+        RejectedRow* grown = (RejectedRow*)realloc(batch->rejected, capacity * sizeof(RejectedRow));
+        if (grown == NULL) {
+            return false;
+        }
+        batch->rejected = grown;
+    }
+
+    char* copy = strndup(text, length);
+    if (copy == NULL) {
+        return false;
+    }
+    batch->rejected[batch->rejectedCount++] = (RejectedRow){offset, line, reason, copy};
+
+    return true;
+}
+// *************************************************************************
+
+// ************* CSV *******************************************************
+/*	Scans one row starting at position and returns the position after its line end (or end).  Without
+	an arena only the boundaries are found.  With one, the first fieldCount fields are decoded into
+	fields (quotes removed, "" turned into ").  *fieldsSeen is the number of fields in the row and *lines
+	the number of line ends in it.  A field is quoted only if it starts with a quote; quotes anywhere else
+	are taken literally.
+*/
+const char* scanRow(const char* position, const char* end, Arena* arena, char** fields, int fieldCount, int* fieldsSeen, int* lines, bool* unterminated) {
+    int field = 0;
+
+    *lines = 0;
+    *unterminated = false;
+    while (true) {
+        // the quoted part, if any: up to the first quote that isn't doubled
+        const char* quotedStart = position;
+        const char* quotedEnd = position;
+        if (position < end && *position == '"') {
+            quotedStart = ++position;
+            while (true) {
+                const char* quote = (const char*)memchr(position, '"', end - position);
+                if (quote == NULL) {
+                    *unterminated = true;
+                    position = end;
+                    quotedEnd = end;
+                    break;
+                }
+                position = quote + 1;
+                if (position < end && *position == '"') {
+                    position++;
+                } else {
+                    quotedEnd = quote;
+                    break;
+                }
+            }
+            for (const char* c = quotedStart; c < quotedEnd; c++) {
+                *lines += *c == '\n';
+            }
+        }
+
+        // the unquoted part (all of an unquoted field; text after the closing quote is kept as it is)
+        const char* start = position;
+        while (position < end && *position != ',' && *position != '\n') {
+            position++;
+        }
+        const char* stop = position;
+        if (stop > start && (stop == end || *stop == '\n') && stop[-1] == '\r') {
+            stop--;
+        }
+
+        if (arena != NULL && field < fieldCount) {
+            char* out = (char*)arenaAlloc(arena, (quotedEnd - quotedStart) + (stop - start) + 1);
+            fields[field] = out;
+            if (out != NULL) {
+                // every quote in the quoted part is doubled
+                for (const char* c = quotedStart; c < quotedEnd; c++) {
+                    *out++ = *c;
+                    c += *c == '"';
+                }
+                memcpy(out, start, stop - start);
+                out[stop - start] = '\0';
+            }
+        }
+        field++;
+
+        if (position < end && *position == ',') {
+            position++;
+            continue;
+        }
+        if (position < end) {
+            (*lines)++;
+            position++;
+        }
+        break;
+    }
+
+    *fieldsSeen = field;
+    return position;
+}
+
+bool createPlan(ImportPlan* plan, const ImportColumn* columns, int columnCount, char** titles, int titleCount) {
+    plan->targets = (ImportTarget*)calloc(columnCount, sizeof(ImportTarget));
+    plan->fieldOfColumn = (int*)calloc(columnCount, sizeof(int));
+    plan->targetOfColumn = (int*)calloc(columnCount, sizeof(int));
+    plan->targetCount = 0;
+    plan->columns = columns;
+    plan->columnCount = columnCount;
+    plan->fieldCount = 0;
+    if (plan->targets == NULL || plan->fieldOfColumn == NULL || plan->targetOfColumn == NULL) {
+        freePlan(plan);
+        return false;
+    }
+
+    bool hasFN = false;
+    for (int i = 0; i < columnCount; i++) {
+        const ImportColumn* column = &columns[i];
+        const char* group = column->group != NULL ? column->group : "";
+        if (column->name == NULL || column->value < 0 || (column->title == NULL && column->column < 0)) {
+            freePlan(plan);
+            return false;
+        }
+
+        int field = column->title == NULL ? column->column : -1;
+        for (int t = 0; field < 0 && t < titleCount; t++) {
+            if (titles[t] != NULL && strcmp(titles[t], column->title) == 0) {
+                field = t;
+            }
+        }
+        if (field < 0) {
+            freePlan(plan);
+            plan->fieldCount = -1; // reported as INV_FILE
+            return false;
+        }
+        plan->fieldOfColumn[i] = field;
+        if (field >= plan->fieldCount) {
+            plan->fieldCount = field + 1;
+        }
+
+        int target = 0;
+        while (target < plan->targetCount && (strcasecmp(plan->targets[target].name, column->name) != 0 ||
+                strcasecmp(plan->targets[target].group, group) != 0)) {
+            target++;
+        }
+        if (target == plan->targetCount) {
+            bool isFN = strlen(group) == 0 && strcasecmp(column->name, "FN") == 0;
+            plan->targets[plan->targetCount++] = (ImportTarget){column->name, group, 0, isFN};
+            hasFN = hasFN || isFN;
+        }
+        if (column->value >= plan->targets[target].valueCount) {
+            plan->targets[target].valueCount = column->value + 1;
+        }
+        plan->targetOfColumn[i] = target;
+    }
+
+    if (!hasFN) {
+        freePlan(plan);
+        return false;
+    }
+    return true;
+}
+
+void freePlan(ImportPlan* plan) {
+    free(plan->targets);
+    free(plan->fieldOfColumn);
+    free(plan->targetOfColumn);
+    plan->targets = NULL;
+    plan->fieldOfColumn = NULL;
+    plan->targetOfColumn = NULL;
+}
+// *************************************************************************
+
+// ************* Arena *****************************************************
+void* arenaAlloc(Arena* arena, size_t size) {
+    size = (size + 7) & ~(size_t)7;
+
+    ArenaBlock* block = arena->head;
+    if (block == NULL || block->size - block->used < size) {
+        size_t blockSize = size > ARENA_BLOCK ? size : ARENA_BLOCK;
+        block = (ArenaBlock*)malloc(sizeof(ArenaBlock) + blockSize);
+        if (block == NULL) {
+            return NULL;
+        }
+        block->next = arena->head;
+        block->used = 0;
+        block->size = blockSize;
+        arena->head = block;
+    }
+
+    void* memory = block->data + block->used;
+    block->used += size;
+    return memory;
+}
+
+// keeps the newest block for the next batch and frees the rest
+void resetArena(Arena* arena) {
+    if (arena->head == NULL) {
+        return;
+    }
+
+    ArenaBlock* kept = arena->head;
+    arena->head = kept->next;
+    freeArena(arena);
+    kept->next = NULL;
+    kept->used = 0;
+    arena->head = kept;
+}
+
+void freeArena(Arena* arena) {
+    while (arena->head != NULL) {
+        ArenaBlock* next = arena->head->next;
+        free(arena->head);
+        arena->head = next;
+    }
+}
+// *************************************************************************
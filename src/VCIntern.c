@@ -0,0 +1,282 @@
+// Author: Ben Martens (1349551)
+
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "VCIntern.h"
+
+#define INTERN_SHARDS 16 // independently locked parts of a table, picked by hash
+#define DEFAULT_BUCKETS 64
+
+typedef struct internEntry {
+    struct internEntry* next;
+    uint64_t hash;
+    size_t length;
+    char text[];
+} InternEntry;
+
+typedef struct internShard {
+    pthread_mutex_t lock;
+    InternEntry** buckets;
+    size_t bucketCount; // always a power of two
+    int length;
+    size_t bytes;
+} InternShard;
+
+struct internTable {
+    bool foldCase;
+    InternShard shards[INTERN_SHARDS];
+};
+
+static InternTable* globalTable = NULL;
+static pthread_once_t globalTableOnce = PTHREAD_ONCE_INIT;
+
+static InternEntry** findEntry(InternTable* table, const char* string, size_t length, uint64_t hash, InternShard** shard);
+static bool entryMatches(const InternEntry* entry, const char* string, size_t length, bool foldCase);
+static void growShard(InternShard* shard);
+static void createGlobalTable(void);
+
+// ************* Tables ****************************************************
+InternTable* createInternTable(bool foldCase) {
+    InternTable* table = (InternTable*)malloc(sizeof(InternTable));
+    if (table == NULL) {
+        return NULL;
+    }
+
+    table->foldCase = foldCase;
+    for (int i = 0; i < INTERN_SHARDS; i++) {
+        InternShard* shard = &table->shards[i];
+        pthread_mutex_init(&shard->lock, NULL);
+        shard->bucketCount = DEFAULT_BUCKETS;
+        shard->buckets = (InternEntry**)calloc(shard->bucketCount, sizeof(InternEntry*));
+        shard->length = 0;
+        shard->bytes = 0;
+    }
+    for (int i = 0; i < INTERN_SHARDS; i++) {
+        if (table->shards[i].buckets == NULL) {
+            deleteInternTable(table);
+            return NULL;
+        }
+    }
+
+    return table;
+}
+
+void deleteInternTable(InternTable* table) {
+    if (table == NULL) {
+        return;
+    }
+
+    for (int i = 0; i < INTERN_SHARDS; i++) {
+        InternShard* shard = &table->shards[i];
+        for (size_t b = 0; shard->buckets != NULL && b < shard->bucketCount; b++) {
+            InternEntry* entry = shard->buckets[b];
+            while (entry != NULL) {
+                InternEntry* next = entry->next;
+                free(entry);
+                entry = next;
+            }
+        }
+        free(shard->buckets);
+        pthread_mutex_destroy(&shard->lock);
+    }
+    free(table);
+}
+
+const char* internString(InternTable* table, const char* string, size_t length) {
+    if (table == NULL || string == NULL) {
+        return NULL;
+    }
+
+    uint64_t hash = hashString(string, length, table->foldCase);
+    InternShard* shard = NULL;
+    const char* result = NULL;
+
+    InternEntry** bucket = findEntry(table, string, length, hash, &shard);
+    if (*bucket != NULL) {
+        result = (*bucket)->text;
+    } else {
+        bucket = &shard->buckets[(hash / INTERN_SHARDS) & (shard->bucketCount - 1)];
+        InternEntry* entry = (InternEntry*)malloc(sizeof(InternEntry) + length + 1);
+        if (entry != NULL) {
+            entry->hash = hash;
+            entry->length = length;
+            memcpy(entry->text, string, length);
+            entry->text[length] = '\0';
+            entry->next = *bucket;
+            *bucket = entry;
+            shard->length++;
+            shard->bytes += length + 1;
+            result = entry->text;
+            if ((size_t)shard->length > shard->bucketCount) {
+                growShard(shard);
+            }
+        }
+    }
+    pthread_mutex_unlock(&shard->lock);
+
+    return result;
+}
+
+const char* findInternedString(InternTable* table, const char* string, size_t length) {
+    if (table == NULL || string == NULL) {
+        return NULL;
+    }
+
+    InternShard* shard = NULL;
+    InternEntry** link = findEntry(table, string, length, hashString(string, length, table->foldCase), &shard);
+    const char* result = *link != NULL ? (*link)->text : NULL;
+    pthread_mutex_unlock(&shard->lock);
+
+    return result;
+}
+
+int internTableLength(InternTable* table) {
+    int length = 0;
+
+    if (table == NULL) {
+        return 0;
+    }
+
+    for (int i = 0; i < INTERN_SHARDS; i++) {
+        pthread_mutex_lock(&table->shards[i].lock);
+        length += table->shards[i].length;
+        pthread_mutex_unlock(&table->shards[i].lock);
+    }
+
+    return length;
+}
+
+size_t internTableBytes(InternTable* table) {
+    size_t bytes = 0;
+
+    if (table == NULL) {
+        return 0;
+    }
+
+    for (int i = 0; i < INTERN_SHARDS; i++) {
+        pthread_mutex_lock(&table->shards[i].lock);
+        bytes += table->shards[i].bytes;
+        pthread_mutex_unlock(&table->shards[i].lock);
+    }
+
+    return bytes;
+}
+// *************************************************************************
+
+// ************* Global table **********************************************
+/*	Property names, parameter names and common parameter values (RFC 6350), each interned in lower
+	and upper case.  Nothing else is ever added, so the table stays the same size however much
+	input is parsed.
+*/
+static const char* vCardVocabulary[] = {
+    // properties
+    "begin", "end", "version", "source", "kind", "xml", "fn", "n", "nickname", "photo", "bday",
+    "anniversary", "gender", "adr", "tel", "email", "impp", "iimp", "lang", "tz", "geo", "title", "role",
+    "logo", "org", "member", "related", "categories", "note", "prodid", "rev", "sound", "uid",
+    "clientpidmap", "url", "key", "fburl", "caladruri", "caluri",
+    // parameters
+    "language", "value", "pref", "altid", "pid", "type", "mediatype", "calscale", "sort-as", "label",
+    "charset", "encoding",
+    // values
+    "text", "uri", "date", "time", "date-time", "date-and-or-time", "timestamp", "boolean", "integer",
+    "float", "utc-offset", "language-tag", "gregorian", "work", "home", "cell", "voice", "fax", "video",
+    "pager", "textphone", "internet", "x400", "main", "contact", "acquaintance", "friend", "met",
+    "co-worker", "colleague", "co-resident", "neighbor", "child", "parent", "sibling", "spouse", "kin",
+    "muse", "crush", "sweetheart", "me", "agent", "emergency", "individual", "group", "location",
+    "en", "fr", "b", "utf-8", "quoted-printable", "base64"};
+
+const char* findVCardString(const char* string, size_t length) {
+    return findInternedString(vCardInternTable(), string, length);
+}
+
+InternTable* vCardInternTable(void) {
+    pthread_once(&globalTableOnce, createGlobalTable);
+    return globalTable;
+}
+
+void createGlobalTable(void) {
+    globalTable = createInternTable(false);
+    if (globalTable == NULL) {
+        return;
+    }
+
+    char upper[32];
+    for (size_t i = 0; i < sizeof(vCardVocabulary) / sizeof(vCardVocabulary[0]); i++) {
+        size_t length = strlen(vCardVocabulary[i]);
+        for (size_t c = 0; c < length; c++) {
+            upper[c] = (char)toupper((unsigned char)vCardVocabulary[i][c]);
+        }
+        // a word left out because memory ran out is just copied wherever it is used
+        internString(globalTable, vCardVocabulary[i], length);
+        internString(globalTable, upper, length);
+    }
+}
+// *************************************************************************
+
+// ************* Hashing ***************************************************
+uint64_t hashString(const char* string, size_t length, bool foldCase) {
+    uint64_t hash = 14695981039346656037ULL;
+
+    for (size_t i = 0; i < length; i++) {
+        unsigned char c = (unsigned char)string[i];
+        hash ^= foldCase ? (unsigned char)tolower(c) : c;
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+// *************************************************************************
+
+// ************* Helpers ***************************************************
+/*	Finds the link to an equal string's entry, or to the NULL at the end of its bucket, with its
+	shard locked.  The low bits of the hash pick the shard, so the bucket uses the bits above them.
+*/
+InternEntry** findEntry(InternTable* table, const char* string, size_t length, uint64_t hash, InternShard** shard) {
+    *shard = &table->shards[hash % INTERN_SHARDS];
+    pthread_mutex_lock(&(*shard)->lock);
+
+    InternEntry** link = &(*shard)->buckets[(hash / INTERN_SHARDS) & ((*shard)->bucketCount - 1)];
+    while (*link != NULL && !((*link)->hash == hash && entryMatches(*link, string, length, table->foldCase))) {
+        link = &(*link)->next;
+    }
+
+    return link;
+}
+
+bool entryMatches(const InternEntry* entry, const char* string, size_t length, bool foldCase) {
+    if (entry->length != length) {
+        return false;
+    }
+
+    return foldCase ? strncasecmp(entry->text, string, length) == 0 : memcmp(entry->text, string, length) == 0;
+}
+
+// doubles the bucket array; on allocation failure the shard just keeps its longer chains
+void growShard(InternShard* shard) {
+    size_t bucketCount = shard->bucketCount * 2;
+    InternEntry** buckets = (InternEntry**)calloc(bucketCount, sizeof(InternEntry*));
+    if (buckets == NULL) {
+        return;
+    }
+
+    for (size_t b = 0; b < shard->bucketCount; b++) {
+        InternEntry* entry = shard->buckets[b];
+        while (entry != NULL) {
+            InternEntry* next = entry->next;
+            InternEntry** bucket = &buckets[(entry->hash / INTERN_SHARDS) & (bucketCount - 1)];
+            entry->next = *bucket;
+            *bucket = entry;
+            entry = next;
+        }
+    }
+    free(shard->buckets);
+    shard->buckets = buckets;
+    shard->bucketCount = bucketCount;
+}
+// *************************************************************************
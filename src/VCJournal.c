@@ -0,0 +1,1011 @@
+// Author: Ben Martens (1349551)
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "VCJournal.h"
+#include "VCFiles.h"
+#include "VCFlatCard.h"
+#include "VCRosterDiff.h"
+
+#define DEFAULT_COMPACT_BYTES (16u << 20)
+#define RECORD_ALIGNMENT 8
+
+/*	Every record in the journal and the snapshot is a RecordHeader followed by the payload, padded with
+	zeroes to a multiple of RECORD_ALIGNMENT.  The checksum is the CRC-32 of the payload followed by
+	the header fields after it.  Payloads are built from u32 numbers, strings (u32 length including the
+	terminator, then the bytes) and, last, a FlatCard:
+
+		RECORD_PUT			key, card
+		RECORD_REMOVE		key
+		RECORD_SET			key, name, group, index, hasProperty[, card whose FN is the property]
+		RECORD_CHECKPOINT	(empty) first record of a snapshot, whose sequence the snapshot covers
+*/
+typedef struct recordHeader {
+    uint32_t length; // of the payload, without padding
+    uint32_t checksum;
+    uint64_t sequence;
+    uint32_t type;
+    uint32_t reserved;
+} RecordHeader;
+
+typedef enum recordType { RECORD_PUT = 1, RECORD_REMOVE, RECORD_SET, RECORD_CHECKPOINT } RecordType;
+
+typedef struct journalBuffer {
+    char* data;
+    size_t length;
+    size_t capacity;
+} JournalBuffer;
+
+// a payload taken apart; the strings point into the payload
+typedef struct decodedRecord {
+    RecordType type;
+    const char* key;
+    const char* name;
+    const char* group;
+    int index;
+    Card* card; // NULL for removals and for SET records that remove their slot
+} DecodedRecord;
+
+// the cards a snapshot is made of.  They stay valid while compactReader is inside a read section.
+typedef struct snapshotCards {
+    const char** keys;
+    const Card** cards;
+    int length;
+    int capacity;
+} SnapshotCards;
+
+typedef struct payloadReader {
+    const char* data;
+    size_t length;
+    size_t position;
+} PayloadReader;
+
+struct journaledRoster {
+    char* journalPath;
+    char* snapshotPath;
+    JournalOptions options;
+    ConcurrentRoster* cards;
+    RosterReader* reader; // used by whichever thread holds lock
+    RosterReader* compactReader; // used by whichever thread holds compactLock
+
+    // serializes mutations and guards everything up to fileLock
+    pthread_mutex_t lock;
+    pthread_cond_t pendingCond; // records were appended, or the roster is closing
+    pthread_cond_t durableCond; // syncedSequence moved
+    pthread_cond_t compactCond; // compactRequested was set, or the roster is closing
+    JournalBuffer pending;      // records not yet handed to the writer thread
+    uint64_t nextSequence;
+    uint64_t appendedSequence;
+    uint64_t syncedSequence;
+    VCardErrorCode ioError;
+    bool stopping;
+    bool compactRequested;
+    JournalStats stats;
+
+    // guards fd and journalBytes.  lock may be taken while holding it, never the other way round.
+    pthread_mutex_t fileLock;
+    int fd;
+    size_t journalBytes;
+
+    pthread_mutex_t compactLock; // one compaction at a time
+    pthread_t flusher;
+    pthread_t compactor;
+};
+
+static bool appendBytes(JournalBuffer* buffer, const void* data, size_t length);
+static bool appendU32(JournalBuffer* buffer, uint32_t value);
+static bool appendString(JournalBuffer* buffer, const char* string);
+static bool appendCard(JournalBuffer* buffer, const Card* card);
+static bool appendRecord(JournalBuffer* buffer, RecordType type, uint64_t sequence, const JournalBuffer* payload, uint32_t payloadCRC);
+static void freeBuffer(JournalBuffer* buffer);
+
+static bool readU32(PayloadReader* reader, uint32_t* value);
+static const char* readString(PayloadReader* reader);
+static Card* readCard(PayloadReader* reader);
+static VCardErrorCode decodeRecord(RecordType type, const char* payload, size_t length, DecodedRecord* record);
+static VCardErrorCode applyRecord(JournaledRoster* roster, DecodedRecord* record);
+static void keepChange(void* change);
+
+static VCardErrorCode commitRecord(JournaledRoster* roster, RecordType type, JournalBuffer* payload);
+static void* flushJournal(void* argument);
+static void* compactInBackground(void* argument);
+static bool collectCard(const char* key, const Card* card, void* context);
+static bool encodeCard(JournalBuffer* snapshot, uint64_t sequence, const char* key, const Card* card);
+
+static size_t scanRecords(const char* data, size_t length, bool (*visit)(const RecordHeader* header, const char* payload, void* context), void* context);
+static bool replaySnapshotRecord(const RecordHeader* header, const char* payload, void* context);
+static bool replayJournalRecord(const RecordHeader* header, const char* payload, void* context);
+static bool keepNewerRecord(const RecordHeader* header, const char* payload, void* context);
+static VCardErrorCode recover(JournaledRoster* roster);
+
+static bool readWholeFile(int fd, JournalBuffer* buffer);
+static bool writeAll(int fd, const char* data, size_t length);
+static bool replaceFile(const char* path, const char* data, size_t length);
+
+// ************* Opening and closing ****************************************
+void initJournalOptions(JournalOptions* options) {
+    if (options == NULL) {
+        return;
+    }
+
+    options->sync = JOURNAL_SYNC_EACH;
+    options->commitDelayMs = 0;
+    options->compactBytes = DEFAULT_COMPACT_BYTES;
+}
+
+VCardErrorCode openJournaledRoster(const char* base, const JournalOptions* options, JournaledRoster** obj) {
+    if (obj == NULL) {
+        return OTHER_ERROR;
+    }
+    *obj = NULL;
+    if (base == NULL) {
+        return OTHER_ERROR;
+    }
+
+    JournaledRoster* roster = (JournaledRoster*)calloc(1, sizeof(JournaledRoster));
+    if (roster == NULL) {
+        return OTHER_ERROR;
+    }
+    if (options != NULL) {
+        roster->options = *options;
+    } else {
+        initJournalOptions(&roster->options);
+    }
+    roster->fd = -1;
+    roster->journalPath = joinPath(base, ".journal");
+    roster->snapshotPath = joinPath(base, ".snapshot");
+    roster->cards = createConcurrentRoster(0);
+    roster->reader = roster->cards != NULL ? attachRosterReader(roster->cards) : NULL;
+    roster->compactReader = roster->cards != NULL ? attachRosterReader(roster->cards) : NULL;
+    if (roster->journalPath == NULL || roster->snapshotPath == NULL || roster->reader == NULL || roster->compactReader == NULL) {
+        if (roster->cards != NULL) {
+            deleteConcurrentRoster(roster->cards);
+        }
+        free(roster->journalPath);
+        free(roster->snapshotPath);
+        free(roster);
+        return OTHER_ERROR;
+    }
+
+    pthread_mutex_init(&roster->lock, NULL);
+    pthread_mutex_init(&roster->fileLock, NULL);
+    pthread_mutex_init(&roster->compactLock, NULL);
+    pthread_cond_init(&roster->pendingCond, NULL);
+    pthread_cond_init(&roster->durableCond, NULL);
+    pthread_cond_init(&roster->compactCond, NULL);
+    roster->nextSequence = 1;
+    roster->ioError = OK;
+
+    VCardErrorCode error = recover(roster);
+    if (error == OK && pthread_create(&roster->flusher, NULL, flushJournal, roster) != 0) {
+        error = OTHER_ERROR;
+    }
+    if (error == OK && pthread_create(&roster->compactor, NULL, compactInBackground, roster) != 0) {
+        // the flusher is running already, so shut it down properly
+        roster->compactor = roster->flusher;
+        closeJournaledRoster(roster);
+        return OTHER_ERROR;
+    }
+    if (error != OK) {
+        if (roster->fd >= 0) {
+            close(roster->fd);
+        }
+        detachRosterReader(roster->reader);
+        detachRosterReader(roster->compactReader);
+        deleteConcurrentRoster(roster->cards);
+        free(roster->journalPath);
+        free(roster->snapshotPath);
+        free(roster);
+        return error;
+    }
+
+    *obj = roster;
+    return OK;
+}
+
+VCardErrorCode closeJournaledRoster(JournaledRoster* roster) {
+    if (roster == NULL) {
+        return OTHER_ERROR;
+    }
+
+    // the flusher only exits once pending is empty
+    pthread_mutex_lock(&roster->lock);
+    roster->stopping = true;
+    pthread_cond_broadcast(&roster->pendingCond);
+    pthread_cond_broadcast(&roster->compactCond);
+    pthread_mutex_unlock(&roster->lock);
+    pthread_join(roster->flusher, NULL);
+    if (!pthread_equal(roster->compactor, roster->flusher)) {
+        pthread_join(roster->compactor, NULL);
+    }
+
+    VCardErrorCode error = roster->ioError;
+    close(roster->fd);
+    freeBuffer(&roster->pending);
+    detachRosterReader(roster->reader);
+    detachRosterReader(roster->compactReader);
+    deleteConcurrentRoster(roster->cards);
+    pthread_cond_destroy(&roster->pendingCond);
+    pthread_cond_destroy(&roster->durableCond);
+    pthread_cond_destroy(&roster->compactCond);
+    pthread_mutex_destroy(&roster->lock);
+    pthread_mutex_destroy(&roster->fileLock);
+    pthread_mutex_destroy(&roster->compactLock);
+    free(roster->journalPath);
+    free(roster->snapshotPath);
+    free(roster);
+
+    return error;
+}
+
+ConcurrentRoster* journaledRosterCards(JournaledRoster* roster) {
+    return roster != NULL ? roster->cards : NULL;
+}
+
+void journalStatistics(JournaledRoster* roster, JournalStats* stats) {
+    if (roster == NULL || stats == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&roster->lock);
+    *stats = roster->stats;
+    pthread_mutex_unlock(&roster->lock);
+    pthread_mutex_lock(&roster->fileLock);
+    stats->journalBytes = roster->journalBytes;
+    pthread_mutex_unlock(&roster->fileLock);
+}
+// **************************************************************************
+
+// ************* Mutations **************************************************
+VCardErrorCode journalPutCard(JournaledRoster* roster, const Card* card) {
+    const char* key = cardUIDKey(card, NULL);
+    JournalBuffer payload = {0};
+
+    if (roster == NULL || key == NULL) {
+        return OTHER_ERROR;
+    }
+    if (!appendString(&payload, key) || !appendCard(&payload, card)) {
+        freeBuffer(&payload);
+        return OTHER_ERROR;
+    }
+
+    return commitRecord(roster, RECORD_PUT, &payload);
+}
+
+VCardErrorCode journalRemoveCard(JournaledRoster* roster, const char* key) {
+    JournalBuffer payload = {0};
+
+    if (roster == NULL || key == NULL) {
+        return OTHER_ERROR;
+    }
+    if (!appendString(&payload, key)) {
+        freeBuffer(&payload);
+        return OTHER_ERROR;
+    }
+
+    return commitRecord(roster, RECORD_REMOVE, &payload);
+}
+
+VCardErrorCode journalSetProperty(JournaledRoster* roster, const char* key, const char* name, const char* group, int index, const Property* property) {
+    JournalBuffer payload = {0};
+
+    if (group == NULL) {
+        group = "";
+    }
+    if (roster == NULL || key == NULL || name == NULL || index < 0) {
+        return OTHER_ERROR;
+    }
+    // the property has to belong to the slot it is stored in
+    if (property != NULL && (property->name == NULL || property->group == NULL ||
+            strcasecmp(property->name, name) != 0 || strcasecmp(property->group, group) != 0)) {
+        return OTHER_ERROR;
+    }
+
+    bool encoded = appendString(&payload, key) && appendString(&payload, name) && appendString(&payload, group) &&
+                   appendU32(&payload, (uint32_t)index) && appendU32(&payload, property != NULL);
+    if (encoded && property != NULL) {
+        List noProperties = {0};
+        Card wrapper = {.fn = (Property*)property, .optionalProperties = &noProperties};
+        encoded = appendCard(&payload, &wrapper);
+    }
+    if (!encoded) {
+        freeBuffer(&payload);
+        return OTHER_ERROR;
+    }
+
+    return commitRecord(roster, RECORD_SET, &payload);
+}
+
+VCardErrorCode journalSync(JournaledRoster* roster) {
+    if (roster == NULL) {
+        return OTHER_ERROR;
+    }
+
+    pthread_mutex_lock(&roster->lock);
+    uint64_t target = roster->appendedSequence;
+    while (roster->syncedSequence < target) {
+        pthread_cond_wait(&roster->durableCond, &roster->lock);
+    }
+    VCardErrorCode error = roster->ioError;
+    pthread_mutex_unlock(&roster->lock);
+
+    return error;
+}
+
+/*	Queues the record for the writer thread and applies it to the cards.  The payload is decoded before
+	taking the lock, so the only work done under it is the change itself and a copy into pending.
+	The record is queued first and taken back out if the change fails, so running out of memory in
+	either step leaves the cards and the journal agreeing.  Once a write has failed nothing more is
+	applied, so the cards get no further ahead of the journal.
+	Frees payload.
+*/
+VCardErrorCode commitRecord(JournaledRoster* roster, RecordType type, JournalBuffer* payload) {
+    DecodedRecord record;
+    VCardErrorCode error = decodeRecord(type, payload->data, payload->length, &record);
+    uint32_t payloadCRC = (uint32_t)crc32(0, (const Bytef*)payload->data, payload->length);
+
+    if (error != OK) {
+        freeBuffer(payload);
+        return error;
+    }
+
+    pthread_mutex_lock(&roster->lock);
+    uint64_t sequence = roster->nextSequence;
+    size_t queued = roster->pending.length;
+    error = roster->ioError;
+    if (error == OK && !appendRecord(&roster->pending, type, sequence, payload, payloadCRC)) {
+        error = OTHER_ERROR;
+    }
+    if (error == OK) {
+        error = applyRecord(roster, &record);
+        if (error != OK) {
+            roster->pending.length = queued;
+        }
+    }
+    if (error == OK) {
+        roster->nextSequence++;
+        roster->appendedSequence = sequence;
+        roster->stats.records++;
+        pthread_cond_signal(&roster->pendingCond);
+        if (roster->options.sync == JOURNAL_SYNC_EACH) {
+            while (roster->syncedSequence < sequence) {
+                pthread_cond_wait(&roster->durableCond, &roster->lock);
+            }
+            error = roster->ioError;
+        }
+    }
+    pthread_mutex_unlock(&roster->lock);
+
+    deleteCard(record.card);
+    freeBuffer(payload);
+    return error;
+}
+
+// the caller holds lock.  Takes the card out of the record if it ends up in the roster.
+VCardErrorCode applyRecord(JournaledRoster* roster, DecodedRecord* record) {
+    VCardErrorCode error = OTHER_ERROR;
+
+    if (record->type == RECORD_PUT) {
+        error = concurrentRosterPut(roster->cards, record->key, record->card);
+        if (error == OK) {
+            record->card = NULL;
+        }
+    } else if (record->type == RECORD_REMOVE) {
+        error = concurrentRosterRemove(roster->cards, record->key);
+    } else if (record->type == RECORD_SET) {
+        // cards in the roster are never modified in place, since readers may be looking at them
+        enterRosterRead(roster->reader);
+        Card* card = copyCard(concurrentRosterFind(roster->reader, record->key));
+        leaveRosterRead(roster->reader);
+        if (card == NULL) {
+            return OTHER_ERROR;
+        }
+
+        PropertyChange change = {CHANGE_MODIFIED, (char*)record->name, (char*)record->group, record->index,
+                                 NULL, record->card != NULL ? record->card->fn : NULL, NULL, NULL};
+        List* changes = initializeList(propertyChangeToString, keepChange, comparePropertyChanges);
+        insertBack(changes, &change);
+        error = applyCardChanges(card, changes);
+        freeList(changes);
+
+        if (error == OK) {
+            error = concurrentRosterPut(roster->cards, record->key, card);
+        }
+        if (error != OK) {
+            deleteCard(card);
+        }
+    }
+
+    return error;
+}
+
+// the change passed to applyCardChanges lives on the stack
+void keepChange(void* change) {
+    (void)change;
+}
+// **************************************************************************
+
+// ************* Writer threads *********************************************
+void* flushJournal(void* argument) {
+    JournaledRoster* roster = (JournaledRoster*)argument;
+    JournalBuffer writing = {0};
+
+    pthread_mutex_lock(&roster->lock);
+    while (true) {
+        while (roster->pending.length == 0 && !roster->stopping) {
+            pthread_cond_wait(&roster->pendingCond, &roster->lock);
+        }
+        if (roster->pending.length == 0) {
+            break;
+        }
+
+        // let more writers join this commit
+        if (roster->options.commitDelayMs > 0 && !roster->stopping) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += roster->options.commitDelayMs / 1000;
+            deadline.tv_nsec += (long)(roster->options.commitDelayMs % 1000) * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            while (!roster->stopping && pthread_cond_timedwait(&roster->pendingCond, &roster->lock, &deadline) != ETIMEDOUT) {
+            }
+        }
+
+        // swap buffers, so writers fill the other one while this one is written
+        JournalBuffer swap = roster->pending;
+        roster->pending = writing;
+        roster->pending.length = 0;
+        writing = swap;
+        uint64_t last = roster->appendedSequence;
+        pthread_mutex_unlock(&roster->lock);
+
+        pthread_mutex_lock(&roster->fileLock);
+        bool written = writeAll(roster->fd, writing.data, writing.length) && fdatasync(roster->fd) == 0;
+        if (written) {
+            roster->journalBytes += writing.length;
+        }
+        size_t journalBytes = roster->journalBytes;
+        pthread_mutex_unlock(&roster->fileLock);
+
+        pthread_mutex_lock(&roster->lock);
+        if (!written) {
+            roster->ioError = WRITE_ERROR;
+        }
+        roster->syncedSequence = last;
+        roster->stats.syncs++;
+        pthread_cond_broadcast(&roster->durableCond);
+        if (roster->options.compactBytes > 0 && journalBytes > roster->options.compactBytes) {
+            roster->compactRequested = true;
+            pthread_cond_signal(&roster->compactCond);
+        }
+    }
+    pthread_mutex_unlock(&roster->lock);
+
+    freeBuffer(&writing);
+    return NULL;
+}
+
+void* compactInBackground(void* argument) {
+    JournaledRoster* roster = (JournaledRoster*)argument;
+
+    pthread_mutex_lock(&roster->lock);
+    while (true) {
+        while (!roster->compactRequested && !roster->stopping) {
+            pthread_cond_wait(&roster->compactCond, &roster->lock);
+        }
+        if (roster->stopping) {
+            break;
+        }
+        roster->compactRequested = false;
+        pthread_mutex_unlock(&roster->lock);
+
+        // on failure the old files stay valid, and the next commit asks again
+        compactJournal(roster);
+
+        pthread_mutex_lock(&roster->lock);
+    }
+    pthread_mutex_unlock(&roster->lock);
+
+    return NULL;
+}
+// **************************************************************************
+
+// ************* Compaction *************************************************
+VCardErrorCode compactJournal(JournaledRoster* roster) {
+    JournalBuffer snapshot = {0};
+    JournalBuffer empty = {0};
+
+    if (roster == NULL) {
+        return OTHER_ERROR;
+    }
+
+    pthread_mutex_lock(&roster->compactLock);
+
+    // the snapshot covers every record up to covered, whether or not it is on disk yet.  Writers are only
+    // held up while the cards are listed: they are encoded after the lock is released, and the read
+    // section keeps the ones replaced in the meantime from being freed.
+    SnapshotCards listed = {0};
+    pthread_mutex_lock(&roster->lock);
+    uint64_t covered = roster->nextSequence - 1;
+    listed.capacity = concurrentRosterLength(roster->cards);
+    listed.keys = (const char**)malloc((listed.capacity + 1) * sizeof(const char*));
+    listed.cards = (const Card**)malloc((listed.capacity + 1) * sizeof(const Card*));
+    enterRosterRead(roster->compactReader);
+    if (listed.keys != NULL && listed.cards != NULL) {
+        concurrentRosterForEach(roster->compactReader, collectCard, &listed);
+    }
+    pthread_mutex_unlock(&roster->lock);
+
+    bool encoded = listed.keys != NULL && listed.cards != NULL && appendRecord(&snapshot, RECORD_CHECKPOINT, covered, &empty, 0);
+    for (int i = 0; encoded && i < listed.length; i++) {
+        encoded = encodeCard(&snapshot, covered, listed.keys[i], listed.cards[i]);
+    }
+    leaveRosterRead(roster->compactReader);
+    free(listed.keys);
+    free(listed.cards);
+
+    bool written = encoded && replaceFile(roster->snapshotPath, snapshot.data, snapshot.length);
+    freeBuffer(&snapshot);
+
+    // drop what the snapshot covers from the journal.  Records still in pending are appended to the new file.
+    if (written) {
+        pthread_mutex_lock(&roster->fileLock);
+        JournalBuffer journal = {0};
+        JournalBuffer kept = {0};
+        void* keepContext[2] = {&kept, &covered};
+        written = lseek(roster->fd, 0, SEEK_SET) == 0 && readWholeFile(roster->fd, &journal);
+        if (written) {
+            scanRecords(journal.data, journal.length, keepNewerRecord, keepContext);
+            written = keepContext[0] != NULL && replaceFile(roster->journalPath, kept.data, kept.length);
+        }
+        if (written) {
+            int fd = open(roster->journalPath, O_RDWR | O_APPEND | O_CLOEXEC);
+            if (fd >= 0) {
+                close(roster->fd);
+                roster->fd = fd;
+                roster->journalBytes = kept.length;
+            } else {
+                // the old descriptor points at the unlinked file; the next write would be lost
+                written = false;
+                pthread_mutex_lock(&roster->lock);
+                roster->ioError = WRITE_ERROR;
+                pthread_mutex_unlock(&roster->lock);
+            }
+        }
+        freeBuffer(&journal);
+        freeBuffer(&kept);
+        pthread_mutex_unlock(&roster->fileLock);
+    }
+
+    if (written) {
+        pthread_mutex_lock(&roster->lock);
+        roster->stats.compactions++;
+        pthread_mutex_unlock(&roster->lock);
+    }
+    pthread_mutex_unlock(&roster->compactLock);
+
+    return written ? OK : WRITE_ERROR;
+}
+
+// context is a SnapshotCards with room for every card in the roster
+bool collectCard(const char* key, const Card* card, void* context) {
+    SnapshotCards* listed = (SnapshotCards*)context;
+
+    if (listed->length == listed->capacity) {
+        return false;
+    }
+    listed->keys[listed->length] = key;
+    listed->cards[listed->length] = card;
+    listed->length++;
+
+    return true;
+}
+
+bool encodeCard(JournalBuffer* snapshot, uint64_t sequence, const char* key, const Card* card) {
+    JournalBuffer payload = {0};
+
+    bool encoded = appendString(&payload, key) && appendCard(&payload, card) &&
+                   appendRecord(snapshot, RECORD_PUT, sequence, &payload, (uint32_t)crc32(0, (const Bytef*)payload.data, payload.length));
+    freeBuffer(&payload);
+
+    return encoded;
+}
+
+// context is {JournalBuffer* kept, uint64_t* covered}; the buffer is set to NULL on failure
+bool keepNewerRecord(const RecordHeader* header, const char* payload, void* context) {
+    void** arguments = (void**)context;
+    size_t padded = (header->length + RECORD_ALIGNMENT - 1) / RECORD_ALIGNMENT * RECORD_ALIGNMENT;
+
+    if (header->sequence <= *(uint64_t*)arguments[1]) {
+        return true;
+    }
+    if (!appendBytes((JournalBuffer*)arguments[0], (const char*)(payload - sizeof(RecordHeader)), sizeof(RecordHeader) + padded)) {
+        arguments[0] = NULL;
+        return false;
+    }
+
+    return true;
+}
+// **************************************************************************
+
+// ************* Recovery ***************************************************
+typedef struct replayState {
+    JournaledRoster* roster;
+    uint64_t covered;  // sequence the snapshot covers
+    uint64_t last;     // highest sequence seen
+    bool sawCheckpoint;
+    VCardErrorCode error;
+} ReplayState;
+
+VCardErrorCode recover(JournaledRoster* roster) {
+    ReplayState state = {roster, 0, 0, false, OK};
+    JournalBuffer data = {0};
+
+    int fd = open(roster->snapshotPath, O_RDONLY | O_CLOEXEC);
+    if (fd < 0 && errno != ENOENT) {
+        return INV_FILE;
+    }
+    if (fd >= 0) {
+        bool loaded = readWholeFile(fd, &data);
+        close(fd);
+        if (!loaded) {
+            freeBuffer(&data);
+            return INV_FILE;
+        }
+
+        // the snapshot was renamed into place complete, so any damage means it can't be trusted
+        size_t length = data.length;
+        size_t valid = scanRecords(data.data, length, replaySnapshotRecord, &state);
+        freeBuffer(&data);
+        if (state.error != OK) {
+            return state.error;
+        }
+        if (valid != length || !state.sawCheckpoint) {
+            return INV_FILE;
+        }
+    }
+
+    // a new journal's directory entry has to be on disk before anything written to it can count
+    roster->fd = open(roster->journalPath, O_RDWR | O_APPEND | O_CLOEXEC);
+    if (roster->fd < 0 && errno == ENOENT) {
+        roster->fd = open(roster->journalPath, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (roster->fd >= 0 && !syncDirectory(roster->journalPath)) {
+            return INV_FILE;
+        }
+    }
+    if (roster->fd < 0) {
+        return INV_FILE;
+    }
+    data = (JournalBuffer){0};
+    if (!readWholeFile(roster->fd, &data)) {
+        freeBuffer(&data);
+        return INV_FILE;
+    }
+
+    // a torn or damaged tail is what a crash in the middle of a write leaves behind; cut it off
+    state.last = state.covered;
+    size_t length = data.length;
+    size_t valid = scanRecords(data.data, length, replayJournalRecord, &state);
+    freeBuffer(&data);
+    if (state.error != OK) {
+        return state.error;
+    }
+    if (valid != length && (ftruncate(roster->fd, valid) != 0 || fdatasync(roster->fd) != 0)) {
+        return INV_FILE;
+    }
+
+    roster->journalBytes = valid;
+    roster->nextSequence = state.last + 1;
+    roster->appendedSequence = state.last;
+    roster->syncedSequence = state.last;
+
+    return OK;
+}
+
+bool replaySnapshotRecord(const RecordHeader* header, const char* payload, void* context) {
+    ReplayState* state = (ReplayState*)context;
+    DecodedRecord record;
+
+    if (!state->sawCheckpoint) {
+        state->sawCheckpoint = header->type == RECORD_CHECKPOINT && header->length == 0;
+        state->covered = header->sequence;
+        if (!state->sawCheckpoint) {
+            state->error = INV_FILE;
+        }
+        return state->sawCheckpoint;
+    }
+
+    if (header->type != RECORD_PUT || decodeRecord(RECORD_PUT, payload, header->length, &record) != OK) {
+        state->error = INV_FILE;
+        return false;
+    }
+    VCardErrorCode error = applyRecord(state->roster, &record);
+    deleteCard(record.card);
+    if (error != OK) {
+        state->error = error;
+        return false;
+    }
+
+    return true;
+}
+
+bool replayJournalRecord(const RecordHeader* header, const char* payload, void* context) {
+    ReplayState* state = (ReplayState*)context;
+    DecodedRecord record;
+
+    if (header->sequence > state->last) {
+        state->last = header->sequence;
+    }
+    if (header->sequence <= state->covered) {
+        return true;
+    }
+
+    // records were only journaled after they applied cleanly, so a failure here means a damaged file
+    if (decodeRecord((RecordType)header->type, payload, header->length, &record) != OK) {
+        state->error = INV_FILE;
+        return false;
+    }
+    VCardErrorCode error = applyRecord(state->roster, &record);
+    deleteCard(record.card);
+    if (error != OK) {
+        state->error = INV_FILE;
+        return false;
+    }
+    state->roster->stats.replayed++;
+
+    return true;
+}
+
+/*	Calls visit for every record with a correct checksum, from the start of data, and stops at the
+	first one that is cut short or damaged, or when visit returns false.  Returns the length of the
+	records visited.
+*/
+size_t scanRecords(const char* data, size_t length, bool (*visit)(const RecordHeader* header, const char* payload, void* context), void* context) {
+    size_t position = 0;
+
+    while (length - position >= sizeof(RecordHeader)) {
+        RecordHeader header;
+        memcpy(&header, data + position, sizeof(RecordHeader));
+        size_t padded = ((size_t)header.length + RECORD_ALIGNMENT - 1) / RECORD_ALIGNMENT * RECORD_ALIGNMENT;
+        if (padded > length - position - sizeof(RecordHeader)) {
+            break;
+        }
+
+        const char* payload = data + position + sizeof(RecordHeader);
+        uint32_t crc = (uint32_t)crc32(0, (const Bytef*)payload, header.length);
+        crc = (uint32_t)crc32(crc, (const Bytef*)data + position + offsetof(RecordHeader, sequence), sizeof(RecordHeader) - offsetof(RecordHeader, sequence));
+        if (crc != header.checksum || !visit(&header, payload, context)) {
+            break;
+        }
+        position += sizeof(RecordHeader) + padded;
+    }
+
+    return position;
+}
+// **************************************************************************
+
+// ************* Record encoding ********************************************
+bool appendRecord(JournalBuffer* buffer, RecordType type, uint64_t sequence, const JournalBuffer* payload, uint32_t payloadCRC) {
+    static const char padding[RECORD_ALIGNMENT] = {0};
+    RecordHeader header = {(uint32_t)payload->length, 0, sequence, type, 0};
+
+    if (payload->length > UINT32_MAX) {
+        return false;
+    }
+    header.checksum = (uint32_t)crc32(payloadCRC, (const Bytef*)&header + offsetof(RecordHeader, sequence), sizeof(RecordHeader) - offsetof(RecordHeader, sequence));
+
+    size_t start = buffer->length;
+    if (!appendBytes(buffer, &header, sizeof(header)) || !appendBytes(buffer, payload->data, payload->length) ||
+            !appendBytes(buffer, padding, (RECORD_ALIGNMENT - payload->length % RECORD_ALIGNMENT) % RECORD_ALIGNMENT)) {
+        buffer->length = start;
+        return false;
+    }
+
+    return true;
+}
+
+bool appendBytes(JournalBuffer* buffer, const void* data, size_t length) {
+    if (buffer->length + length > buffer->capacity) {
+        size_t capacity = buffer->capacity > 0 ? buffer->capacity : 256;
+        while (capacity < buffer->length + length) {
+            capacity *= 2;
+        }
+        char* grown = (char*)realloc(buffer->data, capacity);
+        if (grown == NULL) {
+            return false;
+        }
+        buffer->data = grown;
+        buffer->capacity = capacity;
+    }
+
+    if (length > 0) {
+        memcpy(buffer->data + buffer->length, data, length);
+    }
+    buffer->length += length;
+
+    return true;
+}
+
+bool appendU32(JournalBuffer* buffer, uint32_t value) {
+    return appendBytes(buffer, &value, sizeof(value));
+}
+
+bool appendString(JournalBuffer* buffer, const char* string) {
+    size_t length = strlen(string) + 1;
+
+    return length <= UINT32_MAX && appendU32(buffer, (uint32_t)length) && appendBytes(buffer, string, length);
+}
+
+bool appendCard(JournalBuffer* buffer, const Card* card) {
+    FlatCard* flat = NULL;
+
+    if (createFlatCard(card, &flat) != OK) {
+        return false;
+    }
+    bool appended = appendBytes(buffer, flat, flat->size);
+    deleteFlatCard(flat);
+
+    return appended;
+}
+
+void freeBuffer(JournalBuffer* buffer) {
+    free(buffer->data);
+    buffer->data = NULL;
+    buffer->length = 0;
+    buffer->capacity = 0;
+}
+// **************************************************************************
+
+// ************* Record decoding ********************************************
+VCardErrorCode decodeRecord(RecordType type, const char* payload, size_t length, DecodedRecord* record) {
+    PayloadReader reader = {payload, length, 0};
+    uint32_t index = 0;
+    uint32_t hasProperty = 0;
+
+    *record = (DecodedRecord){type, NULL, NULL, NULL, 0, NULL};
+    if (type != RECORD_PUT && type != RECORD_REMOVE && type != RECORD_SET) {
+        return OTHER_ERROR;
+    }
+
+    record->key = readString(&reader);
+    if (record->key == NULL) {
+        return OTHER_ERROR;
+    }
+    if (type == RECORD_SET) {
+        record->name = readString(&reader);
+        record->group = readString(&reader);
+        if (record->name == NULL || record->group == NULL || !readU32(&reader, &index) ||
+                !readU32(&reader, &hasProperty) || index > INT32_MAX) {
+            return OTHER_ERROR;
+        }
+        record->index = (int)index;
+    }
+    if (type == RECORD_PUT || hasProperty) {
+        record->card = readCard(&reader);
+        if (record->card == NULL) {
+            return OTHER_ERROR;
+        }
+    }
+
+    return reader.position == reader.length ? OK : OTHER_ERROR;
+}
+
+bool readU32(PayloadReader* reader, uint32_t* value) {
+    if (reader->length - reader->position < sizeof(uint32_t)) {
+        return false;
+    }
+    memcpy(value, reader->data + reader->position, sizeof(uint32_t));
+    reader->position += sizeof(uint32_t);
+
+    return true;
+}
+
+const char* readString(PayloadReader* reader) {
+    uint32_t length = 0;
+
+    if (!readU32(reader, &length) || length == 0 || length > reader->length - reader->position) {
+        return NULL;
+    }
+    const char* string = reader->data + reader->position;
+    if (memchr(string, '\0', length) != string + length - 1) {
+        return NULL;
+    }
+    reader->position += length;
+
+    return string;
+}
+
+// the card takes up the rest of the payload.  It is copied out first, since the payload isn't aligned.
+Card* readCard(PayloadReader* reader) {
+    size_t length = reader->length - reader->position;
+    Card* card = NULL;
+
+    if (length < sizeof(FlatCard)) {
+        return NULL;
+    }
+    FlatCard* flat = (FlatCard*)malloc(length);
+    if (flat == NULL) {
+        return NULL;
+    }
+    memcpy(flat, reader->data + reader->position, length);
+    if (flat->size == length) {
+        flatCardToCard(flat, length, &card);
+    }
+    free(flat);
+    reader->position = reader->length;
+
+    return card;
+}
+// **************************************************************************
+
+// ************* Helpers ****************************************************
+// reads fd from its current position to the end
+bool readWholeFile(int fd, JournalBuffer* buffer) {
+    char chunk[65536];
+
+    while (true) {
+        ssize_t count = read(fd, chunk, sizeof(chunk));
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count < 0 || !appendBytes(buffer, chunk, (size_t)count)) {
+            return false;
+        }
+        if (count == 0) {
+            return true;
+        }
+    }
+}
+
+bool writeAll(int fd, const char* data, size_t length) {
+    while (length > 0) {
+        ssize_t count = write(fd, data, length);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count < 0) {
+            return false;
+        }
+        data += count;
+        length -= (size_t)count;
+    }
+
+    return true;
+}
+
+// replaces path atomically: writes a temporary file, syncs it, renames it over path and syncs the directory
+bool replaceFile(const char* path, const char* data, size_t length) {
+    char* temporary = joinPath(path, ".tmp");
+
+    if (temporary == NULL) {
+        return false;
+    }
+
+    int fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    bool replaced = fd >= 0 && writeAll(fd, data, length) && fsync(fd) == 0;
+    if (fd >= 0) {
+        replaced = close(fd) == 0 && replaced;
+    }
+    replaced = replaced && rename(temporary, path) == 0;
+    if (!replaced) {
+        unlink(temporary);
+    } else {
+        replaced = syncDirectory(path);
+    }
+
+    free(temporary);
+    return replaced;
+}
+// **************************************************************************
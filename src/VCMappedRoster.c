@@ -0,0 +1,435 @@
+// Author: Ben Martens (1349551)
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "VCMappedRoster.h"
+
+// how long attachMappedRoster waits for a publisher that is still writing the segment
+#define ATTACH_RETRIES 1000
+#define ATTACH_RETRY_NS 1000000L
+
+// where Linux keeps shared memory segments as files, so that a new segment can be renamed over an old one
+#define SHM_DIRECTORY "/dev/shm"
+
+struct mappedRoster {
+    const unsigned char* base;
+    size_t size;
+    const MappedRosterHeader* header;
+    const MappedCardEntry* cards;
+    const uint32_t* keys;
+};
+
+// a card's key and roster position, sorted to build the key index
+typedef struct keySlot {
+    const char* key;
+    uint32_t index;
+} KeySlot;
+
+static uint64_t supersedeSegment(const char* name, bool* existed);
+static uint64_t segmentGeneration(int fd);
+static void markSuperseded(int fd);
+static bool validateSegment(const MappedRoster* roster);
+static bool rangeInside(uint64_t offset, uint64_t length, uint64_t size);
+static int compareKeySlots(const void* first, const void* second);
+static uint64_t alignOffset(uint64_t offset);
+
+// ************* Publishing ************************************************
+VCardErrorCode publishMappedRoster(const char* name, List* roster, CardKeyFunction key, void* context) {
+    if (name == NULL || roster == NULL) {
+        return OTHER_ERROR;
+    }
+    if (key == NULL) {
+        key = cardUIDKey;
+    }
+
+    int cardCount = getLength(roster);
+    FlatCard** flats = (FlatCard**)calloc(cardCount > 0 ? cardCount : 1, sizeof(FlatCard*));
+    KeySlot* slots = (KeySlot*)malloc((cardCount > 0 ? cardCount : 1) * sizeof(KeySlot));
+    if (flats == NULL || slots == NULL) {
+        free(flats);
+        free(slots);
+        return OTHER_ERROR;
+    }
+
+    // flatten every card first, to know the size of the segment
+    VCardErrorCode error = OK;
+    uint32_t keyCount = 0;
+    uint64_t keyBytes = 0;
+    uint64_t cardBytes = 0;
+    int index = 0;
+    void* element;
+    ListIterator iter = createIterator(roster);
+    while (error == OK && (element = nextElement(&iter)) != NULL) {
+        const Card* card = (const Card*)element;
+        error = createFlatCard(card, &flats[index]);
+        if (error != OK) {
+            break;
+        }
+        cardBytes += alignOffset(flats[index]->size);
+
+        const char* cardKey = key(card, context);
+        if (cardKey != NULL) {
+            slots[keyCount].key = cardKey;
+            slots[keyCount].index = (uint32_t)index;
+            keyCount++;
+            keyBytes += strlen(cardKey) + 1;
+        }
+        index++;
+    }
+
+    uint64_t cardsOffset = alignOffset(sizeof(MappedRosterHeader));
+    uint64_t keysOffset = cardsOffset + (uint64_t)cardCount * sizeof(MappedCardEntry);
+    uint64_t keyStringsOffset = alignOffset(keysOffset + (uint64_t)keyCount * sizeof(uint32_t));
+    uint64_t flatsOffset = alignOffset(keyStringsOffset + keyBytes);
+    uint64_t size = flatsOffset + cardBytes;
+    if (error == OK && (keyStringsOffset + keyBytes > UINT32_MAX || size != (size_t)size)) {
+        error = OTHER_ERROR; // key offsets are 32 bits
+    }
+
+    // the new segment is written under a temporary name and renamed over the old one once it is
+    // ready, so that the name always leads to a whole roster
+    char temporaryName[NAME_MAX + 1];
+    char temporaryPath[sizeof(SHM_DIRECTORY) + NAME_MAX + 1];
+    char path[sizeof(SHM_DIRECTORY) + NAME_MAX + 1];
+    if (error == OK && (name[0] != '/' ||
+            snprintf(temporaryName, sizeof(temporaryName), "%s.%ld.new", name, (long)getpid()) >= (int)sizeof(temporaryName) ||
+            snprintf(temporaryPath, sizeof(temporaryPath), SHM_DIRECTORY "%s", temporaryName) >= (int)sizeof(temporaryPath) ||
+            snprintf(path, sizeof(path), SHM_DIRECTORY "%s", name) >= (int)sizeof(path))) {
+        error = OTHER_ERROR;
+    }
+
+    int fd = -1;
+    int oldFd = -1;
+    unsigned char* base = MAP_FAILED;
+    if (error == OK) {
+        qsort(slots, keyCount, sizeof(KeySlot), compareKeySlots);
+
+        oldFd = shm_open(name, O_RDWR, 0);
+        uint64_t generation = (oldFd >= 0 ? segmentGeneration(oldFd) : 0) + 1;
+        shm_unlink(temporaryName); // left by a publisher with the same pid that died
+        fd = shm_open(temporaryName, O_CREAT | O_EXCL | O_RDWR, 0644);
+        if (fd < 0 || ftruncate(fd, (off_t)size) != 0) {
+            error = INV_FILE;
+        } else {
+            base = (unsigned char*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (base == MAP_FAILED) {
+                error = INV_FILE;
+            }
+        }
+
+        if (error == OK) {
+            // ftruncate zero filled the segment, so the state already reads MAPPED_ROSTER_WRITING
+            MappedRosterHeader* header = (MappedRosterHeader*)base;
+            header->magic = MAPPED_ROSTER_MAGIC;
+            header->version = MAPPED_ROSTER_VERSION;
+            header->cardCount = (uint32_t)cardCount;
+            header->generation = generation;
+            header->size = size;
+            header->cards = cardsOffset;
+            header->keys = keysOffset;
+            header->keyCount = keyCount;
+            header->keyStrings = keyStringsOffset;
+
+            MappedCardEntry* entries = (MappedCardEntry*)(base + cardsOffset);
+            uint64_t offset = flatsOffset;
+            for (int i = 0; i < cardCount; i++) {
+                memcpy(base + offset, flats[i], flats[i]->size);
+                entries[i].offset = offset;
+                entries[i].size = flats[i]->size;
+                offset += alignOffset(flats[i]->size);
+            }
+
+            uint32_t* keys = (uint32_t*)(base + keysOffset);
+            offset = keyStringsOffset;
+            for (uint32_t i = 0; i < keyCount; i++) {
+                size_t length = strlen(slots[i].key) + 1;
+                memcpy(base + offset, slots[i].key, length);
+                keys[i] = slots[i].index;
+                entries[slots[i].index].key = (uint32_t)offset;
+                offset += length;
+            }
+
+            atomic_store_explicit(&header->state, MAPPED_ROSTER_READY, memory_order_release);
+            if (rename(temporaryPath, path) != 0) {
+                error = INV_FILE;
+            }
+        }
+        if (error != OK && fd >= 0) {
+            shm_unlink(temporaryName);
+        }
+    }
+    if (oldFd >= 0) {
+        if (error == OK) {
+            markSuperseded(oldFd);
+        }
+        close(oldFd);
+    }
+
+    if (base != MAP_FAILED) {
+        munmap(base, size);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    for (int i = 0; i < cardCount; i++) {
+        deleteFlatCard(flats[i]);
+    }
+    free(flats);
+    free(slots);
+
+    return error;
+}
+
+VCardErrorCode removeMappedRoster(const char* name) {
+    bool existed;
+
+    if (name == NULL) {
+        return OTHER_ERROR;
+    }
+
+    supersedeSegment(name, &existed);
+    return existed ? OK : INV_FILE;
+}
+
+// marks the segment under name as superseded and unlinks it, returning its generation (0 if none)
+uint64_t supersedeSegment(const char* name, bool* existed) {
+    int fd = shm_open(name, O_RDWR, 0);
+    *existed = fd >= 0;
+    if (fd < 0) {
+        return 0;
+    }
+
+    uint64_t generation = segmentGeneration(fd);
+    markSuperseded(fd);
+    close(fd);
+    shm_unlink(name);
+
+    return generation;
+}
+
+// generation of the segment open on fd, 0 if it isn't a mapped roster
+uint64_t segmentGeneration(int fd) {
+    struct stat info;
+    uint64_t generation = 0;
+
+    if (fstat(fd, &info) == 0 && (size_t)info.st_size >= sizeof(MappedRosterHeader)) {
+        MappedRosterHeader* header = (MappedRosterHeader*)mmap(NULL, sizeof(MappedRosterHeader), PROT_READ, MAP_SHARED, fd, 0);
+        if (header != MAP_FAILED) {
+            if (header->magic == MAPPED_ROSTER_MAGIC) {
+                generation = header->generation;
+            }
+            munmap(header, sizeof(MappedRosterHeader));
+        }
+    }
+
+    return generation;
+}
+
+void markSuperseded(int fd) {
+    struct stat info;
+
+    if (fstat(fd, &info) == 0 && (size_t)info.st_size >= sizeof(MappedRosterHeader)) {
+        MappedRosterHeader* header = (MappedRosterHeader*)mmap(NULL, sizeof(MappedRosterHeader), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (header != MAP_FAILED) {
+            if (header->magic == MAPPED_ROSTER_MAGIC) {
+                atomic_store_explicit(&header->state, MAPPED_ROSTER_SUPERSEDED, memory_order_release);
+            }
+            munmap(header, sizeof(MappedRosterHeader));
+        }
+    }
+}
+// *************************************************************************
+
+// ************* Readers ***************************************************
+VCardErrorCode attachMappedRoster(const char* name, MappedRoster** obj) {
+    if (obj == NULL) {
+        return OTHER_ERROR;
+    }
+    *obj = NULL;
+    if (name == NULL) {
+        return OTHER_ERROR;
+    }
+
+    MappedRoster* roster = (MappedRoster*)calloc(1, sizeof(MappedRoster));
+    if (roster == NULL) {
+        return OTHER_ERROR;
+    }
+
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        free(roster);
+        return INV_FILE;
+    }
+
+    // a publisher may still be sizing or filling the segment
+    for (int attempt = 0; attempt < ATTACH_RETRIES && roster->base == NULL; attempt++) {
+        struct stat info;
+        if (fstat(fd, &info) != 0) {
+            break;
+        }
+        if ((size_t)info.st_size >= sizeof(MappedRosterHeader)) {
+            void* base = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            if (base == MAP_FAILED) {
+                break;
+            }
+            const MappedRosterHeader* header = (const MappedRosterHeader*)base;
+            if (atomic_load_explicit((atomic_uint*)&header->state, memory_order_acquire) != MAPPED_ROSTER_WRITING) {
+                roster->base = (const unsigned char*)base;
+                roster->size = info.st_size;
+                break;
+            }
+            munmap(base, info.st_size);
+        }
+
+        struct timespec pause = {0, ATTACH_RETRY_NS};
+        nanosleep(&pause, NULL);
+    }
+    close(fd);
+
+    if (roster->base == NULL) {
+        free(roster);
+        return INV_FILE;
+    }
+    roster->header = (const MappedRosterHeader*)roster->base;
+    if (!validateSegment(roster)) {
+        detachMappedRoster(roster);
+        return INV_FILE;
+    }
+    roster->cards = (const MappedCardEntry*)(roster->base + roster->header->cards);
+    roster->keys = (const uint32_t*)(roster->base + roster->header->keys);
+
+    *obj = roster;
+    return OK;
+}
+
+void detachMappedRoster(MappedRoster* obj) {
+    if (obj == NULL) {
+        return;
+    }
+
+    munmap((void*)obj->base, obj->size);
+    free(obj);
+}
+
+int mappedRosterLength(const MappedRoster* obj) {
+    return obj != NULL ? (int)obj->header->cardCount : 0;
+}
+
+const FlatCard* mappedRosterGetCard(const MappedRoster* obj, int index) {
+    if (obj == NULL || index < 0 || (uint32_t)index >= obj->header->cardCount) {
+        return NULL;
+    }
+
+    return (const FlatCard*)(obj->base + obj->cards[index].offset);
+}
+
+const char* mappedRosterGetKey(const MappedRoster* obj, int index) {
+    if (obj == NULL || index < 0 || (uint32_t)index >= obj->header->cardCount || obj->cards[index].key == 0) {
+        return NULL;
+    }
+
+    return (const char*)(obj->base + obj->cards[index].key);
+}
+
+const FlatCard* mappedRosterFind(const MappedRoster* obj, const char* key) {
+    if (obj == NULL || key == NULL) {
+        return NULL;
+    }
+
+    // lower bound, so that the first of several cards with the same key is found
+    uint32_t low = 0;
+    uint32_t high = obj->header->keyCount;
+    while (low < high) {
+        uint32_t middle = low + (high - low) / 2;
+        if (strcmp(mappedRosterGetKey(obj, (int)obj->keys[middle]), key) < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    if (low == obj->header->keyCount || strcmp(mappedRosterGetKey(obj, (int)obj->keys[low]), key) != 0) {
+        return NULL;
+    }
+
+    return mappedRosterGetCard(obj, (int)obj->keys[low]);
+}
+
+uint64_t mappedRosterGeneration(const MappedRoster* obj) {
+    return obj != NULL ? obj->header->generation : 0;
+}
+
+bool mappedRosterIsCurrent(const MappedRoster* obj) {
+    return obj != NULL && atomic_load_explicit((atomic_uint*)&obj->header->state, memory_order_acquire) == MAPPED_ROSTER_READY;
+}
+// *************************************************************************
+
+// ************* Helpers ***************************************************
+// checks every offset in the segment, so that the accessors never read outside it
+bool validateSegment(const MappedRoster* roster) {
+    const MappedRosterHeader* header = roster->header;
+    uint64_t size = roster->size;
+
+    if (header->magic != MAPPED_ROSTER_MAGIC || header->version != MAPPED_ROSTER_VERSION || header->size != size) {
+        return false;
+    }
+    if (header->cards % 8 != 0 || !rangeInside(header->cards, (uint64_t)header->cardCount * sizeof(MappedCardEntry), size)) {
+        return false;
+    }
+    if (header->keys % 4 != 0 || header->keyCount > header->cardCount ||
+        !rangeInside(header->keys, (uint64_t)header->keyCount * sizeof(uint32_t), size)) {
+        return false;
+    }
+
+    const MappedCardEntry* entries = (const MappedCardEntry*)(roster->base + header->cards);
+    for (uint32_t i = 0; i < header->cardCount; i++) {
+        if (entries[i].offset % 8 != 0 || !rangeInside(entries[i].offset, entries[i].size, size) ||
+            !flatCardIsValid(roster->base + entries[i].offset, entries[i].size)) {
+            return false;
+        }
+        if (entries[i].key != 0 && (entries[i].key >= size || memchr(roster->base + entries[i].key, '\0', size - entries[i].key) == NULL)) {
+            return false;
+        }
+    }
+
+    // the key index must list keyed cards in order for the binary search
+    const uint32_t* keys = (const uint32_t*)(roster->base + header->keys);
+    for (uint32_t i = 0; i < header->keyCount; i++) {
+        if (keys[i] >= header->cardCount || entries[keys[i]].key == 0) {
+            return false;
+        }
+        if (i > 0 && strcmp((const char*)roster->base + entries[keys[i - 1]].key, (const char*)roster->base + entries[keys[i]].key) > 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool rangeInside(uint64_t offset, uint64_t length, uint64_t size) {
+    return offset <= size && length <= size - offset;
+}
+
+// by key, then by roster position so that equal keys keep roster order
+int compareKeySlots(const void* first, const void* second) {
+    const KeySlot* a = (const KeySlot*)first;
+    const KeySlot* b = (const KeySlot*)second;
+
+    int order = strcmp(a->key, b->key);
+    if (order != 0) {
+        return order;
+    }
+
+    return a->index < b->index ? -1 : a->index > b->index;
+}
+
+uint64_t alignOffset(uint64_t offset) {
+    return (offset + 7) & ~(uint64_t)7;
+}
+// *************************************************************************
@@ -0,0 +1,636 @@
+// Author: Ben Martens (1349551)
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "VCDecompress.h"
+#include "VCParallelParse.h"
+#include "VCRosterList.h"
+
+#define DEFAULT_CHUNK_BYTES (4u << 20)
+#define DEFAULT_QUEUE_LENGTH 256
+#define READ_BLOCK (1u << 20) // first buffer size for decompressed input
+
+typedef struct parseChunk {
+    const char* start;
+    const char* end;
+
+    Card** cards; // in input order, when collecting in order
+    int cardCount;
+    int cardCapacity;
+    VCardDiagnostic** diagnostics; // with lines counted from the start of the chunk
+    int diagnosticCount;
+    int diagnosticCapacity;
+    int lines;   // line breaks in the chunk, once parsed
+    bool parsed;
+    bool failed; // out of memory
+} ParseChunk;
+
+struct rosterParse {
+    const char* data;
+    size_t length;
+    char* buffer;  // decompressed input, or NULL
+    void* mapping; // mapped input, or NULL
+    size_t mappingLength;
+
+    ParallelParseOptions options;
+    bool ordered;
+    ParseChunk* chunks;
+    int chunkCount;
+    atomic_int nextChunk;
+    atomic_bool cancelled;
+    pthread_t* workers;
+    int workerCount;
+
+    // parsed cards waiting for nextParsedCard, when not collecting in order
+    pthread_mutex_t lock;
+    pthread_cond_t cardReady;
+    pthread_cond_t spaceFree;
+    Card** queue;
+    int queueHead;
+    int queueCount;
+    int runningWorkers;
+};
+
+static RosterParse* createRosterParse(const ParallelParseOptions* options, bool ordered);
+static void deleteRosterParse(RosterParse* parse);
+static VCardErrorCode loadInput(RosterParse* parse, const char* fileName);
+static bool cutChunks(RosterParse* parse);
+static VCardErrorCode parseInOrder(RosterParse* parse, List** roster);
+static bool collectDiagnostics(RosterParse* parse);
+static void* parseChunks(void* argument);
+static bool parseChunk(RosterParse* parse, ParseChunk* chunk, List* scratch);
+static bool takeDiagnostics(ParseChunk* chunk, List* scratch, size_t offset, int line);
+static bool deliverCard(RosterParse* parse, ParseChunk* chunk, Card* card);
+static const char* nextCardStart(const char* position, const char* end, int* lines);
+static bool isCardStart(const char* position, const char* end);
+static const char* trimCard(const char* start, const char* end);
+static void keepDiagnostic(void* diagnostic);
+
+
+// ************* Parse functions *******************************************
+void initParallelParseOptions(ParallelParseOptions* options) {
+    if (options == NULL) {
+        return;
+    }
+
+    initParseOptions(&options->parse);
+    options->threads = 0;
+    options->chunkBytes = 0;
+    options->queueLength = 0;
+}
+
+VCardErrorCode parseRosterFromBuffer(const char* data, size_t length, const ParallelParseOptions* options, List** roster) {
+    if (roster == NULL) {
+        return OTHER_ERROR;
+    }
+    *roster = NULL;
+    if (data == NULL) {
+        return OTHER_ERROR;
+    }
+
+    RosterParse* parse = createRosterParse(options, true);
+    if (parse == NULL) {
+        return OTHER_ERROR;
+    }
+    parse->data = data;
+    parse->length = length;
+
+    return parseInOrder(parse, roster);
+}
+
+VCardErrorCode parseRosterFromFile(const char* fileName, const ParallelParseOptions* options, List** roster) {
+    if (roster == NULL) {
+        return OTHER_ERROR;
+    }
+    *roster = NULL;
+    if (fileName == NULL) {
+        return INV_FILE;
+    }
+
+    RosterParse* parse = createRosterParse(options, true);
+    if (parse == NULL) {
+        return OTHER_ERROR;
+    }
+    VCardErrorCode error = loadInput(parse, fileName);
+    if (error != OK) {
+        deleteRosterParse(parse);
+        return error;
+    }
+
+    return parseInOrder(parse, roster);
+}
+
+VCardErrorCode startRosterParse(const char* fileName, const ParallelParseOptions* options, RosterParse** obj) {
+    if (obj == NULL) {
+        return OTHER_ERROR;
+    }
+    *obj = NULL;
+    if (fileName == NULL) {
+        return INV_FILE;
+    }
+
+    RosterParse* parse = createRosterParse(options, false);
+    if (parse == NULL) {
+        return OTHER_ERROR;
+    }
+    VCardErrorCode error = loadInput(parse, fileName);
+    if (error != OK) {
+        deleteRosterParse(parse);
+        return error;
+    }
+
+    int threads = parse->options.threads;
+    parse->queue = (Card**)malloc(parse->options.queueLength * sizeof(Card*));
+    if (!cutChunks(parse) || parse->queue == NULL) {
+        deleteRosterParse(parse);
+        return OTHER_ERROR;
+    }
+    if (threads > parse->chunkCount) {
+        threads = parse->chunkCount > 0 ? parse->chunkCount : 1;
+    }
+    parse->workers = (pthread_t*)calloc(threads, sizeof(pthread_t));
+    if (parse->workers == NULL) {
+        deleteRosterParse(parse);
+        return OTHER_ERROR;
+    }
+
+    // every worker leaves once, so count them all before any can start
+    parse->runningWorkers = threads;
+    while (parse->workerCount < threads && pthread_create(&parse->workers[parse->workerCount], NULL, parseChunks, parse) == 0) {
+        parse->workerCount++;
+    }
+    pthread_mutex_lock(&parse->lock);
+    parse->runningWorkers -= threads - parse->workerCount;
+    pthread_mutex_unlock(&parse->lock);
+    if (parse->workerCount == 0) {
+        deleteRosterParse(parse);
+        return OTHER_ERROR;
+    }
+
+    *obj = parse;
+    return OK;
+}
+
+Card* nextParsedCard(RosterParse* parse) {
+    Card* card = NULL;
+
+    if (parse == NULL) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&parse->lock);
+    while (parse->queueCount == 0 && parse->runningWorkers > 0) {
+        pthread_cond_wait(&parse->cardReady, &parse->lock);
+    }
+    if (parse->queueCount > 0) {
+        card = parse->queue[parse->queueHead];
+        parse->queueHead = (parse->queueHead + 1) % parse->options.queueLength;
+        parse->queueCount--;
+        pthread_cond_signal(&parse->spaceFree);
+    }
+    pthread_mutex_unlock(&parse->lock);
+
+    return card;
+}
+
+VCardErrorCode finishRosterParse(RosterParse* parse) {
+    if (parse == NULL) {
+        return OTHER_ERROR;
+    }
+
+    atomic_store(&parse->cancelled, true);
+    pthread_mutex_lock(&parse->lock);
+    pthread_cond_broadcast(&parse->spaceFree);
+    pthread_mutex_unlock(&parse->lock);
+    for (int i = 0; i < parse->workerCount; i++) {
+        pthread_join(parse->workers[i], NULL);
+    }
+
+    bool collected = collectDiagnostics(parse);
+    deleteRosterParse(parse);
+
+    return collected ? OK : OTHER_ERROR;
+}
+// *************************************************************************
+
+// ************* Setup *****************************************************
+RosterParse* createRosterParse(const ParallelParseOptions* options, bool ordered) {
+    RosterParse* parse = (RosterParse*)calloc(1, sizeof(RosterParse));
+    if (parse == NULL) {
+        return NULL;
+    }
+
+    if (options != NULL) {
+        parse->options = *options;
+    } else {
+        initParallelParseOptions(&parse->options);
+    }
+    if (parse->options.threads <= 0) {
+        parse->options.threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (parse->options.threads <= 0) {
+        parse->options.threads = 1;
+    }
+    if (parse->options.chunkBytes == 0) {
+        parse->options.chunkBytes = DEFAULT_CHUNK_BYTES;
+    }
+    if (parse->options.queueLength <= 0) {
+        parse->options.queueLength = DEFAULT_QUEUE_LENGTH;
+    }
+
+    parse->ordered = ordered;
+    atomic_init(&parse->nextChunk, 0);
+    atomic_init(&parse->cancelled, false);
+    pthread_mutex_init(&parse->lock, NULL);
+    pthread_cond_init(&parse->cardReady, NULL);
+    pthread_cond_init(&parse->spaceFree, NULL);
+
+    return parse;
+}
+
+void deleteRosterParse(RosterParse* parse) {
+    for (int i = 0; i < parse->chunkCount; i++) {
+        ParseChunk* chunk = &parse->chunks[i];
+        for (int c = 0; c < chunk->cardCount; c++) {
+            deleteCard(chunk->cards[c]);
+        }
+        for (int d = 0; d < chunk->diagnosticCount; d++) {
+            deleteDiagnostic(chunk->diagnostics[d]);
+        }
+        free(chunk->cards);
+        free(chunk->diagnostics);
+    }
+    for (int i = 0; i < parse->queueCount; i++) {
+        deleteCard(parse->queue[(parse->queueHead + i) % parse->options.queueLength]);
+    }
+
+    pthread_cond_destroy(&parse->spaceFree);
+    pthread_cond_destroy(&parse->cardReady);
+    pthread_mutex_destroy(&parse->lock);
+    if (parse->mapping != NULL) {
+        munmap(parse->mapping, parse->mappingLength);
+    }
+    free(parse->buffer);
+    free(parse->chunks);
+    free(parse->queue);
+    free(parse->workers);
+    free(parse);
+}
+
+// maps a plain file, or decompresses a compressed one into memory
+VCardErrorCode loadInput(RosterParse* parse, const char* fileName) {
+    VCardCompression compression = compressionForFileName(fileName, NULL);
+    if (!compressionSupported(compression)) {
+        return INV_FILE;
+    }
+
+    if (compression == VCARD_COMPRESSION_NONE) {
+        struct stat info;
+        int fd = open(fileName, O_RDONLY);
+        if (fd < 0) {
+            return INV_FILE;
+        }
+        if (fstat(fd, &info) != 0) {
+            close(fd);
+            return INV_FILE;
+        }
+        parse->data = "";
+        parse->length = 0;
+        if (info.st_size > 0) {
+            parse->mapping = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (parse->mapping == MAP_FAILED) {
+                parse->mapping = NULL;
+                close(fd);
+                return INV_FILE;
+            }
+            madvise(parse->mapping, info.st_size, MADV_SEQUENTIAL);
+            parse->mappingLength = info.st_size;
+            parse->data = (const char*)parse->mapping;
+            parse->length = info.st_size;
+        }
+        close(fd);
+        return OK;
+    }
+
+    FILE* fp = fopen(fileName, "rb");
+    if (fp == NULL) {
+        return INV_FILE;
+    }
+    DecompressStream* stream = NULL;
+    VCardErrorCode error = openDecompressStream(fp, compression, &stream);
+    if (error != OK) {
+        fclose(fp);
+        return error;
+    }
+
+    size_t capacity = 0;
+    size_t length = 0;
+    size_t count = 0;
+    do {
+        if (length == capacity) {
+            capacity = capacity > 0 ? capacity * 2 : READ_BLOCK;
+            char* grown = (char*)realloc(parse->buffer, capacity);
+            if (grown == NULL) {
+                error = OTHER_ERROR;
+                break;
+            }
+            parse->buffer = grown;
+        }
+        count = readDecompressStream(stream, parse->buffer + length, capacity - length);
+        length += count;
+    } while (count > 0);
+    if (closeDecompressStream(stream) != OK && error == OK) {
+        error = INV_FILE;
+    }
+    fclose(fp);
+
+    parse->data = parse->buffer != NULL ? parse->buffer : "";
+    parse->length = length;
+    return error;
+}
+
+// cuts the input into chunks of about chunkBytes that each start with a card
+bool cutChunks(RosterParse* parse) {
+    size_t chunkBytes = parse->options.chunkBytes;
+    const char* position = parse->data;
+    const char* end = parse->data + parse->length;
+
+    parse->chunks = (ParseChunk*)calloc(parse->length / chunkBytes + 2, sizeof(ParseChunk));
+    if (parse->chunks == NULL) {
+        return false;
+    }
+
+    while (position < end) {
+        ParseChunk* chunk = &parse->chunks[parse->chunkCount++];
+        chunk->start = position;
+        if ((size_t)(end - position) <= chunkBytes) {
+            chunk->end = end;
+        } else {
+            int lines = 0;
+            chunk->end = nextCardStart(position + chunkBytes - 1, end, &lines);
+        }
+        position = chunk->end;
+    }
+
+    return true;
+}
+
+VCardErrorCode parseInOrder(RosterParse* parse, List** roster) {
+    if (!cutChunks(parse)) {
+        deleteRosterParse(parse);
+        return OTHER_ERROR;
+    }
+
+    int threads = parse->options.threads;
+    if (threads > parse->chunkCount) {
+        threads = parse->chunkCount;
+    }
+    pthread_t* workers = (pthread_t*)calloc(threads > 0 ? threads : 1, sizeof(pthread_t));
+    int started = 0;
+    while (workers != NULL && started < threads - 1 && pthread_create(&workers[started], NULL, parseChunks, parse) == 0) {
+        started++;
+    }
+    parseChunks(parse); // the calling thread works too, and finishes the chunks on its own if no thread started
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    free(workers);
+
+    List* cards = createRosterList();
+    bool failed = !collectDiagnostics(parse);
+    for (int i = 0; i < parse->chunkCount; i++) {
+        ParseChunk* chunk = &parse->chunks[i];
+        for (int c = 0; c < chunk->cardCount; c++) {
+            insertBack(cards, chunk->cards[c]);
+        }
+        chunk->cardCount = 0;
+    }
+    deleteRosterParse(parse);
+
+    if (failed) {
+        freeList(cards);
+        return OTHER_ERROR;
+    }
+    *roster = cards;
+    return OK;
+}
+
+/*	Moves the diagnostics of the parsed chunks to the caller's list, numbering their lines from the start
+	of the input.  That needs the line count of every chunk before, so it stops at the first chunk a
+	cancelled parse never finished.  Returns false if a chunk ran out of memory.
+*/
+bool collectDiagnostics(RosterParse* parse) {
+    List* diagnostics = parse->options.parse.diagnostics;
+    bool counted = true;
+    bool failed = false;
+    int lineBase = 0;
+
+    for (int i = 0; i < parse->chunkCount; i++) {
+        ParseChunk* chunk = &parse->chunks[i];
+        failed = failed || chunk->failed;
+        counted = counted && chunk->parsed;
+        for (int d = 0; d < chunk->diagnosticCount; d++) {
+            VCardDiagnostic* diagnostic = chunk->diagnostics[d];
+            if (counted && diagnostics != NULL) {
+                diagnostic->line += lineBase;
+                insertBack(diagnostics, diagnostic);
+            } else {
+                deleteDiagnostic(diagnostic);
+            }
+        }
+        chunk->diagnosticCount = 0;
+        lineBase += chunk->lines;
+    }
+
+    return !failed;
+}
+// *************************************************************************
+
+// ************* Workers ***************************************************
+void* parseChunks(void* argument) {
+    RosterParse* parse = (RosterParse*)argument;
+    List* scratch = NULL;
+
+    if (parse->options.parse.diagnostics != NULL) {
+        scratch = initializeList(diagnosticToString, keepDiagnostic, compareDiagnostics);
+    }
+
+    int index;
+    while (!atomic_load(&parse->cancelled) && (index = atomic_fetch_add(&parse->nextChunk, 1)) < parse->chunkCount) {
+        ParseChunk* chunk = &parse->chunks[index];
+        chunk->failed = !parseChunk(parse, chunk, scratch);
+    }
+    if (scratch != NULL) {
+        freeList(scratch);
+    }
+
+    if (!parse->ordered) {
+        pthread_mutex_lock(&parse->lock);
+        if (--parse->runningWorkers == 0) {
+            pthread_cond_broadcast(&parse->cardReady);
+        }
+        pthread_mutex_unlock(&parse->lock);
+    }
+
+    return NULL;
+}
+
+bool parseChunk(RosterParse* parse, ParseChunk* chunk, List* scratch) {
+    VCardParseOptions options = parse->options.parse;
+    options.diagnostics = scratch;
+    if (parse->options.parse.diagnostics != NULL && scratch == NULL) {
+        return false;
+    }
+
+    const char* card = chunk->start;
+    int line = 0; // line breaks before the card, in the chunk
+    while (card < chunk->end) {
+        if (atomic_load_explicit(&parse->cancelled, memory_order_relaxed)) {
+            return true;
+        }
+
+        int lines = 0;
+        const char* next = nextCardStart(card, chunk->end, &lines);
+        const char* textEnd = trimCard(card, next);
+        if (textEnd > card) {
+            Card* parsed = NULL;
+            createCardFromBuffer(card, textEnd - card, &parsed, &options);
+            if (scratch != NULL && !takeDiagnostics(chunk, scratch, card - parse->data, line)) {
+                deleteCard(parsed);
+                return false;
+            }
+            if (parsed != NULL && !deliverCard(parse, chunk, parsed)) {
+                return false;
+            }
+        }
+        line += lines;
+        card = next;
+    }
+    chunk->lines = line;
+    chunk->parsed = true;
+
+    return true;
+}
+
+// moves the diagnostics of one card to its chunk, relative to the chunk instead of the card
+bool takeDiagnostics(ParseChunk* chunk, List* scratch, size_t offset, int line) {
+    bool stored = true;
+
+    void* element;
+    ListIterator iter = createIterator(scratch);
+    while ((element = nextElement(&iter)) != NULL) {
+        VCardDiagnostic* diagnostic = (VCardDiagnostic*)element;
+        diagnostic->offset += offset;
+        diagnostic->line += line;
+
+        if (chunk->diagnosticCount == chunk->diagnosticCapacity) {
+            int capacity = chunk->diagnosticCapacity > 0 ? chunk->diagnosticCapacity * 2 : 16;
+            VCardDiagnostic** grown = (VCardDiagnostic**)realloc(chunk->diagnostics, capacity * sizeof(VCardDiagnostic*));
+            if (grown == NULL) {
+                deleteDiagnostic(diagnostic);
+                stored = false;
+                continue;
+            }
+            chunk->diagnostics = grown;
+            chunk->diagnosticCapacity = capacity;
+        }
+        chunk->diagnostics[chunk->diagnosticCount++] = diagnostic;
+    }
+    clearList(scratch);
+
+    return stored;
+}
+
+// keeps the card with its chunk, or queues it for nextParsedCard
+bool deliverCard(RosterParse* parse, ParseChunk* chunk, Card* card) {
+    if (parse->ordered) {
+        if (chunk->cardCount == chunk->cardCapacity) {
+            int capacity = chunk->cardCapacity > 0 ? chunk->cardCapacity * 2 : 64;
+            Card** grown = (Card**)realloc(chunk->cards, capacity * sizeof(Card*));
+            if (grown == NULL) {
+                deleteCard(card);
+                return false;
+            }
+            chunk->cards = grown;
+            chunk->cardCapacity = capacity;
+        }
+        chunk->cards[chunk->cardCount++] = card;
+        return true;
+    }
+
+    pthread_mutex_lock(&parse->lock);
+    while (parse->queueCount == parse->options.queueLength && !atomic_load(&parse->cancelled)) {
+        pthread_cond_wait(&parse->spaceFree, &parse->lock);
+    }
+    if (atomic_load(&parse->cancelled)) {
+        pthread_mutex_unlock(&parse->lock);
+        deleteCard(card);
+        return true;
+    }
+    parse->queue[(parse->queueHead + parse->queueCount) % parse->options.queueLength] = card;
+    parse->queueCount++;
+    pthread_cond_signal(&parse->cardReady);
+    pthread_mutex_unlock(&parse->lock);
+
+    return true;
+}
+// *************************************************************************
+
+// ************* Helpers ***************************************************
+// the first line after the one position is on that begins a card, or end; *lines counts the line breaks passed
+const char* nextCardStart(const char* position, const char* end, int* lines) {
+    while (position < end) {
+        const char* newline = memchr(position, '\n', end - position);
+        if (newline == NULL) {
+            return end;
+        }
+        (*lines)++;
+        position = newline + 1;
+        if (isCardStart(position, end)) {
+            return position;
+        }
+    }
+
+    return end;
+}
+
+bool isCardStart(const char* position, const char* end) {
+    size_t available = end - position;
+
+    return available >= 11 && strncasecmp(position, "BEGIN:VCARD", 11) == 0 &&
+           (available == 11 || position[11] == '\r' || position[11] == '\n');
+}
+
+// the end of a card's text without the blank lines after it, or start if it is all blank
+const char* trimCard(const char* start, const char* end) {
+    const char* last = end;
+
+    while (last > start && (last[-1] == '\r' || last[-1] == '\n')) {
+        last--;
+    }
+    if (last == start) {
+        return start;
+    }
+
+    // keep the line ending of the last line
+    if (end - last >= 2 && last[0] == '\r' && last[1] == '\n') {
+        return last + 2;
+    }
+    if (end - last >= 1 && last[0] == '\n') {
+        return last + 1;
+    }
+    return last;
+}
+
+// the scratch list only lends its diagnostics to the chunk
+void keepDiagnostic(void* diagnostic) {
+    (void)diagnostic;
+}
+// *************************************************************************
@@ -0,0 +1,430 @@
+// Author: Ben Martens (1349551)
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+
+#include "VCIntern.h"
+#include "VCParseCache.h"
+
+#define DEFAULT_BUCKETS 64
+#define GLOBAL_CACHE_BYTES (64u << 20)
+
+// identifies one version of a file
+typedef struct fileKey {
+    dev_t device;
+    ino_t inode;
+    off_t size;
+    struct timespec modified;
+} FileKey;
+
+/*	An entry is referenced by the cache while it is in the table, and by every CachedCard handed out.
+	It is freed when the last reference goes, so the cache and its users never have to agree on who
+	drops it.
+*/
+struct cachedCard {
+    atomic_int references;
+    char* path;
+    uint64_t hash;
+    FileKey key;
+    Card* card;
+    size_t bytes;
+
+    // guarded by the cache's lock
+    bool loading;
+    bool inTable;
+    VCardErrorCode error;
+    struct cachedCard* next;  // in its bucket
+    struct cachedCard* newer; // least recently used order
+    struct cachedCard* older;
+};
+
+struct parseCache {
+    pthread_mutex_t lock;
+    pthread_cond_t loaded;
+    CachedCard** buckets;
+    size_t bucketCount; // always a power of two
+    CachedCard* newest;
+    CachedCard* oldest;
+    size_t maxBytes;
+    ParseCacheStats stats;
+};
+
+static ParseCache* globalCache = NULL;
+static pthread_once_t globalCacheOnce = PTHREAD_ONCE_INIT;
+
+static void createGlobalCache(void);
+static bool readFileKey(const char* fileName, FileKey* key);
+static bool sameFileKey(const FileKey* first, const FileKey* second);
+static CachedCard* findEntry(ParseCache* cache, const char* path, uint64_t hash);
+static void insertEntry(ParseCache* cache, CachedCard* entry);
+static void removeEntry(ParseCache* cache, CachedCard* entry);
+static void touchEntry(ParseCache* cache, CachedCard* entry);
+static void unlinkLRU(ParseCache* cache, CachedCard* entry);
+static void evictEntries(ParseCache* cache);
+static void growTable(ParseCache* cache);
+static size_t cardBytes(const Card* card);
+static size_t propertyBytes(const Property* property);
+static size_t stringBytes(const char* string);
+
+// ************* Cache *****************************************************
+ParseCache* createParseCache(size_t maxBytes) {
+    ParseCache* cache = (ParseCache*)calloc(1, sizeof(ParseCache));
+    if (cache == NULL) {
+        return NULL;
+    }
+
+    cache->bucketCount = DEFAULT_BUCKETS;
+    cache->buckets = (CachedCard**)calloc(cache->bucketCount, sizeof(CachedCard*));
+    if (cache->buckets == NULL) {
+        free(cache);
+        return NULL;
+    }
+    pthread_mutex_init(&cache->lock, NULL);
+    pthread_cond_init(&cache->loaded, NULL);
+    cache->maxBytes = maxBytes;
+
+    return cache;
+}
+
+void deleteParseCache(ParseCache* cache) {
+    if (cache == NULL) {
+        return;
+    }
+
+    clearParseCache(cache);
+    pthread_cond_destroy(&cache->loaded);
+    pthread_mutex_destroy(&cache->lock);
+    free(cache->buckets);
+    free(cache);
+}
+
+ParseCache* vCardParseCache(void) {
+    pthread_once(&globalCacheOnce, createGlobalCache);
+    return globalCache;
+}
+
+void createGlobalCache(void) {
+    globalCache = createParseCache(GLOBAL_CACHE_BYTES);
+}
+
+void clearParseCache(ParseCache* cache) {
+    if (cache == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    for (size_t b = 0; b < cache->bucketCount; b++) {
+        CachedCard* entry = cache->buckets[b];
+        while (entry != NULL) {
+            CachedCard* next = entry->next;
+            if (!entry->loading) {
+                removeEntry(cache, entry);
+            }
+            entry = next;
+        }
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
+
+void parseCacheStatistics(ParseCache* cache, ParseCacheStats* stats) {
+    if (cache == NULL || stats == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    *stats = cache->stats;
+    pthread_mutex_unlock(&cache->lock);
+}
+// *************************************************************************
+
+// ************* Loading ***************************************************
+VCardErrorCode loadCachedCard(ParseCache* cache, const char* fileName, CachedCard** obj) {
+    FileKey key;
+
+    if (obj == NULL) {
+        return OTHER_ERROR;
+    }
+    *obj = NULL;
+    if (cache == NULL) {
+        cache = vCardParseCache();
+    }
+    if (cache == NULL) {
+        return OTHER_ERROR;
+    }
+    if (fileName == NULL || !readFileKey(fileName, &key)) {
+        return INV_FILE;
+    }
+
+    uint64_t hash = hashString(fileName, strlen(fileName), false);
+    pthread_mutex_lock(&cache->lock);
+    CachedCard* entry = findEntry(cache, fileName, hash);
+    if (entry != NULL && sameFileKey(&entry->key, &key)) {
+        atomic_fetch_add(&entry->references, 1);
+        touchEntry(cache, entry);
+        while (entry->loading) {
+            pthread_cond_wait(&cache->loaded, &cache->lock);
+        }
+        VCardErrorCode error = entry->error;
+        if (error == OK) {
+            cache->stats.hits++;
+        }
+        pthread_mutex_unlock(&cache->lock);
+
+        if (error != OK) {
+            releaseCachedCard(entry);
+            return error;
+        }
+        *obj = entry;
+        return OK;
+    }
+
+    // a different version of the file, or a new one: parse it outside the lock, while other loads wait.
+    // An older version still loading leaves the table too; its loader sees inTable is false and keeps it out.
+    if (entry != NULL) {
+        removeEntry(cache, entry);
+    }
+    cache->stats.misses++;
+    entry = (CachedCard*)calloc(1, sizeof(CachedCard));
+    char* path = strdup(fileName);
+    if (entry == NULL || path == NULL) {
+        pthread_mutex_unlock(&cache->lock);
+        free(entry);
+        free(path);
+        return OTHER_ERROR;
+    }
+    atomic_init(&entry->references, 2); // the table and the caller
+    entry->path = path;
+    entry->hash = hash;
+    entry->key = key;
+    entry->loading = true;
+    entry->error = OK;
+    insertEntry(cache, entry);
+    pthread_mutex_unlock(&cache->lock);
+
+    Card* card = NULL;
+    VCardErrorCode error = createCard(path, &card);
+    size_t bytes = card != NULL ? cardBytes(card) : 0;
+
+    // if the file changed while it was parsed, the card may be a mix of both versions: don't keep it
+    FileKey after;
+    bool unchanged = readFileKey(fileName, &after) && sameFileKey(&key, &after);
+
+    pthread_mutex_lock(&cache->lock);
+    entry->card = card;
+    entry->error = error;
+    entry->loading = false;
+    pthread_cond_broadcast(&cache->loaded);
+    if (entry->inTable && (error != OK || !unchanged)) {
+        removeEntry(cache, entry);
+    } else if (entry->inTable) {
+        entry->bytes = bytes;
+        cache->stats.bytes += bytes;
+        evictEntries(cache);
+    }
+    pthread_mutex_unlock(&cache->lock);
+
+    if (error != OK) {
+        releaseCachedCard(entry);
+        return error;
+    }
+    *obj = entry;
+    return OK;
+}
+
+const Card* cachedCardGet(const CachedCard* cached) {
+    return cached != NULL ? cached->card : NULL;
+}
+
+CachedCard* retainCachedCard(CachedCard* cached) {
+    if (cached != NULL) {
+        atomic_fetch_add(&cached->references, 1);
+    }
+
+    return cached;
+}
+
+void releaseCachedCard(CachedCard* cached) {
+    if (cached == NULL || atomic_fetch_sub(&cached->references, 1) != 1) {
+        return;
+    }
+
+    deleteCard(cached->card);
+    free(cached->path);
+    free(cached);
+}
+// *************************************************************************
+
+// ************* Table and LRU list ****************************************
+// the caller holds the lock for all of these
+
+CachedCard* findEntry(ParseCache* cache, const char* path, uint64_t hash) {
+    for (CachedCard* entry = cache->buckets[hash & (cache->bucketCount - 1)]; entry != NULL; entry = entry->next) {
+        if (entry->hash == hash && strcmp(entry->path, path) == 0) {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+void insertEntry(ParseCache* cache, CachedCard* entry) {
+    CachedCard** bucket = &cache->buckets[entry->hash & (cache->bucketCount - 1)];
+    entry->next = *bucket;
+    *bucket = entry;
+    entry->inTable = true;
+
+    entry->older = cache->newest;
+    entry->newer = NULL;
+    if (cache->newest != NULL) {
+        cache->newest->newer = entry;
+    } else {
+        cache->oldest = entry;
+    }
+    cache->newest = entry;
+
+    cache->stats.entries++;
+    if ((size_t)cache->stats.entries > cache->bucketCount) {
+        growTable(cache);
+    }
+}
+
+// takes the entry out of the table and drops the table's reference
+void removeEntry(ParseCache* cache, CachedCard* entry) {
+    CachedCard** link = &cache->buckets[entry->hash & (cache->bucketCount - 1)];
+    while (*link != entry) {
+        link = &(*link)->next;
+    }
+    *link = entry->next;
+    unlinkLRU(cache, entry);
+    entry->inTable = false;
+
+    cache->stats.entries--;
+    cache->stats.bytes -= entry->bytes;
+    releaseCachedCard(entry);
+}
+
+void touchEntry(ParseCache* cache, CachedCard* entry) {
+    if (cache->newest == entry) {
+        return;
+    }
+
+    unlinkLRU(cache, entry);
+    entry->older = cache->newest;
+    entry->newer = NULL;
+    cache->newest->newer = entry;
+    cache->newest = entry;
+}
+
+void unlinkLRU(ParseCache* cache, CachedCard* entry) {
+    if (entry->newer != NULL) {
+        entry->newer->older = entry->older;
+    } else {
+        cache->newest = entry->older;
+    }
+    if (entry->older != NULL) {
+        entry->older->newer = entry->newer;
+    } else {
+        cache->oldest = entry->newer;
+    }
+    entry->newer = NULL;
+    entry->older = NULL;
+}
+
+// evicts from the old end, always keeping the newest entry; entries still loading are skipped
+void evictEntries(ParseCache* cache) {
+    CachedCard* entry = cache->oldest;
+
+    while (cache->maxBytes > 0 && cache->stats.bytes > cache->maxBytes && entry != NULL && entry != cache->newest) {
+        CachedCard* newer = entry->newer;
+        if (!entry->loading) {
+            removeEntry(cache, entry);
+            cache->stats.evictions++;
+        }
+        entry = newer;
+    }
+}
+
+void growTable(ParseCache* cache) {
+    size_t bucketCount = cache->bucketCount * 2;
+    CachedCard** buckets = (CachedCard**)calloc(bucketCount, sizeof(CachedCard*));
+    if (buckets == NULL) {
+        return; // longer chains, still correct
+    }
+
+    for (size_t b = 0; b < cache->bucketCount; b++) {
+        CachedCard* entry = cache->buckets[b];
+        while (entry != NULL) {
+            CachedCard* next = entry->next;
+            CachedCard** bucket = &buckets[entry->hash & (bucketCount - 1)];
+            entry->next = *bucket;
+            *bucket = entry;
+            entry = next;
+        }
+    }
+    free(cache->buckets);
+    cache->buckets = buckets;
+    cache->bucketCount = bucketCount;
+}
+// *************************************************************************
+
+// ************* Helpers ***************************************************
+bool readFileKey(const char* fileName, FileKey* key) {
+    struct stat info;
+
+    if (stat(fileName, &info) != 0) {
+        return false;
+    }
+    key->device = info.st_dev;
+    key->inode = info.st_ino;
+    key->size = info.st_size;
+    key->modified = info.st_mtim;
+
+    return true;
+}
+
+bool sameFileKey(const FileKey* first, const FileKey* second) {
+    return first->device == second->device && first->inode == second->inode && first->size == second->size &&
+           first->modified.tv_sec == second->modified.tv_sec && first->modified.tv_nsec == second->modified.tv_nsec;
+}
+
+// rough heap use of a card: every struct and string, not counting allocator overhead
+size_t cardBytes(const Card* card) {
+    size_t bytes = sizeof(Card) + sizeof(List) + (card->fn != NULL ? propertyBytes(card->fn) : 0);
+
+    void* element;
+    ListIterator iter = createIterator(card->optionalProperties);
+    while ((element = nextElement(&iter)) != NULL) {
+        bytes += sizeof(Node) + propertyBytes((const Property*)element);
+    }
+    const DateTime* dates[2] = {card->birthday, card->anniversary};
+    for (int i = 0; i < 2; i++) {
+        if (dates[i] != NULL) {
+            bytes += sizeof(DateTime) + stringBytes(dates[i]->date) + stringBytes(dates[i]->time) + stringBytes(dates[i]->text);
+        }
+    }
+
+    return bytes;
+}
+
+size_t propertyBytes(const Property* property) {
+    size_t bytes = sizeof(Property) + 2 * sizeof(List) + stringBytes(property->name) + stringBytes(property->group);
+
+    void* element;
+    ListIterator iter = createIterator(property->parameters);
+    while ((element = nextElement(&iter)) != NULL) {
+        const Parameter* parameter = (const Parameter*)element;
+        bytes += sizeof(Node) + sizeof(Parameter) + stringBytes(parameter->name) + stringBytes(parameter->value);
+    }
+    iter = createIterator(property->values);
+    while ((element = nextElement(&iter)) != NULL) {
+        bytes += sizeof(Node) + stringBytes((const char*)element);
+    }
+
+    return bytes;
+}
+size_t stringBytes(const char* string) {
+    return string != NULL ? strlen(string) + 1 : 0;
+}
+// *************************************************************************
@@ -2,101 +2,314 @@
 
 #define _GNU_SOURCE
 #include "VCParser.h"
-
-static ssize_t readNextLine(char** currentLine, char** nextLine, FILE* fp, size_t* len);
-static Property* createProperty(Card* card, const char* currentLine);
-static void parsePropertyValues(List* valueList, const char* name, char* valueString);
+#include "VCDecompress.h"
+#include "VCIntern.h"
+#include "VCTrace.h"
+
+#define READ_CHUNK_SIZE 65536 // initial read window of a LineReader; only its growth counts against VCardParseLimits.bytes
+
+// the logical (unfolded) line being parsed and the physical line read ahead to detect folding
+typedef struct lineReader {
+    // input window; for a caller's buffer it is the whole buffer, otherwise it is chunk, refilled by read
+    VCardReadFunction read;
+    void* context;
+    const char* data;
+    size_t dataLength;
+    size_t dataPosition;
+    char* chunk;
+    size_t chunkCapacity;
+    bool endOfInput;
+
+    char* line;
+    size_t lineCapacity;
+    size_t lineOffset;
+    int lineNumber;
+
+    char* next;
+    size_t nextCapacity;
+    ssize_t nextLength; // -1 once the end of the input has been reached
+    bool nextTerminated; // whether the physical line ended with "\r\n"
+    size_t nextOffset;
+    int nextNumber;
+
+    size_t offset;
+    int physicalLines;
+
+    // 0 for no limit, see VCardParseLimits
+    size_t maxLineLength;
+    int maxFolds;
+    bool nextOverLimit; // the look-ahead line is longer than maxLineLength and was not read
+} LineReader;
+
+typedef enum lineStatus { LINE_OK, LINE_END, LINE_UNTERMINATED, LINE_TOO_LONG, LINE_TOO_MANY_FOLDS } LineStatus;
+
+// what parseCard has let the card being parsed use so far
+typedef struct parseBudget {
+    VCardParseLimits limits;
+    int properties;
+    size_t bytes; // properties and dates
+    size_t readerBytes; // the reader's line buffers, as of the current line
+} ParseBudget;
+
+// where the event parser is in the stream of cards
+typedef enum eventState { EVENTS_OUTSIDE, EVENTS_HEADER, EVENTS_INSIDE } EventState;
+
+// a named vCard file, read directly or through a decompressor
+typedef struct cardInput {
+    FILE* fp;
+    DecompressStream* stream;
+    VCardReadFunction read;
+    void* context;
+} CardInput;
+
+/*	A parsed property and everything it owns in one allocation: both list heads, a node for every
+	parameter and value, the Parameter structs, and a copy of the value part of the line that the values
+	point into.  Names and parameter strings that are vCard words in all lower or all upper case share the
+	global copy (see findVCardString); the rest, groups included, are copied after the values.  Elements added to the lists later are allocated as usual.
+*/
+typedef struct propertyBlock {
+    Property property;
+    List parameters;
+    List values;
+    Node nodes[]; // parameter nodes, value nodes, then the Parameter structs and the text
+} PropertyBlock;
+
+// optional properties that the parser keeps (FN, BDAY and ANNIVERSARY are handled separately)
+static const char* optionalPropertyNames[] = {"SOURCE", "KIND", "XML", "N", "NICKNAME", "PHOTO", "GENDER", "ADR",
+        "TEL", "EMAIL", "IIMP", "LANG", "TZ", "GEO", "TITLE", "ROLE", "LOGO", "ORG", "MEMBER", "RELATED",
+        "CATEGORIES", "NOTE", "PRODID", "REV", "SOUND", "UID", "CLIENTPIDMAP", "URL", "KEY", "FBURL",
+        "CALADRURI", "CALURI"};
+
+static VCardErrorCode writeCardFile(const char* fileName, const Card* obj);
+static VCardErrorCode checkCard(const Card* obj);
+static bool hasVCardExtension(const char* fileName, size_t length);
+static VCardErrorCode openCardInput(const char* fileName, CardInput* input);
+static VCardErrorCode closeCardInput(CardInput* input);
+static void initLineReader(LineReader* reader, VCardReadFunction read, void* context, const char* buffer, size_t length, const VCardParseLimits* limits);
+static size_t readFromFile(void* context, char* buffer, size_t size);
+static void freeLineReader(LineReader* reader);
+static LineStatus readNextLine(LineReader* reader);
+static LineStatus skipLongLine(LineReader* reader);
+static void readPhysicalLine(LineReader* reader);
+static VCardErrorCode parseCard(LineReader* reader, Card** obj, const VCardParseOptions* options);
+static VCardErrorCode parseEvents(LineReader* reader, const VCardEventHandler* handler);
+static void addDiagnostic(const VCardParseOptions* options, VCardErrorCode error, const LineReader* reader, const char* reason, bool withText);
+static void locateDiagnostic(VCardDiagnostic* diag, const LineReader* reader, bool withText);
+static bool continueAfterError(const VCardEventHandler* handler, const LineReader* reader, VCardErrorCode error, const char* reason, bool withText);
+static bool scanPropertyLine(const char* line, VCardPropertyEvent* event, const char** reason);
+static bool projectedOut(const char* line, const char* const* projection);
+static bool isOptionalPropertyName(const char* name, size_t length);
+static VCardErrorCode createProperty(Card* card, const char* currentLine, ParseBudget* budget, const char** reason);
+static bool spendBudget(ParseBudget* budget, size_t bytes);
+static size_t readerBytes(const LineReader* reader);
+static const char* nextParameter(const char** position, const char* end, size_t* length);
+static bool tokenIs(const char* token, size_t length, const char* expected);
+static size_t storedLength(size_t length);
+static const char* storeToken(const char* token, size_t length, char** nextText);
+static void parsePropertyValues(List* valueList, char* valueString);
+static size_t propertyBlockSize(int paramCount, int valueCount, size_t textSize);
+static PropertyBlock* createPropertyBlock(int paramCount, int valueCount, size_t textSize, Parameter** params, char** text);
 static DateTime* createDateTime(char* inputString);
 static bool validateDateTime(DateTime* dateTime);
 
 // ************* Card parser ***********************************************
 VCardErrorCode createCard(char* fileName, Card** obj) {
+    return createCardWithOptions(fileName, obj, NULL);
+}
+
+VCardErrorCode createCardWithOptions(char* fileName, Card** obj, const VCardParseOptions* options) {
     VCardErrorCode error = OK;
-    FILE* fp;
-    char* currentLine = NULL;
-    char* nextLine = NULL;
-    size_t len = 0;
-    Card* newCard = NULL;
+    CardInput input;
 
     if (obj == NULL) {
         return OTHER_ERROR;
     }
+    *obj = NULL;
 
-    if (fileName == NULL) {
-        return INV_FILE;
+    error = openCardInput(fileName, &input);
+    if (error != OK) {
+        return error;
     }
 
-    // check the file extension
-    char* extension = strrchr(fileName, '.');
-    if (extension == NULL || (strcmp(extension, ".vcf") != 0 && strcmp(extension, ".vcard") != 0)) {
+    error = createCardFromReader(input.read, input.context, obj, options);
+    // a damaged archive is reported as such, whatever the parser made of the text before the damage
+    if (closeCardInput(&input) != OK) {
+        deleteCard(*obj);
+        *obj = NULL;
+        error = INV_FILE;
+    }
+
+    return error;
+}
+
+VCardErrorCode createCardFromBuffer(const char* buffer, size_t length, Card** obj, const VCardParseOptions* options) {
+    VCardErrorCode error = OK;
+    LineReader reader;
+
+    if (obj == NULL) {
+        return OTHER_ERROR;
+    }
+    *obj = NULL;
+
+    if (buffer == NULL) {
         return INV_FILE;
     }
 
-    fp = fopen(fileName, "r");
+    initLineReader(&reader, NULL, NULL, buffer, length, options != NULL ? &options->limits : NULL);
+    error = parseCard(&reader, obj, options);
+    freeLineReader(&reader);
+
+    return error;
+}
+
+VCardErrorCode createCardFromFile(FILE* fp, Card** obj, const VCardParseOptions* options) {
     if (fp == NULL) {
-        return INV_FILE;
+        if (obj != NULL) {
+            *obj = NULL;
+        }
+        return obj == NULL ? OTHER_ERROR : INV_FILE;
     }
 
-    *obj = (Card*)malloc(sizeof(Card));
-    newCard = *obj;
-    newCard->fn = NULL;
-    newCard->optionalProperties = initializeList(propertyToString, deleteProperty, compareProperties);
-    newCard->birthday = NULL;
-    newCard->anniversary = NULL;
+    return createCardFromReader(readFromFile, fp, obj, options);
+}
 
-    // read the first line and make sure it is the BEGIN:VCARD property
-    if (readNextLine(&currentLine, &nextLine, fp, &len) == -1) {
-        error = INV_PROP;
-        goto EXIT;
+VCardErrorCode createCardFromReader(VCardReadFunction read, void* context, Card** obj, const VCardParseOptions* options) {
+    VCardErrorCode error = OK;
+    LineReader reader;
+
+    if (obj == NULL) {
+        return OTHER_ERROR;
     }
-    if (strcasecmp(currentLine, "BEGIN:VCARD") != 0) {
-        error = INV_CARD;
-        goto EXIT;
+    *obj = NULL;
+
+    if (read == NULL) {
+        return INV_FILE;
     }
 
-    // read the second line and make sure it is the VERSION:4.0 property
-    if (readNextLine(&currentLine, &nextLine, fp, &len) == -1) {
-        error = INV_PROP;
-        goto EXIT;
+    initLineReader(&reader, read, context, NULL, 0, options != NULL ? &options->limits : NULL);
+    error = parseCard(&reader, obj, options);
+    freeLineReader(&reader);
+
+    return error;
+}
+
+void initParseOptions(VCardParseOptions* options) {
+    if (options == NULL) {
+        return;
     }
-    if (strcasecmp(currentLine, "VERSION:4.0") != 0) {
-        error = INV_CARD;
-        goto EXIT;
+
+    options->tolerant = false;
+    options->diagnostics = NULL;
+    options->projection = NULL;
+    memset(&options->limits, 0, sizeof(options->limits));
+}
+
+VCardErrorCode parseVCardEvents(const char* fileName, const VCardEventHandler* handler) {
+    VCardErrorCode error = OK;
+    CardInput input;
+
+    if (handler == NULL) {
+        return OTHER_ERROR;
     }
 
-    // read the file line-by-line (unfolding any folded lines)
-    while (readNextLine(&currentLine, &nextLine, fp, &len) != -1) {
-        if (createProperty(newCard, currentLine) == NULL) {
-            error = INV_PROP;
-            goto EXIT;
-        }
+    error = openCardInput(fileName, &input);
+    if (error != OK) {
+        return error;
     }
 
-    // make sure the file contains the FN property
-    if (newCard->fn == NULL) {
-        error = INV_CARD;
-        goto EXIT;
+    error = parseVCardEventsFromReader(input.read, input.context, handler);
+    if (closeCardInput(&input) != OK) {
+        error = INV_FILE;
     }
 
-    // make sure the file ends with the END:VCARD property
-    if (strcasecmp(currentLine, "END:VCARD") != 0) {
-        error = INV_CARD;
-        goto EXIT;
+    return error;
+}
+
+VCardErrorCode parseVCardEventsFromBuffer(const char* buffer, size_t length, const VCardEventHandler* handler) {
+    VCardErrorCode error = OK;
+    LineReader reader;
+
+    if (handler == NULL) {
+        return OTHER_ERROR;
+    }
+    if (buffer == NULL) {
+        return INV_FILE;
     }
 
-EXIT:
-    if (error != OK) {
-        deleteCard(newCard);
-        newCard = NULL;
+    initLineReader(&reader, NULL, NULL, buffer, length, NULL);
+    error = parseEvents(&reader, handler);
+    freeLineReader(&reader);
+
+    return error;
+}
+
+VCardErrorCode parseVCardEventsFromReader(VCardReadFunction read, void* context, const VCardEventHandler* handler) {
+    VCardErrorCode error = OK;
+    LineReader reader;
+
+    if (handler == NULL) {
+        return OTHER_ERROR;
     }
-    if (fp) {
-        fclose(fp);
+    if (read == NULL) {
+        return INV_FILE;
     }
-    free(currentLine);
-    free(nextLine);
+
+    initLineReader(&reader, read, context, NULL, 0, NULL);
+    error = parseEvents(&reader, handler);
+    freeLineReader(&reader);
+
     return error;
 }
 
+bool nextVCardParameter(VCardSpan* parameters, VCardSpan* name, VCardSpan* value) {
+    if (parameters == NULL || parameters->start == NULL || name == NULL || value == NULL) {
+        return false;
+    }
+
+    const char* position = parameters->start;
+    const char* end = parameters->start + parameters->length;
+    size_t length = 0;
+    const char* token = nextParameter(&position, end, &length);
+    parameters->start = position;
+    parameters->length = end - position;
+    if (token == NULL) {
+        return false;
+    }
+
+    // the parser only reports well-formed parameters, but a caller's span may have one without '='
+    const char* equals = memchr(token, '=', length);
+    name->start = token;
+    name->length = equals != NULL ? (size_t)(equals - token) : length;
+    value->start = equals != NULL ? equals + 1 : token + length;
+    value->length = length - name->length - (equals != NULL);
+
+    return true;
+}
+
+bool nextVCardValue(VCardSpan* values, VCardSpan* value) {
+    if (values == NULL || values->start == NULL || value == NULL) {
+        return false;
+    }
+
+    const char* semicolon = memchr(values->start, ';', values->length);
+    value->start = values->start;
+    if (semicolon == NULL) {
+        value->length = values->length;
+        values->start = NULL;
+        values->length = 0;
+    } else {
+        value->length = semicolon - values->start;
+        values->start = semicolon + 1;
+        values->length -= value->length + 1;
+    }
+
+    return true;
+}
+
+bool vCardSpanIs(VCardSpan span, const char* expected) {
+    return span.start != NULL && expected != NULL && tokenIs(span.start, span.length, expected);
+}
+
 void deleteCard(Card* obj) {
     if (obj == NULL) {
         return;
@@ -195,6 +408,10 @@ char* errorToString(VCardErrorCode err) {
         err_string = (char*)malloc(12);
         strcpy(err_string, "OTHER_ERROR");
         break;   
+    case LIMIT_EXCEEDED:
+        err_string = (char*)malloc(15);
+        strcpy(err_string, "LIMIT_EXCEEDED");
+        break;
     default:
         err_string = (char*)malloc(19);
         strcpy(err_string, "Invalid error code");
@@ -205,6 +422,24 @@ char* errorToString(VCardErrorCode err) {
 }
 
 VCardErrorCode writeCard(const char* fileName, const Card* obj) {
+    int length = obj != NULL && obj->optionalProperties != NULL ? getLength(obj->optionalProperties) : 0;
+    VCARD_TRACE(write__start, "writeCard", VCARD_TRACE_BEGIN, "properties", length);
+    VCardErrorCode error = writeCardFile(fileName, obj);
+    VCARD_TRACE(write__done, "writeCard", VCARD_TRACE_END, "error", error);
+
+    return error;
+}
+
+VCardErrorCode validateCard(const Card* obj) {
+    int length = obj != NULL && obj->optionalProperties != NULL ? getLength(obj->optionalProperties) : 0;
+    VCARD_TRACE(validate__start, "validateCard", VCARD_TRACE_BEGIN, "properties", length);
+    VCardErrorCode error = checkCard(obj);
+    VCARD_TRACE(validate__done, "validateCard", VCARD_TRACE_END, "error", error);
+
+    return error;
+}
+
+VCardErrorCode writeCardFile(const char* fileName, const Card* obj) {
     FILE* fp;
     char* cardString = NULL;
     char* fullName = NULL;
@@ -287,7 +522,7 @@ VCardErrorCode writeCard(const char* fileName, const Card* obj) {
     return OK;
 }
 
-VCardErrorCode validateCard(const Card* obj) {
+VCardErrorCode checkCard(const Card* obj) {
     if (obj == NULL ||
             obj->fn == NULL ||
             obj->optionalProperties == NULL) {
@@ -436,8 +671,12 @@ void deleteProperty(void* toBeDeleted) {
     }
     
     property = (Property*)toBeDeleted;
-    free(property->name);
-    if (property->group && strlen(property->group) > 0) {
+    // the name and group of a parsed property are interned or live in its own allocation (see createProperty)
+    bool parsed = listStorageContains(property->parameters, property);
+    if (!parsed) {
+        free(property->name);
+    }
+    if (!parsed && property->group && strlen(property->group) > 0) {
         free(property->group);
     }
     freeList(property->parameters);
@@ -457,8 +696,13 @@ int compareProperties(const void* first, const void* second) {
     firstProperty = (Property*)first;
     secondProperty = (Property*)second;
 
-    ret += strcasecmp(firstProperty->name, secondProperty->name);
-    ret += strcasecmp(firstProperty->group, secondProperty->group);
+    // parsed names and groups are interned, so equal ones are usually the same pointer
+    if (firstProperty->name != secondProperty->name) {
+        ret += strcasecmp(firstProperty->name, secondProperty->name);
+    }
+    if (firstProperty->group != secondProperty->group) {
+        ret += strcasecmp(firstProperty->group, secondProperty->group);
+    }
 
     if (getLength(firstProperty->parameters) != getLength(secondProperty->parameters)) {
         ret++;
@@ -500,36 +744,41 @@ char* propertyToString(void* prop) {
     }
 
     property = (Property*)prop;
-    size_t length = strlen(property->name) + 1;
-
-    propertyString = (char*)malloc(length + 1);
-    snprintf(propertyString, length + 1, "%s", property->name);
 
+    // measure first so the string is built in one allocation (repeated strcat is quadratic on long properties)
+    size_t length = strlen(property->name) + 1;
     void* paramElem;
     ListIterator paramIter = createIterator(property->parameters);
     while ((paramElem = nextElement(&paramIter)) != NULL) {
         Parameter* param = (Parameter*)paramElem;
-        size_t length = 1 + strlen(param->name) + 1 + strlen(param->value) + 1;
-        propertyString = (char*)realloc(propertyString, strlen(propertyString) + length);
-        strcat(propertyString, ";");
-        strcat(propertyString, param->name);
-        strcat(propertyString, "=");
-        strcat(propertyString, param->value);
+        length += 1 + strlen(param->name) + 1 + strlen(param->value);
     }
-    propertyString = (char*)realloc(propertyString, strlen(propertyString) + 2);
-    strcat(propertyString, ":");
-
     void* valueElem;
     ListIterator valueIter = createIterator(property->values);
     while ((valueElem = nextElement(&valueIter)) != NULL) {
-        char* value = (char*)valueElem;
-        propertyString = (char*)realloc(propertyString, strlen(propertyString) + strlen(value) + 2);
-        strcat(propertyString, property->values->printData(value));
-        strcat(propertyString, ";");
+        length += strlen(property->values->printData(valueElem)) + 1;
+    }
+
+    propertyString = (char*)malloc(length + 2);
+    char* end = stpcpy(propertyString, property->name);
+
+    paramIter = createIterator(property->parameters);
+    while ((paramElem = nextElement(&paramIter)) != NULL) {
+        Parameter* param = (Parameter*)paramElem;
+        end = stpcpy(end, ";");
+        end = stpcpy(end, param->name);
+        end = stpcpy(end, "=");
+        end = stpcpy(end, param->value);
+    }
+    end = stpcpy(end, ":");
+
+    valueIter = createIterator(property->values);
+    while ((valueElem = nextElement(&valueIter)) != NULL) {
+        end = stpcpy(end, property->values->printData(valueElem));
+        end = stpcpy(end, ";");
     }
-    propertyString = (char*)realloc(propertyString, strlen(propertyString) + 2); // make room for the \r
-    propertyString[strlen(propertyString) - 1] = '\r'; // replace the last ';' with '\r' (just used for writing back to a file)
-    strcat(propertyString, "\n"); // add the newline
+    *(end - 1) = '\r'; // replace the last ';' with '\r' (just used for writing back to a file)
+    strcpy(end, "\n"); // add the newline
 
     return propertyString;
 }
@@ -559,8 +808,13 @@ int compareParameters(const void* first, const void* second) {
     firstParam = (Parameter*)first;
     secondParam = (Parameter*)second;
 
-    ret += strcasecmp(firstParam->name, secondParam->name);
-    ret += strcasecmp(firstParam->value, secondParam->value);
+    // parsed parameters are interned, so equal ones are usually the same pointers
+    if (firstParam->name != secondParam->name) {
+        ret += strcasecmp(firstParam->name, secondParam->name);
+    }
+    if (firstParam->value != secondParam->value) {
+        ret += strcasecmp(firstParam->value, secondParam->value);
+    }
 
     return ret;
 }
@@ -668,289 +922,1139 @@ char* dateToString(void* date) {
 }
 // **************************************************************************
 
-// ************* Static helper functions ************************************
-ssize_t readNextLine(char** currentLine, char** nextLine, FILE* fp, size_t* len) {
-    ssize_t read_size = 0;
-
-    if (*currentLine == NULL) {
-        getline(currentLine, len, fp);
-        if (*(*currentLine + strlen(*currentLine) - 2) != '\r') { // make sure line ends with "\r\n"
-            return -1;
-        }
-        *(*currentLine + strlen(*currentLine) - 2) = '\0'; // remove the \r\n from the string
-        read_size = getline(nextLine, len, fp);
-        if (*(*nextLine + strlen(*nextLine) - 2) != '\r') { // make sure line ends with "\r\n"
-            return -1;
-        }
-        *(*nextLine + strlen(*nextLine) - 2) = '\0'; // remove the \r\n from the string
-        while (*nextLine[0] == ' ') {
-            *currentLine = (char*)realloc(*currentLine, strlen(*currentLine) + strlen(*nextLine));
-            strcat(*currentLine, *nextLine + 1);
-            read_size = getline(nextLine, len, fp);
-            if (*(*nextLine + strlen(*nextLine) - 2) != '\r') { // make sure line ends with "\r\n"
-                return -1;
-            }
-            *(*nextLine + strlen(*nextLine) - 2) = '\0';
-        }
-    } else {
-        // copy nextLine to currentLine
-        *currentLine = (char*)realloc(*currentLine, strlen(*nextLine) + 1);
-        if (*currentLine) {
-            snprintf(*currentLine, strlen(*nextLine) + 1, "%s", *nextLine);
-        } else {
-            return -1;
-        }
+// ************* Copy helper functions **************************************
+Card* copyCard(const Card* obj) {
+    Card* newCard = NULL;
 
-        read_size = getline(nextLine, len, fp);
-        if (*(*nextLine + strlen(*nextLine) - 2) != '\r') { // make sure line ends with "\r\n"
-            return -1;
-        }
-        *(*nextLine + strlen(*nextLine) - 2) = '\0'; // remove the \r\n from the string
-        while (*nextLine[0] == ' ') {
-            *currentLine = (char*)realloc(*currentLine, strlen(*currentLine) + strlen(*nextLine));
-            strcat(*currentLine, *nextLine + 1);
-            read_size = getline(nextLine, len, fp);
-            if (*(*nextLine + strlen(*nextLine) - 2) != '\r') { // make sure line ends with "\r\n"
-                return -1;
-            }
-            *(*nextLine + strlen(*nextLine) - 2) = '\0';
-        }
+    if (obj == NULL) {
+        return NULL;
+    }
+
+    newCard = (Card*)malloc(sizeof(Card));
+    if (newCard == NULL) {
+        return NULL;
+    }
+    newCard->fn = copyProperty(obj->fn);
+    newCard->optionalProperties = initializeList(propertyToString, deleteProperty, compareProperties);
+    newCard->birthday = copyDate(obj->birthday);
+    newCard->anniversary = copyDate(obj->anniversary);
+
+    void* element;
+    ListIterator iter = createIterator(obj->optionalProperties);
+    while ((element = nextElement(&iter)) != NULL) {
+        insertBack(newCard->optionalProperties, copyProperty((Property*)element));
     }
 
-    return read_size;
+    return newCard;
 }
 
-Property* createProperty(Card* card, const char* stringToParse) {
-    char* propertyName = NULL;
-    char* paramString = NULL;
-    char* valueString = NULL;
-    char* propertyString = NULL; // just a temporary string so that the original one isn't modified by strtok
+Property* copyProperty(const Property* prop) {
     Property* newProperty = NULL;
 
+    if (prop == NULL) {
+        return NULL;
+    }
+
     newProperty = (Property*)malloc(sizeof(Property));
-    newProperty->name = NULL;
-    newProperty->group = NULL;
+    if (newProperty == NULL) {
+        return NULL;
+    }
+    newProperty->name = strdup(prop->name);
+    if (prop->group && strlen(prop->group) > 0) {
+        newProperty->group = strdup(prop->group);
+    } else {
+        newProperty->group = ""; // empty groups are never freed (see deleteProperty)
+    }
     newProperty->parameters = initializeList(parameterToString, deleteParameter, compareParameters);
     newProperty->values = initializeList(valueToString, deleteValue, compareValues);
-    propertyString = (char*)malloc(strlen(stringToParse) + 1);
-    snprintf(propertyString, strlen(stringToParse) + 1, "%s", stringToParse);
-    
-    valueString = strpbrk(propertyString, ":"); 
-    if (valueString) {
-        valueString = valueString + 1; // set valueString to everything after colon
-    } else { // no colon in the string
-        free(propertyString);
-        deleteProperty(newProperty);
+
+    void* element;
+    ListIterator iter = createIterator(prop->parameters);
+    while ((element = nextElement(&iter)) != NULL) {
+        insertBack(newProperty->parameters, copyParameter((Parameter*)element));
+    }
+    iter = createIterator(prop->values);
+    while ((element = nextElement(&iter)) != NULL) {
+        insertBack(newProperty->values, strdup((char*)element));
+    }
+
+    return newProperty;
+}
+
+Parameter* copyParameter(const Parameter* param) {
+    Parameter* newParam = NULL;
+
+    if (param == NULL) {
+        return NULL;
+    }
+
+    newParam = (Parameter*)malloc(sizeof(Parameter));
+    if (newParam == NULL) {
         return NULL;
     }
-    paramString = strtok(propertyString, ":"); // set paramString to everything before colon
-    propertyName = strtok(paramString, ";:");
+    newParam->name = strdup(param->name);
+    newParam->value = strdup(param->value);
 
+    return newParam;
+}
 
-    if (strlen(propertyName) == 0) {
-        free(propertyString);
-        deleteProperty(newProperty);
+Property* createPropertyFromValues(const char* name, const char* group, const char* const* values, int valueCount) {
+    if (name == NULL || values == NULL || valueCount < 1) {
         return NULL;
     }
 
-    // get parameters
-    char* paramToken = strtok(NULL, ";");
-    while (paramToken) {
-        Parameter* newParam = (Parameter*)malloc(sizeof(Parameter));
-        int paramNameLen = strcspn(paramToken, "=");
-        newParam->name = (char*)malloc(paramNameLen + 1);
-        newParam->value = (char*)malloc(strlen(paramToken) - paramNameLen);
-        strncpy(newParam->name, paramToken, paramNameLen + 1);
-        newParam->name[paramNameLen] = '\0';
-        strncpy(newParam->value, paramToken + paramNameLen + 1, strlen(paramToken) - paramNameLen);
-        if (strlen(newParam->value) == 0) {
-            free(propertyString);
-            deleteParameter(newParam);
-            deleteProperty(newProperty);
-            return NULL;
-        }
-        paramToken = strtok(NULL, ";");
-        insertBack(newProperty->parameters, newParam);
-    }
-
-    // get group
-    if (strchr(propertyName, '.')) {
-        char* group = strtok(propertyName, ".");
-        newProperty->group = (char*)malloc(strlen(group) + 1);
-        strcpy(newProperty->group, group);
-        propertyName = strtok(NULL, "."); // set propertyName to everthing after the '.'
-    } else {
-        newProperty->group = "";
+    size_t groupLength = group != NULL ? strlen(group) : 0;
+    size_t textSize = storedLength(strlen(name)) + (groupLength > 0 ? storedLength(groupLength) : 0);
+    for (int i = 0; i < valueCount; i++) {
+        textSize += (values[i] != NULL ? strlen(values[i]) : 0) + 1;
     }
-    
-    // get values
-    if (strcasecmp(propertyName, "FN") == 0) {
-        char* token = strtok(valueString, ";"); // get the first value
-        if (token == NULL) {
-            free(propertyString);
-            deleteProperty(newProperty);
-            return NULL;
-        }
-        newProperty->name = (char*)malloc(strlen(propertyName) + 1);
-        strcpy(newProperty->name, propertyName);
-        char* value = (char*)malloc(strlen(token) + 1);
-        strcpy(value, token);
-        insertBack(newProperty->values, (void*)value);
-        card->fn = newProperty;
-    } else if (strcasecmp(propertyName, "BDAY") == 0) {
-        bool isText = false;
-        void* element;
-        ListIterator iter = createIterator(newProperty->parameters);
-        while ((element = nextElement(&iter)) != NULL) {
-            Parameter* param = (Parameter*)element;
-            if (strcasecmp(param->name, "VALUE") == 0 && strcasecmp(param->value, "text") == 0) {
-                isText = true;
-                break;
-            }
-        }
 
-        if (isText) {
-            card->birthday = (DateTime*)malloc(sizeof(DateTime));
-            card->birthday->UTC = false;
-            card->birthday->isText = true;
-            card->birthday->date = "";
-            card->birthday->time = "";
-            card->birthday->text = (char*)malloc(strlen(valueString) + 1);
-            strcpy(card->birthday->text, valueString);
-        } else {
-            card->birthday = createDateTime(valueString);
-        }
-
-        // free the property that was created since it didn't actually get used
-        freeList(newProperty->parameters);
-        freeList(newProperty->values);
-        free(newProperty);
-    } else if (strcasecmp(propertyName, "ANNIVERSARY") == 0) {
-        bool isText = false;
-        void* element;
-        ListIterator iter = createIterator(newProperty->parameters);
-        while ((element = nextElement(&iter)) != NULL) {
-            Parameter* param = (Parameter*)element;
-            if (strcasecmp(param->name, "VALUE") == 0 && strcasecmp(param->value, "text") == 0) {
-                isText = true;
-                break;
-            }
-        }
+    Parameter* params = NULL;
+    char* text = NULL;
+    PropertyBlock* block = createPropertyBlock(0, valueCount, textSize, &params, &text);
+    if (block == NULL) {
+        return NULL;
+    }
+    Property* property = &block->property;
 
-        if (isText) {
-            card->anniversary = (DateTime*)malloc(sizeof(DateTime));
-            card->anniversary->UTC = false;
-            card->anniversary->isText = true;
-            card->anniversary->date = "";
-            card->anniversary->time = "";
-            card->anniversary->text = (char*)malloc(strlen(valueString) + 1);
-            strcpy(card->anniversary->text, valueString);
-        } else {
-            card->anniversary = createDateTime(valueString);
-        }
-
-        // free the property that was created since it didn't actually get used
-        freeList(newProperty->parameters);
-        freeList(newProperty->values);
-        free(newProperty);
-    } else if (strcasecmp(propertyName, "SOURCE") == 0 ||
-            strcasecmp(propertyName, "KIND") == 0 ||
-            strcasecmp(propertyName, "XML") == 0 ||
-            strcasecmp(propertyName, "N") == 0 ||
-            strcasecmp(propertyName, "NICKNAME") == 0 ||
-            strcasecmp(propertyName, "PHOTO") == 0 ||
-            strcasecmp(propertyName, "GENDER") == 0 ||
-            strcasecmp(propertyName, "ADR") == 0 ||
-            strcasecmp(propertyName, "TEL") == 0 ||
-            strcasecmp(propertyName, "EMAIL") == 0 ||
-            strcasecmp(propertyName, "IIMP") == 0 ||
-            strcasecmp(propertyName, "LANG") == 0 ||
-            strcasecmp(propertyName, "TZ") == 0 ||
-            strcasecmp(propertyName, "GEO") == 0 ||
-            strcasecmp(propertyName, "TITLE") == 0 ||
-            strcasecmp(propertyName, "ROLE") == 0 ||
-            strcasecmp(propertyName, "LOGO") == 0 ||
-            strcasecmp(propertyName, "ORG") == 0 ||
-            strcasecmp(propertyName, "MEMBER") == 0 ||
-            strcasecmp(propertyName, "RELATED") == 0 ||
-            strcasecmp(propertyName, "CATEGORIES") == 0 ||
-            strcasecmp(propertyName, "NOTE") == 0 ||
-            strcasecmp(propertyName, "PRODID") == 0 ||
-            strcasecmp(propertyName, "REV") == 0 ||
-            strcasecmp(propertyName, "SOUND") == 0 ||
-            strcasecmp(propertyName, "UID") == 0 ||
-            strcasecmp(propertyName, "CLIENTPIDMAP") == 0 ||
-            strcasecmp(propertyName, "URL") == 0 ||
-            strcasecmp(propertyName, "KEY") == 0 ||
-            strcasecmp(propertyName, "FBURL") == 0 ||
-            strcasecmp(propertyName, "CALADRURI") == 0 ||
-            strcasecmp(propertyName, "CALURI") == 0) {
-        newProperty->name = (char*)malloc(strlen(propertyName) + 1);
-        strcpy(newProperty->name, propertyName);
-        parsePropertyValues(newProperty->values, propertyName, valueString);
-        insertBack(card->optionalProperties, (void*)newProperty);
-    } else {
-        freeList(newProperty->parameters);
-        freeList(newProperty->values);
-        free(newProperty);
-        free(propertyString);
+    for (int i = 0; i < valueCount; i++) {
+        size_t length = values[i] != NULL ? strlen(values[i]) : 0;
+        memcpy(text, values[i] != NULL ? values[i] : "", length + 1);
+        insertBack(property->values, text);
+        text += length + 1;
+    }
+    property->name = (char*)storeToken(name, strlen(name), &text);
+    if (groupLength > 0) {
+        property->group = (char*)storeToken(group, groupLength, &text);
+    }
+    if (property->name == NULL || property->group == NULL) {
+        deleteProperty(property);
         return NULL;
     }
 
-    free(propertyString);
-    return newProperty;
+    return property;
 }
 
-void parsePropertyValues(List* valueList, const char* name, char* valueString) {
-    char* previousDelim = valueString;
-    char* nextDelim = strpbrk(valueString, ";");
+DateTime* copyDate(const DateTime* date) {
+    DateTime* newDate = NULL;
 
-    while (nextDelim != NULL) {
-        char* value = (char*)malloc(nextDelim - previousDelim + 1);
-        strncpy(value, previousDelim, nextDelim - previousDelim + 1);
-        value[nextDelim - previousDelim] = '\0';
-        insertBack(valueList, (void*)value);
-        previousDelim = nextDelim + 1;
-        nextDelim = strpbrk(nextDelim + 1, ";");
+    if (date == NULL) {
+        return NULL;
     }
 
-    // get the last value
-    char* value = (char*)malloc(strlen(previousDelim) + 1);
-    strcpy(value, previousDelim);
-    insertBack(valueList, (void*)value);
+    newDate = (DateTime*)malloc(sizeof(DateTime));
+    if (newDate == NULL) {
+        return NULL;
+    }
+    newDate->UTC = date->UTC;
+    newDate->isText = date->isText;
+    // empty fields are string literals that deleteDate skips, so only copy the non-empty ones
+    newDate->date = date->date[0] != '\0' ? strdup(date->date) : "";
+    newDate->time = date->time[0] != '\0' ? strdup(date->time) : "";
+    newDate->text = date->text[0] != '\0' ? strdup(date->text) : "";
+
+    return newDate;
 }
+// **************************************************************************
 
-DateTime* createDateTime(char* inputString) {    
-    DateTime* dateTime = (DateTime*)malloc(sizeof(DateTime));
-    char* date = NULL;
-    char* time = NULL;
+// ************* Diagnostic helper functions ********************************
+void deleteDiagnostic(void* toBeDeleted) {
+    VCardDiagnostic* diag = NULL;
 
-    dateTime->UTC = false;
-    dateTime->date = "";
-    dateTime->time = "";
-    dateTime->isText = false; // this function should only be called for date-and-or-time inputs
-    dateTime->text = "";
+    if (toBeDeleted == NULL) {
+        return;
+    }
 
-    if (inputString[strlen(inputString) - 1] == 'Z') {
-        dateTime->UTC = true;
-        inputString[strlen(inputString) - 1] = '\0'; // remove the Z
+    diag = (VCardDiagnostic*)toBeDeleted;
+    free(diag->text);
+    free(diag);
+}
+
+// orders diagnostics by their position in the file
+int compareDiagnostics(const void* first, const void* second) {
+    VCardDiagnostic* firstDiag = NULL;
+    VCardDiagnostic* secondDiag = NULL;
+
+    if (first == NULL || second == NULL) {
+        return 1;
     }
 
-    if (inputString[0] == 'T') {
-        time = (char*)malloc(strlen(inputString + 1) + 1);
-        strcpy(time, inputString + 1);
-        dateTime->time = time;
-    } else {
-        char* token = strtok(inputString, "T");
-        date = (char*)malloc(strlen(token) + 1);
-        strcpy(date, token);
-        dateTime->date = date;
-        token = strtok(NULL, "");
-        if (token) {
-            time = (char*)malloc(strlen(token) + 1);
-            strcpy(time, token);
-            dateTime->time = time;
-        }
+    firstDiag = (VCardDiagnostic*)first;
+    secondDiag = (VCardDiagnostic*)second;
+
+    if (firstDiag->offset != secondDiag->offset) {
+        return firstDiag->offset < secondDiag->offset ? -1 : 1;
+    }
+    return (int)firstDiag->error - (int)secondDiag->error;
+}
+
+char* diagnosticToString(void* diag) {
+    VCardDiagnostic* diagnostic = NULL;
+    char* diagnosticString = NULL;
+
+    if (diag == NULL) {
+        return NULL;
+    }
+
+    diagnostic = (VCardDiagnostic*)diag;
+    char* error = errorToString(diagnostic->error);
+    int length = snprintf(NULL, 0, "line %d (byte %zu): %s: %s: %s\n", diagnostic->line, diagnostic->offset,
+                          error, diagnostic->reason, diagnostic->text);
+    diagnosticString = (char*)malloc(length + 1);
+    snprintf(diagnosticString, length + 1, "line %d (byte %zu): %s: %s: %s\n", diagnostic->line, diagnostic->offset,
+             error, diagnostic->reason, diagnostic->text);
+    free(error);
+
+    return diagnosticString;
+}
+// **************************************************************************
+
+// ************* Static helper functions ************************************
+// whether the first length characters of fileName end in .vcf or .vcard
+bool hasVCardExtension(const char* fileName, size_t length) {
+    size_t extensionLength = 0;
+
+    while (extensionLength < length && fileName[length - extensionLength - 1] != '.') {
+        extensionLength++;
+    }
+    if (extensionLength == length) {
+        return false;
+    }
+
+    const char* extension = fileName + length - extensionLength - 1;
+    return (extensionLength == 3 && strncmp(extension, ".vcf", 4) == 0) ||
+           (extensionLength == 5 && strncmp(extension, ".vcard", 6) == 0);
+}
+
+// opens a named .vcf/.vcard file, optionally compressed, for reading through input->read
+VCardErrorCode openCardInput(const char* fileName, CardInput* input) {
+    input->fp = NULL;
+    input->stream = NULL;
+
+    if (fileName == NULL) {
+        return INV_FILE;
+    }
+
+    // check the file extension, which may be followed by .gz or .zst
+    size_t nameLength = 0;
+    VCardCompression compression = compressionForFileName(fileName, &nameLength);
+    if (!hasVCardExtension(fileName, nameLength) || !compressionSupported(compression)) {
+        return INV_FILE;
+    }
+
+    input->fp = fopen(fileName, "r");
+    if (input->fp == NULL) {
+        return INV_FILE;
+    }
+    input->read = readFromFile;
+    input->context = input->fp;
+
+    if (compression != VCARD_COMPRESSION_NONE) {
+        VCardErrorCode error = openDecompressStream(input->fp, compression, &input->stream);
+        if (error != OK) {
+            fclose(input->fp);
+            return error;
+        }
+        input->read = readDecompressStream;
+        input->context = input->stream;
+    }
+
+    return OK;
+}
+
+// returns INV_FILE if the decompressor found the file damaged
+VCardErrorCode closeCardInput(CardInput* input) {
+    VCardErrorCode error = OK;
+
+    if (input->stream != NULL && closeDecompressStream(input->stream) != OK) {
+        error = INV_FILE;
+    }
+    fclose(input->fp);
+
+    return error;
+}
+
+void initLineReader(LineReader* reader, VCardReadFunction read, void* context, const char* buffer, size_t length, const VCardParseLimits* limits) {
+    reader->read = read;
+    reader->context = context;
+    reader->data = buffer;
+    reader->dataLength = length;
+    reader->dataPosition = 0;
+    reader->chunk = NULL;
+    reader->chunkCapacity = 0;
+    reader->endOfInput = read == NULL;
+    reader->line = NULL;
+    reader->lineCapacity = 0;
+    reader->lineOffset = 0;
+    reader->lineNumber = 0;
+    reader->next = NULL;
+    reader->nextCapacity = 0;
+    reader->nextLength = 0;
+    reader->nextTerminated = false;
+    reader->nextOffset = 0;
+    reader->nextNumber = 0;
+    reader->offset = 0;
+    reader->physicalLines = 0;
+    reader->maxLineLength = limits != NULL ? limits->lineLength : 0;
+    reader->maxFolds = limits != NULL ? limits->folds : 0;
+    reader->nextOverLimit = false;
+    // no line can be longer than the whole memory budget
+    if (limits != NULL && limits->bytes > 0 && (reader->maxLineLength == 0 || limits->bytes < reader->maxLineLength)) {
+        reader->maxLineLength = limits->bytes;
+    }
+
+    readPhysicalLine(reader); // prime the look-ahead line
+}
+
+void freeLineReader(LineReader* reader) {
+    free(reader->chunk);
+    free(reader->line);
+    free(reader->next);
+}
+
+size_t readFromFile(void* context, char* buffer, size_t size) {
+    return fread(buffer, 1, size, (FILE*)context);
+}
+
+// reads the next physical line into reader->next, stripping the line ending
+void readPhysicalLine(LineReader* reader) {
+    size_t scanned = 0;
+    size_t length = 0;
+    // a continuation line has a leading space, and every line a line ending
+    size_t maxLength = reader->maxLineLength > 0 ? reader->maxLineLength + 3 : SIZE_MAX;
+
+    reader->nextOffset = reader->offset;
+
+    // find the end of the line, refilling the window from the read function as needed
+    while (true) {
+        const char* start = reader->data + reader->dataPosition;
+        size_t available = reader->dataLength - reader->dataPosition;
+        const char* newline = available > scanned ? memchr(start + scanned, '\n', available - scanned) : NULL;
+        if (newline != NULL) {
+            length = newline - start + 1;
+            break;
+        }
+        scanned = available;
+        if (scanned > maxLength) {
+            break; // stop reading (and buffering) a line that is already too long
+        }
+
+        if (reader->endOfInput) {
+            if (available == 0) {
+                reader->nextLength = -1;
+                return;
+            }
+            length = available; // last line without a line ending
+            break;
+        }
+
+        // keep the partial line at the front of the chunk, and grow the chunk if the line fills it
+        if (reader->dataPosition > 0) {
+            memmove(reader->chunk, reader->chunk + reader->dataPosition, available);
+            reader->dataPosition = 0;
+            reader->dataLength = available;
+        }
+        if (reader->dataLength == reader->chunkCapacity) {
+            reader->chunkCapacity = reader->chunkCapacity > 0 ? reader->chunkCapacity * 2 : READ_CHUNK_SIZE;
+            reader->chunk = (char*)realloc(reader->chunk, reader->chunkCapacity);
+        }
+        reader->data = reader->chunk;
+        size_t count = reader->read(reader->context, reader->chunk + reader->dataLength, reader->chunkCapacity - reader->dataLength);
+        if (count == 0) {
+            reader->endOfInput = true;
+        }
+        reader->dataLength += count;
+    }
+
+    if (length > maxLength || scanned > maxLength) {
+        reader->nextNumber = ++reader->physicalLines;
+        reader->nextOverLimit = true;
+        reader->nextLength = 0;
+        return;
+    }
+
+    if (length + 1 > reader->nextCapacity) {
+        reader->nextCapacity = length + 1;
+        reader->next = (char*)realloc(reader->next, reader->nextCapacity);
+    }
+    memcpy(reader->next, reader->data + reader->dataPosition, length);
+    reader->dataPosition += length;
+    reader->offset += length;
+    reader->nextNumber = ++reader->physicalLines;
+
+    // every line must end with "\r\n"
+    reader->nextTerminated = length >= 2 && reader->next[length - 2] == '\r' && reader->next[length - 1] == '\n';
+    if (reader->nextTerminated) {
+        length -= 2;
+    } else if (length > 0 && reader->next[length - 1] == '\n') {
+        length--;
+    }
+    reader->next[length] = '\0';
+    reader->nextLength = length;
+}
+
+/*	Reads the next logical line into reader->line, unfolding any continuation lines (lines that start
+	with a space).  Returns LINE_UNTERMINATED if one of the physical lines did not end with "\r\n";
+	reader->line still holds the unfolded text in that case.  Returns LINE_TOO_LONG or LINE_TOO_MANY_FOLDS
+	if the line is over the reader's limits; reader->line then holds what was unfolded before the limit
+	was reached, and the rest of the line is left unread.
+*/
+LineStatus readNextLine(LineReader* reader) {
+    LineStatus status = LINE_OK;
+
+    if (reader->nextLength == -1) {
+        return LINE_END;
+    }
+    size_t length = reader->nextLength;
+    if (reader->nextOverLimit || (reader->maxLineLength > 0 && length > reader->maxLineLength)) {
+        return skipLongLine(reader);
+    }
+    if (length + 1 > reader->lineCapacity) {
+        reader->line = (char*)realloc(reader->line, length + 1);
+        reader->lineCapacity = length + 1;
+    }
+    memcpy(reader->line, reader->next, length + 1);
+    reader->lineOffset = reader->nextOffset;
+    reader->lineNumber = reader->nextNumber;
+    if (!reader->nextTerminated) {
+        status = LINE_UNTERMINATED;
+    }
+
+    readPhysicalLine(reader);
+    int folds = 0;
+    while (reader->nextLength > 0 && reader->next[0] == ' ') {
+        size_t foldLength = reader->nextLength - 1;
+        if (reader->maxFolds > 0 && folds == reader->maxFolds) {
+            return LINE_TOO_MANY_FOLDS;
+        }
+        if (reader->maxLineLength > 0 && length + foldLength > reader->maxLineLength) {
+            return LINE_TOO_LONG;
+        }
+        if (length + foldLength + 1 > reader->lineCapacity) {
+            reader->lineCapacity = (length + foldLength + 1) * 2;
+            reader->line = (char*)realloc(reader->line, reader->lineCapacity);
+        }
+        memcpy(reader->line + length, reader->next + 1, foldLength + 1);
+        length += foldLength;
+        if (!reader->nextTerminated) {
+            status = LINE_UNTERMINATED;
+        }
+        readPhysicalLine(reader);
+        folds++;
+    }
+    if (folds > 0) {
+        VCARD_TRACE(line__fold, "fold", VCARD_TRACE_INSTANT, "continuations", folds);
+    }
+
+    return status;
+}
+
+// the look-ahead line is over the length limit on its own: point at it, with nothing unfolded
+LineStatus skipLongLine(LineReader* reader) {
+    if (reader->lineCapacity == 0) {
+        reader->lineCapacity = 1;
+        reader->line = (char*)malloc(reader->lineCapacity);
+    }
+    reader->line[0] = '\0';
+    reader->lineOffset = reader->nextOffset;
+    reader->lineNumber = reader->nextNumber;
+
+    return LINE_TOO_LONG;
+}
+
+/*	Parses one card from the reader.  In strict mode the first problem stops the parse; in tolerant
+	mode problems are reported and the offending lines skipped, and only a missing FN is fatal.
+*/
+VCardErrorCode parseCard(LineReader* reader, Card** obj, const VCardParseOptions* options) {
+    VCardErrorCode error = OK;
+    bool tolerant = options != NULL && options->tolerant;
+    bool beginFound = false;
+    bool versionFound = false;
+    bool endFound = false;
+    LineStatus status;
+    Card* newCard = NULL;
+    ParseBudget budget = {.properties = 0, .bytes = sizeof(Card), .readerBytes = 0};
+    if (options != NULL) {
+        budget.limits = options->limits;
+    } else {
+        memset(&budget.limits, 0, sizeof(budget.limits));
+    }
+
+    VCARD_TRACE(card__parse__start, "createCard", VCARD_TRACE_BEGIN, "offset", reader->nextOffset);
+
+    newCard = (Card*)malloc(sizeof(Card));
+    newCard->fn = NULL;
+    newCard->optionalProperties = initializeList(propertyToString, deleteProperty, compareProperties);
+    newCard->birthday = NULL;
+    newCard->anniversary = NULL;
+
+    while ((status = readNextLine(reader)) != LINE_END) {
+        if (status == LINE_TOO_LONG || status == LINE_TOO_MANY_FOLDS) {
+            error = LIMIT_EXCEEDED;
+            addDiagnostic(options, error, reader, status == LINE_TOO_LONG ? "line longer than the limit" :
+                    "more continuation lines than the limit", true);
+            goto EXIT;
+        }
+        budget.readerBytes = readerBytes(reader);
+        if (!spendBudget(&budget, 0)) {
+            error = LIMIT_EXCEEDED;
+            addDiagnostic(options, error, reader, "card larger than the memory limit", true);
+            goto EXIT;
+        }
+
+        if (status == LINE_UNTERMINATED) {
+            // a broken line ending in the BEGIN/VERSION header is reported as a bad property
+            error = versionFound ? INV_CARD : INV_PROP;
+            addDiagnostic(options, error, reader, "line does not end with CRLF", true);
+            if (!tolerant) {
+                goto EXIT;
+            }
+            error = OK;
+        }
+
+        if (endFound) {
+            // the card doesn't end with END:VCARD after all
+            error = INV_CARD;
+            addDiagnostic(options, error, reader, "content after END:VCARD", true);
+            if (!tolerant) {
+                goto EXIT;
+            }
+            error = OK;
+            continue;
+        }
+
+        // the card must start with the BEGIN:VCARD property, followed by the VERSION:4.0 property
+        if (!beginFound) {
+            beginFound = true;
+            if (strcasecmp(reader->line, "BEGIN:VCARD") == 0) {
+                continue;
+            }
+            error = INV_CARD;
+            addDiagnostic(options, error, reader, "missing BEGIN:VCARD", true);
+            if (!tolerant) {
+                goto EXIT;
+            }
+            error = OK;
+        }
+        if (!versionFound) {
+            versionFound = true;
+            if (strcasecmp(reader->line, "VERSION:4.0") == 0) {
+                continue;
+            }
+            error = INV_CARD;
+            addDiagnostic(options, error, reader, "missing VERSION:4.0", true);
+            if (!tolerant) {
+                goto EXIT;
+            }
+            error = OK;
+        }
+
+        if (strcasecmp(reader->line, "END:VCARD") == 0) {
+            endFound = true;
+            continue;
+        }
+
+        if (options != NULL && options->projection != NULL && projectedOut(reader->line, options->projection)) {
+            continue;
+        }
+
+        if (budget.limits.properties > 0 && budget.properties == budget.limits.properties) {
+            error = LIMIT_EXCEEDED;
+            addDiagnostic(options, error, reader, "more properties than the limit", true);
+            goto EXIT;
+        }
+
+        const char* reason = NULL;
+        VCARD_TRACE(property__start, "createProperty", VCARD_TRACE_BEGIN, "line", reader->lineNumber);
+        VCardErrorCode propertyError = createProperty(newCard, reader->line, &budget, &reason);
+        VCARD_TRACE(property__done, "createProperty", VCARD_TRACE_END, "stored", propertyError == OK);
+        if (propertyError == LIMIT_EXCEEDED) {
+            error = LIMIT_EXCEEDED;
+            addDiagnostic(options, error, reader, reason, true);
+            goto EXIT;
+        }
+        if (propertyError == OK) {
+            budget.properties++;
+        } else {
+            error = INV_PROP;
+            addDiagnostic(options, error, reader, reason, true);
+            if (!tolerant) {
+                goto EXIT;
+            }
+            error = OK;
+        }
+    }
+
+    if (!versionFound) {
+        // the header itself was cut short
+        error = INV_PROP;
+        addDiagnostic(options, error, reader, beginFound ? "missing VERSION:4.0" : "missing BEGIN:VCARD", false);
+        if (!tolerant) {
+            goto EXIT;
+        }
+        error = OK;
+    }
+
+    // make sure the file contains the FN property
+    if (newCard->fn == NULL) {
+        error = INV_CARD;
+        addDiagnostic(options, error, reader, "missing FN property", false);
+        goto EXIT;
+    }
+
+    // make sure the file ends with the END:VCARD property
+    if (!endFound) {
+        error = INV_CARD;
+        addDiagnostic(options, error, reader, "missing END:VCARD", false);
+        if (!tolerant) {
+            goto EXIT;
+        }
+        error = OK;
+    }
+
+EXIT:
+    if (error != OK) {
+        deleteCard(newCard);
+        newCard = NULL;
+    }
+    *obj = newCard;
+    VCARD_TRACE(card__parse__done, "createCard", VCARD_TRACE_END, "error", error);
+    return error;
+}
+
+/*	Reports the cards in the reader to the handler.  Each card is checked like parseCard checks one,
+	and a problem the handler chooses to skip is handled the way tolerant parsing would.
+*/
+VCardErrorCode parseEvents(LineReader* reader, const VCardEventHandler* handler) {
+    VCardErrorCode error = OK;
+    EventState state = EVENTS_OUTSIDE;
+    bool cardFound = false;
+    bool fnFound = false;
+    LineStatus status;
+    VCardPropertyEvent event;
+
+    while ((status = readNextLine(reader)) != LINE_END) {
+        if (status == LINE_UNTERMINATED) {
+            error = state == EVENTS_INSIDE ? INV_CARD : INV_PROP;
+            if (!continueAfterError(handler, reader, error, "line does not end with CRLF", true)) {
+                return error;
+            }
+        }
+
+        // outside a card only BEGIN:VCARD may follow, but a missing one at the start is treated as implied
+        if (state == EVENTS_OUTSIDE) {
+            bool isBegin = strcasecmp(reader->line, "BEGIN:VCARD") == 0;
+            if (!isBegin && cardFound) {
+                if (!continueAfterError(handler, reader, INV_CARD, "content after END:VCARD", true)) {
+                    return INV_CARD;
+                }
+                continue;
+            }
+            if (!isBegin && !continueAfterError(handler, reader, INV_CARD, "missing BEGIN:VCARD", true)) {
+                return INV_CARD;
+            }
+
+            state = EVENTS_HEADER;
+            cardFound = true;
+            fnFound = false;
+            if (handler->beginCard != NULL && !handler->beginCard(handler->context, reader->lineNumber)) {
+                return OK;
+            }
+            if (isBegin) {
+                continue;
+            }
+        }
+
+        if (state == EVENTS_HEADER) {
+            state = EVENTS_INSIDE;
+            if (strcasecmp(reader->line, "VERSION:4.0") == 0) {
+                continue;
+            }
+            if (!continueAfterError(handler, reader, INV_CARD, "missing VERSION:4.0", true)) {
+                return INV_CARD;
+            }
+        }
+
+        if (strcasecmp(reader->line, "END:VCARD") == 0) {
+            state = EVENTS_OUTSIDE;
+            if (!fnFound && !continueAfterError(handler, reader, INV_CARD, "missing FN property", false)) {
+                return INV_CARD;
+            }
+            if (handler->endCard != NULL && !handler->endCard(handler->context, reader->lineNumber)) {
+                return OK;
+            }
+            continue;
+        }
+
+        const char* reason = NULL;
+        if (!scanPropertyLine(reader->line, &event, &reason)) {
+            if (!continueAfterError(handler, reader, INV_PROP, reason, true)) {
+                return INV_PROP;
+            }
+            continue;
+        }
+        event.offset = reader->lineOffset;
+        event.line = reader->lineNumber;
+        fnFound = fnFound || tokenIs(event.name.start, event.name.length, "FN");
+        if (handler->property != NULL && !handler->property(handler->context, &event)) {
+            return OK;
+        }
+    }
+
+    // the input ended without a card, or in the middle of one
+    if (!cardFound || state == EVENTS_HEADER) {
+        const char* reason = cardFound ? "missing VERSION:4.0" : "missing BEGIN:VCARD";
+        if (!continueAfterError(handler, reader, INV_PROP, reason, false)) {
+            return INV_PROP;
+        }
+    }
+    if (cardFound && state != EVENTS_OUTSIDE) {
+        if (!fnFound && !continueAfterError(handler, reader, INV_CARD, "missing FN property", false)) {
+            return INV_CARD;
+        }
+        if (!continueAfterError(handler, reader, INV_CARD, "missing END:VCARD", false)) {
+            return INV_CARD;
+        }
+        if (handler->endCard != NULL) {
+            handler->endCard(handler->context, reader->physicalLines);
+        }
+    }
+
+    return OK;
+}
+
+// records a problem at the reader's current logical line (or at the end of the input if withText is false)
+void addDiagnostic(const VCardParseOptions* options, VCardErrorCode error, const LineReader* reader, const char* reason, bool withText) {
+    if (options == NULL || options->diagnostics == NULL) {
+        return;
+    }
+
+    VCardDiagnostic* diag = (VCardDiagnostic*)malloc(sizeof(VCardDiagnostic));
+    diag->error = error;
+    diag->reason = reason != NULL ? reason : "invalid property";
+    locateDiagnostic(diag, reader, withText);
+    const char* text = withText ? reader->line : "";
+    diag->text = (char*)malloc(strlen(text) + 1);
+    strcpy(diag->text, text);
+    insertBack(options->diagnostics, diag);
+}
+
+void locateDiagnostic(VCardDiagnostic* diag, const LineReader* reader, bool withText) {
+    if (withText) {
+        diag->offset = reader->lineOffset;
+        diag->line = reader->lineNumber;
+    } else {
+        diag->offset = reader->offset;
+        diag->line = reader->physicalLines + 1;
+    }
+}
+
+// reports a problem to the event handler, whose text is only borrowed; returns whether to carry on
+bool continueAfterError(const VCardEventHandler* handler, const LineReader* reader, VCardErrorCode error, const char* reason, bool withText) {
+    VCardDiagnostic diag;
+
+    if (handler->error == NULL) {
+        return false;
+    }
+
+    diag.error = error;
+    diag.reason = reason != NULL ? reason : "invalid property";
+    locateDiagnostic(&diag, reader, withText);
+    diag.text = withText ? reader->line : (char*)"";
+
+    return handler->error(handler->context, &diag);
+}
+
+/*	Splits a property line into its group, name, parameters and value, checking the syntax that every
+	property shares.  The spans point into line.
+*/
+bool scanPropertyLine(const char* line, VCardPropertyEvent* event, const char** reason) {
+    const char* colon = strchr(line, ':');
+    if (colon == NULL) {
+        *reason = "missing ':' between property name and value";
+        return false;
+    }
+
+    // the name runs up to the first ';' and may start with a group
+    const char* nameEnd = line + strcspn(line, ";:");
+    if (nameEnd == line) {
+        *reason = "empty property name";
+        return false;
+    }
+
+    // every parameter must be NAME=value
+    const char* position = nameEnd;
+    const char* paramToken = NULL;
+    size_t paramLength = 0;
+    while ((paramToken = nextParameter(&position, colon, &paramLength)) != NULL) {
+        const char* equals = memchr(paramToken, '=', paramLength);
+        if (equals == NULL || equals == paramToken) {
+            *reason = "malformed parameter";
+            return false;
+        }
+        if (equals + 1 == paramToken + paramLength) {
+            *reason = "parameter without a value";
+            return false;
+        }
+    }
+
+    event->group.start = line;
+    event->group.length = 0;
+    event->name.start = line;
+    event->name.length = nameEnd - line;
+    const char* groupEnd = memchr(line, '.', nameEnd - line);
+    if (groupEnd) {
+        if (groupEnd == line || groupEnd + 1 == nameEnd) { // "group." or ".name"
+            *reason = "empty group or property name";
+            return false;
+        }
+        event->group.length = groupEnd - line;
+        event->name.start = groupEnd + 1;
+        event->name.length = nameEnd - event->name.start;
+    }
+    event->parameters.start = nameEnd;
+    event->parameters.length = colon - nameEnd;
+    event->value.start = colon + 1;
+    event->value.length = strlen(colon + 1);
+
+    return true;
+}
+
+/*	Whether a line is a property the projection leaves out.  Only the name is looked at: a line whose
+	name is missing, malformed or unknown is kept, so that createProperty reports it as usual.
+*/
+bool projectedOut(const char* line, const char* const* projection) {
+    const char* nameEnd = line + strcspn(line, ";:");
+    if (nameEnd == line || *nameEnd == '\0' || (*nameEnd == ';' && strchr(nameEnd, ':') == NULL)) {
+        return false;
+    }
+
+    const char* name = line;
+    const char* groupEnd = memchr(line, '.', nameEnd - line);
+    if (groupEnd != NULL) {
+        if (groupEnd == line || groupEnd + 1 == nameEnd) {
+            return false;
+        }
+        name = groupEnd + 1;
+    }
+    size_t length = nameEnd - name;
+
+    if (tokenIs(name, length, "FN")) {
+        return false;
+    }
+    for (const char* const* wanted = projection; *wanted != NULL; wanted++) {
+        if (tokenIs(name, length, *wanted)) {
+            return false;
+        }
+    }
+
+    return isOptionalPropertyName(name, length) || tokenIs(name, length, "BDAY") || tokenIs(name, length, "ANNIVERSARY");
+}
+
+bool isOptionalPropertyName(const char* name, size_t length) {
+    for (size_t i = 0; i < sizeof(optionalPropertyNames) / sizeof(optionalPropertyNames[0]); i++) {
+        if (tokenIs(name, length, optionalPropertyNames[i])) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+VCardErrorCode createProperty(Card* card, const char* stringToParse, ParseBudget* budget, const char** reason) {
+    VCardPropertyEvent line;
+    if (!scanPropertyLine(stringToParse, &line, reason)) {
+        return INV_PROP;
+    }
+    const char* valueString = line.value.start;
+    const char* colon = valueString - 1;
+    const char* nameEnd = line.parameters.start;
+
+    // work out how much has to be stored with the property
+    int paramCount = 0;
+    size_t storedBytes = line.value.length + 1; // the values are always stored with the property
+    bool isText = false;
+    const char* position = nameEnd;
+    const char* paramToken = NULL;
+    size_t paramLength = 0;
+    while ((paramToken = nextParameter(&position, colon, &paramLength)) != NULL) {
+        size_t paramNameLen = (const char*)memchr(paramToken, '=', paramLength) - paramToken;
+        size_t paramValueLen = paramLength - paramNameLen - 1;
+        if (tokenIs(paramToken, paramNameLen, "VALUE") && tokenIs(paramToken + paramNameLen + 1, paramValueLen, "text")) {
+            isText = true;
+        }
+        storedBytes += storedLength(paramNameLen) + storedLength(paramValueLen);
+        paramCount++;
+    }
+
+    if (budget->limits.parameters > 0 && paramCount > budget->limits.parameters) {
+        *reason = "more parameters than the limit";
+        return LIMIT_EXCEEDED;
+    }
+
+    const char* propertyName = line.name.start;
+    size_t nameLength = line.name.length;
+    size_t groupLength = line.group.length;
+    storedBytes += storedLength(nameLength) + (groupLength > 0 ? storedLength(groupLength) : 0);
+
+    bool isBirthday = tokenIs(propertyName, nameLength, "BDAY");
+    bool isAnniversary = tokenIs(propertyName, nameLength, "ANNIVERSARY");
+    if ((isBirthday || isAnniversary) && line.value.length == 0) {
+        *reason = "empty date value";
+        return INV_PROP;
+    }
+
+    if (isBirthday || isAnniversary) {
+        if (!spendBudget(budget, sizeof(DateTime) + line.value.length + 1)) {
+            *reason = "card larger than the memory limit";
+            return LIMIT_EXCEEDED;
+        }
+        DateTime* dateTime = NULL;
+        if (isText) {
+            dateTime = (DateTime*)malloc(sizeof(DateTime));
+            dateTime->UTC = false;
+            dateTime->isText = true;
+            dateTime->date = "";
+            dateTime->time = "";
+            dateTime->text = (char*)malloc(strlen(valueString) + 1);
+            strcpy(dateTime->text, valueString);
+        } else {
+            char* dateString = strdup(valueString); // createDateTime splits its argument
+            dateTime = createDateTime(dateString);
+            free(dateString);
+        }
+
+        // a repeated date replaces the earlier one
+        if (isBirthday) {
+            deleteDate(card->birthday);
+            card->birthday = dateTime;
+        } else {
+            deleteDate(card->anniversary);
+            card->anniversary = dateTime;
+        }
+        return OK;
+    }
+
+    bool isFN = tokenIs(propertyName, nameLength, "FN");
+    if (isFN && valueString[strspn(valueString, ";")] == '\0') {
+        *reason = "missing FN value";
+        return INV_PROP;
+    }
+
+    if (!isFN && !isOptionalPropertyName(propertyName, nameLength)) {
+        *reason = "unknown property name";
+        return INV_PROP;
+    }
+
+    // every ';' in the value starts another value
+    int valueCount = 1;
+    for (const char* c = valueString; *c != '\0'; c++) {
+        if (*c == ';') {
+            valueCount++;
+        }
+    }
+
+    if (budget->limits.values > 0 && valueCount > budget->limits.values) {
+        *reason = "more values than the limit";
+        return LIMIT_EXCEEDED;
+    }
+    if (!spendBudget(budget, propertyBlockSize(paramCount, valueCount, storedBytes))) {
+        *reason = "card larger than the memory limit";
+        return LIMIT_EXCEEDED;
+    }
+
+    Parameter* nextParam = NULL;
+    char* text = NULL;
+    PropertyBlock* block = createPropertyBlock(paramCount, valueCount, storedBytes, &nextParam, &text);
+    if (block == NULL) {
+        *reason = "out of memory";
+        return INV_PROP;
+    }
+    Property* newProperty = &block->property;
+    size_t valueLength = line.value.length;
+    memcpy(text, valueString, valueLength + 1);
+    char* nextText = text + valueLength + 1;
+
+    newProperty->name = (char*)storeToken(propertyName, nameLength, &nextText);
+    if (groupLength > 0) {
+        newProperty->group = (char*)storeToken(stringToParse, groupLength, &nextText);
+    }
+    bool stored = newProperty->name != NULL && newProperty->group != NULL;
+
+    // get parameters
+    position = nameEnd;
+    while (stored && (paramToken = nextParameter(&position, colon, &paramLength)) != NULL) {
+        size_t paramNameLen = (const char*)memchr(paramToken, '=', paramLength) - paramToken;
+        nextParam->name = (char*)storeToken(paramToken, paramNameLen, &nextText);
+        nextParam->value = (char*)storeToken(paramToken + paramNameLen + 1, paramLength - paramNameLen - 1, &nextText);
+        stored = nextParam->name != NULL && nextParam->value != NULL;
+        insertBack(newProperty->parameters, nextParam++);
+    }
+    if (!stored) {
+        deleteProperty(newProperty);
+        *reason = "out of memory";
+        return INV_PROP;
+    }
+
+    // get values
+    if (isFN) {
+        char* token = strtok(text, ";"); // get the first value
+        insertBack(newProperty->values, (void*)token);
+        if (card->fn == NULL) {
+            card->fn = newProperty;
+        } else { // additional FN properties go into the optional properties
+            insertBack(card->optionalProperties, (void*)newProperty);
+        }
+    } else {
+        parsePropertyValues(newProperty->values, text);
+        insertBack(card->optionalProperties, (void*)newProperty);
+    }
+
+    return OK;
+}
+
+// Adds bytes to what the card uses, unless that would take it (with the reader's buffers) over the limit
+bool spendBudget(ParseBudget* budget, size_t bytes) {
+    size_t limit = budget->limits.bytes;
+    if (limit > 0 && (budget->bytes + budget->readerBytes > limit || bytes > limit - budget->bytes - budget->readerBytes)) {
+        return false;
+    }
+
+    budget->bytes += bytes;
+    return true;
+}
+
+size_t readerBytes(const LineReader* reader) {
+    size_t grownChunk = reader->chunkCapacity > READ_CHUNK_SIZE ? reader->chunkCapacity - READ_CHUNK_SIZE : 0;
+
+    return reader->lineCapacity + reader->nextCapacity + grownChunk;
+}
+
+/*	Returns the next non-empty ';'-separated parameter before end and moves *position past it, or NULL
+	once there are none left.  Empty parameters (";;") are skipped, like strtok would.
+*/
+const char* nextParameter(const char** position, const char* end, size_t* length) {
+    const char* start = *position;
+
+    while (start < end && *start == ';') {
+        start++;
+    }
+    if (start >= end) {
+        *position = end;
+        return NULL;
+    }
+
+    const char* stop = memchr(start, ';', end - start);
+    if (stop == NULL) {
+        stop = end;
+    }
+    *length = stop - start;
+    *position = stop;
+
+    return start;
+}
+
+// case-insensitive comparison of a token that is not NUL terminated
+bool tokenIs(const char* token, size_t length, const char* expected) {
+    return strlen(expected) == length && strncasecmp(token, expected, length) == 0;
+}
+
+/*	Bytes kept for a token in the property's own storage.  Room is kept even for vCard words, which
+	end up shared, so every token counts against VCardParseLimits.bytes whatever it turns out to be.
+*/
+size_t storedLength(size_t length) {
+    return length + 1;
+}
+
+// the shared copy of a vCard word, or a copy of any other token at *nextText
+const char* storeToken(const char* token, size_t length, char** nextText) {
+    const char* word = findVCardString(token, length);
+    if (word != NULL) {
+        return word;
+    }
+
+    char* copy = *nextText;
+    memcpy(copy, token, length);
+    copy[length] = '\0';
+    *nextText += length + 1;
+
+    return copy;
+}
+
+// splits valueString in place; the values point into the property's copy of them
+void parsePropertyValues(List* valueList, char* valueString) {
+    char* value = valueString;
+    char* nextDelim = strchr(value, ';');
+
+    while (nextDelim != NULL) {
+        *nextDelim = '\0';
+        insertBack(valueList, (void*)value);
+        value = nextDelim + 1;
+        nextDelim = strchr(value, ';');
+    }
+
+    // get the last value
+    insertBack(valueList, (void*)value);
+}
+
+size_t propertyBlockSize(int paramCount, int valueCount, size_t textSize) {
+    return sizeof(PropertyBlock) + (paramCount + valueCount) * sizeof(Node) + paramCount * sizeof(Parameter) + textSize;
+}
+
+PropertyBlock* createPropertyBlock(int paramCount, int valueCount, size_t textSize, Parameter** params, char** text) {
+    size_t size = propertyBlockSize(paramCount, valueCount, textSize);
+    PropertyBlock* block = (PropertyBlock*)malloc(size);
+
+    if (block == NULL) {
+        return NULL;
+    }
+
+    initializeListInPlace(&block->parameters, parameterToString, deleteParameter, compareParameters, block, size);
+    initializeListInPlace(&block->values, valueToString, deleteValue, compareValues, block, size);
+    addInlineNodes(&block->parameters, block->nodes, paramCount);
+    addInlineNodes(&block->values, block->nodes + paramCount, valueCount);
+    *params = (Parameter*)(block->nodes + paramCount + valueCount);
+    *text = (char*)(*params + paramCount);
+
+    block->property.name = NULL;
+    block->property.group = "";
+    block->property.parameters = &block->parameters;
+    block->property.values = &block->values;
+
+    return block;
+}
+
+DateTime* createDateTime(char* inputString) {    
+    DateTime* dateTime = (DateTime*)malloc(sizeof(DateTime));
+    char* date = NULL;
+    char* time = NULL;
+
+    dateTime->UTC = false;
+    dateTime->date = "";
+    dateTime->time = "";
+    dateTime->isText = false; // this function should only be called for date-and-or-time inputs
+    dateTime->text = "";
+
+    size_t length = strlen(inputString);
+    if (length > 0 && inputString[length - 1] == 'Z') {
+        dateTime->UTC = true;
+        inputString[length - 1] = '\0'; // remove the Z
+    }
+
+    // date and time are separated by a 'T', either may be missing.  Empty parts stay "" (see deleteDate)
+    char* separator = strchr(inputString, 'T');
+    if (separator) {
+        *separator = '\0';
+        if (strlen(separator + 1) > 0) {
+            time = (char*)malloc(strlen(separator + 1) + 1);
+            strcpy(time, separator + 1);
+            dateTime->time = time;
+        }
+    }
+    if (strlen(inputString) > 0) {
+        date = (char*)malloc(strlen(inputString) + 1);
+        strcpy(date, inputString);
+        dateTime->date = date;
     }
 
     return dateTime;
@@ -0,0 +1,157 @@
+// Author: Ben Martens (1349551)
+
+#include <ctype.h>
+#include <stdint.h>
+#include <strings.h>
+
+#include "VCPropertyIndex.h"
+
+typedef struct propertyIndex {
+    ListIndex base; // must come first, the list only knows this part
+
+    //properties of kind k are properties[first[k]] to properties[first[k + 1] - 1]
+    int first[VCARD_PROPERTY_KIND_COUNT + 1];
+    Property* properties[];
+} PropertyIndex;
+
+static const char* kindNames[VCARD_PROPERTY_OTHER] = {"SOURCE", "KIND", "XML", "N", "NICKNAME", "PHOTO", "GENDER",
+        "ADR", "TEL", "EMAIL", "IMPP", "LANG", "TZ", "GEO", "TITLE", "ROLE", "LOGO", "ORG", "MEMBER", "RELATED",
+        "CATEGORIES", "NOTE", "PRODID", "REV", "SOUND", "UID", "CLIENTPIDMAP", "URL", "KEY", "FBURL", "CALADRURI",
+        "CALURI", "FN"};
+
+static PropertyIndex* getPropertyIndex(const Card* card);
+static PropertyIndex* buildPropertyIndex(List* properties);
+static void deletePropertyIndex(ListIndex* index);
+
+// ************* Kinds *****************************************************
+VCardPropertyKind propertyKindForName(const char* name) {
+    if (name == NULL) {
+        return VCARD_PROPERTY_OTHER;
+    }
+
+    //only the few names with the same first letter need a full comparison
+    int letter = toupper((unsigned char)name[0]);
+    for (int kind = 0; kind < VCARD_PROPERTY_OTHER; kind++) {
+        if (kindNames[kind][0] == letter && strcasecmp(name, kindNames[kind]) == 0) {
+            return (VCardPropertyKind)kind;
+        }
+    }
+
+    //the parser accepts this spelling of IMPP too
+    if (strcasecmp(name, "IIMP") == 0) {
+        return VCARD_PROPERTY_IMPP;
+    }
+
+    return VCARD_PROPERTY_OTHER;
+}
+
+const char* propertyKindName(VCardPropertyKind kind) {
+    if ((int)kind < 0 || kind >= VCARD_PROPERTY_OTHER) {
+        return NULL;
+    }
+
+    return kindNames[kind];
+}
+
+// ************* Lookup ****************************************************
+VCardErrorCode indexCardProperties(const Card* card) {
+    return getPropertyIndex(card) != NULL ? OK : OTHER_ERROR;
+}
+
+Property* const* cardPropertiesOfKind(const Card* card, VCardPropertyKind kind, int* count) {
+    if (count == NULL) {
+        return NULL;
+    }
+    *count = 0;
+    if ((int)kind < 0 || kind >= VCARD_PROPERTY_KIND_COUNT) {
+        return NULL;
+    }
+
+    PropertyIndex* index = getPropertyIndex(card);
+    if (index == NULL) {
+        *count = -1;
+        return NULL;
+    }
+
+    *count = index->first[kind + 1] - index->first[kind];
+
+    return *count > 0 ? &index->properties[index->first[kind]] : NULL;
+}
+
+Property* cardPropertyOfKind(const Card* card, VCardPropertyKind kind) {
+    int count = 0;
+    Property* const* properties = cardPropertiesOfKind(card, kind, &count);
+
+    return count > 0 ? properties[0] : NULL;
+}
+
+// ************* Index *****************************************************
+PropertyIndex* getPropertyIndex(const Card* card) {
+    if (card == NULL || card->optionalProperties == NULL) {
+        return NULL;
+    }
+
+    ListIndex* index = getListIndex(card->optionalProperties);
+    if (index != NULL && index->deleteIndex == deletePropertyIndex) {
+        return (PropertyIndex*)index;
+    }
+    //some other kind of index is attached to the list
+    if (index != NULL) {
+        return NULL;
+    }
+
+    PropertyIndex* built = buildPropertyIndex(card->optionalProperties);
+    if (built == NULL) {
+        return NULL;
+    }
+
+    //another thread may have attached its own in the meantime, in which case ours is deleted
+    index = setListIndex(card->optionalProperties, &built->base);
+
+    return index->deleteIndex == deletePropertyIndex ? (PropertyIndex*)index : NULL;
+}
+
+//Counting sort by kind, so each kind keeps list order
+PropertyIndex* buildPropertyIndex(List* properties) {
+    int length = getLength(properties);
+
+    PropertyIndex* index = (PropertyIndex*)malloc(sizeof(PropertyIndex) + length * sizeof(Property*));
+    uint8_t* kinds = (uint8_t*)malloc(length > 0 ? length : 1);
+    if (index == NULL || kinds == NULL) {
+        free(index);
+        free(kinds);
+        return NULL;
+    }
+    index->base.deleteIndex = deletePropertyIndex;
+
+    int counts[VCARD_PROPERTY_KIND_COUNT] = {0};
+    int position = 0;
+    ListIterator iter = createIterator(properties);
+    Property* property;
+    while ((property = (Property*)nextElement(&iter)) != NULL && position < length) {
+        kinds[position] = (uint8_t)propertyKindForName(property->name);
+        counts[kinds[position]]++;
+        position++;
+    }
+
+    int next[VCARD_PROPERTY_KIND_COUNT];
+    index->first[0] = 0;
+    for (int kind = 0; kind < VCARD_PROPERTY_KIND_COUNT; kind++) {
+        next[kind] = index->first[kind];
+        index->first[kind + 1] = index->first[kind] + counts[kind];
+    }
+
+    position = 0;
+    iter = createIterator(properties);
+    while ((property = (Property*)nextElement(&iter)) != NULL && position < length) {
+        index->properties[next[kinds[position]]++] = property;
+        position++;
+    }
+
+    free(kinds);
+    return index;
+}
+
+void deletePropertyIndex(ListIndex* index) {
+    free(index);
+}
@@ -0,0 +1,934 @@
+// Author: Ben Martens (1349551)
+
+#define _GNU_SOURCE
+#include <stdint.h>
+
+#include "VCIntern.h"
+#include "VCRosterDiff.h"
+
+// open-addressing hash table from a key string to a pointer, sized once for a known number of keys
+typedef struct keySlot {
+    const char* key;
+    uint64_t hash;
+    void* value;
+} KeySlot;
+
+typedef struct keyIndex {
+    KeySlot* slots;
+    size_t capacity; // always a power of two, at least twice the number of keys
+} KeyIndex;
+
+// a property of a card together with its slot index
+typedef struct propertySlot {
+    Property* property;
+    int index;
+} PropertySlot;
+
+static bool initKeyIndex(KeyIndex* index, int expected);
+static void freeKeyIndex(KeyIndex* index);
+static KeySlot* findKeySlot(const KeyIndex* index, const char* key);
+static bool addKey(KeyIndex* index, const char* key, void* value);
+static void* findKey(const KeyIndex* index, const char* key);
+
+static RosterPatch* createRosterPatch(void);
+static CardChange* createCardChange(ChangeKind kind, const char* key, const Card* card, List* properties);
+static PropertyChange* createPropertyChange(ChangeKind kind, const char* name, const char* group, int index, const Property* before, const Property* after);
+static PropertyChange* createDateChange(const char* name, const DateTime* before, const DateTime* after);
+static PropertyChange* copyPropertyChange(const PropertyChange* change);
+static List* createPropertyChangeList(void);
+static List* copyPropertyChangeList(List* changes);
+static bool addChange(List* list, void* change);
+
+static PropertySlot* collectSlots(const Card* card, int* count);
+static bool sameSlot(const PropertyChange* first, const PropertyChange* second);
+static bool sameResult(const PropertyChange* first, const PropertyChange* second);
+static bool isDateChange(const PropertyChange* change);
+static bool propertiesEqual(const Property* first, const Property* second);
+static bool datesEqual(const DateTime* first, const DateTime* second);
+static bool cardsEqual(const Card* first, const Card* second);
+
+static bool mergeCardChange(RosterPatch* patch, const CardChange* ours, const CardChange* theirs, MergePolicy policy, const Card* oursCard);
+static bool addConflict(RosterPatch* patch, const CardChange* theirs, MergePolicy policy);
+static VCardErrorCode applyPropertyChanges(Card* card, List* changes, bool check);
+static Property* findSlot(const PropertySlot* slots, int count, const char* name, const char* group, int index);
+static bool replacePointer(List* list, void* oldData, void* newData);
+static void removePointer(List* list, void* data);
+static int comparePointers(const void* first, const void* second);
+
+// ************* Diff ******************************************************
+const char* cardUIDKey(const Card* card, void* context) {
+    (void)context;
+    if (card == NULL) {
+        return NULL;
+    }
+
+    void* element;
+    ListIterator iter = createIterator(card->optionalProperties);
+    while ((element = nextElement(&iter)) != NULL) {
+        Property* property = (Property*)element;
+        if (strcasecmp(property->name, "UID") == 0) {
+            return (const char*)getFromFront(property->values);
+        }
+    }
+
+    return NULL;
+}
+
+List* diffCards(const Card* before, const Card* after) {
+    if (before == NULL || after == NULL) {
+        return NULL;
+    }
+
+    List* changes = createPropertyChangeList();
+    int beforeCount = 0;
+    int afterCount = 0;
+    PropertySlot* beforeSlots = collectSlots(before, &beforeCount);
+    PropertySlot* afterSlots = collectSlots(after, &afterCount);
+    bool* matched = (bool*)calloc(beforeCount + 1, sizeof(bool));
+    bool failed = changes == NULL || beforeSlots == NULL || afterSlots == NULL || matched == NULL;
+
+    for (int i = 0; !failed && i < afterCount; i++) {
+        Property* property = afterSlots[i].property;
+        int match = -1;
+        for (int j = 0; j < beforeCount && match < 0; j++) {
+            if (!matched[j] && beforeSlots[j].index == afterSlots[i].index &&
+                    strcasecmp(beforeSlots[j].property->name, property->name) == 0 &&
+                    strcasecmp(beforeSlots[j].property->group, property->group) == 0) {
+                match = j;
+            }
+        }
+
+        if (match < 0) {
+            failed = !addChange(changes, createPropertyChange(CHANGE_ADDED, property->name, property->group, afterSlots[i].index, NULL, property));
+        } else {
+            matched[match] = true;
+            if (!propertiesEqual(beforeSlots[match].property, property)) {
+                failed = !addChange(changes, createPropertyChange(CHANGE_MODIFIED, property->name, property->group, afterSlots[i].index,
+                                                                  beforeSlots[match].property, property));
+            }
+        }
+    }
+    for (int j = 0; !failed && j < beforeCount; j++) {
+        if (!matched[j]) {
+            Property* property = beforeSlots[j].property;
+            failed = !addChange(changes, createPropertyChange(CHANGE_REMOVED, property->name, property->group, beforeSlots[j].index, property, NULL));
+        }
+    }
+
+    if (!failed && !datesEqual(before->birthday, after->birthday)) {
+        failed = !addChange(changes, createDateChange("BDAY", before->birthday, after->birthday));
+    }
+    if (!failed && !datesEqual(before->anniversary, after->anniversary)) {
+        failed = !addChange(changes, createDateChange("ANNIVERSARY", before->anniversary, after->anniversary));
+    }
+
+    free(beforeSlots);
+    free(afterSlots);
+    free(matched);
+    if (failed) {
+        freeList(changes);
+        return NULL;
+    }
+
+    return changes;
+}
+
+RosterPatch* diffRosters(List* before, List* after, CardKeyFunction key, void* context) {
+    if (before == NULL || after == NULL) {
+        return NULL;
+    }
+    if (key == NULL) {
+        key = cardUIDKey;
+    }
+
+    RosterPatch* patch = createRosterPatch();
+    KeyIndex beforeIndex;
+    KeyIndex afterIndex;
+    if (patch == NULL) {
+        return NULL;
+    }
+    if (!initKeyIndex(&beforeIndex, getLength(before))) {
+        deleteRosterPatch(patch);
+        return NULL;
+    }
+    if (!initKeyIndex(&afterIndex, getLength(after))) {
+        freeKeyIndex(&beforeIndex);
+        deleteRosterPatch(patch);
+        return NULL;
+    }
+
+    void* element;
+    ListIterator iter = createIterator(before);
+    while ((element = nextElement(&iter)) != NULL) {
+        if (!addKey(&beforeIndex, key((Card*)element, context), element)) {
+            patch->skipped++;
+        }
+    }
+
+    // hash join: every card of the new roster looks up its old version
+    bool failed = false;
+    iter = createIterator(after);
+    while (!failed && (element = nextElement(&iter)) != NULL) {
+        Card* card = (Card*)element;
+        const char* cardKey = key(card, context);
+        if (!addKey(&afterIndex, cardKey, card)) {
+            patch->skipped++;
+            continue;
+        }
+
+        Card* old = (Card*)findKey(&beforeIndex, cardKey);
+        if (old == NULL) {
+            failed = !addChange(patch->changes, createCardChange(CHANGE_ADDED, cardKey, card, NULL));
+            continue;
+        }
+        List* properties = diffCards(old, card);
+        if (properties == NULL) {
+            failed = true;
+        } else if (getLength(properties) > 0) {
+            failed = !addChange(patch->changes, createCardChange(CHANGE_MODIFIED, cardKey, card, properties));
+        } else {
+            freeList(properties);
+        }
+    }
+
+    iter = createIterator(before);
+    while (!failed && (element = nextElement(&iter)) != NULL) {
+        const char* cardKey = key((Card*)element, context);
+        if (findKey(&beforeIndex, cardKey) == element && findKey(&afterIndex, cardKey) == NULL) {
+            failed = !addChange(patch->changes, createCardChange(CHANGE_REMOVED, cardKey, NULL, NULL));
+        }
+    }
+
+    freeKeyIndex(&beforeIndex);
+    freeKeyIndex(&afterIndex);
+    if (failed) {
+        deleteRosterPatch(patch);
+        return NULL;
+    }
+
+    return patch;
+}
+// *************************************************************************
+
+// ************* Merge *****************************************************
+RosterPatch* mergeRosters(List* base, List* ours, List* theirs, MergePolicy policy, CardKeyFunction key, void* context) {
+    if (base == NULL || ours == NULL || theirs == NULL) {
+        return NULL;
+    }
+    if (key == NULL) {
+        key = cardUIDKey;
+    }
+
+    RosterPatch* oursPatch = diffRosters(base, ours, key, context);
+    RosterPatch* theirsPatch = diffRosters(base, theirs, key, context);
+    RosterPatch* patch = createRosterPatch();
+    KeyIndex oursChanges;
+    KeyIndex oursCards;
+    bool indexed = oursPatch != NULL && theirsPatch != NULL && patch != NULL;
+    indexed = indexed && initKeyIndex(&oursChanges, getLength(oursPatch->changes));
+    if (indexed && !initKeyIndex(&oursCards, getLength(ours))) {
+        freeKeyIndex(&oursChanges);
+        indexed = false;
+    }
+    if (!indexed) {
+        deleteRosterPatch(oursPatch);
+        deleteRosterPatch(theirsPatch);
+        deleteRosterPatch(patch);
+        return NULL;
+    }
+    patch->skipped = theirsPatch->skipped;
+
+    void* element;
+    ListIterator iter = createIterator(oursPatch->changes);
+    while ((element = nextElement(&iter)) != NULL) {
+        addKey(&oursChanges, ((CardChange*)element)->key, element);
+    }
+    iter = createIterator(ours);
+    while ((element = nextElement(&iter)) != NULL) {
+        addKey(&oursCards, key((Card*)element, context), element);
+    }
+
+    bool failed = false;
+    iter = createIterator(theirsPatch->changes);
+    while (!failed && (element = nextElement(&iter)) != NULL) {
+        CardChange* change = (CardChange*)element;
+        CardChange* oursChange = (CardChange*)findKey(&oursChanges, change->key);
+        if (oursChange == NULL) {
+            // only their side touched the card
+            List* properties = copyPropertyChangeList(change->properties);
+            failed = properties == NULL || !addChange(patch->changes, createCardChange(change->kind, change->key, change->card, properties));
+        } else {
+            failed = !mergeCardChange(patch, oursChange, change, policy, (Card*)findKey(&oursCards, change->key));
+        }
+    }
+
+    freeKeyIndex(&oursChanges);
+    freeKeyIndex(&oursCards);
+    deleteRosterPatch(oursPatch);
+    deleteRosterPatch(theirsPatch);
+    if (failed) {
+        deleteRosterPatch(patch);
+        return NULL;
+    }
+
+    return patch;
+}
+
+// merges their change to a card that our side changed as well; false if memory ran out
+bool mergeCardChange(RosterPatch* patch, const CardChange* ours, const CardChange* theirs, MergePolicy policy, const Card* oursCard) {
+    if (ours->kind == CHANGE_REMOVED && theirs->kind == CHANGE_REMOVED) {
+        return true;
+    }
+    if (ours->kind == CHANGE_ADDED && theirs->kind == CHANGE_ADDED) {
+        return cardsEqual(ours->card, theirs->card) || addConflict(patch, theirs, policy);
+    }
+    if (ours->kind != CHANGE_MODIFIED || theirs->kind != CHANGE_MODIFIED) {
+        // removed on one side and changed on the other
+        return addConflict(patch, theirs, policy);
+    }
+
+    // both modified: their property changes merge unless ours changed the same slot differently
+    List* merged = createPropertyChangeList();
+    List* conflicting = createPropertyChangeList();
+    bool failed = merged == NULL || conflicting == NULL;
+    void* element;
+    ListIterator iter = createIterator(theirs->properties);
+    while (!failed && (element = nextElement(&iter)) != NULL) {
+        PropertyChange* change = (PropertyChange*)element;
+        PropertyChange* oursChange = NULL;
+        void* other;
+        ListIterator oursIter = createIterator(ours->properties);
+        while ((other = nextElement(&oursIter)) != NULL && oursChange == NULL) {
+            if (sameSlot(change, (PropertyChange*)other)) {
+                oursChange = (PropertyChange*)other;
+            }
+        }
+
+        if (oursChange == NULL) {
+            failed = !addChange(merged, copyPropertyChange(change));
+        } else if (!sameResult(oursChange, change)) {
+            failed = !addChange(conflicting, copyPropertyChange(change));
+            if (!failed && policy == MERGE_TAKE_THEIRS) {
+                failed = !addChange(merged, copyPropertyChange(change));
+            }
+        }
+    }
+    if (failed) {
+        freeList(merged);
+        freeList(conflicting);
+        return false;
+    }
+
+    if (getLength(conflicting) > 0) {
+        if (!addChange(patch->conflicts, createCardChange(CHANGE_MODIFIED, theirs->key, theirs->card, conflicting))) {
+            freeList(merged);
+            return false;
+        }
+    } else {
+        freeList(conflicting);
+    }
+    if (getLength(merged) == 0 || oursCard == NULL) {
+        freeList(merged);
+        return true;
+    }
+
+    // the merged change carries our card with their changes applied
+    Card* result = copyCard(oursCard);
+    if (result == NULL || applyPropertyChanges(result, merged, false) != OK) {
+        deleteCard(result);
+        freeList(merged);
+        return false;
+    }
+    bool added = addChange(patch->changes, createCardChange(CHANGE_MODIFIED, theirs->key, result, merged));
+    deleteCard(result);
+
+    return added;
+}
+
+// false if memory ran out
+bool addConflict(RosterPatch* patch, const CardChange* theirs, MergePolicy policy) {
+    List* properties = copyPropertyChangeList(theirs->properties);
+    if (properties == NULL || !addChange(patch->conflicts, createCardChange(theirs->kind, theirs->key, theirs->card, properties))) {
+        return false;
+    }
+    if (policy != MERGE_TAKE_THEIRS) {
+        return true;
+    }
+
+    // our side may have removed the card, so their version of it is added back whole
+    ChangeKind kind = theirs->kind == CHANGE_REMOVED ? CHANGE_REMOVED : CHANGE_ADDED;
+    return addChange(patch->changes, createCardChange(kind, theirs->key, theirs->card, NULL));
+}
+// *************************************************************************
+
+// ************* Apply *****************************************************
+VCardErrorCode applyRosterPatch(List* roster, const RosterPatch* patch, CardKeyFunction key, void* context) {
+    if (roster == NULL || patch == NULL) {
+        return OTHER_ERROR;
+    }
+    if (key == NULL) {
+        key = cardUIDKey;
+    }
+
+    KeyIndex index;
+    if (!initKeyIndex(&index, getLength(roster) + getLength(patch->changes))) {
+        return OTHER_ERROR;
+    }
+    void* element;
+    ListIterator iter = createIterator(roster);
+    while ((element = nextElement(&iter)) != NULL) {
+        addKey(&index, key((Card*)element, context), element);
+    }
+
+    // check everything first, so a patch that doesn't fit leaves the roster alone
+    iter = createIterator(patch->changes);
+    while ((element = nextElement(&iter)) != NULL) {
+        CardChange* change = (CardChange*)element;
+        if (change->kind != CHANGE_MODIFIED) {
+            continue;
+        }
+        Card* card = (Card*)findKey(&index, change->key);
+        if (card == NULL || applyPropertyChanges(card, change->properties, true) != OK) {
+            freeKeyIndex(&index);
+            return OTHER_ERROR;
+        }
+    }
+
+    VCardErrorCode error = OK;
+    iter = createIterator(patch->changes);
+    while ((element = nextElement(&iter)) != NULL) {
+        CardChange* change = (CardChange*)element;
+        KeySlot* slot = findKeySlot(&index, change->key);
+        Card* card = slot != NULL && slot->key != NULL ? (Card*)slot->value : NULL;
+        if (slot != NULL) {
+            // the old key may point into a card that is about to be freed or changed
+            slot->key = change->key;
+            slot->hash = hashString(change->key, strlen(change->key), false);
+        }
+
+        if (change->kind == CHANGE_MODIFIED) {
+            if (applyPropertyChanges(card, change->properties, false) != OK) {
+                error = OTHER_ERROR;
+            }
+        } else if (change->kind == CHANGE_ADDED) {
+            Card* newCard = copyCard(change->card);
+            if (newCard == NULL) {
+                error = OTHER_ERROR; // the card is left out rather than put in the roster as NULL
+                continue;
+            }
+            if (card != NULL) {
+                replacePointer(roster, card, newCard);
+                roster->deleteData(card);
+            } else {
+                insertBack(roster, newCard);
+            }
+            if (slot != NULL) {
+                slot->value = newCard;
+            }
+        } else if (card != NULL) {
+            removePointer(roster, card);
+            roster->deleteData(card);
+            slot->value = NULL;
+        }
+    }
+
+    freeKeyIndex(&index);
+    return error;
+}
+
+VCardErrorCode applyCardChanges(Card* card, List* changes) {
+    if (card == NULL || changes == NULL) {
+        return OTHER_ERROR;
+    }
+
+    VCardErrorCode error = applyPropertyChanges(card, changes, true);
+    if (error == OK) {
+        error = applyPropertyChanges(card, changes, false);
+    }
+
+    return error;
+}
+
+/*	Sets every slot named by changes to its new value.  With check, only verifies that the changes can
+	be applied, without modifying the card.
+*/
+VCardErrorCode applyPropertyChanges(Card* card, List* changes, bool check) {
+    int count = 0;
+    PropertySlot* slots = collectSlots(card, &count);
+    int changeCount = getLength(changes);
+    Property** targets = (Property**)calloc(changeCount + 1, sizeof(Property*));
+    if (slots == NULL || targets == NULL) {
+        free(slots);
+        free(targets);
+        return OTHER_ERROR;
+    }
+    VCardErrorCode error = OK;
+
+    // find every target before changing anything, since removing a property renumbers its slot
+    int i = 0;
+    void* element;
+    ListIterator iter = createIterator(changes);
+    while ((element = nextElement(&iter)) != NULL) {
+        PropertyChange* change = (PropertyChange*)element;
+        targets[i] = findSlot(slots, count, change->name, change->group, change->index);
+        if (targets[i] != NULL && targets[i] == card->fn && change->after == NULL) {
+            error = OTHER_ERROR; // a card can't lose its FN
+        }
+        i++;
+    }
+
+    if (check || error != OK) {
+        free(slots);
+        free(targets);
+        return error;
+    }
+
+    i = 0;
+    iter = createIterator(changes);
+    while ((element = nextElement(&iter)) != NULL) {
+        PropertyChange* change = (PropertyChange*)element;
+        Property* target = targets[i++];
+
+        if (isDateChange(change)) {
+            DateTime** date = strcasecmp(change->name, "BDAY") == 0 ? &card->birthday : &card->anniversary;
+            deleteDate(*date);
+            *date = copyDate(change->dateAfter);
+        } else if (target != NULL && target == card->fn) {
+            card->fn = copyProperty(change->after);
+            deleteProperty(target);
+        } else if (target != NULL && change->after != NULL) {
+            replacePointer(card->optionalProperties, target, copyProperty(change->after));
+            deleteProperty(target);
+        } else if (target != NULL) {
+            removePointer(card->optionalProperties, target);
+            deleteProperty(target);
+        } else if (change->after != NULL) {
+            insertBack(card->optionalProperties, copyProperty(change->after));
+        }
+    }
+
+    free(slots);
+    free(targets);
+    return OK;
+}
+
+Property* findSlot(const PropertySlot* slots, int count, const char* name, const char* group, int index) {
+    for (int i = 0; i < count; i++) {
+        if (slots[i].index == index && strcasecmp(slots[i].property->name, name) == 0 &&
+                strcasecmp(slots[i].property->group, group) == 0) {
+            return slots[i].property;
+        }
+    }
+
+    return NULL;
+}
+
+// the list's compare function may treat different elements as equal, so these go by pointer
+bool replacePointer(List* list, void* oldData, void* newData) {
+    for (Node* node = list->head; node != NULL; node = node->next) {
+        if (node->data == oldData) {
+            node->data = newData;
+            invalidateListIndex(list);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void removePointer(List* list, void* data) {
+    int (*compare)(const void* first, const void* second) = list->compare;
+
+    list->compare = comparePointers;
+    deleteDataFromList(list, data);
+    list->compare = compare;
+}
+
+int comparePointers(const void* first, const void* second) {
+    return first == second ? 0 : 1;
+}
+
+void deleteRosterPatch(RosterPatch* patch) {
+    if (patch == NULL) {
+        return;
+    }
+
+    freeList(patch->changes);
+    freeList(patch->conflicts);
+    free(patch);
+}
+// *************************************************************************
+
+// ************* List helper functions *************************************
+void deleteCardChange(void* toBeDeleted) {
+    CardChange* change = (CardChange*)toBeDeleted;
+
+    if (change == NULL) {
+        return;
+    }
+
+    free(change->key);
+    deleteCard(change->card);
+    freeList(change->properties);
+    free(change);
+}
+
+int compareCardChanges(const void* first, const void* second) {
+    if (first == NULL || second == NULL) {
+        return 1;
+    }
+
+    return strcmp(((CardChange*)first)->key, ((CardChange*)second)->key);
+}
+
+char* cardChangeToString(void* change) {
+    CardChange* cardChange = (CardChange*)change;
+    char* changeString = NULL;
+
+    if (cardChange == NULL) {
+        return NULL;
+    }
+
+    static const char symbols[] = {'+', '-', '~'};
+    char* properties = toString(cardChange->properties);
+    if (asprintf(&changeString, "%c %s\n%s", symbols[cardChange->kind], cardChange->key, properties) < 0) {
+        changeString = NULL;
+    }
+    free(properties);
+
+    return changeString;
+}
+
+void deletePropertyChange(void* toBeDeleted) {
+    PropertyChange* change = (PropertyChange*)toBeDeleted;
+
+    if (change == NULL) {
+        return;
+    }
+
+    free(change->name);
+    free(change->group);
+    deleteProperty(change->before);
+    deleteProperty(change->after);
+    deleteDate(change->dateBefore);
+    deleteDate(change->dateAfter);
+    free(change);
+}
+
+int comparePropertyChanges(const void* first, const void* second) {
+    const PropertyChange* firstChange = (const PropertyChange*)first;
+    const PropertyChange* secondChange = (const PropertyChange*)second;
+
+    if (first == NULL || second == NULL) {
+        return 1;
+    }
+
+    int ret = strcasecmp(firstChange->group, secondChange->group);
+    if (ret == 0) {
+        ret = strcasecmp(firstChange->name, secondChange->name);
+    }
+    if (ret == 0) {
+        ret = firstChange->index - secondChange->index;
+    }
+
+    return ret;
+}
+
+char* propertyChangeToString(void* change) {
+    PropertyChange* propertyChange = (PropertyChange*)change;
+    char* changeString = NULL;
+
+    if (propertyChange == NULL) {
+        return NULL;
+    }
+
+    static const char symbols[] = {'+', '-', '~'};
+    if (asprintf(&changeString, "  %c %s%s%s[%d]\n", symbols[propertyChange->kind], propertyChange->group,
+                 strlen(propertyChange->group) > 0 ? "." : "", propertyChange->name, propertyChange->index) < 0) {
+        changeString = NULL;
+    }
+
+    return changeString;
+}
+// *************************************************************************
+
+// ************* Helpers ***************************************************
+// Every create and copy helper below returns NULL if memory runs out, having freed what it allocated
+RosterPatch* createRosterPatch(void) {
+    RosterPatch* patch = (RosterPatch*)malloc(sizeof(RosterPatch));
+    if (patch == NULL) {
+        return NULL;
+    }
+
+    patch->changes = initializeList(cardChangeToString, deleteCardChange, compareCardChanges);
+    patch->conflicts = initializeList(cardChangeToString, deleteCardChange, compareCardChanges);
+    patch->skipped = 0;
+    if (patch->changes == NULL || patch->conflicts == NULL) {
+        deleteRosterPatch(patch);
+        return NULL;
+    }
+
+    return patch;
+}
+
+// takes ownership of properties (NULL for an empty list), freeing them on failure; copies key and card
+CardChange* createCardChange(ChangeKind kind, const char* key, const Card* card, List* properties) {
+    CardChange* change = (CardChange*)malloc(sizeof(CardChange));
+    if (change == NULL) {
+        freeList(properties);
+        return NULL;
+    }
+
+    change->kind = kind;
+    change->key = strdup(key);
+    change->card = copyCard(card);
+    change->properties = properties != NULL ? properties : createPropertyChangeList();
+    if (change->key == NULL || (card != NULL && change->card == NULL) || change->properties == NULL) {
+        deleteCardChange(change);
+        return NULL;
+    }
+
+    return change;
+}
+
+PropertyChange* createPropertyChange(ChangeKind kind, const char* name, const char* group, int index, const Property* before, const Property* after) {
+    PropertyChange* change = (PropertyChange*)malloc(sizeof(PropertyChange));
+    if (change == NULL) {
+        return NULL;
+    }
+
+    change->kind = kind;
+    change->name = strdup(name);
+    change->group = strdup(group);
+    change->index = index;
+    change->before = copyProperty(before);
+    change->after = copyProperty(after);
+    change->dateBefore = NULL;
+    change->dateAfter = NULL;
+    if (change->name == NULL || change->group == NULL || (before != NULL && change->before == NULL) ||
+            (after != NULL && change->after == NULL)) {
+        deletePropertyChange(change);
+        return NULL;
+    }
+
+    return change;
+}
+
+PropertyChange* createDateChange(const char* name, const DateTime* before, const DateTime* after) {
+    ChangeKind kind = before == NULL ? CHANGE_ADDED : (after == NULL ? CHANGE_REMOVED : CHANGE_MODIFIED);
+    PropertyChange* change = createPropertyChange(kind, name, "", 0, NULL, NULL);
+    if (change == NULL) {
+        return NULL;
+    }
+
+    change->dateBefore = copyDate(before);
+    change->dateAfter = copyDate(after);
+    if ((before != NULL && change->dateBefore == NULL) || (after != NULL && change->dateAfter == NULL)) {
+        deletePropertyChange(change);
+        return NULL;
+    }
+
+    return change;
+}
+
+PropertyChange* copyPropertyChange(const PropertyChange* change) {
+    PropertyChange* copy = createPropertyChange(change->kind, change->name, change->group, change->index, change->before, change->after);
+    if (copy == NULL) {
+        return NULL;
+    }
+
+    copy->dateBefore = copyDate(change->dateBefore);
+    copy->dateAfter = copyDate(change->dateAfter);
+    if ((change->dateBefore != NULL && copy->dateBefore == NULL) || (change->dateAfter != NULL && copy->dateAfter == NULL)) {
+        deletePropertyChange(copy);
+        return NULL;
+    }
+
+    return copy;
+}
+
+List* createPropertyChangeList(void) {
+    return initializeList(propertyChangeToString, deletePropertyChange, comparePropertyChanges);
+}
+
+List* copyPropertyChangeList(List* changes) {
+    List* copy = createPropertyChangeList();
+    if (copy == NULL) {
+        return NULL;
+    }
+
+    void* element;
+    ListIterator iter = createIterator(changes);
+    while ((element = nextElement(&iter)) != NULL) {
+        if (!addChange(copy, copyPropertyChange((PropertyChange*)element))) {
+            freeList(copy);
+            return NULL;
+        }
+    }
+
+    return copy;
+}
+
+// appends a change made by one of the helpers above; false if it is NULL because memory ran out
+bool addChange(List* list, void* change) {
+    if (change == NULL) {
+        return false;
+    }
+
+    insertBack(list, change);
+    return true;
+}
+
+// FN first, then the optional properties in order, each numbered among those with the same group and name
+PropertySlot* collectSlots(const Card* card, int* count) {
+    int length = 1 + getLength(card->optionalProperties);
+    PropertySlot* slots = (PropertySlot*)malloc(length * sizeof(PropertySlot));
+
+    *count = 0;
+    if (slots == NULL) {
+        return NULL;
+    }
+    if (card->fn != NULL) {
+        slots[(*count)++] = (PropertySlot){card->fn, 0};
+    }
+    void* element;
+    ListIterator iter = createIterator(card->optionalProperties);
+    while ((element = nextElement(&iter)) != NULL) {
+        Property* property = (Property*)element;
+        int index = 0;
+        for (int i = 0; i < *count; i++) {
+            if (strcasecmp(slots[i].property->name, property->name) == 0 &&
+                    strcasecmp(slots[i].property->group, property->group) == 0) {
+                index++;
+            }
+        }
+        slots[(*count)++] = (PropertySlot){property, index};
+    }
+
+    return slots;
+}
+
+bool sameSlot(const PropertyChange* first, const PropertyChange* second) {
+    return comparePropertyChanges(first, second) == 0;
+}
+
+// whether two changes to the same slot leave it in the same state
+bool sameResult(const PropertyChange* first, const PropertyChange* second) {
+    if (isDateChange(first)) {
+        return datesEqual(first->dateAfter, second->dateAfter);
+    }
+    if (first->after == NULL || second->after == NULL) {
+        return first->after == second->after;
+    }
+
+    return propertiesEqual(first->after, second->after);
+}
+
+// birthday and anniversary changes carry DateTimes instead of properties
+bool isDateChange(const PropertyChange* change) {
+    return change->before == NULL && change->after == NULL && strlen(change->group) == 0 &&
+           (strcasecmp(change->name, "BDAY") == 0 || strcasecmp(change->name, "ANNIVERSARY") == 0);
+}
+
+// names are case-insensitive; everything else has to match exactly
+bool propertiesEqual(const Property* first, const Property* second) {
+    if (strcasecmp(first->name, second->name) != 0 || strcasecmp(first->group, second->group) != 0 ||
+            getLength(first->parameters) != getLength(second->parameters) ||
+            getLength(first->values) != getLength(second->values)) {
+        return false;
+    }
+
+    ListIterator iter1 = createIterator(first->parameters);
+    ListIterator iter2 = createIterator(second->parameters);
+    Parameter* param1;
+    Parameter* param2;
+    while ((param1 = nextElement(&iter1)) != NULL && (param2 = nextElement(&iter2)) != NULL) {
+        // interned parameters (see VCIntern.h) are usually the same pointers
+        if ((param1->name != param2->name && strcasecmp(param1->name, param2->name) != 0) ||
+                (param1->value != param2->value && strcmp(param1->value, param2->value) != 0)) {
+            return false;
+        }
+    }
+
+    iter1 = createIterator(first->values);
+    iter2 = createIterator(second->values);
+    char* value1;
+    char* value2;
+    while ((value1 = nextElement(&iter1)) != NULL && (value2 = nextElement(&iter2)) != NULL) {
+        if (strcmp(value1, value2) != 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool datesEqual(const DateTime* first, const DateTime* second) {
+    if (first == NULL || second == NULL) {
+        return first == second;
+    }
+
+    return first->UTC == second->UTC && first->isText == second->isText && strcmp(first->date, second->date) == 0 &&
+           strcmp(first->time, second->time) == 0 && strcmp(first->text, second->text) == 0;
+}
+
+bool cardsEqual(const Card* first, const Card* second) {
+    List* changes = diffCards(first, second);
+    bool equal = changes != NULL && getLength(changes) == 0;
+
+    freeList(changes);
+    return equal;
+}
+
+bool initKeyIndex(KeyIndex* index, int expected) {
+    index->capacity = 16;
+    while (index->capacity < (size_t)expected * 2) {
+        index->capacity *= 2;
+    }
+    index->slots = (KeySlot*)calloc(index->capacity, sizeof(KeySlot));
+
+    return index->slots != NULL;
+}
+
+void freeKeyIndex(KeyIndex* index) {
+    free(index->slots);
+    index->slots = NULL;
+}
+
+// the slot holding key, or the empty slot where it would go.  NULL only if the table is full.
+KeySlot* findKeySlot(const KeyIndex* index, const char* key) {
+    if (key == NULL) {
+        return NULL;
+    }
+
+    uint64_t hash = hashString(key, strlen(key), false);
+    for (size_t i = 0; i < index->capacity; i++) {
+        KeySlot* slot = &index->slots[(hash + i) & (index->capacity - 1)];
+        if (slot->key == NULL || (slot->hash == hash && strcmp(slot->key, key) == 0)) {
+            return slot;
+        }
+    }
+
+    return NULL;
+}
+
+// false if key is NULL, already present, or there is no room
+bool addKey(KeyIndex* index, const char* key, void* value) {
+    KeySlot* slot = findKeySlot(index, key);
+
+    if (slot == NULL || slot->key != NULL) {
+        return false;
+    }
+    slot->key = key;
+    slot->hash = hashString(key, strlen(key), false);
+    slot->value = value;
+
+    return true;
+}
+
+void* findKey(const KeyIndex* index, const char* key) {
+    KeySlot* slot = findKeySlot(index, key);
+
+    return slot != NULL && slot->key != NULL ? slot->value : NULL;
+}
+// *************************************************************************
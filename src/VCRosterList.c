@@ -0,0 +1,26 @@
+// Author: Ben Martens (1349551)
+
+#include "VCRosterList.h"
+
+static char* rosterCardToString(void* card);
+static void rosterDeleteCard(void* card);
+static int rosterCompareCards(const void* first, const void* second);
+
+// ************* Rosters ***************************************************
+List* createRosterList(void) {
+    return initializeList(rosterCardToString, rosterDeleteCard, rosterCompareCards);
+}
+
+char* rosterCardToString(void* card) {
+    return cardToString((const Card*)card);
+}
+
+void rosterDeleteCard(void* card) {
+    deleteCard((Card*)card);
+}
+
+// by FN, like compareProperties
+int rosterCompareCards(const void* first, const void* second) {
+    return compareProperties(((const Card*)first)->fn, ((const Card*)second)->fn);
+}
+// *************************************************************************
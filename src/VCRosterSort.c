@@ -0,0 +1,490 @@
+// Author: Ben Martens (1349551)
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <unistd.h>
+
+#include "VCRosterSort.h"
+
+#define MIN_CARDS_PER_THREAD 8192
+#define INSERTION_SORT_LENGTH 16
+#define KEY_SEPARATOR '\x01' // sorts before any character a name can contain, so "Li" < "Lin"
+
+/*	A key is compared byte by byte, like memcmp.  With a number function it starts with a byte that puts
+	cards without a number last and the number itself, big endian with the sign bit flipped; then come
+	the names, separated by KEY_SEPARATOR.
+*/
+typedef struct sortEntry {
+    uint64_t prefix; // the first 8 bytes of the key, big endian and zero padded, so most comparisons are one integer comparison
+    const char* key;
+    uint32_t length;
+    int index;       // position in the roster
+} SortEntry;
+
+// one thread's share of the work: a range of the cards, then merging pairs of sorted runs
+typedef struct sortTask {
+    struct rosterSort* sort;
+    int start;
+    int end;
+    char* keys; // the keys of the cards in [start, end)
+    size_t keysLength;
+    size_t keysCapacity;
+    bool failed;
+
+    // the runs [mergeStart, mergeMiddle) and [mergeMiddle, mergeEnd) of source are merged into target
+    const SortEntry* source;
+    SortEntry* target;
+    int mergeStart;
+    int mergeMiddle;
+    int mergeEnd;
+} SortTask;
+
+typedef struct rosterSort {
+    RosterSortOptions options;
+    Card** cards;
+    int count;
+    SortEntry* entries; // sorted, once runRosterSort returns
+    SortEntry* scratch;
+    SortTask* tasks;
+    int taskCount;
+} RosterSort;
+
+static VCardErrorCode runRosterSort(List* roster, const RosterSortOptions* options, RosterSort* sort);
+static void freeRosterSort(RosterSort* sort);
+static bool runTasks(RosterSort* sort, int taskCount, void* (*function)(void* argument));
+static void* sortRange(void* argument);
+static void* mergeRuns(void* argument);
+static bool addSortKey(SortTask* task, SortEntry* entry, const Card* card);
+static bool reserveKey(SortTask* task, size_t length);
+static bool appendName(SortTask* task, const char* name, bool separate);
+static void mergeSort(SortEntry* entries, SortEntry* scratch, int count, bool descending);
+static void mergeSortInto(SortEntry* entries, SortEntry* target, int count, bool descending);
+static void insertionSort(SortEntry* entries, int count, bool descending);
+static void mergeEntries(const SortEntry* first, int firstCount, const SortEntry* second, int secondCount, SortEntry* target, bool descending);
+static int compareEntries(const SortEntry* first, const SortEntry* second, bool descending);
+
+// ************* Sorting ***************************************************
+void initRosterSortOptions(RosterSortOptions* options) {
+    if (options == NULL) {
+        return;
+    }
+
+    options->number = NULL;
+    options->context = NULL;
+    options->descending = false;
+    options->threads = 0;
+}
+
+VCardErrorCode rosterSortOrder(List* roster, const RosterSortOptions* options, int** order) {
+    if (order == NULL) {
+        return OTHER_ERROR;
+    }
+    *order = NULL;
+
+    RosterSort sort;
+    VCardErrorCode error = runRosterSort(roster, options, &sort);
+    if (error == OK && sort.count > 0) {
+        *order = (int*)malloc(sort.count * sizeof(int));
+        if (*order == NULL) {
+            error = OTHER_ERROR;
+        }
+    }
+    for (int i = 0; error == OK && i < sort.count; i++) {
+        (*order)[i] = sort.entries[i].index;
+    }
+
+    freeRosterSort(&sort);
+    return error;
+}
+
+VCardErrorCode sortedRosterView(List* roster, const RosterSortOptions* options, Card*** view, int* count) {
+    if (view == NULL || count == NULL) {
+        return OTHER_ERROR;
+    }
+    *view = NULL;
+    *count = 0;
+
+    RosterSort sort;
+    VCardErrorCode error = runRosterSort(roster, options, &sort);
+    if (error == OK && sort.count > 0) {
+        *view = (Card**)malloc(sort.count * sizeof(Card*));
+        if (*view == NULL) {
+            error = OTHER_ERROR;
+        }
+    }
+    for (int i = 0; error == OK && i < sort.count; i++) {
+        (*view)[i] = sort.cards[sort.entries[i].index];
+    }
+    if (error == OK) {
+        *count = sort.count;
+    }
+
+    freeRosterSort(&sort);
+    return error;
+}
+
+VCardErrorCode sortRoster(List* roster, const RosterSortOptions* options) {
+    RosterSort sort;
+    VCardErrorCode error = runRosterSort(roster, options, &sort);
+
+    if (error == OK) {
+        int i = 0;
+        for (Node* node = roster->head; node != NULL; node = node->next) {
+            node->data = sort.cards[sort.entries[i++].index];
+        }
+        invalidateListIndex(roster);
+    }
+
+    freeRosterSort(&sort);
+    return error;
+}
+
+/*	Each task extracts the keys of its range of cards and sorts them; then the runs are merged in pairs,
+	a round at a time, each merge on its own thread, until one run is left.
+*/
+VCardErrorCode runRosterSort(List* roster, const RosterSortOptions* options, RosterSort* sort) {
+    memset(sort, 0, sizeof(RosterSort));
+    if (roster == NULL) {
+        return OTHER_ERROR;
+    }
+    if (options != NULL) {
+        sort->options = *options;
+    } else {
+        initRosterSortOptions(&sort->options);
+    }
+
+    sort->count = getLength(roster);
+    if (sort->count == 0) {
+        return OK;
+    }
+
+    int threads = sort->options.threads > 0 ? sort->options.threads : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int maxThreads = (sort->count + MIN_CARDS_PER_THREAD - 1) / MIN_CARDS_PER_THREAD;
+    sort->taskCount = threads < 1 ? 1 : (threads > maxThreads ? maxThreads : threads);
+
+    sort->cards = (Card**)malloc(sort->count * sizeof(Card*));
+    sort->entries = (SortEntry*)malloc(sort->count * sizeof(SortEntry));
+    sort->scratch = (SortEntry*)malloc(sort->count * sizeof(SortEntry));
+    sort->tasks = (SortTask*)calloc(sort->taskCount, sizeof(SortTask));
+    if (sort->cards == NULL || sort->entries == NULL || sort->scratch == NULL || sort->tasks == NULL) {
+        return OTHER_ERROR;
+    }
+
+    int i = 0;
+    ListIterator iter = createIterator(roster);
+    void* element;
+    while ((element = nextElement(&iter)) != NULL && i < sort->count) {
+        sort->cards[i++] = (Card*)element;
+    }
+
+    for (int t = 0; t < sort->taskCount; t++) {
+        sort->tasks[t].sort = sort;
+        sort->tasks[t].start = (int)((int64_t)sort->count * t / sort->taskCount);
+        sort->tasks[t].end = (int)((int64_t)sort->count * (t + 1) / sort->taskCount);
+    }
+    if (!runTasks(sort, sort->taskCount, sortRange)) {
+        return OTHER_ERROR;
+    }
+
+    // merge rounds: run r covers [tasks[r].start, tasks[r].end), and each round halves the number of runs
+    SortEntry* source = sort->entries;
+    SortEntry* target = sort->scratch;
+    for (int width = 1; width < sort->taskCount; width *= 2) {
+        int merges = 0;
+        for (int first = 0; first < sort->taskCount; first += 2 * width) {
+            int second = first + width < sort->taskCount ? first + width : sort->taskCount;
+            int last = first + 2 * width < sort->taskCount ? first + 2 * width : sort->taskCount;
+            SortTask* task = &sort->tasks[merges++];
+            task->source = source;
+            task->target = target;
+            task->mergeStart = sort->tasks[first].start;
+            task->mergeMiddle = second < sort->taskCount ? sort->tasks[second].start : sort->count;
+            task->mergeEnd = last < sort->taskCount ? sort->tasks[last].start : sort->count;
+        }
+        if (!runTasks(sort, merges, mergeRuns)) {
+            return OTHER_ERROR;
+        }
+        SortEntry* swap = source;
+        source = target;
+        target = swap;
+    }
+    // entries is the sorted array from here on, whichever buffer that ended up in
+    sort->scratch = target;
+    sort->entries = source;
+
+    return OK;
+}
+
+void freeRosterSort(RosterSort* sort) {
+    for (int t = 0; sort->tasks != NULL && t < sort->taskCount; t++) {
+        free(sort->tasks[t].keys);
+    }
+    free(sort->tasks);
+    free(sort->cards);
+    free(sort->entries);
+    free(sort->scratch);
+}
+
+// runs function on the first taskCount tasks, the last one on the calling thread
+bool runTasks(RosterSort* sort, int taskCount, void* (*function)(void* argument)) {
+    pthread_t* workers = taskCount > 1 ? (pthread_t*)malloc((taskCount - 1) * sizeof(pthread_t)) : NULL;
+    bool* started = taskCount > 1 ? (bool*)calloc(taskCount - 1, sizeof(bool)) : NULL;
+
+    if (taskCount > 1 && (workers == NULL || started == NULL)) {
+        // no room to track threads: every task runs here
+        for (int t = 0; t < taskCount; t++) {
+            function(&sort->tasks[t]);
+        }
+    } else {
+        for (int t = 0; t < taskCount - 1; t++) {
+            started[t] = pthread_create(&workers[t], NULL, function, &sort->tasks[t]) == 0;
+        }
+        // a task whose thread could not be started runs here instead
+        for (int t = 0; t < taskCount - 1; t++) {
+            if (!started[t]) {
+                function(&sort->tasks[t]);
+            }
+        }
+        function(&sort->tasks[taskCount - 1]);
+
+        for (int t = 0; t < taskCount - 1; t++) {
+            if (started[t]) {
+                pthread_join(workers[t], NULL);
+            }
+        }
+    }
+    bool failed = false;
+    for (int t = 0; t < taskCount; t++) {
+        failed = failed || sort->tasks[t].failed;
+    }
+
+    free(workers);
+    free(started);
+    return !failed;
+}
+
+void* sortRange(void* argument) {
+    SortTask* task = (SortTask*)argument;
+    RosterSort* sort = task->sort;
+
+    for (int i = task->start; i < task->end && !task->failed; i++) {
+        SortEntry* entry = &sort->entries[i];
+        entry->index = i;
+        task->failed = !addSortKey(task, entry, sort->cards[i]);
+    }
+    if (task->failed) {
+        return NULL;
+    }
+
+    // the keys were stored as offsets, since the buffer may have moved while it grew
+    for (int i = task->start; i < task->end; i++) {
+        SortEntry* entry = &sort->entries[i];
+        entry->key = task->keys + (uintptr_t)entry->key;
+        uint64_t prefix = 0;
+        for (uint32_t b = 0; b < 8; b++) {
+            prefix = (prefix << 8) | (b < entry->length ? (unsigned char)entry->key[b] : 0);
+        }
+        entry->prefix = prefix;
+    }
+
+    mergeSort(&sort->entries[task->start], &sort->scratch[task->start], task->end - task->start, sort->options.descending);
+    return NULL;
+}
+
+void* mergeRuns(void* argument) {
+    SortTask* task = (SortTask*)argument;
+
+    mergeEntries(&task->source[task->mergeStart], task->mergeMiddle - task->mergeStart, &task->source[task->mergeMiddle],
+            task->mergeEnd - task->mergeMiddle, &task->target[task->mergeStart], task->sort->options.descending);
+    return NULL;
+}
+// *************************************************************************
+
+// ************* Keys ******************************************************
+// Appends the card's key to the task's buffer, and sets the entry's key to its offset there
+bool addSortKey(SortTask* task, SortEntry* entry, const Card* card) {
+    size_t start = task->keysLength;
+    const RosterSortOptions* options = &task->sort->options;
+
+    if (options->number != NULL) {
+        if (!reserveKey(task, 9)) {
+            return false;
+        }
+        int64_t number = 0;
+        bool hasNumber = options->number(card, options->context, &number);
+        // descending order reverses the comparison, so the byte is flipped to keep cards without a number last
+        task->keys[task->keysLength++] = hasNumber == options->descending;
+        uint64_t bits = hasNumber ? (uint64_t)number ^ ((uint64_t)1 << 63) : 0;
+        for (int shift = 56; shift >= 0; shift -= 8) {
+            task->keys[task->keysLength++] = (char)(bits >> shift);
+        }
+    }
+    size_t namesStart = task->keysLength;
+
+    const Property* n = NULL;
+
+    void* element;
+    ListIterator iter = createIterator(card->optionalProperties);
+    while ((element = nextElement(&iter)) != NULL) {
+        const Property* property = (const Property*)element;
+        if ((property->name[0] == 'N' || property->name[0] == 'n') && property->name[1] == '\0') {
+            n = property;
+            break;
+        }
+    }
+
+    bool named = false;
+    if (n != NULL) {
+        // family name, given names, additional names
+        int component = 0;
+        iter = createIterator(n->values);
+        while (component < 3 && (element = nextElement(&iter)) != NULL) {
+            size_t before = task->keysLength;
+            if (!appendName(task, (const char*)element, component > 0)) {
+                return false;
+            }
+            // an N without a family or given name says nothing to sort on
+            named = named || (component < 2 && task->keysLength > before + (component > 0));
+            component++;
+        }
+    }
+    if (!named) {
+        task->keysLength = namesStart;
+        if (card->fn != NULL && !appendName(task, (const char*)getFromFront(card->fn->values), false)) {
+            return false;
+        }
+    }
+
+    entry->key = (const char*)(uintptr_t)start;
+    entry->length = (uint32_t)(task->keysLength - start);
+    return true;
+}
+
+bool reserveKey(SortTask* task, size_t length) {
+    if (task->keysLength + length <= task->keysCapacity) {
+        return true;
+    }
+
+    size_t capacity = task->keysCapacity > 0 ? task->keysCapacity * 2 : 4096;
+    while (task->keysLength + length > capacity) {
+        capacity *= 2;
+    }
+    char* keys = (char*)realloc(task->keys, capacity);
+    if (keys == NULL) {
+        return false;
+    }
+    task->keys = keys;
+    task->keysCapacity = capacity;
+
+    return true;
+}
+
+// appends name (case folded, without leading and trailing spaces), after a separator if separate is true
+bool appendName(SortTask* task, const char* name, bool separate) {
+    if (name == NULL) {
+        name = "";
+    }
+    while (*name == ' ') {
+        name++;
+    }
+    size_t length = strlen(name);
+    while (length > 0 && name[length - 1] == ' ') {
+        length--;
+    }
+
+    if (!reserveKey(task, length + 1)) {
+        return false;
+    }
+
+    if (separate) {
+        task->keys[task->keysLength++] = KEY_SEPARATOR;
+    }
+    for (size_t i = 0; i < length; i++) {
+        unsigned char c = (unsigned char)name[i];
+        // control characters would upset the separators
+        if (c > KEY_SEPARATOR) {
+            task->keys[task->keysLength++] = (char)(c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c);
+        }
+    }
+
+    return true;
+}
+// *************************************************************************
+
+// ************* Merge sort ************************************************
+/*	Sorts entries, using scratch (of the same length) as working space.  The halves are sorted into
+	scratch and merged back, and mergeSortInto does the opposite, so entries are never copied back and forth.
+*/
+void mergeSort(SortEntry* entries, SortEntry* scratch, int count, bool descending) {
+    if (count <= INSERTION_SORT_LENGTH) {
+        insertionSort(entries, count, descending);
+        return;
+    }
+
+    int half = count / 2;
+    mergeSortInto(entries, scratch, half, descending);
+    mergeSortInto(entries + half, scratch + half, count - half, descending);
+    mergeEntries(scratch, half, scratch + half, count - half, entries, descending);
+}
+
+// sorts entries into target, using entries as working space
+void mergeSortInto(SortEntry* entries, SortEntry* target, int count, bool descending) {
+    if (count <= INSERTION_SORT_LENGTH) {
+        memcpy(target, entries, count * sizeof(SortEntry));
+        insertionSort(target, count, descending);
+        return;
+    }
+
+    int half = count / 2;
+    mergeSort(entries, target, half, descending);
+    mergeSort(entries + half, target + half, count - half, descending);
+    mergeEntries(entries, half, entries + half, count - half, target, descending);
+}
+
+void insertionSort(SortEntry* entries, int count, bool descending) {
+    for (int i = 1; i < count; i++) {
+        SortEntry entry = entries[i];
+        int j = i;
+        while (j > 0 && compareEntries(&entry, &entries[j - 1], descending) < 0) {
+            entries[j] = entries[j - 1];
+            j--;
+        }
+        entries[j] = entry;
+    }
+}
+
+void mergeEntries(const SortEntry* first, int firstCount, const SortEntry* second, int secondCount, SortEntry* target, bool descending) {
+    int i = 0;
+    int j = 0;
+    int k = 0;
+
+    while (i < firstCount && j < secondCount) {
+        // ties go to the first run, which keeps the sort stable
+        if (compareEntries(&second[j], &first[i], descending) < 0) {
+            target[k++] = second[j++];
+        } else {
+            target[k++] = first[i++];
+        }
+    }
+    memcpy(&target[k], &first[i], (firstCount - i) * sizeof(SortEntry));
+    k += firstCount - i;
+    memcpy(&target[k], &second[j], (secondCount - j) * sizeof(SortEntry));
+}
+
+int compareEntries(const SortEntry* first, const SortEntry* second, bool descending) {
+    int result = 0;
+    if (first->prefix != second->prefix) {
+        result = first->prefix < second->prefix ? -1 : 1;
+    } else if (first->length > 8 && second->length > 8) {
+        uint32_t length = first->length < second->length ? first->length : second->length;
+        result = memcmp(first->key + 8, second->key + 8, length - 8);
+        if (result == 0 && first->length != second->length) {
+            result = first->length < second->length ? -1 : 1;
+        }
+    } else if (first->length != second->length) {
+        result = first->length < second->length ? -1 : 1;
+    }
+
+    return descending ? -result : result;
+}
+// *************************************************************************
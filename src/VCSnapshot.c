@@ -0,0 +1,399 @@
+// Author: Ben Martens (1349551)
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "VCSnapshot.h"
+
+#define SNAPSHOT_CHUNK_SIZE 32
+
+/*	Cards and chunks are reference counted and shared between versions.  owner is the id of the
+	writer that created the object.  Writer ids are never reused, so a writer may modify an object
+	in place only if it created it itself; anything older may be visible to readers and is copied.
+*/
+typedef struct sharedCard {
+    atomic_int refs;
+    uint64_t owner;
+    Card* card;
+} SharedCard;
+
+// every chunk except the last one is full
+typedef struct snapshotChunk {
+    atomic_int refs;
+    uint64_t owner;
+    int count;
+    SharedCard* cards[SNAPSHOT_CHUNK_SIZE];
+} SnapshotChunk;
+
+struct rosterSnapshot {
+    atomic_int refs;
+    uint64_t version;
+    int length;
+    int chunkCount;
+    int chunkCapacity;
+    SnapshotChunk** chunks;
+};
+
+struct sharedRoster {
+    pthread_mutex_t pinLock; // only held to swap or retain current, never while reading a snapshot
+    pthread_mutex_t writeLock;
+    RosterSnapshot* current;
+    uint64_t lastWriterId;
+};
+
+struct rosterWriter {
+    SharedRoster* roster;
+    RosterSnapshot* draft;
+    uint64_t id;
+};
+
+static SharedCard* createSharedCard(Card* card, uint64_t owner);
+static void releaseSharedCard(SharedCard* shared);
+static SnapshotChunk* createChunk(uint64_t owner);
+static void releaseChunk(SnapshotChunk* chunk);
+static SnapshotChunk* mutableChunk(RosterWriter* writer, int chunkIndex);
+static RosterSnapshot* createSnapshot(uint64_t version, int chunkCapacity);
+
+// ************* Roster ****************************************************
+SharedRoster* createSharedRoster(void) {
+    SharedRoster* roster = (SharedRoster*)malloc(sizeof(SharedRoster));
+    if (roster == NULL) {
+        return NULL;
+    }
+
+    roster->current = createSnapshot(0, 0);
+    if (roster->current == NULL) {
+        free(roster);
+        return NULL;
+    }
+    pthread_mutex_init(&roster->pinLock, NULL);
+    pthread_mutex_init(&roster->writeLock, NULL);
+    roster->lastWriterId = 0;
+
+    return roster;
+}
+
+void deleteSharedRoster(SharedRoster* roster) {
+    if (roster == NULL) {
+        return;
+    }
+
+    releaseSnapshot(roster->current);
+    pthread_mutex_destroy(&roster->pinLock);
+    pthread_mutex_destroy(&roster->writeLock);
+    free(roster);
+}
+// *************************************************************************
+
+// ************* Readers ***************************************************
+RosterSnapshot* pinSnapshot(SharedRoster* roster) {
+    RosterSnapshot* snapshot = NULL;
+
+    pthread_mutex_lock(&roster->pinLock);
+    snapshot = roster->current;
+    atomic_fetch_add(&snapshot->refs, 1);
+    pthread_mutex_unlock(&roster->pinLock);
+
+    return snapshot;
+}
+
+void releaseSnapshot(RosterSnapshot* snapshot) {
+    if (snapshot == NULL || atomic_fetch_sub(&snapshot->refs, 1) != 1) {
+        return;
+    }
+
+    for (int i = 0; i < snapshot->chunkCount; i++) {
+        releaseChunk(snapshot->chunks[i]);
+    }
+    free(snapshot->chunks);
+    free(snapshot);
+}
+
+uint64_t snapshotVersion(const RosterSnapshot* snapshot) {
+    return snapshot->version;
+}
+
+int snapshotLength(const RosterSnapshot* snapshot) {
+    return snapshot->length;
+}
+
+const Card* snapshotGetCard(const RosterSnapshot* snapshot, int index) {
+    if (index < 0 || index >= snapshot->length) {
+        return NULL;
+    }
+
+    return snapshot->chunks[index / SNAPSHOT_CHUNK_SIZE]->cards[index % SNAPSHOT_CHUNK_SIZE]->card;
+}
+// *************************************************************************
+
+// ************* Writers ***************************************************
+RosterWriter* beginRosterWrite(SharedRoster* roster) {
+    RosterWriter* writer = (RosterWriter*)malloc(sizeof(RosterWriter));
+    if (writer == NULL) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&roster->writeLock);
+
+    // no pin needed: current only changes on commit, which needs the write lock we hold
+    RosterSnapshot* current = roster->current;
+    writer->draft = createSnapshot(current->version + 1, current->chunkCount);
+    if (writer->draft == NULL) {
+        pthread_mutex_unlock(&roster->writeLock);
+        free(writer);
+        return NULL;
+    }
+    writer->roster = roster;
+    writer->id = ++roster->lastWriterId;
+
+    // the draft starts by sharing every chunk of the current version
+    for (int i = 0; i < current->chunkCount; i++) {
+        atomic_fetch_add(&current->chunks[i]->refs, 1);
+        writer->draft->chunks[i] = current->chunks[i];
+    }
+    writer->draft->chunkCount = current->chunkCount;
+    writer->draft->length = current->length;
+
+    return writer;
+}
+
+int writerLength(const RosterWriter* writer) {
+    return writer->draft->length;
+}
+
+Card* writerEditCard(RosterWriter* writer, int index) {
+    if (index < 0 || index >= writer->draft->length) {
+        return NULL;
+    }
+
+    SnapshotChunk* chunk = mutableChunk(writer, index / SNAPSHOT_CHUNK_SIZE);
+    if (chunk == NULL) {
+        return NULL;
+    }
+
+    SharedCard** slot = &chunk->cards[index % SNAPSHOT_CHUNK_SIZE];
+    if ((*slot)->owner != writer->id) {
+        Card* card = copyCard((*slot)->card);
+        SharedCard* copy = createSharedCard(card, writer->id);
+        if (copy == NULL) {
+            deleteCard(card);
+            return NULL;
+        }
+        releaseSharedCard(*slot);
+        *slot = copy;
+    }
+
+    return (*slot)->card;
+}
+
+VCardErrorCode writerReplaceCard(RosterWriter* writer, int index, Card* card) {
+    if (card == NULL || index < 0 || index >= writer->draft->length) {
+        return OTHER_ERROR;
+    }
+
+    SnapshotChunk* chunk = mutableChunk(writer, index / SNAPSHOT_CHUNK_SIZE);
+    SharedCard* shared = createSharedCard(card, writer->id);
+    if (chunk == NULL || shared == NULL) {
+        free(shared);
+        return OTHER_ERROR;
+    }
+
+    releaseSharedCard(chunk->cards[index % SNAPSHOT_CHUNK_SIZE]);
+    chunk->cards[index % SNAPSHOT_CHUNK_SIZE] = shared;
+
+    return OK;
+}
+
+VCardErrorCode writerAppendCard(RosterWriter* writer, Card* card) {
+    RosterSnapshot* draft = writer->draft;
+    SnapshotChunk* chunk = NULL;
+
+    SharedCard* shared = createSharedCard(card, writer->id);
+    if (shared == NULL) {
+        return OTHER_ERROR;
+    }
+
+    if (draft->length % SNAPSHOT_CHUNK_SIZE == 0) {
+        // the last chunk is full (or there is none), start a new one
+        if (draft->chunkCount == draft->chunkCapacity) {
+            int capacity = draft->chunkCapacity > 0 ? draft->chunkCapacity * 2 : 4;
+            SnapshotChunk** chunks = (SnapshotChunk**)realloc(draft->chunks, capacity * sizeof(SnapshotChunk*));
+            if (chunks == NULL) {
+                free(shared);
+                return OTHER_ERROR;
+            }
+            draft->chunks = chunks;
+            draft->chunkCapacity = capacity;
+        }
+        chunk = createChunk(writer->id);
+        if (chunk == NULL) {
+            free(shared);
+            return OTHER_ERROR;
+        }
+        draft->chunks[draft->chunkCount++] = chunk;
+    } else {
+        chunk = mutableChunk(writer, draft->chunkCount - 1);
+        if (chunk == NULL) {
+            free(shared);
+            return OTHER_ERROR;
+        }
+    }
+
+    chunk->cards[chunk->count++] = shared;
+    draft->length++;
+
+    return OK;
+}
+
+VCardErrorCode writerRemoveCard(RosterWriter* writer, int index) {
+    RosterSnapshot* draft = writer->draft;
+
+    if (index < 0 || index >= draft->length) {
+        return OTHER_ERROR;
+    }
+
+    // every chunk from the removed card to the end shifts, so all of them become private first
+    for (int i = index / SNAPSHOT_CHUNK_SIZE; i < draft->chunkCount; i++) {
+        if (mutableChunk(writer, i) == NULL) {
+            return OTHER_ERROR;
+        }
+    }
+
+    SharedCard* removed = draft->chunks[index / SNAPSHOT_CHUNK_SIZE]->cards[index % SNAPSHOT_CHUNK_SIZE];
+    for (int i = index; i < draft->length - 1; i++) {
+        draft->chunks[i / SNAPSHOT_CHUNK_SIZE]->cards[i % SNAPSHOT_CHUNK_SIZE] =
+            draft->chunks[(i + 1) / SNAPSHOT_CHUNK_SIZE]->cards[(i + 1) % SNAPSHOT_CHUNK_SIZE];
+    }
+
+    SnapshotChunk* last = draft->chunks[draft->chunkCount - 1];
+    last->count--;
+    if (last->count == 0) {
+        releaseChunk(last);
+        draft->chunkCount--;
+    }
+    draft->length--;
+    releaseSharedCard(removed);
+
+    return OK;
+}
+
+uint64_t commitRosterWrite(RosterWriter* writer) {
+    SharedRoster* roster = writer->roster;
+    uint64_t version = writer->draft->version;
+
+    pthread_mutex_lock(&roster->pinLock);
+    RosterSnapshot* previous = roster->current;
+    roster->current = writer->draft;
+    pthread_mutex_unlock(&roster->pinLock);
+
+    // readers still holding the previous version keep it alive
+    releaseSnapshot(previous);
+    pthread_mutex_unlock(&roster->writeLock);
+    free(writer);
+
+    return version;
+}
+
+void abortRosterWrite(RosterWriter* writer) {
+    releaseSnapshot(writer->draft);
+    pthread_mutex_unlock(&writer->roster->writeLock);
+    free(writer);
+}
+// *************************************************************************
+
+// ************* Static helper functions ***********************************
+SharedCard* createSharedCard(Card* card, uint64_t owner) {
+    if (card == NULL) {
+        return NULL;
+    }
+
+    SharedCard* shared = (SharedCard*)malloc(sizeof(SharedCard));
+    if (shared == NULL) {
+        return NULL;
+    }
+    atomic_init(&shared->refs, 1);
+    shared->owner = owner;
+    shared->card = card;
+
+    return shared;
+}
+
+void releaseSharedCard(SharedCard* shared) {
+    if (shared == NULL || atomic_fetch_sub(&shared->refs, 1) != 1) {
+        return;
+    }
+
+    deleteCard(shared->card);
+    free(shared);
+}
+
+SnapshotChunk* createChunk(uint64_t owner) {
+    SnapshotChunk* chunk = (SnapshotChunk*)malloc(sizeof(SnapshotChunk));
+    if (chunk == NULL) {
+        return NULL;
+    }
+    atomic_init(&chunk->refs, 1);
+    chunk->owner = owner;
+    chunk->count = 0;
+
+    return chunk;
+}
+
+void releaseChunk(SnapshotChunk* chunk) {
+    if (chunk == NULL || atomic_fetch_sub(&chunk->refs, 1) != 1) {
+        return;
+    }
+
+    for (int i = 0; i < chunk->count; i++) {
+        releaseSharedCard(chunk->cards[i]);
+    }
+    free(chunk);
+}
+
+// returns the draft's chunk at chunkIndex, copying it first if it is shared with a published version
+SnapshotChunk* mutableChunk(RosterWriter* writer, int chunkIndex) {
+    SnapshotChunk* chunk = writer->draft->chunks[chunkIndex];
+
+    if (chunk->owner == writer->id) {
+        return chunk;
+    }
+
+    SnapshotChunk* copy = createChunk(writer->id);
+    if (copy == NULL) {
+        return NULL;
+    }
+    copy->count = chunk->count;
+    for (int i = 0; i < chunk->count; i++) {
+        atomic_fetch_add(&chunk->cards[i]->refs, 1);
+        copy->cards[i] = chunk->cards[i];
+    }
+    releaseChunk(chunk);
+    writer->draft->chunks[chunkIndex] = copy;
+
+    return copy;
+}
+
+RosterSnapshot* createSnapshot(uint64_t version, int chunkCapacity) {
+    RosterSnapshot* snapshot = (RosterSnapshot*)malloc(sizeof(RosterSnapshot));
+    if (snapshot == NULL) {
+        return NULL;
+    }
+
+    atomic_init(&snapshot->refs, 1);
+    snapshot->version = version;
+    snapshot->length = 0;
+    snapshot->chunkCount = 0;
+    snapshot->chunkCapacity = chunkCapacity;
+    snapshot->chunks = NULL;
+    if (chunkCapacity > 0) {
+        snapshot->chunks = (SnapshotChunk**)malloc(chunkCapacity * sizeof(SnapshotChunk*));
+        if (snapshot->chunks == NULL) {
+            free(snapshot);
+            return NULL;
+        }
+    }
+
+    return snapshot;
+}
+// **************************************************************************
@@ -0,0 +1,186 @@
+// Author: Ben Martens (1349551)
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "VCTrace.h"
+
+/*	One event in the ring buffer.  sequence is the event's number plus one once it has been written, so
+	slots that were claimed but not filled in are left out.  The fields are stored atomically (relaxed)
+	because the slot is reused by whichever thread wraps around to it.
+*/
+typedef struct traceSlot {
+    atomic_uint_fast64_t sequence;
+    const char* name;
+    const char* argName;
+    uint64_t timestamp; // CLOCK_MONOTONIC, in nanoseconds
+    int64_t arg;
+    uint32_t thread;
+    char phase;
+} TraceSlot;
+
+atomic_bool vCardTracing = false;
+
+// the ring buffer only changes under traceLock, and only while no thread is recording (see stopTracing)
+static pthread_mutex_t traceLock = PTHREAD_MUTEX_INITIALIZER;
+static TraceSlot* slots = NULL;
+static size_t slotCount = 0; // a power of two
+static atomic_uint_fast64_t nextSlot = 0;
+static atomic_int recorders = 0;
+
+static _Thread_local uint32_t traceThread = 0;
+
+static void stopTracing(void);
+static bool writeEvent(FILE* fp, const TraceSlot* slot, int pid);
+
+// ************* Control ***************************************************
+VCardErrorCode startVCardTrace(size_t capacity) {
+    if (capacity == 0 || capacity > ((size_t)1 << 40)) {
+        return OTHER_ERROR;
+    }
+
+    size_t count = 1;
+    while (count < capacity) {
+        count *= 2;
+    }
+
+    pthread_mutex_lock(&traceLock);
+    stopTracing();
+
+    if (count != slotCount) {
+        TraceSlot* newSlots = (TraceSlot*)malloc(count * sizeof(TraceSlot));
+        if (newSlots == NULL) {
+            pthread_mutex_unlock(&traceLock);
+            return OTHER_ERROR;
+        }
+        free(slots);
+        slots = newSlots;
+        slotCount = count;
+    }
+    for (size_t i = 0; i < slotCount; i++) {
+        atomic_init(&slots[i].sequence, 0);
+    }
+    atomic_store(&nextSlot, 0);
+    atomic_store(&vCardTracing, true);
+
+    pthread_mutex_unlock(&traceLock);
+    return OK;
+}
+
+void stopVCardTrace(void) {
+    pthread_mutex_lock(&traceLock);
+    stopTracing();
+    pthread_mutex_unlock(&traceLock);
+}
+
+size_t vCardTraceLength(void) {
+    pthread_mutex_lock(&traceLock);
+    uint64_t recorded = atomic_load(&nextSlot);
+    size_t length = recorded < slotCount ? (size_t)recorded : slotCount;
+    pthread_mutex_unlock(&traceLock);
+
+    return length;
+}
+
+void freeVCardTrace(void) {
+    pthread_mutex_lock(&traceLock);
+    stopTracing();
+    free(slots);
+    slots = NULL;
+    slotCount = 0;
+    atomic_store(&nextSlot, 0);
+    pthread_mutex_unlock(&traceLock);
+}
+
+/*	Recorders announce themselves before checking vCardTracing, and this clears it before waiting for
+	them, so once it returns no thread can be inside the ring buffer.
+*/
+void stopTracing(void) {
+    atomic_store(&vCardTracing, false);
+    while (atomic_load(&recorders) > 0) {
+        sched_yield();
+    }
+}
+// *************************************************************************
+
+// ************* Recording *************************************************
+void recordVCardTraceEvent(const char* name, char phase, const char* argName, int64_t arg) {
+    atomic_fetch_add(&recorders, 1);
+
+    if (atomic_load(&vCardTracing)) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (traceThread == 0) {
+            traceThread = (uint32_t)syscall(SYS_gettid);
+        }
+
+        uint64_t number = atomic_fetch_add_explicit(&nextSlot, 1, memory_order_relaxed);
+        TraceSlot* slot = &slots[number & (slotCount - 1)];
+        __atomic_store_n(&slot->name, name, __ATOMIC_RELAXED);
+        __atomic_store_n(&slot->argName, argName, __ATOMIC_RELAXED);
+        __atomic_store_n(&slot->timestamp, (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec, __ATOMIC_RELAXED);
+        __atomic_store_n(&slot->arg, arg, __ATOMIC_RELAXED);
+        __atomic_store_n(&slot->thread, traceThread, __ATOMIC_RELAXED);
+        __atomic_store_n(&slot->phase, phase, __ATOMIC_RELAXED);
+        atomic_store_explicit(&slot->sequence, number + 1, memory_order_release);
+    }
+
+    atomic_fetch_sub(&recorders, 1);
+}
+// *************************************************************************
+
+// ************* Output ****************************************************
+VCardErrorCode writeVCardTrace(const char* fileName) {
+    if (fileName == NULL) {
+        return WRITE_ERROR;
+    }
+
+    pthread_mutex_lock(&traceLock);
+    stopTracing();
+
+    if (slots == NULL) {
+        pthread_mutex_unlock(&traceLock);
+        return INV_FILE;
+    }
+
+    FILE* fp = fopen(fileName, "w");
+    if (fp == NULL) {
+        pthread_mutex_unlock(&traceLock);
+        return WRITE_ERROR;
+    }
+
+    int pid = (int)getpid();
+    bool ok = fprintf(fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n"
+            "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"vcparser\"}}", pid) > 0;
+
+    uint64_t recorded = atomic_load(&nextSlot);
+    uint64_t number = recorded > slotCount ? recorded - slotCount : 0;
+    for (; ok && number < recorded; number++) {
+        const TraceSlot* slot = &slots[number & (slotCount - 1)];
+        if (atomic_load_explicit(&slot->sequence, memory_order_acquire) == number + 1) {
+            ok = writeEvent(fp, slot, pid);
+        }
+    }
+
+    ok = ok && fprintf(fp, "\n]}\n") > 0;
+    if (fclose(fp) != 0) {
+        ok = false;
+    }
+
+    pthread_mutex_unlock(&traceLock);
+    return ok ? OK : WRITE_ERROR;
+}
+
+// Timestamps are in microseconds on the CLOCK_MONOTONIC clock, the one perf uses, so the two can be lined up
+bool writeEvent(FILE* fp, const TraceSlot* slot, int pid) {
+    return fprintf(fp, ",\n{\"name\":\"%s\",\"cat\":\"vcparser\",\"ph\":\"%c\",%s\"ts\":%llu.%03llu,\"pid\":%d,\"tid\":%u,"
+            "\"args\":{\"%s\":%lld}}", slot->name, slot->phase,
+            slot->phase == VCARD_TRACE_INSTANT ? "\"s\":\"t\"," : "",
+            (unsigned long long)(slot->timestamp / 1000), (unsigned long long)(slot->timestamp % 1000), pid,
+            slot->thread, slot->argName, (long long)slot->arg) > 0;
+}
+// *************************************************************************
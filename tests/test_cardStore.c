@@ -0,0 +1,326 @@
+// Author: Ben Martens (1349551)
+
+/*	Tests for VCCardStore: B+tree splits, removals and cursors over all three indexes, and recovery
+	from a commit cut short after its journal was written, from an incomplete journal and from a
+	damaged page.  The store lives in a fresh directory in /tmp.
+*/
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "VCCardStore.h"
+#include "VCRosterDiff.h"
+
+#define CHECK(condition) check((condition), #condition, __LINE__)
+
+// enough cards for interior pages in every tree
+#define CARD_COUNT 3000
+#define BIG_NOTE 9000
+
+static char directory[] = "/tmp/vcstore-test-XXXXXX";
+static char storePath[64];
+static char journalPath[80];
+static int failures;
+
+static void check(bool passed, const char* condition, int line);
+static CardStore* openStore(int cachePages, CardStoreSync sync);
+static Card* makeCard(const char* uid, const char* email, int noteLength);
+static int storeCards(CardStore* store, const char* prefix, int first, int end, const char* domain);
+static int scanCount(CardStore* store, CardStoreIndex index, const char* from, const char* to, bool* ordered);
+static const char* emailOf(const Card* card);
+static off_t fileSize(const char* path);
+
+static void testSplitsAndCursors(void);
+static void testRemovals(void);
+static void testTornCommit(void);
+static void testIncompleteJournal(void);
+static void testDamagedPage(void);
+
+int main(void) {
+    if (mkdtemp(directory) == NULL) {
+        perror("mkdtemp");
+        return 1;
+    }
+    snprintf(storePath, sizeof(storePath), "%s/cards", directory);
+    snprintf(journalPath, sizeof(journalPath), "%s-journal", storePath);
+
+    // the tests run in order, each on the store the one before left
+    testSplitsAndCursors();
+    testRemovals();
+    testTornCommit();
+    testIncompleteJournal();
+    testDamagedPage();
+
+    unlink(storePath);
+    unlink(journalPath);
+    rmdir(directory);
+    printf("test_cardStore: %d failure%s\n", failures, failures == 1 ? "" : "s");
+    return failures == 0 ? 0 : 1;
+}
+
+// ************* Tests *****************************************************
+void testSplitsAndCursors(void) {
+    CardStoreStats stats;
+    bool ordered;
+
+    // a small cache, so that pages are evicted and read back during the changes
+    CardStore* store = openStore(16, CARD_STORE_SYNC_DEFERRED);
+    CHECK(storeCards(store, "u", 0, CARD_COUNT, "x.ca") == CARD_COUNT);
+    Card* big = makeCard("big", "big@x.ca", BIG_NOTE);
+    CHECK(storeCard(store, big) == OK);
+    deleteCard(big);
+    CHECK(closeCardStore(store) == OK);
+
+    store = openStore(16, CARD_STORE_SYNC_EACH);
+    cardStoreStatistics(store, &stats);
+    CHECK(stats.cards == CARD_COUNT + 1);
+
+    Card* card = NULL;
+    CHECK(getStoredCard(store, "u01234", &card) == OK && card != NULL && strcmp(emailOf(card), "u01234@x.ca") == 0);
+    deleteCard(card);
+    CHECK(getStoredCard(store, "nobody", &card) == OK && card == NULL);
+    CHECK(getStoredCard(store, "big", &card) == OK && card != NULL);
+    if (card != NULL) {
+        const Property* note = (const Property*)getFromBack(card->optionalProperties);
+        CHECK(strcmp(note->name, "NOTE") == 0 && strlen((const char*)getFromFront(note->values)) == BIG_NOTE);
+    }
+    deleteCard(card);
+
+    CHECK(scanCount(store, CARD_STORE_BY_UID, NULL, NULL, &ordered) == CARD_COUNT + 1 && ordered);
+    CHECK(scanCount(store, CARD_STORE_BY_UID, "u01000", "u01099", &ordered) == 100 && ordered);
+    CHECK(scanCount(store, CARD_STORE_BY_EMAIL, NULL, NULL, &ordered) == CARD_COUNT + 1);
+    CHECK(scanCount(store, CARD_STORE_BY_EMAIL, "U00042@X.CA", "u00042@x.ca", &ordered) == 1);
+    CHECK(scanCount(store, CARD_STORE_BY_FN, "student u00100", "student u00199", &ordered) == 100);
+
+    // a cursor picks up changes made between its calls
+    CardStoreCursor* cursor;
+    CHECK(openCardStoreCursor(store, CARD_STORE_BY_UID, "u00010", "u00012", &cursor) == OK);
+    CHECK(nextStoredCard(cursor, &card) == OK && card != NULL);
+    deleteCard(card);
+    CHECK(removeStoredCard(store, "u00011") == OK);
+    CHECK(nextStoredCard(cursor, &card) == OK && card != NULL && strcmp(cardUIDKey(card, NULL), "u00012") == 0);
+    deleteCard(card);
+    CHECK(nextStoredCard(cursor, &card) == OK && card == NULL);
+    closeCardStoreCursor(cursor);
+
+    CHECK(closeCardStore(store) == OK);
+}
+
+void testRemovals(void) {
+    CardStoreStats stats;
+    bool ordered;
+    char uid[16];
+
+    CardStore* store = openStore(64, CARD_STORE_SYNC_DEFERRED);
+    int removed = 0;
+    for (int i = 0; i < CARD_COUNT; i += 2) {
+        snprintf(uid, sizeof(uid), "u%05d", i);
+        removed += removeStoredCard(store, uid) == OK;
+    }
+    CHECK(removed == CARD_COUNT / 2);
+    CHECK(removeStoredCard(store, "u00000") == OTHER_ERROR);
+    CHECK(removeStoredCard(store, "big") == OK);
+
+    // replacing a card moves it in the indexes
+    Card* card = makeCard("u00001", "moved@y.ca", 0);
+    CHECK(storeCard(store, card) == OK);
+    deleteCard(card);
+    CHECK(closeCardStore(store) == OK);
+
+    // u00011 went in the cursor test
+    int left = CARD_COUNT / 2 - 1;
+    store = openStore(64, CARD_STORE_SYNC_EACH);
+    cardStoreStatistics(store, &stats);
+    CHECK(stats.cards == (uint64_t)left);
+    CHECK(scanCount(store, CARD_STORE_BY_UID, NULL, NULL, &ordered) == left && ordered);
+    CHECK(scanCount(store, CARD_STORE_BY_EMAIL, NULL, NULL, &ordered) == left);
+    CHECK(scanCount(store, CARD_STORE_BY_FN, NULL, NULL, &ordered) == left);
+    CHECK(scanCount(store, CARD_STORE_BY_EMAIL, "u00001@x.ca", "u00001@x.ca", &ordered) == 0);
+    CHECK(scanCount(store, CARD_STORE_BY_EMAIL, "moved@y.ca", "moved@y.ca", &ordered) == 1);
+    CHECK(getStoredCard(store, "u00002", &card) == OK && card == NULL);
+    CHECK(closeCardStore(store) == OK);
+}
+
+// The page writes of a commit fail part way, after its journal is on disk.  Opening the store again
+// must finish the commit from the journal.
+void testTornCommit(void) {
+    CardStoreStats stats;
+    bool ordered;
+
+    CardStore* store = openStore(1024, CARD_STORE_SYNC_DEFERRED);
+    CHECK(storeCards(store, "v", 0, 200, "z.ca") == 200);
+
+    // new pages go past the end of the file, which the limit stops; the journal is much smaller
+    struct rlimit saved;
+    struct rlimit limit;
+    getrlimit(RLIMIT_FSIZE, &saved);
+    limit = saved;
+    limit.rlim_cur = (rlim_t)fileSize(storePath) + 4096;
+    signal(SIGXFSZ, SIG_IGN);
+    CHECK(setrlimit(RLIMIT_FSIZE, &limit) == 0);
+    CHECK(commitCardStore(store) == WRITE_ERROR);
+    CHECK(setrlimit(RLIMIT_FSIZE, &saved) == 0);
+    CHECK(fileSize(journalPath) > 0);
+
+    // the store refuses changes until it is opened again
+    Card* card = makeCard("w", "w@z.ca", 0);
+    CHECK(storeCard(store, card) == WRITE_ERROR);
+    deleteCard(card);
+    CHECK(closeCardStore(store) == WRITE_ERROR);
+
+    store = openStore(64, CARD_STORE_SYNC_EACH);
+    CHECK(fileSize(journalPath) == 0);
+    cardStoreStatistics(store, &stats);
+    CHECK(stats.cards == CARD_COUNT / 2 - 1 + 200);
+    CHECK(scanCount(store, CARD_STORE_BY_UID, "v", "w", &ordered) == 200 && ordered);
+    CHECK(scanCount(store, CARD_STORE_BY_EMAIL, "v00199@z.ca", "v00199@z.ca", &ordered) == 1);
+    CHECK(closeCardStore(store) == OK);
+}
+
+// a journal that was never finished belongs to a commit that never touched the file
+void testIncompleteJournal(void) {
+    CardStoreStats stats;
+    char garbage[5000];
+
+    memset(garbage, 0x5A, sizeof(garbage));
+    int fd = open(journalPath, O_WRONLY | O_TRUNC);
+    CHECK(fd >= 0 && write(fd, garbage, sizeof(garbage)) == (ssize_t)sizeof(garbage));
+    close(fd);
+
+    CardStore* store = openStore(64, CARD_STORE_SYNC_EACH);
+    CHECK(fileSize(journalPath) == 0);
+    cardStoreStatistics(store, &stats);
+    CHECK(stats.cards == CARD_COUNT / 2 - 1 + 200);
+    CHECK(closeCardStore(store) == OK);
+}
+
+void testDamagedPage(void) {
+    unsigned char byte;
+
+    // page 1 is the first leaf of the UID tree
+    int fd = open(storePath, O_RDWR);
+    CHECK(fd >= 0 && pread(fd, &byte, 1, 4096 + 100) == 1);
+    byte ^= 0x01;
+    CHECK(pwrite(fd, &byte, 1, 4096 + 100) == 1);
+    close(fd);
+
+    CardStore* store = openStore(64, CARD_STORE_SYNC_EACH);
+    CardStoreCursor* cursor;
+    Card* card = NULL;
+    VCardErrorCode error;
+    CHECK(openCardStoreCursor(store, CARD_STORE_BY_UID, NULL, NULL, &cursor) == OK);
+    while ((error = nextStoredCard(cursor, &card)) == OK && card != NULL) {
+        deleteCard(card);
+    }
+    closeCardStoreCursor(cursor);
+    CHECK(error == INV_FILE);
+    closeCardStore(store);
+}
+// *************************************************************************
+
+// ************* Helpers ***************************************************
+void check(bool passed, const char* condition, int line) {
+    if (!passed) {
+        fprintf(stderr, "test_cardStore.c:%d: %s failed\n", line, condition);
+        failures++;
+    }
+}
+
+CardStore* openStore(int cachePages, CardStoreSync sync) {
+    CardStoreOptions options;
+    CardStore* store = NULL;
+
+    initCardStoreOptions(&options);
+    options.cachePages = cachePages;
+    options.sync = sync;
+    if (openCardStore(storePath, &options, &store) != OK) {
+        fprintf(stderr, "test_cardStore: can't open %s\n", storePath);
+        exit(1);
+    }
+
+    return store;
+}
+
+Card* makeCard(const char* uid, const char* email, int noteLength) {
+    char* note = (char*)malloc(noteLength + 1);
+    char* text = (char*)malloc(noteLength + 256);
+    Card* card = NULL;
+
+    memset(note, 'n', noteLength);
+    note[noteLength] = '\0';
+    snprintf(text, noteLength + 256, "BEGIN:VCARD\r\nVERSION:4.0\r\nFN:Student %s\r\nUID:%s\r\nEMAIL:%s\r\n%s%s%sEND:VCARD\r\n",
+            uid, uid, email, noteLength > 0 ? "NOTE:" : "", note, noteLength > 0 ? "\r\n" : "");
+    createCardFromBuffer(text, strlen(text), &card, NULL);
+    free(note);
+    free(text);
+
+    return card;
+}
+
+// stores cards <prefix><first> to <prefix><end - 1>, out of order, and returns how many went in
+int storeCards(CardStore* store, const char* prefix, int first, int end, const char* domain) {
+    char uid[16];
+    char email[32];
+    int stored = 0;
+
+    for (int i = 0; i < end - first; i++) {
+        int n = first + (int)(((long)i * 7919) % (end - first)); // 7919 is prime, so every n comes up once
+        snprintf(uid, sizeof(uid), "%s%05d", prefix, n);
+        snprintf(email, sizeof(email), "%s@%s", uid, domain);
+        Card* card = makeCard(uid, email, 0);
+        stored += card != NULL && storeCard(store, card) == OK;
+        deleteCard(card);
+    }
+
+    return stored;
+}
+
+// the number of cards a cursor returns; *ordered tells whether their UIDs kept rising
+int scanCount(CardStore* store, CardStoreIndex index, const char* from, const char* to, bool* ordered) {
+    CardStoreCursor* cursor;
+    Card* card;
+    char last[CARD_STORE_MAX_UID + 1] = "";
+    int count = 0;
+
+    *ordered = true;
+    if (openCardStoreCursor(store, index, from, to, &cursor) != OK) {
+        return -1;
+    }
+    while (nextStoredCard(cursor, &card) == OK && card != NULL) {
+        const char* uid = cardUIDKey(card, NULL);
+        *ordered = *ordered && strcmp(last, uid) < 0;
+        snprintf(last, sizeof(last), "%s", uid);
+        count++;
+        deleteCard(card);
+    }
+    closeCardStoreCursor(cursor);
+
+    return count;
+}
+
+const char* emailOf(const Card* card) {
+    void* element;
+    ListIterator iter = createIterator(card->optionalProperties);
+
+    while ((element = nextElement(&iter)) != NULL) {
+        const Property* property = (const Property*)element;
+        if (strcmp(property->name, "EMAIL") == 0) {
+            return (const char*)getFromFront(property->values);
+        }
+    }
+
+    return "";
+}
+
+off_t fileSize(const char* path) {
+    struct stat status;
+
+    return stat(path, &status) == 0 ? status.st_size : -1;
+}
+// *************************************************************************
@@ -0,0 +1,284 @@
+// Author: Ben Martens (1349551)
+
+/*	Tests for VCChart: every kind of chart is a complete SVG document, charts of grades too large for
+	a double's spacing still finish, and the dashboard's files (written on several threads) match the
+	charts written one at a time.
+*/
+
+#define _GNU_SOURCE
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "VCChart.h"
+
+#define CHECK(condition) check((condition), #condition, __LINE__)
+
+#define CARD_COUNT 200
+#define SECTION_COUNT 4
+
+// a chart that takes longer than this has hung
+#define TIME_LIMIT_S 20
+
+static char directory[] = "/tmp/vcchart-test-XXXXXX";
+static int failures;
+
+static void check(bool passed, const char* condition, int line);
+static List* makeRoster(int count, int64_t firstGrade, int64_t gradeStep);
+static const char* propertyValue(const Card* card, const char* name);
+static bool readGrade(const Card* card, void* context, int64_t* number);
+static const char* readSection(const Card* card, void* context);
+static char* chartText(List* roster, const ChartAssessment* assessment, ChartKind kind, const ChartOptions* options, VCardErrorCode* error);
+static char* fileText(const char* fileName);
+static int countText(const char* text, const char* part);
+static bool isSvg(const char* text);
+static char* printCard(void* card);
+static void freeCard(void* card);
+static int compareCards(const void* first, const void* second);
+
+static void testKinds(void);
+static void testArguments(void);
+static void testHugeGrades(void);
+static void testDashboard(void);
+
+int main(void) {
+    if (mkdtemp(directory) == NULL) {
+        perror("mkdtemp");
+        return 1;
+    }
+    alarm(TIME_LIMIT_S);
+
+    testKinds();
+    testArguments();
+    testHugeGrades();
+    testDashboard();
+
+    rmdir(directory);
+    printf("test_chart: %d failure%s\n", failures, failures == 1 ? "" : "s");
+    return failures == 0 ? 0 : 1;
+}
+
+// ************* Tests *****************************************************
+void testKinds(void) {
+    List* roster = makeRoster(CARD_COUNT, 0, 1);
+    ChartAssessment assessment = {"Midterm", readGrade, NULL, 0, 200};
+    ChartOptions options;
+    VCardErrorCode error;
+
+    initChartOptions(&options);
+    options.section = readSection;
+
+    char* histogram = chartText(roster, &assessment, CHART_HISTOGRAM, &options, &error);
+    CHECK(error == OK && isSvg(histogram));
+    CHECK(countText(histogram, "class=\"bar\"") == options.bins);
+    free(histogram);
+
+    char* boxPlot = chartText(roster, &assessment, CHART_BOX_PLOT, &options, &error);
+    CHECK(error == OK && isSvg(boxPlot));
+    free(boxPlot);
+
+    // one box for the class and one for each section
+    char* sections = chartText(roster, &assessment, CHART_SECTIONS, &options, &error);
+    CHECK(error == OK && isSvg(sections));
+    CHECK(strstr(sections, ">All<") != NULL);
+    CHECK(strstr(sections, ">S0<") != NULL && strstr(sections, ">S3<") != NULL);
+    free(sections);
+
+    // a roster where nobody has a grade still gives a chart
+    List* empty = makeRoster(0, 0, 1);
+    char* nothing = chartText(empty, &assessment, CHART_BOX_PLOT, NULL, &error);
+    CHECK(error == OK && isSvg(nothing));
+    free(nothing);
+
+    freeList(empty);
+    freeList(roster);
+}
+
+void testArguments(void) {
+    List* roster = makeRoster(10, 0, 1);
+    ChartAssessment assessment = {"Quiz", readGrade, NULL, 0, 0};
+    ChartAssessment noGrade = {"Quiz", NULL, NULL, 0, 0};
+    ChartOptions options;
+    char path[64];
+
+    initChartOptions(&options);
+    CHECK(writeGradeChart(NULL, &assessment, CHART_HISTOGRAM, NULL, stdout) == OTHER_ERROR);
+    CHECK(writeGradeChart(roster, &noGrade, CHART_HISTOGRAM, NULL, stdout) == OTHER_ERROR);
+    CHECK(writeGradeChart(roster, &assessment, CHART_SECTIONS, &options, stdout) == OTHER_ERROR);
+    CHECK(writeGradeChart(roster, &assessment, (ChartKind)7, &options, stdout) == OTHER_ERROR);
+    options.bins = 0;
+    CHECK(writeGradeChart(roster, &assessment, CHART_HISTOGRAM, &options, stdout) == OTHER_ERROR);
+
+    snprintf(path, sizeof(path), "%s/missing/chart.svg", directory);
+    CHECK(writeGradeChartToFile(roster, &assessment, CHART_HISTOGRAM, NULL, path) == WRITE_ERROR);
+    freeList(roster);
+}
+
+// Past 2^53 doubles are further apart than one grade, so the axis must be drawn in counted steps
+void testHugeGrades(void) {
+    VCardErrorCode error;
+
+    List* single = makeRoster(1, 100000000000000000LL, 1);
+    ChartAssessment assessment = {"Huge", readGrade, NULL, 0, 0};
+    char* chart = chartText(single, &assessment, CHART_BOX_PLOT, NULL, &error);
+    CHECK(error == OK && isSvg(chart));
+    CHECK(countText(chart, "class=\"grid\"") < 100);
+    free(chart);
+    freeList(single);
+
+    List* spread = makeRoster(CARD_COUNT, INT64_MAX - CARD_COUNT * 3, 3);
+    chart = chartText(spread, &assessment, CHART_HISTOGRAM, NULL, &error);
+    CHECK(error == OK && isSvg(chart));
+    free(chart);
+    chart = chartText(spread, &assessment, CHART_BOX_PLOT, NULL, &error);
+    CHECK(error == OK && isSvg(chart));
+    free(chart);
+    freeList(spread);
+}
+
+void testDashboard(void) {
+    static const char* suffixes[] = {"histogram", "boxplot", "sections"};
+    List* roster = makeRoster(CARD_COUNT, 0, 1);
+    ChartAssessment assessments[3] = {{"First", readGrade, NULL, 0, 200}, {"Second", readGrade, NULL, 0, 0}, {"Third", readGrade, NULL, 50, 150}};
+    ChartOptions options;
+    char prefix[64];
+    char path[96];
+    VCardErrorCode error;
+
+    initChartOptions(&options);
+    options.section = readSection;
+    options.threads = 4;
+    snprintf(prefix, sizeof(prefix), "%s/chart", directory);
+    CHECK(writeGradeDashboard(roster, assessments, 3, &options, prefix) == OK);
+
+    for (int i = 0; i < 3; i++) {
+        for (int kind = CHART_HISTOGRAM; kind <= CHART_SECTIONS; kind++) {
+            snprintf(path, sizeof(path), "%s-%03d-%s.svg", prefix, i, suffixes[kind]);
+            char* written = fileText(path);
+            char* expected = chartText(roster, &assessments[i], (ChartKind)kind, &options, &error);
+            CHECK(written != NULL && expected != NULL && strcmp(written, expected) == 0);
+            free(written);
+            free(expected);
+            unlink(path);
+        }
+    }
+    freeList(roster);
+}
+// *************************************************************************
+
+// ************* Helpers ***************************************************
+void check(bool passed, const char* condition, int line) {
+    if (!passed) {
+        fprintf(stderr, "test_chart.c:%d: %s failed\n", line, condition);
+        failures++;
+    }
+}
+
+// cards with grades (in NOTE) firstGrade, firstGrade + gradeStep, ..., spread over SECTION_COUNT sections (in ORG)
+List* makeRoster(int count, int64_t firstGrade, int64_t gradeStep) {
+    List* roster = initializeList(printCard, freeCard, compareCards);
+    char text[256];
+
+    for (int i = 0; i < count; i++) {
+        Card* card = NULL;
+        snprintf(text, sizeof(text), "BEGIN:VCARD\r\nVERSION:4.0\r\nFN:Student %d\r\nNOTE:%lld\r\nORG:S%d\r\nEND:VCARD\r\n",
+                i, (long long)(firstGrade + i * gradeStep), i % SECTION_COUNT);
+        if (createCardFromBuffer(text, strlen(text), &card, NULL) == OK) {
+            insertBack(roster, card);
+        }
+    }
+
+    return roster;
+}
+
+const char* propertyValue(const Card* card, const char* name) {
+    void* element;
+    ListIterator iter = createIterator(card->optionalProperties);
+
+    while ((element = nextElement(&iter)) != NULL) {
+        const Property* property = (const Property*)element;
+        if (strcmp(property->name, name) == 0) {
+            return (const char*)getFromFront(property->values);
+        }
+    }
+
+    return NULL;
+}
+
+bool readGrade(const Card* card, void* context, int64_t* number) {
+    (void)context;
+    const char* value = propertyValue(card, "NOTE");
+    if (value == NULL) {
+        return false;
+    }
+
+    *number = strtoll(value, NULL, 10);
+    return true;
+}
+
+const char* readSection(const Card* card, void* context) {
+    (void)context;
+    return propertyValue(card, "ORG");
+}
+
+char* chartText(List* roster, const ChartAssessment* assessment, ChartKind kind, const ChartOptions* options, VCardErrorCode* error) {
+    char* text = NULL;
+    size_t length = 0;
+
+    FILE* fp = open_memstream(&text, &length);
+    *error = writeGradeChart(roster, assessment, kind, options, fp);
+    fclose(fp);
+
+    return text;
+}
+
+char* fileText(const char* fileName) {
+    FILE* fp = fopen(fileName, "rb");
+    struct stat status;
+
+    if (fp == NULL || fstat(fileno(fp), &status) != 0) {
+        if (fp != NULL) {
+            fclose(fp);
+        }
+        return NULL;
+    }
+    char* text = (char*)calloc(status.st_size + 1, 1);
+    if (text != NULL && fread(text, 1, status.st_size, fp) != (size_t)status.st_size) {
+        free(text);
+        text = NULL;
+    }
+    fclose(fp);
+
+    return text;
+}
+
+int countText(const char* text, const char* part) {
+    int count = 0;
+
+    for (const char* found = strstr(text, part); found != NULL; found = strstr(found + 1, part)) {
+        count++;
+    }
+
+    return count;
+}
+
+bool isSvg(const char* text) {
+    size_t length = text != NULL ? strlen(text) : 0;
+
+    return length > 12 && strncmp(text, "<?xml", 5) == 0 && strstr(text, "<svg ") != NULL && strcmp(text + length - 7, "</svg>\n") == 0;
+}
+
+char* printCard(void* card) {
+    return cardToString((Card*)card);
+}
+
+void freeCard(void* card) {
+    deleteCard((Card*)card);
+}
+
+int compareCards(const void* first, const void* second) {
+    return first != second;
+}
+// *************************************************************************
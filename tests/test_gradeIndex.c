@@ -0,0 +1,333 @@
+// Author: Ben Martens (1349551)
+
+/*	Tests for VCGradeIndex: thousands of random grade changes, with every query checked against a
+	brute force model that keeps the grades in a plain array and sorts it.
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "VCGradeIndex.h"
+
+#define CHECK(condition) check((condition), #condition, __LINE__)
+
+#define CARD_COUNT 500
+#define UPDATE_COUNT 4000
+#define FULL_CHECK_INTERVAL 250
+#define QUERIES_PER_UPDATE 8
+
+// grades from a small range, so that many are equal
+#define GRADE_RANGE 40
+
+// the grades the cards hold; the grade function reads these, so a student's "card" can be edited
+typedef struct model {
+    int64_t grades[CARD_COUNT];
+    bool graded[CARD_COUNT];
+    int sorted[CARD_COUNT]; // positions of the graded students, lowest grade first
+    int count;
+} Model;
+
+static int failures;
+static Model model;
+
+static void check(bool passed, const char* condition, int line);
+static List* makeRoster(int count);
+static bool readGrade(const Card* card, void* context, int64_t* number);
+static int64_t randomGrade(void);
+static int compareModelStudents(const void* first, const void* second);
+static void sortModel(void);
+static int modelCount(int64_t grade, int direction);
+static int64_t modelGradeAtPercentile(double percentile);
+static void checkStudent(const GradeIndex* index, int position);
+static void checkPercentile(const GradeIndex* index, double percentile);
+static void checkAll(const GradeIndex* index);
+static char* printCard(void* card);
+static void freeCard(void* card);
+static int compareCards(const void* first, const void* second);
+
+static void testRandomUpdates(void);
+static void testArguments(void);
+
+int main(void) {
+    srand(1349551);
+
+    testRandomUpdates();
+    testArguments();
+
+    printf("test_gradeIndex: %d failure%s\n", failures, failures == 1 ? "" : "s");
+    return failures == 0 ? 0 : 1;
+}
+
+// ************* Tests *****************************************************
+void testRandomUpdates(void) {
+    List* roster = makeRoster(CARD_COUNT);
+    GradeIndex* index = NULL;
+
+    for (int i = 0; i < CARD_COUNT; i++) {
+        model.graded[i] = rand() % 3 != 0;
+        model.grades[i] = randomGrade();
+    }
+    CHECK(createGradeIndex(roster, readGrade, &model, &index) == OK);
+    CHECK(gradeIndexLength(index) == CARD_COUNT);
+    sortModel();
+    checkAll(index);
+
+    for (int update = 1; update <= UPDATE_COUNT; update++) {
+        int position = rand() % CARD_COUNT;
+        switch (rand() % 4) {
+            case 0:
+            case 1:
+                model.graded[position] = true;
+                model.grades[position] = randomGrade();
+                CHECK(setStudentGrade(index, position, model.grades[position]) == OK);
+                break;
+            case 2:
+                model.graded[position] = false;
+                CHECK(clearStudentGrade(index, position) == OK);
+                break;
+            default:
+                // the card changed under the index
+                model.graded[position] = rand() % 4 != 0;
+                model.grades[position] = randomGrade();
+                CHECK(refreshStudentGrade(index, position) == OK);
+                break;
+        }
+        sortModel();
+
+        checkStudent(index, position);
+        for (int q = 0; q < QUERIES_PER_UPDATE; q++) {
+            checkStudent(index, rand() % CARD_COUNT);
+            // quarters are exact in a double, so the model and the index cannot round differently
+            checkPercentile(index, rand() % 401 / 4.0);
+        }
+        if (update % FULL_CHECK_INTERVAL == 0) {
+            checkAll(index);
+        }
+    }
+
+    // with every grade cleared the index is empty again
+    for (int i = 0; i < CARD_COUNT; i++) {
+        model.graded[i] = false;
+        CHECK(clearStudentGrade(index, i) == OK);
+    }
+    sortModel();
+    checkAll(index);
+
+    deleteGradeIndex(index);
+    freeList(roster);
+}
+
+void testArguments(void) {
+    List* roster = makeRoster(3);
+    GradeIndex* index = (GradeIndex*)&index;
+    int positions[3];
+    int64_t grade;
+
+    CHECK(createGradeIndex(NULL, readGrade, &model, &index) == OTHER_ERROR && index == NULL);
+    CHECK(createGradeIndex(roster, NULL, &model, &index) == OTHER_ERROR && index == NULL);
+
+    for (int i = 0; i < 3; i++) {
+        model.graded[i] = false;
+    }
+    CHECK(createGradeIndex(roster, readGrade, &model, &index) == OK);
+    CHECK(gradedCount(index) == 0);
+    CHECK(gradeAtPercentile(index, 50, &grade) == OTHER_ERROR);
+    CHECK(setStudentGrade(index, 3, 1) == OTHER_ERROR);
+    CHECK(setStudentGrade(index, -1, 1) == OTHER_ERROR);
+    CHECK(getStudentGrade(index, 3, &grade) == false);
+    CHECK(gradedCard(index, 3) == NULL && gradedCard(index, 2) != NULL);
+
+    CHECK(setStudentGrade(index, 1, INT64_MIN) == OK);
+    CHECK(setStudentGrade(index, 2, INT64_MAX) == OK);
+    CHECK(gradeAtPercentile(index, -1, &grade) == OTHER_ERROR);
+    CHECK(gradeAtPercentile(index, 101, &grade) == OTHER_ERROR);
+    CHECK(gradeAtPercentile(index, 0, &grade) == OK && grade == INT64_MIN);
+    CHECK(gradeAtPercentile(index, 100, &grade) == OK && grade == INT64_MAX);
+    CHECK(studentRank(index, 0) == 0 && studentPercentileRank(index, 0) == -1);
+    CHECK(topGradedStudents(index, 3, positions) == 2 && positions[0] == 2 && positions[1] == 1);
+    CHECK(topGradedStudents(index, 0, positions) == 0);
+    CHECK(nthGradedStudent(index, 2) == -1);
+
+    deleteGradeIndex(index);
+    freeList(roster);
+}
+// *************************************************************************
+
+// ************* Helpers ***************************************************
+void check(bool passed, const char* condition, int line) {
+    if (!passed) {
+        fprintf(stderr, "test_gradeIndex.c:%d: %s failed\n", line, condition);
+        failures++;
+    }
+}
+
+// cards whose UIDs are their roster positions
+List* makeRoster(int count) {
+    List* roster = initializeList(printCard, freeCard, compareCards);
+    char text[256];
+
+    for (int i = 0; i < count; i++) {
+        Card* card = NULL;
+        snprintf(text, sizeof(text), "BEGIN:VCARD\r\nVERSION:4.0\r\nFN:Student %d\r\nUID:%d\r\nEND:VCARD\r\n", i, i);
+        if (createCardFromBuffer(text, strlen(text), &card, NULL) == OK) {
+            insertBack(roster, card);
+        }
+    }
+
+    return roster;
+}
+
+bool readGrade(const Card* card, void* context, int64_t* number) {
+    const Model* grades = (const Model*)context;
+    void* element;
+    ListIterator iter = createIterator(card->optionalProperties);
+
+    while ((element = nextElement(&iter)) != NULL) {
+        const Property* property = (const Property*)element;
+        if (strcmp(property->name, "UID") == 0) {
+            int position = atoi((const char*)getFromFront(property->values));
+            *number = grades->grades[position];
+            return grades->graded[position];
+        }
+    }
+
+    return false;
+}
+
+// now and then a grade at the ends of the range, to catch overflow
+int64_t randomGrade(void) {
+    switch (rand() % 50) {
+        case 0:
+            return INT64_MIN;
+        case 1:
+            return INT64_MAX;
+        default:
+            return rand() % GRADE_RANGE - GRADE_RANGE / 4;
+    }
+}
+
+// lower grades first; among equal grades the student later in the roster, who counts as worse
+int compareModelStudents(const void* first, const void* second) {
+    int a = *(const int*)first;
+    int b = *(const int*)second;
+
+    if (model.grades[a] != model.grades[b]) {
+        return model.grades[a] < model.grades[b] ? -1 : 1;
+    }
+    return b - a;
+}
+
+void sortModel(void) {
+    model.count = 0;
+    for (int i = 0; i < CARD_COUNT; i++) {
+        if (model.graded[i]) {
+            model.sorted[model.count++] = i;
+        }
+    }
+    qsort(model.sorted, model.count, sizeof(int), compareModelStudents);
+}
+
+// number of grades below (direction < 0), equal to (0) or above (> 0) a grade
+int modelCount(int64_t grade, int direction) {
+    int count = 0;
+
+    for (int i = 0; i < CARD_COUNT; i++) {
+        if (model.graded[i]) {
+            int64_t other = model.grades[i];
+            count += direction < 0 ? other < grade : direction > 0 ? other > grade : other == grade;
+        }
+    }
+
+    return count;
+}
+
+int64_t modelGradeAtPercentile(double percentile) {
+    // the smallest rank with rank / count >= percentile / 100, counting up so no rounding is involved
+    int rank = 1;
+    while (rank < model.count && rank * 100.0 < percentile * model.count) {
+        rank++;
+    }
+
+    return model.grades[model.sorted[rank - 1]];
+}
+
+void checkStudent(const GradeIndex* index, int position) {
+    int64_t grade;
+    bool graded = getStudentGrade(index, position, &grade);
+
+    CHECK(graded == model.graded[position]);
+    if (!model.graded[position]) {
+        CHECK(studentRank(index, position) == 0);
+        CHECK(studentPercentileRank(index, position) == -1);
+        return;
+    }
+
+    int64_t expected = model.grades[position];
+    int below = modelCount(expected, -1);
+    int equal = modelCount(expected, 0);
+    CHECK(grade == expected);
+    CHECK(countGradesBelow(index, expected) == below);
+    CHECK(countGradesAbove(index, expected) == modelCount(expected, 1));
+    CHECK(studentRank(index, position) == 1 + modelCount(expected, 1));
+    CHECK(studentPercentileRank(index, position) == (below + equal / 2.0) * 100.0 / model.count);
+}
+
+void checkPercentile(const GradeIndex* index, double percentile) {
+    int64_t grade;
+
+    if (model.count == 0) {
+        CHECK(gradeAtPercentile(index, percentile, &grade) == OTHER_ERROR);
+        return;
+    }
+    CHECK(gradeAtPercentile(index, percentile, &grade) == OK && grade == modelGradeAtPercentile(percentile));
+}
+
+void checkAll(const GradeIndex* index) {
+    static int positions[CARD_COUNT + 1];
+
+    CHECK(gradedCount(index) == model.count);
+    for (int i = 0; i < CARD_COUNT; i++) {
+        checkStudent(index, i);
+    }
+    for (int p = 0; p <= 100; p++) {
+        checkPercentile(index, p);
+    }
+
+    bool matches = true;
+    for (int n = 0; n < model.count; n++) {
+        matches = matches && nthGradedStudent(index, n) == model.sorted[n];
+    }
+    CHECK(matches);
+    CHECK(nthGradedStudent(index, model.count) == -1);
+
+    for (int k = 1; k <= CARD_COUNT + 1; k += 37) {
+        int expected = k < model.count ? k : model.count;
+        CHECK(bottomGradedStudents(index, k, positions) == expected);
+        matches = true;
+        for (int i = 0; i < expected; i++) {
+            matches = matches && positions[i] == model.sorted[i];
+        }
+        CHECK(matches);
+
+        CHECK(topGradedStudents(index, k, positions) == expected);
+        matches = true;
+        for (int i = 0; i < expected; i++) {
+            matches = matches && positions[i] == model.sorted[model.count - 1 - i];
+        }
+        CHECK(matches);
+    }
+}
+
+char* printCard(void* card) {
+    return cardToString((Card*)card);
+}
+
+void freeCard(void* card) {
+    deleteCard((Card*)card);
+}
+
+int compareCards(const void* first, const void* second) {
+    return first != second;
+}
+// *************************************************************************
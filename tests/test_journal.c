@@ -0,0 +1,313 @@
+// Author: Ben Martens (1349551)
+
+/*	Recovery tests for VCJournal.  Every test writes a roster under a fresh directory in /tmp, closes
+	it, sometimes damages the files the way a crash would, and checks the cards after opening it again.
+*/
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "VCJournal.h"
+
+#define CHECK(condition) check((condition), #condition, __LINE__)
+
+static char directory[] = "/tmp/vcjournal-test-XXXXXX";
+static char base[64];
+static char journalPath[80];
+static char snapshotPath[80];
+static int failures;
+
+static void check(bool passed, const char* condition, int line);
+static void startTest(const char* name);
+static Card* makeCard(const char* uid, const char* email);
+static void putCards(JournaledRoster* roster, int first, int end, const char* domain);
+static int cardCount(JournaledRoster* roster);
+static bool hasCard(JournaledRoster* roster, const char* uid);
+static bool emailIs(JournaledRoster* roster, const char* uid, const char* email);
+static off_t fileSize(const char* path);
+
+static void testReopen(void);
+static void testTornTail(void);
+static void testGarbageTail(void);
+static void testDamagedRecord(void);
+static void testCompaction(void);
+static void testSetProperty(void);
+
+int main(void) {
+    if (mkdtemp(directory) == NULL) {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    testReopen();
+    testTornTail();
+    testGarbageTail();
+    testDamagedRecord();
+    testCompaction();
+    testSetProperty();
+
+    startTest("");
+    rmdir(directory);
+    printf("test_journal: %d failure%s\n", failures, failures == 1 ? "" : "s");
+    return failures == 0 ? 0 : 1;
+}
+
+// ************* Tests *****************************************************
+void testReopen(void) {
+    JournaledRoster* roster;
+
+    startTest("reopen");
+    CHECK(openJournaledRoster(base, NULL, &roster) == OK);
+    putCards(roster, 0, 20, "old");
+    CHECK(journalRemoveCard(roster, "u3") == OK);
+    CHECK(journalRemoveCard(roster, "u3") == OTHER_ERROR);
+    CHECK(closeJournaledRoster(roster) == OK);
+
+    JournalStats stats;
+    CHECK(openJournaledRoster(base, NULL, &roster) == OK);
+    journalStatistics(roster, &stats);
+    CHECK(stats.replayed == 21);
+    CHECK(cardCount(roster) == 19);
+    CHECK(!hasCard(roster, "u3"));
+    CHECK(emailIs(roster, "u5", "u5@old"));
+    CHECK(closeJournaledRoster(roster) == OK);
+}
+
+// a crash in the middle of an append leaves part of a record, which is cut off
+void testTornTail(void) {
+    JournaledRoster* roster;
+
+    startTest("torn");
+    CHECK(openJournaledRoster(base, NULL, &roster) == OK);
+    putCards(roster, 0, 10, "old");
+    CHECK(closeJournaledRoster(roster) == OK);
+    off_t complete = fileSize(journalPath);
+
+    CHECK(openJournaledRoster(base, NULL, &roster) == OK);
+    putCards(roster, 10, 11, "old");
+    CHECK(closeJournaledRoster(roster) == OK);
+    CHECK(fileSize(journalPath) > complete);
+    CHECK(truncate(journalPath, fileSize(journalPath) - 3) == 0);
+
+    CHECK(openJournaledRoster(base, NULL, &roster) == OK);
+    CHECK(fileSize(journalPath) == complete);
+    CHECK(cardCount(roster) == 10);
+    CHECK(!hasCard(roster, "u10"));
+    putCards(roster, 11, 12, "old");
+    CHECK(closeJournaledRoster(roster) == OK);
+
+    // the record after the cut must not be mistaken for part of the torn one
+    CHECK(openJournaledRoster(base, NULL, &roster) == OK);
+    CHECK(cardCount(roster) == 11);
+    CHECK(hasCard(roster, "u11"));
+    CHECK(closeJournaledRoster(roster) == OK);
+}
+
+void testGarbageTail(void) {
+    JournaledRoster* roster;
+    char garbage[100];
+
+    startTest("garbage");
+    CHECK(openJournaledRoster(base, NULL, &roster) == OK);
+    putCards(roster, 0, 5, "old");
+    CHECK(closeJournaledRoster(roster) == OK);
+    off_t complete = fileSize(journalPath);
+
+    memset(garbage, 0xAB, sizeof(garbage));
+    int fd = open(journalPath, O_WRONLY | O_APPEND);
+    CHECK(fd >= 0 && write(fd, garbage, sizeof(garbage)) == (ssize_t)sizeof(garbage));
+    close(fd);
+
+    CHECK(openJournaledRoster(base, NULL, &roster) == OK);
+    CHECK(cardCount(roster) == 5);
+    CHECK(fileSize(journalPath) == complete);
+    CHECK(closeJournaledRoster(roster) == OK);
+}
+
+// a record whose checksum fails is dropped, along with everything after it
+void testDamagedRecord(void) {
+    JournaledRoster* roster;
+
+    startTest("damaged");
+    CHECK(openJournaledRoster(base, NULL, &roster) == OK);
+    putCards(roster, 0, 4, "old");
+    CHECK(closeJournaledRoster(roster) == OK);
+    off_t start = fileSize(journalPath);
+
+    CHECK(openJournaledRoster(base, NULL, &roster) == OK);
+    putCards(roster, 4, 5, "old");
+    CHECK(closeJournaledRoster(roster) == OK);
+    off_t end = fileSize(journalPath);
+
+    unsigned char byte;
+    int fd = open(journalPath, O_RDWR);
+    CHECK(fd >= 0 && pread(fd, &byte, 1, (start + end) / 2) == 1);
+    byte ^= 0x40;
+    CHECK(pwrite(fd, &byte, 1, (start + end) / 2) == 1);
+    close(fd);
+
+    CHECK(openJournaledRoster(base, NULL, &roster) == OK);
+    CHECK(cardCount(roster) == 4);
+    CHECK(!hasCard(roster, "u4"));
+    CHECK(closeJournaledRoster(roster) == OK);
+}
+
+// the snapshot holds the cards at the compaction, and the journal the changes after it
+void testCompaction(void) {
+    JournaledRoster* roster;
+    JournalStats stats;
+
+    startTest("compaction");
+    CHECK(openJournaledRoster(base, NULL, &roster) == OK);
+    putCards(roster, 0, 30, "old");
+    CHECK(compactJournal(roster) == OK);
+    CHECK(fileSize(snapshotPath) > 0);
+    putCards(roster, 25, 35, "new");
+    CHECK(journalRemoveCard(roster, "u0") == OK);
+    CHECK(journalRemoveCard(roster, "u1") == OK);
+    CHECK(closeJournaledRoster(roster) == OK);
+
+    CHECK(openJournaledRoster(base, NULL, &roster) == OK);
+    journalStatistics(roster, &stats);
+    CHECK(stats.replayed == 12);
+    CHECK(cardCount(roster) == 33);
+    CHECK(!hasCard(roster, "u0"));
+    CHECK(emailIs(roster, "u24", "u24@old"));
+    CHECK(emailIs(roster, "u25", "u25@new"));
+    CHECK(emailIs(roster, "u34", "u34@new"));
+
+    // a second compaction leaves nothing to replay
+    CHECK(compactJournal(roster) == OK);
+    CHECK(closeJournaledRoster(roster) == OK);
+    CHECK(openJournaledRoster(base, NULL, &roster) == OK);
+    journalStatistics(roster, &stats);
+    CHECK(stats.replayed == 0);
+    CHECK(cardCount(roster) == 33);
+    CHECK(closeJournaledRoster(roster) == OK);
+}
+
+void testSetProperty(void) {
+    JournaledRoster* roster;
+
+    startTest("property");
+    Card* source = makeCard("source", "changed@new");
+    const Property* email = NULL;
+    void* element;
+    ListIterator iter = createIterator(source->optionalProperties);
+    while ((element = nextElement(&iter)) != NULL) {
+        if (strcmp(((Property*)element)->name, "EMAIL") == 0) {
+            email = (Property*)element;
+        }
+    }
+    CHECK(email != NULL);
+
+    CHECK(openJournaledRoster(base, NULL, &roster) == OK);
+    putCards(roster, 0, 3, "old");
+    CHECK(journalSetProperty(roster, "u1", "EMAIL", NULL, 0, email) == OK);
+    CHECK(journalSetProperty(roster, "u2", "EMAIL", NULL, 0, NULL) == OK);
+    CHECK(journalSetProperty(roster, "missing", "EMAIL", NULL, 0, email) == OTHER_ERROR);
+    CHECK(closeJournaledRoster(roster) == OK);
+
+    CHECK(openJournaledRoster(base, NULL, &roster) == OK);
+    CHECK(emailIs(roster, "u0", "u0@old"));
+    CHECK(emailIs(roster, "u1", "changed@new"));
+    CHECK(emailIs(roster, "u2", NULL));
+    CHECK(closeJournaledRoster(roster) == OK);
+
+    deleteCard(source);
+}
+// *************************************************************************
+
+// ************* Helpers ***************************************************
+void check(bool passed, const char* condition, int line) {
+    if (!passed) {
+        fprintf(stderr, "test_journal.c:%d: %s failed\n", line, condition);
+        failures++;
+    }
+}
+
+// removes the files of the previous test and names the next one's
+void startTest(const char* name) {
+    if (base[0] != '\0') {
+        unlink(journalPath);
+        unlink(snapshotPath);
+    }
+
+    snprintf(base, sizeof(base), "%s/%s", directory, name);
+    snprintf(journalPath, sizeof(journalPath), "%s.journal", base);
+    snprintf(snapshotPath, sizeof(snapshotPath), "%s.snapshot", base);
+}
+
+Card* makeCard(const char* uid, const char* email) {
+    char text[256];
+    Card* card = NULL;
+
+    snprintf(text, sizeof(text), "BEGIN:VCARD\r\nVERSION:4.0\r\nFN:Student %s\r\nUID:%s\r\nEMAIL:%s\r\nEND:VCARD\r\n", uid, uid, email);
+    createCardFromBuffer(text, strlen(text), &card, NULL);
+    return card;
+}
+
+// puts cards u<first> to u<end - 1>, with EMAILs u<n>@domain
+void putCards(JournaledRoster* roster, int first, int end, const char* domain) {
+    char uid[16];
+    char email[32];
+
+    for (int i = first; i < end; i++) {
+        snprintf(uid, sizeof(uid), "u%d", i);
+        snprintf(email, sizeof(email), "%s@%s", uid, domain);
+        Card* card = makeCard(uid, email);
+        CHECK(card != NULL && journalPutCard(roster, card) == OK);
+        deleteCard(card);
+    }
+}
+
+int cardCount(JournaledRoster* roster) {
+    return concurrentRosterLength(journaledRosterCards(roster));
+}
+
+bool hasCard(JournaledRoster* roster, const char* uid) {
+    RosterReader* reader = attachRosterReader(journaledRosterCards(roster));
+
+    enterRosterRead(reader);
+    bool found = concurrentRosterFind(reader, uid) != NULL;
+    leaveRosterRead(reader);
+    detachRosterReader(reader);
+
+    return found;
+}
+
+// email NULL checks that the card has no EMAIL
+bool emailIs(JournaledRoster* roster, const char* uid, const char* email) {
+    RosterReader* reader = attachRosterReader(journaledRosterCards(roster));
+    bool matches = false;
+
+    enterRosterRead(reader);
+    const Card* card = concurrentRosterFind(reader, uid);
+    if (card != NULL) {
+        const char* value = NULL;
+        void* element;
+        ListIterator iter = createIterator(card->optionalProperties);
+        while (value == NULL && (element = nextElement(&iter)) != NULL) {
+            const Property* property = (const Property*)element;
+            if (strcmp(property->name, "EMAIL") == 0) {
+                value = (const char*)getFromFront(property->values);
+            }
+        }
+        matches = email == NULL ? value == NULL : value != NULL && strcmp(value, email) == 0;
+    }
+    leaveRosterRead(reader);
+    detachRosterReader(reader);
+
+    return matches;
+}
+
+off_t fileSize(const char* path) {
+    struct stat status;
+
+    return stat(path, &status) == 0 ? status.st_size : -1;
+}
+// *************************************************************************
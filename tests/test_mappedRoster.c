@@ -0,0 +1,147 @@
+// Author: Ben Martens (1349551)
+
+/*	Tests for VCMappedRoster: lookups in a published roster, and replacing it while another process
+	keeps attaching, which must always find one whole roster.
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "VCMappedRoster.h"
+
+#define CHECK(condition) check((condition), #condition, __LINE__)
+
+#define CARD_COUNT 500
+#define REPUBLISH_COUNT 200
+#define ATTACH_COUNT 5000
+
+static int failures;
+
+static void check(bool passed, const char* condition, int line);
+static List* makeRoster(int count);
+static char* printCard(void* card);
+static void freeCard(void* card);
+static int compareCards(const void* first, const void* second);
+
+static void testLookups(const char* name);
+static void testSupersede(const char* name);
+
+int main(void) {
+    char name[64];
+
+    snprintf(name, sizeof(name), "/vcmapped-test-%d", (int)getpid());
+    testLookups(name);
+    testSupersede(name);
+
+    removeMappedRoster(name);
+    printf("test_mappedRoster: %d failure%s\n", failures, failures == 1 ? "" : "s");
+    return failures == 0 ? 0 : 1;
+}
+
+// ************* Tests *****************************************************
+void testLookups(const char* name) {
+    MappedRoster* mapped = NULL;
+    List* roster = makeRoster(CARD_COUNT);
+
+    CHECK(publishMappedRoster(name, roster, NULL, NULL) == OK);
+    CHECK(attachMappedRoster(name, &mapped) == OK);
+    CHECK(mappedRosterLength(mapped) == CARD_COUNT);
+    CHECK(mappedRosterIsCurrent(mapped));
+    CHECK(mappedRosterFind(mapped, "u00123") == mappedRosterGetCard(mapped, 123));
+    CHECK(strcmp(mappedRosterGetKey(mapped, 7), "u00007") == 0);
+    CHECK(mappedRosterFind(mapped, "nobody") == NULL);
+    CHECK(mappedRosterGetCard(mapped, CARD_COUNT) == NULL);
+    detachMappedRoster(mapped);
+
+    CHECK(attachMappedRoster("/vcmapped-test-none", &mapped) == INV_FILE && mapped == NULL);
+    freeList(roster);
+}
+
+void testSupersede(const char* name) {
+    MappedRoster* first = NULL;
+    MappedRoster* last = NULL;
+    List* roster = makeRoster(CARD_COUNT);
+
+    CHECK(attachMappedRoster(name, &first) == OK);
+    uint64_t generation = mappedRosterGeneration(first);
+
+    // the child attaches over and over while the roster is replaced, and exits with the number of failures
+    pid_t child = fork();
+    if (child == 0) {
+        int failed = 0;
+        for (int i = 0; i < ATTACH_COUNT; i++) {
+            MappedRoster* mapped;
+            if (attachMappedRoster(name, &mapped) != OK) {
+                failed++;
+                continue;
+            }
+            failed += mappedRosterLength(mapped) != CARD_COUNT;
+            detachMappedRoster(mapped);
+        }
+        _exit(failed > 255 ? 255 : failed);
+    }
+
+    int published = 0;
+    for (int i = 0; i < REPUBLISH_COUNT; i++) {
+        published += publishMappedRoster(name, roster, NULL, NULL) == OK;
+    }
+    int status = -1;
+    CHECK(child > 0 && waitpid(child, &status, 0) == child);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    CHECK(published == REPUBLISH_COUNT);
+
+    // the old mapping still works, but knows it has been replaced
+    CHECK(!mappedRosterIsCurrent(first));
+    CHECK(mappedRosterFind(first, "u00042") != NULL);
+    CHECK(attachMappedRoster(name, &last) == OK);
+    CHECK(mappedRosterGeneration(last) == generation + REPUBLISH_COUNT);
+    CHECK(mappedRosterIsCurrent(last));
+
+    CHECK(removeMappedRoster(name) == OK);
+    CHECK(!mappedRosterIsCurrent(last));
+    CHECK(removeMappedRoster(name) == INV_FILE);
+    detachMappedRoster(first);
+    detachMappedRoster(last);
+    freeList(roster);
+}
+// *************************************************************************
+
+// ************* Helpers ***************************************************
+void check(bool passed, const char* condition, int line) {
+    if (!passed) {
+        fprintf(stderr, "test_mappedRoster.c:%d: %s failed\n", line, condition);
+        failures++;
+    }
+}
+
+// cards u00000 to u<count - 1>, in order
+List* makeRoster(int count) {
+    List* roster = initializeList(printCard, freeCard, compareCards);
+    char text[256];
+
+    for (int i = 0; i < count; i++) {
+        Card* card = NULL;
+        snprintf(text, sizeof(text), "BEGIN:VCARD\r\nVERSION:4.0\r\nFN:Student %d\r\nUID:u%05d\r\nEND:VCARD\r\n", i, i);
+        if (createCardFromBuffer(text, strlen(text), &card, NULL) == OK) {
+            insertBack(roster, card);
+        }
+    }
+
+    return roster;
+}
+
+char* printCard(void* card) {
+    return cardToString((Card*)card);
+}
+
+void freeCard(void* card) {
+    deleteCard((Card*)card);
+}
+
+int compareCards(const void* first, const void* second) {
+    return first != second;
+}
+// *************************************************************************
@@ -0,0 +1,331 @@
+// Author: Ben Martens (1349551)
+
+/*	Tests for VCRosterSort: the order of a large roster, on one to eight threads, matches a plain qsort
+	with a comparator that works on the names directly, and the view and the in place sort agree with it.
+*/
+
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "VCRosterSort.h"
+
+#define CHECK(condition) check((condition), #condition, __LINE__)
+
+#define CARD_COUNT 100000
+#define MAX_THREADS 8
+
+// the names have edge spaces and mixed case, and few numbers, so that many keys are equal
+static const char* names[] = {"", " ", "Li", "li ", "Lin", " LIN", "de Vries", "De Vries ", "Nguyen", "O'Brien", "Smith", "smith", "Zhang", "Ann Marie"};
+#define NAME_COUNT (int)(sizeof(names) / sizeof(names[0]))
+#define NUMBER_RANGE 50
+
+// a card's names as the comparator sees them: up to three components, or the FN alone
+typedef struct modelKey {
+    char* components[3];
+    int count;
+    bool hasNumber;
+    int64_t number;
+    int index;
+} ModelKey;
+
+static int failures;
+static bool modelDescending;
+
+static void check(bool passed, const char* condition, int line);
+static List* makeRoster(int count);
+static bool readNumber(const Card* card, void* context, int64_t* number);
+static char* foldName(const char* name);
+static void makeModelKey(const Card* card, bool withNumber, int index, ModelKey* key);
+static int compareModelKeys(const void* first, const void* second);
+static int* modelOrder(List* roster, bool withNumber, bool descending);
+static bool sameOrder(const int* first, const int* second, int count);
+static char* printCard(void* card);
+static void freeCard(void* card);
+static int compareCards(const void* first, const void* second);
+
+static void testMatchesModel(List* roster);
+static void testViewAndInPlace(List* roster);
+static void testEdgeCases(void);
+
+int main(void) {
+    srand(1349551);
+    List* roster = makeRoster(CARD_COUNT);
+
+    testMatchesModel(roster);
+    testViewAndInPlace(roster);
+    testEdgeCases();
+
+    freeList(roster);
+    printf("test_rosterSort: %d failure%s\n", failures, failures == 1 ? "" : "s");
+    return failures == 0 ? 0 : 1;
+}
+
+// ************* Tests *****************************************************
+void testMatchesModel(List* roster) {
+    RosterSortOptions options;
+
+    CHECK(getLength(roster) == CARD_COUNT);
+    for (int numbered = 0; numbered <= 1; numbered++) {
+        for (int descending = 0; descending <= 1; descending++) {
+            int* expected = modelOrder(roster, numbered, descending);
+
+            for (int threads = 1; threads <= MAX_THREADS; threads++) {
+                int* order = NULL;
+                initRosterSortOptions(&options);
+                options.number = numbered ? readNumber : NULL;
+                options.descending = descending;
+                options.threads = threads;
+                CHECK(rosterSortOrder(roster, &options, &order) == OK);
+                if (!sameOrder(order, expected, CARD_COUNT)) {
+                    fprintf(stderr, "test_rosterSort.c: order differs with number %d, descending %d, threads %d\n", numbered, descending, threads);
+                    failures++;
+                }
+                free(order);
+            }
+            free(expected);
+        }
+    }
+}
+
+void testViewAndInPlace(List* roster) {
+    RosterSortOptions options;
+    Card** view = NULL;
+    int count = 0;
+
+    initRosterSortOptions(&options);
+    options.number = readNumber;
+    options.threads = 4;
+    int* expected = modelOrder(roster, true, false);
+
+    // the model's indices are positions in the roster before it is sorted
+    Card** cards = (Card**)malloc(CARD_COUNT * sizeof(Card*));
+    ListIterator iter = createIterator(roster);
+    for (int i = 0; i < CARD_COUNT; i++) {
+        cards[i] = (Card*)nextElement(&iter);
+    }
+
+    CHECK(sortedRosterView(roster, &options, &view, &count) == OK && count == CARD_COUNT);
+    bool matches = view != NULL;
+    for (int i = 0; matches && i < CARD_COUNT; i++) {
+        matches = view[i] == cards[expected[i]];
+    }
+    CHECK(matches);
+
+    CHECK(sortRoster(roster, &options) == OK);
+    CHECK(getLength(roster) == CARD_COUNT);
+    iter = createIterator(roster);
+    matches = true;
+    for (int i = 0; matches && i < CARD_COUNT; i++) {
+        matches = nextElement(&iter) == cards[expected[i]];
+    }
+    CHECK(matches);
+
+    // sorting a sorted roster changes nothing, equal keys included
+    CHECK(sortRoster(roster, &options) == OK);
+    iter = createIterator(roster);
+    matches = true;
+    for (int i = 0; matches && i < CARD_COUNT; i++) {
+        matches = nextElement(&iter) == cards[expected[i]];
+    }
+    CHECK(matches);
+
+    free(view);
+    free(cards);
+    free(expected);
+}
+
+void testEdgeCases(void) {
+    List* empty = makeRoster(0);
+    int* order = (int*)&order;
+    Card** view = (Card**)&view;
+    int count = -1;
+
+    CHECK(rosterSortOrder(empty, NULL, &order) == OK && order == NULL);
+    CHECK(sortedRosterView(empty, NULL, &view, &count) == OK && view == NULL && count == 0);
+    CHECK(sortRoster(empty, NULL) == OK);
+    CHECK(rosterSortOrder(NULL, NULL, &order) == OTHER_ERROR);
+    CHECK(rosterSortOrder(empty, NULL, NULL) == OTHER_ERROR);
+    CHECK(sortRoster(NULL, NULL) == OTHER_ERROR);
+    freeList(empty);
+
+    // "Li" sorts before "Lin", and a missing family name before any other
+    const char* text = "BEGIN:VCARD\r\nVERSION:4.0\r\nFN:x\r\nN:Lin;A;;;\r\nEND:VCARD\r\n"
+                       "BEGIN:VCARD\r\nVERSION:4.0\r\nFN:y\r\nN:Li;B;;;\r\nEND:VCARD\r\n"
+                       "BEGIN:VCARD\r\nVERSION:4.0\r\nFN:z\r\nN:;C;;;\r\nEND:VCARD\r\n";
+    List* small = initializeList(printCard, freeCard, compareCards);
+    for (const char* card = text; *card != '\0'; card = strstr(card, "END:VCARD\r\n") + 11) {
+        Card* parsed = NULL;
+        size_t length = strstr(card, "END:VCARD\r\n") + 11 - card;
+        CHECK(createCardFromBuffer(card, length, &parsed, NULL) == OK);
+        insertBack(small, parsed);
+    }
+    CHECK(rosterSortOrder(small, NULL, &order) == OK);
+    CHECK(order != NULL && order[0] == 2 && order[1] == 1 && order[2] == 0);
+    free(order);
+    freeList(small);
+}
+// *************************************************************************
+
+// ************* Helpers ***************************************************
+void check(bool passed, const char* condition, int line) {
+    if (!passed) {
+        fprintf(stderr, "test_rosterSort.c:%d: %s failed\n", line, condition);
+        failures++;
+    }
+}
+
+// random cards: most have an N, some an N with no family or given name, and most a number in NOTE
+List* makeRoster(int count) {
+    List* roster = initializeList(printCard, freeCard, compareCards);
+    char text[512];
+
+    for (int i = 0; i < count; i++) {
+        Card* card = NULL;
+        int length = snprintf(text, sizeof(text), "BEGIN:VCARD\r\nVERSION:4.0\r\nFN:%sx%s\r\n",
+                              names[rand() % NAME_COUNT], rand() % 2 ? " " : "");
+        if (rand() % 5 != 0) {
+            length += snprintf(text + length, sizeof(text) - length, "N:%s;%s;%s;;\r\n",
+                               names[rand() % NAME_COUNT], names[rand() % NAME_COUNT], names[rand() % NAME_COUNT]);
+        }
+        if (rand() % 4 != 0) {
+            length += snprintf(text + length, sizeof(text) - length, "NOTE:%d\r\n", rand() % NUMBER_RANGE - NUMBER_RANGE / 2);
+        }
+        snprintf(text + length, sizeof(text) - length, "END:VCARD\r\n");
+        if (createCardFromBuffer(text, strlen(text), &card, NULL) == OK) {
+            insertBack(roster, card);
+        }
+    }
+
+    return roster;
+}
+
+bool readNumber(const Card* card, void* context, int64_t* number) {
+    (void)context;
+    void* element;
+    ListIterator iter = createIterator(card->optionalProperties);
+
+    while ((element = nextElement(&iter)) != NULL) {
+        const Property* property = (const Property*)element;
+        if (strcmp(property->name, "NOTE") == 0) {
+            *number = strtoll((const char*)getFromFront(property->values), NULL, 10);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// a copy of name in lower case, without leading and trailing spaces
+char* foldName(const char* name) {
+    while (*name == ' ') {
+        name++;
+    }
+    size_t length = strlen(name);
+    while (length > 0 && name[length - 1] == ' ') {
+        length--;
+    }
+
+    char* folded = strndup(name, length);
+    for (size_t i = 0; i < length; i++) {
+        folded[i] = (char)tolower((unsigned char)folded[i]);
+    }
+    return folded;
+}
+
+void makeModelKey(const Card* card, bool withNumber, int index, ModelKey* key) {
+    const Property* n = NULL;
+    void* element;
+    ListIterator iter = createIterator(card->optionalProperties);
+
+    while (n == NULL && (element = nextElement(&iter)) != NULL) {
+        if (strcmp(((const Property*)element)->name, "N") == 0) {
+            n = (const Property*)element;
+        }
+    }
+
+    key->count = 0;
+    if (n != NULL) {
+        iter = createIterator(n->values);
+        while (key->count < 3 && (element = nextElement(&iter)) != NULL) {
+            key->components[key->count++] = foldName((const char*)element);
+        }
+    }
+    bool named = (key->count > 0 && key->components[0][0] != '\0') || (key->count > 1 && key->components[1][0] != '\0');
+    if (!named) {
+        for (int i = 0; i < key->count; i++) {
+            free(key->components[i]);
+        }
+        key->components[0] = foldName((const char*)getFromFront(card->fn->values));
+        key->count = 1;
+    }
+
+    key->hasNumber = withNumber && readNumber(card, NULL, &key->number);
+    key->index = index;
+}
+
+// cards without a number last, then the number, then the names component by component; equal keys in roster order
+int compareModelKeys(const void* first, const void* second) {
+    const ModelKey* a = (const ModelKey*)first;
+    const ModelKey* b = (const ModelKey*)second;
+    int result = 0;
+
+    if (a->hasNumber != b->hasNumber) {
+        return a->hasNumber ? -1 : 1;
+    }
+    if (a->hasNumber && a->number != b->number) {
+        result = a->number < b->number ? -1 : 1;
+    }
+    for (int i = 0; result == 0 && i < a->count && i < b->count; i++) {
+        result = strcmp(a->components[i], b->components[i]);
+    }
+    if (result == 0) {
+        result = a->count - b->count;
+    }
+    if (result != 0) {
+        return modelDescending ? -result : result;
+    }
+
+    return a->index - b->index;
+}
+
+int* modelOrder(List* roster, bool withNumber, bool descending) {
+    int count = getLength(roster);
+    ModelKey* keys = (ModelKey*)malloc(count * sizeof(ModelKey));
+    int* order = (int*)malloc(count * sizeof(int));
+    ListIterator iter = createIterator(roster);
+
+    for (int i = 0; i < count; i++) {
+        makeModelKey((const Card*)nextElement(&iter), withNumber, i, &keys[i]);
+    }
+    modelDescending = descending;
+    qsort(keys, count, sizeof(ModelKey), compareModelKeys);
+
+    for (int i = 0; i < count; i++) {
+        order[i] = keys[i].index;
+        for (int j = 0; j < keys[i].count; j++) {
+            free(keys[i].components[j]);
+        }
+    }
+    free(keys);
+
+    return order;
+}
+
+bool sameOrder(const int* first, const int* second, int count) {
+    return first != NULL && second != NULL && memcmp(first, second, count * sizeof(int)) == 0;
+}
+
+char* printCard(void* card) {
+    return cardToString((Card*)card);
+}
+
+void freeCard(void* card) {
+    deleteCard((Card*)card);
+}
+
+int compareCards(const void* first, const void* second) {
+    return first != second;
+}
+// *************************************************************************